@@ -33,12 +33,23 @@
 #include "hw/xen/xen.h"
 #include "qom/object.h"
 #include "hw/boards.h"
+#include "sysemu/cpus.h"
 
 int tcg_tb_size;
 static bool tcg_allowed = true;
 
 static int tcg_init(MachineState *ms)
 {
+    Error *err = NULL;
+
+    qemu_tcg_configure(ms->tcg_thread, &err);
+    if (!err && ms->tlb_max_bits) {
+        tlb_configure(ms->tlb_max_bits, &err);
+    }
+    if (err) {
+        error_report_err(err);
+        return -EINVAL;
+    }
     tcg_exec_init(tcg_tb_size * 1024 * 1024);
     return 0;
 }
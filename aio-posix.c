@@ -17,18 +17,193 @@
 #include "block/block.h"
 #include "qemu/queue.h"
 #include "qemu/sockets.h"
+#include "trace.h"
+
+/* Initial busy polling window once polling turned out to be useful */
+#define AIO_POLL_NS_START   4000
+
+/* Default growth factor for the busy polling window */
+#define AIO_POLL_GROW_DEFAULT 2
 
 struct AioHandler
 {
     GPollFD pfd;
     IOHandler *io_read;
     IOHandler *io_write;
+    AioPollFn *io_poll;
     int deleted;
     int pollfds_idx;
     void *opaque;
     QLIST_ENTRY(AioHandler) node;
 };
 
+#ifdef CONFIG_EPOLL_CREATE1
+
+#include <sys/epoll.h>
+
+/* Below this many handlers, rebuilding the pollfds array for ppoll() is
+ * cheaper than keeping the epoll set up to date.
+ */
+#define AIO_EPOLL_THRESHOLD 64
+
+#define AIO_EPOLL_MAX_EVENTS 128
+
+static void aio_epoll_disable(AioContext *ctx)
+{
+    ctx->epoll_available = false;
+    ctx->epoll_enabled = false;
+    if (ctx->epollfd >= 0) {
+        close(ctx->epollfd);
+        ctx->epollfd = -1;
+    }
+}
+
+static inline int epoll_events_from_pfd(int pfd_events)
+{
+    return (pfd_events & G_IO_IN ? EPOLLIN : 0) |
+           (pfd_events & G_IO_OUT ? EPOLLOUT : 0) |
+           (pfd_events & G_IO_HUP ? EPOLLHUP : 0) |
+           (pfd_events & G_IO_ERR ? EPOLLERR : 0);
+}
+
+static inline int pfd_events_from_epoll(int epoll_events)
+{
+    return (epoll_events & EPOLLIN ? G_IO_IN : 0) |
+           (epoll_events & EPOLLOUT ? G_IO_OUT : 0) |
+           (epoll_events & EPOLLHUP ? G_IO_HUP : 0) |
+           (epoll_events & EPOLLERR ? G_IO_ERR : 0);
+}
+
+static bool aio_epoll_add(AioContext *ctx, AioHandler *node, int op)
+{
+    struct epoll_event event;
+
+    event.data.ptr = node;
+    event.events = epoll_events_from_pfd(node->pfd.events);
+    return epoll_ctl(ctx->epollfd, op, node->pfd.fd, &event) == 0;
+}
+
+/* Mirror a change made by aio_set_fd_handler() into the epoll set */
+static void aio_epoll_update(AioContext *ctx, AioHandler *node, bool is_new)
+{
+    struct epoll_event event;
+
+    if (!ctx->epoll_enabled) {
+        return;
+    }
+
+    if (!node->pfd.events) {
+        /* Fails harmlessly if the fd was already closed, which removes it
+         * from the set anyway.
+         */
+        epoll_ctl(ctx->epollfd, EPOLL_CTL_DEL, node->pfd.fd, &event);
+    } else if (!aio_epoll_add(ctx, node,
+                              is_new ? EPOLL_CTL_ADD : EPOLL_CTL_MOD)) {
+        aio_epoll_disable(ctx);
+    }
+}
+
+/* Switch to epoll once the number of handlers crosses the threshold */
+static void aio_epoll_try_enable(AioContext *ctx)
+{
+    AioHandler *node;
+    int n = 0;
+
+    if (!ctx->epoll_available || ctx->epoll_enabled) {
+        return;
+    }
+
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!node->deleted && node->pfd.events) {
+            n++;
+        }
+    }
+    if (n < AIO_EPOLL_THRESHOLD) {
+        return;
+    }
+
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!node->deleted && node->pfd.events &&
+            !aio_epoll_add(ctx, node, EPOLL_CTL_ADD)) {
+            aio_epoll_disable(ctx);
+            return;
+        }
+    }
+    ctx->epoll_enabled = true;
+}
+
+static int aio_epoll(AioContext *ctx, int64_t timeout)
+{
+    struct epoll_event events[AIO_EPOLL_MAX_EVENTS];
+    int i, ret;
+
+    if (timeout > 0 && timeout % SCALE_MS) {
+        /* epoll_wait() only has millisecond resolution.  Wait for the epoll
+         * fd itself with ppoll() so that timers still fire on time.
+         */
+        GPollFD pfd = {
+            .fd = ctx->epollfd,
+            .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
+        };
+
+        ret = qemu_poll_ns(&pfd, 1, timeout);
+        if (ret <= 0) {
+            return ret;
+        }
+        timeout = 0;
+    }
+
+    ret = epoll_wait(ctx->epollfd, events, ARRAY_SIZE(events),
+                     timeout < 0 ? -1 : MIN(timeout / SCALE_MS, INT_MAX));
+    for (i = 0; i < ret; i++) {
+        AioHandler *node = events[i].data.ptr;
+
+        node->pfd.revents = pfd_events_from_epoll(events[i].events);
+    }
+    return ret;
+}
+
+void aio_context_setup(AioContext *ctx)
+{
+    ctx->epoll_enabled = false;
+    ctx->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    ctx->epoll_available = ctx->epollfd >= 0;
+}
+
+void aio_context_destroy(AioContext *ctx)
+{
+    aio_epoll_disable(ctx);
+}
+
+#else
+
+static void aio_epoll_update(AioContext *ctx, AioHandler *node, bool is_new)
+{
+}
+
+static void aio_epoll_try_enable(AioContext *ctx)
+{
+}
+
+static int aio_epoll(AioContext *ctx, int64_t timeout)
+{
+    /* epoll is never enabled without CONFIG_EPOLL_CREATE1 */
+    abort();
+}
+
+void aio_context_setup(AioContext *ctx)
+{
+    ctx->epollfd = -1;
+    ctx->epoll_enabled = false;
+    ctx->epoll_available = false;
+}
+
+void aio_context_destroy(AioContext *ctx)
+{
+}
+
+#endif
+
 static AioHandler *find_aio_handler(AioContext *ctx, int fd)
 {
     AioHandler *node;
@@ -57,6 +232,9 @@ void aio_set_fd_handler(AioContext *ctx,
         if (node) {
             g_source_remove_poll(&ctx->source, &node->pfd);
 
+            node->pfd.events = 0;
+            aio_epoll_update(ctx, node, false);
+
             /* If the lock is held, just mark the node as deleted */
             if (ctx->walking_handlers) {
                 node->deleted = 1;
@@ -71,6 +249,8 @@ void aio_set_fd_handler(AioContext *ctx,
             }
         }
     } else {
+        bool is_new = false;
+
         if (node == NULL) {
             /* Alloc and insert if it's not already there */
             node = g_new0(AioHandler, 1);
@@ -78,8 +258,13 @@ void aio_set_fd_handler(AioContext *ctx,
             QLIST_INSERT_HEAD(&ctx->aio_handlers, node, node);
 
             g_source_add_poll(&ctx->source, &node->pfd);
+            is_new = true;
         }
         /* Update handler with latest information */
+        if (node->io_read != io_read || node->io_write != io_write ||
+            node->opaque != opaque) {
+            node->io_poll = NULL;
+        }
         node->io_read = io_read;
         node->io_write = io_write;
         node->opaque = opaque;
@@ -87,6 +272,11 @@ void aio_set_fd_handler(AioContext *ctx,
 
         node->pfd.events = (io_read ? G_IO_IN | G_IO_HUP | G_IO_ERR : 0);
         node->pfd.events |= (io_write ? G_IO_OUT | G_IO_ERR : 0);
+
+        aio_epoll_update(ctx, node, is_new);
+        if (is_new) {
+            aio_epoll_try_enable(ctx);
+        }
     }
 
     aio_notify(ctx);
@@ -100,6 +290,24 @@ void aio_set_event_notifier(AioContext *ctx,
                        (IOHandler *)io_read, NULL, notifier);
 }
 
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollFn *io_poll)
+{
+    AioHandler *node;
+
+    node = find_aio_handler(ctx, fd);
+    assert(node || !io_poll);
+    if (node) {
+        node->io_poll = io_poll;
+    }
+}
+
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll)
+{
+    aio_set_fd_poll(ctx, event_notifier_get_fd(notifier), io_poll);
+}
+
 bool aio_prepare(AioContext *ctx)
 {
     return false;
@@ -186,27 +394,92 @@ bool aio_dispatch(AioContext *ctx)
     return progress;
 }
 
-bool aio_poll(AioContext *ctx, bool blocking)
+/* Call the poll handlers once.  Returns true if any of them made progress. */
+static bool run_poll_handlers_once(AioContext *ctx)
 {
     AioHandler *node;
-    bool was_dispatching;
-    int ret;
+    bool progress = false;
+
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!node->deleted && node->io_poll &&
+            node->io_poll(node->opaque)) {
+            progress = true;
+        }
+    }
+
+    return progress;
+}
+
+/* Busy poll for up to @max_ns nanoseconds.  Polling stops early when a poll
+ * handler makes progress or when another thread schedules a bottom half; in
+ * the latter case there is work to do, but it is dispatched by the caller.
+ *
+ * Returns true if a poll handler made progress.
+ */
+static bool run_poll_handlers(AioContext *ctx, int64_t max_ns)
+{
+    int64_t end_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + max_ns;
     bool progress;
 
-    was_dispatching = ctx->dispatching;
-    progress = false;
+    ctx->walking_handlers++;
+    do {
+        progress = run_poll_handlers_once(ctx);
+    } while (!progress && !aio_bh_scheduled(ctx) &&
+             qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < end_time);
+    ctx->walking_handlers--;
 
-    /* aio_notify can avoid the expensive event_notifier_set if
-     * everything (file descriptors, bottom halves, timers) will
-     * be re-evaluated before the next blocking poll().  This is
-     * already true when aio_poll is called with blocking == false;
-     * if blocking == true, it is only true after poll() returns.
-     *
-     * If we're in a nested event loop, ctx->dispatching might be true.
-     * In that case we can restore it just before returning, but we
-     * have to clear it now.
-     */
-    aio_set_dispatching(ctx, !blocking);
+    return progress;
+}
+
+/* Adjust the busy polling window after a blocking wait of @block_ns
+ * nanoseconds that followed an unsuccessful polling round.
+ *
+ * The parameters can be changed by aio_context_set_poll_params() from
+ * another thread, and poll_ns is read by query-iothreads.
+ */
+static void aio_poll_adjust(AioContext *ctx, int64_t block_ns)
+{
+    int64_t old = atomic_read(&ctx->poll_ns);
+    int64_t max_ns = atomic_read(&ctx->poll_max_ns);
+    int64_t poll_ns = old;
+
+    if (block_ns > max_ns) {
+        /* Polling could not have helped; give the CPU back */
+        int64_t shrink = atomic_read(&ctx->poll_shrink);
+
+        if (shrink) {
+            poll_ns /= shrink;
+        } else {
+            poll_ns = 0;
+        }
+        if (poll_ns != old) {
+            trace_aio_poll_shrink(ctx, old, poll_ns);
+        }
+    } else if (block_ns > poll_ns && poll_ns < max_ns) {
+        /* A longer window would have avoided the sleep */
+        int64_t grow = atomic_read(&ctx->poll_grow);
+
+        if (!grow) {
+            grow = AIO_POLL_GROW_DEFAULT;
+        }
+        if (poll_ns == 0) {
+            poll_ns = AIO_POLL_NS_START;
+        } else {
+            poll_ns *= grow;
+        }
+        if (poll_ns > max_ns) {
+            poll_ns = max_ns;
+        }
+        trace_aio_poll_grow(ctx, old, poll_ns);
+    }
+    atomic_set(&ctx->poll_ns, poll_ns);
+}
+
+/* Rebuild pollfds from the handler list and wait with ppoll() */
+static int aio_ppoll(AioContext *ctx, int64_t timeout)
+{
+    AioHandler *node;
+    int ret;
 
     ctx->walking_handlers++;
 
@@ -227,10 +500,9 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     ctx->walking_handlers--;
 
-    /* wait until next event */
     ret = qemu_poll_ns((GPollFD *)ctx->pollfds->data,
                          ctx->pollfds->len,
-                         blocking ? aio_compute_timeout(ctx) : 0);
+                         timeout);
 
     /* if we have any readable fds, dispatch event */
     if (ret > 0) {
@@ -243,6 +515,69 @@ bool aio_poll(AioContext *ctx, bool blocking)
         }
     }
 
+    return ret;
+}
+
+bool aio_poll(AioContext *ctx, bool blocking)
+{
+    bool was_dispatching;
+    bool progress;
+    bool polled = false;
+    int64_t timeout;
+    int64_t start = 0;
+
+    was_dispatching = ctx->dispatching;
+    progress = false;
+
+    /* aio_notify can avoid the expensive event_notifier_set if
+     * everything (file descriptors, bottom halves, timers) will
+     * be re-evaluated before the next blocking poll().  This is
+     * already true when aio_poll is called with blocking == false;
+     * if blocking == true, it is only true after poll() returns.
+     *
+     * If we're in a nested event loop, ctx->dispatching might be true.
+     * In that case we can restore it just before returning, but we
+     * have to clear it now.
+     */
+    aio_set_dispatching(ctx, !blocking);
+
+    timeout = blocking ? aio_compute_timeout(ctx) : 0;
+
+    /* Busy poll before going to sleep, but never past a timer deadline and
+     * never when there is already work pending.
+     */
+    if (timeout != 0 && atomic_read(&ctx->poll_max_ns)) {
+        int64_t poll_ns = atomic_read(&ctx->poll_ns);
+
+        if (timeout > 0 && timeout < poll_ns) {
+            poll_ns = timeout;
+        }
+        polled = true;
+        if (poll_ns && run_poll_handlers(ctx, poll_ns)) {
+            atomic_set(&ctx->poll_hits, ctx->poll_hits + 1);
+            progress = true;
+            polled = false;
+            timeout = 0;
+        } else {
+            /* A zero window still grows below, but nothing was polled */
+            if (poll_ns) {
+                atomic_set(&ctx->poll_misses, ctx->poll_misses + 1);
+            }
+            start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        }
+    }
+
+    /* wait until next event */
+    if (ctx->epoll_enabled) {
+        aio_epoll(ctx, timeout);
+    } else {
+        aio_ppoll(ctx, timeout);
+    }
+
+    if (polled) {
+        aio_poll_adjust(ctx, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+    }
+
     /* Run dispatch even if there were no readable fds to run timers */
     aio_set_dispatching(ctx, true);
     if (aio_dispatch(ctx)) {
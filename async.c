@@ -198,6 +198,18 @@ aio_ctx_prepare(GSource *source, gint    *timeout)
     return *timeout == 0;
 }
 
+bool aio_bh_scheduled(AioContext *ctx)
+{
+    QEMUBH *bh;
+
+    for (bh = ctx->first_bh; bh; bh = bh->next) {
+        if (!bh->deleted && atomic_read(&bh->scheduled)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static gboolean
 aio_ctx_check(GSource *source)
 {
@@ -232,6 +244,7 @@ aio_ctx_finalize(GSource     *source)
     thread_pool_free(ctx->thread_pool);
     aio_set_event_notifier(ctx, &ctx->notifier, NULL);
     event_notifier_cleanup(&ctx->notifier);
+    aio_context_destroy(ctx);
     rfifolock_destroy(&ctx->lock);
     qemu_mutex_destroy(&ctx->bh_lock);
     g_array_free(ctx->pollfds, TRUE);
@@ -303,6 +316,7 @@ AioContext *aio_context_new(Error **errp)
         return NULL;
     }
     g_source_set_can_recurse(&ctx->source, true);
+    aio_context_setup(ctx);
     aio_set_event_notifier(ctx, &ctx->notifier,
                            (EventNotifierHandler *)
                            event_notifier_test_and_clear);
@@ -312,9 +326,66 @@ AioContext *aio_context_new(Error **errp)
     rfifolock_init(&ctx->lock, aio_rfifolock_cb, ctx);
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
 
+    ctx->thread_pool_min = 0;
+    ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+    ctx->thread_pool_idle_timeout = THREAD_POOL_IDLE_TIMEOUT_DEFAULT;
+    ctx->thread_pool_node = -1;
+    ctx->poll_ns = 0;
+    ctx->poll_max_ns = 0;
+    ctx->poll_grow = 0;
+    ctx->poll_shrink = 0;
+
     return ctx;
 }
 
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, int64_t idle_timeout,
+                                        int64_t node, Error **errp)
+{
+    if (min < 0 || max < 1 || min > max || max > INT_MAX) {
+        error_setg(errp, "thread pool needs 0 <= min <= max and max >= 1");
+        return;
+    }
+    if (idle_timeout < 0 || idle_timeout > INT_MAX) {
+        error_setg(errp, "invalid thread pool idle timeout");
+        return;
+    }
+    if (node < -1 || node > INT_MAX) {
+        error_setg(errp, "invalid thread pool NUMA node");
+        return;
+    }
+
+    ctx->thread_pool_min = min;
+    ctx->thread_pool_max = max;
+    ctx->thread_pool_idle_timeout = idle_timeout;
+    ctx->thread_pool_node = node;
+
+    if (ctx->thread_pool) {
+        thread_pool_update_params(ctx->thread_pool, ctx);
+    }
+}
+
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
+                                 int64_t grow, int64_t shrink,
+                                 Error **errp)
+{
+    if (max_ns < 0 || grow < 0 || shrink < 0) {
+        error_setg(errp, "poll parameters must not be negative");
+        return;
+    }
+
+    /* The AioContext's thread reads them in aio_poll() without a lock */
+    atomic_set(&ctx->poll_max_ns, max_ns);
+    atomic_set(&ctx->poll_grow, grow);
+    atomic_set(&ctx->poll_shrink, shrink);
+    if (atomic_read(&ctx->poll_ns) > max_ns) {
+        atomic_set(&ctx->poll_ns, max_ns);
+    }
+
+    /* Let a blocked aio_poll() pick up the new window */
+    aio_notify(ctx);
+}
+
 void aio_context_ref(AioContext *ctx)
 {
     g_source_ref(&ctx->source);
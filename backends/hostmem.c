@@ -16,6 +16,8 @@
 #include "qapi/qmp/qerror.h"
 #include "qemu/config-file.h"
 #include "qom/object_interfaces.h"
+#include "qemu/timer.h"
+#include "trace.h"
 
 #ifdef CONFIG_NUMA
 #include <numaif.h>
@@ -192,6 +194,78 @@ static void host_memory_backend_set_dump(Object *obj, bool value, Error **errp)
     }
 }
 
+static bool host_memory_backend_get_thp(Object *obj, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->thp;
+}
+
+static void host_memory_backend_set_thp(Object *obj, bool value, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (!memory_region_size(&backend->mr)) {
+        backend->thp = value;
+        return;
+    }
+
+    if (value != backend->thp) {
+        void *ptr = memory_region_get_ram_ptr(&backend->mr);
+        uint64_t sz = memory_region_size(&backend->mr);
+
+        qemu_madvise(ptr, sz,
+                     value ? QEMU_MADV_HUGEPAGE : QEMU_MADV_NOHUGEPAGE);
+        backend->thp = value;
+    }
+}
+
+static void
+host_memory_backend_get_prealloc_threads(Object *obj, Visitor *v,
+                                         void *opaque, const char *name,
+                                         Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    visit_type_int(v, &backend->prealloc_threads, name, errp);
+}
+
+static void
+host_memory_backend_set_prealloc_threads(Object *obj, Visitor *v,
+                                         void *opaque, const char *name,
+                                         Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    Error *local_err = NULL;
+    int64_t value;
+
+    visit_type_int(v, &value, name, &local_err);
+    if (local_err) {
+        goto out;
+    }
+    if (value <= 0 || value > INT_MAX) {
+        error_setg(&local_err, "Property '%s.%s' doesn't take value '%"
+                   PRId64 "'", object_get_typename(obj), name, value);
+        goto out;
+    }
+    backend->prealloc_threads = value;
+out:
+    error_propagate(errp, local_err);
+}
+
+static void host_memory_backend_prealloc(HostMemoryBackend *backend,
+                                         int fd, void *ptr, uint64_t sz)
+{
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads);
+    backend->prealloc_time_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                start;
+    trace_host_memory_backend_prealloc(backend, sz,
+                                       backend->prealloc_threads,
+                                       backend->prealloc_time_ns);
+}
+
 static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -222,7 +296,7 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
         void *ptr = memory_region_get_ram_ptr(&backend->mr);
         uint64_t sz = memory_region_size(&backend->mr);
 
-        os_mem_prealloc(fd, ptr, sz);
+        host_memory_backend_prealloc(backend, fd, ptr, sz);
         backend->prealloc = true;
     }
 }
@@ -236,6 +310,8 @@ static void host_memory_backend_init(Object *obj)
     backend->dump = qemu_opt_get_bool(qemu_get_machine_opts(),
                                       "dump-guest-core", true);
     backend->prealloc = mem_prealloc;
+    backend->thp = true;
+    backend->prealloc_threads = smp_cpus;
 
     object_property_add_bool(obj, "merge",
                         host_memory_backend_get_merge,
@@ -246,6 +322,13 @@ static void host_memory_backend_init(Object *obj)
     object_property_add_bool(obj, "prealloc",
                         host_memory_backend_get_prealloc,
                         host_memory_backend_set_prealloc, NULL);
+    object_property_add(obj, "prealloc-threads", "int",
+                        host_memory_backend_get_prealloc_threads,
+                        host_memory_backend_set_prealloc_threads,
+                        NULL, NULL, NULL);
+    object_property_add_bool(obj, "thp",
+                        host_memory_backend_get_thp,
+                        host_memory_backend_set_thp, NULL);
     object_property_add(obj, "size", "int",
                         host_memory_backend_get_size,
                         host_memory_backend_set_size, NULL, NULL, NULL);
@@ -288,6 +371,9 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
         if (!backend->dump) {
             qemu_madvise(ptr, sz, QEMU_MADV_DONTDUMP);
         }
+        if (!backend->thp) {
+            qemu_madvise(ptr, sz, QEMU_MADV_NOHUGEPAGE);
+        }
 #ifdef CONFIG_NUMA
         unsigned long lastbit = find_last_bit(backend->host_nodes, MAX_NODES);
         /* lastbit == MAX_NODES means maxnode = 0 */
@@ -330,7 +416,9 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * specified NUMA policy in place.
          */
         if (backend->prealloc) {
-            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz);
+            host_memory_backend_prealloc(backend,
+                                         memory_region_get_fd(&backend->mr),
+                                         ptr, sz);
         }
     }
 }
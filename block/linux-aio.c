@@ -12,6 +12,7 @@
 #include "qemu/queue.h"
 #include "block/raw-aio.h"
 #include "qemu/event_notifier.h"
+#include "qemu/atomic.h"
 
 #include <libaio.h>
 
@@ -152,6 +153,42 @@ static void qemu_laio_completion_cb(EventNotifier *e)
     }
 }
 
+/* The completion ring that io_setup() maps into our address space.  Its
+ * layout is part of the kernel ABI but not exported by libaio.
+ */
+struct aio_ring {
+    unsigned id;
+    unsigned nr;
+    unsigned head;
+    unsigned tail;
+    unsigned magic;
+    unsigned compat_features;
+    unsigned incompat_features;
+    unsigned header_length;
+};
+
+#define AIO_RING_MAGIC 0xa10a10a1
+
+/* Check the completion ring from userspace while the AioContext is busy
+ * polling, so that completions are reaped without waiting for the eventfd.
+ */
+static bool qemu_laio_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
+    struct aio_ring *ring = (struct aio_ring *)s->ctx;
+
+    if (s->event_idx == s->event_max &&
+        (ring->magic != AIO_RING_MAGIC ||
+         atomic_read(&ring->head) == atomic_read(&ring->tail))) {
+        return false;
+    }
+
+    event_notifier_test_and_clear(&s->e);
+    qemu_laio_completion_bh(s);
+    return true;
+}
+
 static void laio_cancel(BlockAIOCB *blockacb)
 {
     struct qemu_laiocb *laiocb = (struct qemu_laiocb *)blockacb;
@@ -297,6 +334,7 @@ void laio_attach_aio_context(void *s_, AioContext *new_context)
 
     s->completion_bh = aio_bh_new(new_context, qemu_laio_completion_bh, s);
     aio_set_event_notifier(new_context, &s->e, qemu_laio_completion_cb);
+    aio_set_event_notifier_poll(new_context, &s->e, qemu_laio_poll_cb);
 }
 
 void *laio_init(void)
@@ -27,6 +27,7 @@
 #include "exec/address-spaces.h"
 #include "exec/memory-internal.h"
 #include "qemu/rcu.h"
+#include "qemu/main-loop.h"
 
 /* -icount align implementation. */
 
@@ -133,6 +134,18 @@ void cpu_loop_exit(CPUState *cpu)
     siglongjmp(cpu->jmp_env, 1);
 }
 
+/* Restart the current guest instruction in cpu_exec_step_atomic, i.e.
+ * with all other vCPUs stopped.  Called from helpers with GETPC().
+ */
+void cpu_loop_exit_atomic(CPUState *cpu, uintptr_t retaddr)
+{
+    if (retaddr) {
+        cpu_restore_state(cpu, retaddr);
+    }
+    cpu->exception_index = EXCP_ATOMIC;
+    cpu_loop_exit(cpu);
+}
+
 /* exit the current TB from a signal handler. The host registers are
    restored in a state compatible with the CPU emulator
  */
@@ -201,6 +214,16 @@ static inline tcg_target_ulong cpu_tb_exec(CPUState *cpu, uint8_t *tb_ptr)
     trace_exec_tb_exit((void *) (next_tb & ~TB_EXIT_MASK),
                        next_tb & TB_EXIT_MASK);
 
+    if (next_tb & ~TB_EXIT_MASK) {
+        TranslationBlock *last_tb;
+
+        last_tb = (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
+
+        if (last_tb->cflags & CF_PROFILE) {
+            last_tb->exit_count++;
+        }
+    }
+
     if ((next_tb & TB_EXIT_MASK) > TB_EXIT_IDX1) {
         /* We didn't start executing this TB (eg because the instruction
          * counter hit zero); we must restore the guest PC to the address
@@ -240,17 +263,132 @@ static void cpu_exec_nocache(CPUArchState *env, int max_cycles,
     if (max_cycles > CF_COUNT_MASK)
         max_cycles = CF_COUNT_MASK;
 
+    tb_lock();
     /* tb_gen_code can flush our orig_tb, invalidate it now */
     tb_phys_invalidate(orig_tb, -1);
     tb = tb_gen_code(cpu, pc, cs_base, flags,
                      max_cycles | CF_NOCACHE);
+    tb_unlock();
     cpu->current_tb = tb;
     /* execute the generated code */
     trace_exec_tb_nocache(tb, tb->pc);
     cpu_tb_exec(cpu, tb->tc_ptr);
     cpu->current_tb = NULL;
+    tb_lock();
     tb_phys_invalidate(tb, -1);
     tb_free(tb);
+    tb_unlock();
+}
+
+/* An ARM load-exclusive keeps the other vCPUs stopped until the exclusive
+ * monitor is released again, so that nothing can slip in between it and
+ * the store-exclusive.  Architecturally a store-exclusive only has to
+ * succeed if at most a few instructions separate it from the load.
+ */
+#define TCG_ATOMIC_MAX_INSNS 64
+
+static inline bool cpu_atomic_sequence_pending(CPUArchState *env)
+{
+#if defined(TARGET_ARM)
+    return env->exclusive_addr != -1;
+#else
+    return false;
+#endif
+}
+
+static inline void cpu_atomic_sequence_abort(CPUArchState *env)
+{
+#if defined(TARGET_ARM)
+    /* the next store-exclusive fails and the guest retries */
+    env->exclusive_addr = -1;
+#endif
+}
+
+/* Execute a guest atomic operation that cpu_loop_exit_atomic bailed out
+ * of, one instruction per TB.  The caller has stopped all other vCPUs.
+ */
+void cpu_exec_step_atomic(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+    int n = 0;
+
+    current_cpu = cpu;
+    parallel_cpus = false;
+    rcu_read_lock();
+    cc->cpu_exec_enter(cpu);
+
+    if (sigsetjmp(cpu->jmp_env, 0) == 0) {
+        do {
+            cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+            tb_lock();
+            tb = tb_gen_code(cpu, pc, cs_base, flags, 1 | CF_NOCACHE);
+            tb_unlock();
+            /* exit requests are left for cpu_exec to handle */
+            cpu->tcg_exit_req = 0;
+            cpu->current_tb = tb;
+            trace_exec_tb_nocache(tb, tb->pc);
+            cpu_tb_exec(cpu, tb->tc_ptr);
+            cpu->current_tb = NULL;
+            tb_lock();
+            tb_phys_invalidate(tb, -1);
+            tb_free(tb);
+            tb_unlock();
+        } while (cpu_atomic_sequence_pending(env) &&
+                 ++n < TCG_ATOMIC_MAX_INSNS);
+    } else {
+        /* a guest exception; cpu_exec delivers it */
+        cpu = current_cpu;
+        env = cpu->env_ptr;
+        cc = CPU_GET_CLASS(cpu);
+        cpu->can_do_io = 1;
+        tb_lock_reset();
+    }
+
+    /* once the other vCPUs run again, no store-exclusive may succeed */
+    cpu_atomic_sequence_abort(env);
+
+    cc->cpu_exec_exit(cpu);
+    rcu_read_unlock();
+    parallel_cpus = true;
+    current_cpu = NULL;
+}
+
+struct tb_desc {
+    target_ulong pc;
+    target_ulong cs_base;
+    CPUArchState *env;
+    tb_page_addr_t phys_page1;
+    uint64_t flags;
+};
+
+static bool tb_cmp(const void *p, const void *d)
+{
+    const TranslationBlock *tb = p;
+    const struct tb_desc *desc = d;
+
+    if (tb->pc == desc->pc &&
+        tb->page_addr[0] == desc->phys_page1 &&
+        tb->cs_base == desc->cs_base &&
+        tb->flags == desc->flags) {
+        /* check next page if needed */
+        if (tb->page_addr[1] == -1) {
+            return true;
+        } else {
+            tb_page_addr_t phys_page2;
+            target_ulong virt_page2;
+
+            virt_page2 = (desc->pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+            phys_page2 = get_page_addr_code(desc->env, virt_page2);
+            if (tb->page_addr[1] == phys_page2) {
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
 static TranslationBlock *tb_find_slow(CPUArchState *env,
@@ -259,52 +397,28 @@ static TranslationBlock *tb_find_slow(CPUArchState *env,
                                       uint64_t flags)
 {
     CPUState *cpu = ENV_GET_CPU(env);
-    TranslationBlock *tb, **ptb1;
-    unsigned int h;
-    tb_page_addr_t phys_pc, phys_page1;
-    target_ulong virt_page2;
+    TranslationBlock *tb;
+    tb_page_addr_t phys_pc;
+    struct tb_desc desc;
+    uint32_t h;
 
     tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
 
-    /* find translated block using physical mappings */
+    /* find translated block using physical mappings; the lookup does not
+       write to the table, and runs within cpu_exec's RCU critical section */
     phys_pc = get_page_addr_code(env, pc);
-    phys_page1 = phys_pc & TARGET_PAGE_MASK;
-    h = tb_phys_hash_func(phys_pc);
-    ptb1 = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    for(;;) {
-        tb = *ptb1;
-        if (!tb)
-            goto not_found;
-        if (tb->pc == pc &&
-            tb->page_addr[0] == phys_page1 &&
-            tb->cs_base == cs_base &&
-            tb->flags == flags) {
-            /* check next page if needed */
-            if (tb->page_addr[1] != -1) {
-                tb_page_addr_t phys_page2;
-
-                virt_page2 = (pc & TARGET_PAGE_MASK) +
-                    TARGET_PAGE_SIZE;
-                phys_page2 = get_page_addr_code(env, virt_page2);
-                if (tb->page_addr[1] == phys_page2)
-                    goto found;
-            } else {
-                goto found;
-            }
-        }
-        ptb1 = &tb->phys_hash_next;
-    }
- not_found:
-   /* if no translated code available, then translate it now */
-    tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
-
- found:
-    /* Move the last found TB to the head of the list */
-    if (likely(*ptb1)) {
-        *ptb1 = tb->phys_hash_next;
-        tb->phys_hash_next = tcg_ctx.tb_ctx.tb_phys_hash[h];
-        tcg_ctx.tb_ctx.tb_phys_hash[h] = tb;
+    desc.env = env;
+    desc.pc = pc;
+    desc.cs_base = cs_base;
+    desc.flags = flags;
+    desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
+    h = tb_hash_func(phys_pc, pc, flags, cs_base);
+    tb = qht_lookup(&tcg_ctx.tb_ctx.htable, tb_cmp, &desc, h);
+    if (!tb) {
+        /* if no translated code available, then translate it now */
+        tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
     }
+
     /* we add the TB in the virtual pc hash table */
     cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
     return tb;
@@ -326,9 +440,38 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
                  tb->flags != flags)) {
         tb = tb_find_slow(env, pc, cs_base, flags);
     }
+    tb_mark_used(tb);
     return tb;
 }
 
+/* Multi-threaded TCG runs translated code without the global mutex; take
+ * it for the parts of the execution loop that deliver interrupts and
+ * exceptions, as those touch device state such as interrupt controllers.
+ * Returns true if the caller has to release it again.
+ */
+static inline bool cpu_exec_lock_iothread(void)
+{
+    if (qemu_tcg_mttcg_enabled() && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        return true;
+    }
+    return false;
+}
+
+/* Release the locks that a longjmp out of the translated code may have
+ * left behind.
+ */
+static void cpu_exec_unlock_all(void)
+{
+    tb_lock_reset();
+#ifdef CONFIG_USER_ONLY
+    tcg_atomic_unlock();
+#endif
+    if (qemu_tcg_mttcg_enabled() && qemu_mutex_iothread_locked()) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 static void cpu_handle_debug_exception(CPUArchState *env)
 {
     CPUState *cpu = ENV_GET_CPU(env);
@@ -361,9 +504,6 @@ int cpu_exec(CPUArchState *env)
     uintptr_t next_tb;
     SyncClocks sc;
 
-    /* This must be volatile so it is not trashed by longjmp() */
-    volatile bool have_tb_lock = false;
-
     if (cpu->halted) {
         if (!cpu_has_work(cpu)) {
             return EXCP_HALTED;
@@ -422,8 +562,13 @@ int cpu_exec(CPUArchState *env)
                     cpu->exception_index = -1;
                     break;
 #else
+                    bool locked = cpu_exec_lock_iothread();
+
                     cc->do_interrupt(cpu);
                     cpu->exception_index = -1;
+                    if (locked) {
+                        qemu_mutex_unlock_iothread();
+                    }
 #endif
                 }
             }
@@ -432,6 +577,10 @@ int cpu_exec(CPUArchState *env)
             for(;;) {
                 interrupt_request = cpu->interrupt_request;
                 if (unlikely(interrupt_request)) {
+                    /* dropped by cpu_exec_unlock_all if we longjmp */
+                    bool locked = cpu_exec_lock_iothread();
+
+                    interrupt_request = cpu->interrupt_request;
                     if (unlikely(cpu->singlestep_enabled & SSTEP_NOIRQ)) {
                         /* Mask out external interrupts for this step. */
                         interrupt_request &= ~CPU_INTERRUPT_SSTEP_MASK;
@@ -474,14 +623,16 @@ int cpu_exec(CPUArchState *env)
                            the program flow was changed */
                         next_tb = 0;
                     }
+                    if (locked) {
+                        qemu_mutex_unlock_iothread();
+                    }
                 }
                 if (unlikely(cpu->exit_request)) {
                     cpu->exit_request = 0;
                     cpu->exception_index = EXCP_INTERRUPT;
                     cpu_loop_exit(cpu);
                 }
-                spin_lock(&tcg_ctx.tb_ctx.tb_lock);
-                have_tb_lock = true;
+                tb_lock();
                 tb = tb_find_fast(env);
                 /* Note: we do it here to avoid a gcc bug on Mac OS X when
                    doing it in tb_find_slow */
@@ -503,8 +654,7 @@ int cpu_exec(CPUArchState *env)
                     tb_add_jump((TranslationBlock *)(next_tb & ~TB_EXIT_MASK),
                                 next_tb & TB_EXIT_MASK, tb);
                 }
-                have_tb_lock = false;
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
+                tb_unlock();
 
                 /* cpu_interrupt might be called while translating the
                    TB, but before it is linked into a potentially
@@ -572,10 +722,7 @@ int cpu_exec(CPUArchState *env)
 #ifdef TARGET_I386
             x86_cpu = X86_CPU(cpu);
 #endif
-            if (have_tb_lock) {
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
-                have_tb_lock = false;
-            }
+            cpu_exec_unlock_all();
         }
     } /* for(;;) */
 
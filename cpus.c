@@ -35,10 +35,12 @@
 
 #include "qemu/thread.h"
 #include "sysemu/cpus.h"
+#include "sysemu/numa.h"
 #include "sysemu/qtest.h"
 #include "qemu/main-loop.h"
 #include "qemu/bitmap.h"
 #include "qemu/seqlock.h"
+#include "qemu/rcu.h"
 #include "qapi-event.h"
 #include "hw/nmi.h"
 
@@ -68,6 +70,36 @@ static CPUState *next_cpu;
 int64_t max_delay;
 int64_t max_advance;
 
+/* Multi-threaded TCG translates guest barriers and atomics, but emits
+ * plain guest loads and stores as plain host ones; the host therefore has
+ * to be at least as strongly ordered as the guest.  It also needs real
+ * thread-local storage.
+ */
+#if defined(CONFIG_LINUX) && defined(__x86_64__) && \
+    (defined(TARGET_I386) || defined(TARGET_ARM))
+#define TCG_MTTCG_SUPPORTED 1
+#else
+#define TCG_MTTCG_SUPPORTED 0
+#endif
+
+void qemu_tcg_configure(const char *thread, Error **errp)
+{
+    if (!thread || !strcmp(thread, "single")) {
+        mttcg_enabled = false;
+        parallel_cpus = false;
+    } else if (!strcmp(thread, "multi")) {
+        if (!TCG_MTTCG_SUPPORTED) {
+            error_setg(errp, "multi-threaded TCG is not supported for "
+                       "this guest on this host");
+            return;
+        }
+        mttcg_enabled = true;
+        parallel_cpus = true;
+    } else {
+        error_setg(errp, "Invalid 'tcg-thread' setting '%s'", thread);
+    }
+}
+
 bool cpu_is_stopped(CPUState *cpu)
 {
     return cpu->stopped || !runstate_is_running();
@@ -504,6 +536,10 @@ void configure_icount(QemuOpts *opts, Error **errp)
         }
         return;
     }
+    if (qemu_tcg_mttcg_enabled()) {
+        error_setg(errp, "icount is not supported with multi-threaded TCG");
+        return;
+    }
     icount_align_option = qemu_opt_get_bool(opts, "align", false);
     icount_warp_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL_RT,
                                      icount_warp_rt, NULL);
@@ -777,6 +813,8 @@ static void qemu_tcg_init_cpu_signals(void)
 #endif /* _WIN32 */
 
 static QemuMutex qemu_global_mutex;
+static DEFINE_TLS(bool, iothread_locked);
+#define iothread_locked tls_var(iothread_locked)
 static QemuCond qemu_io_proceeded_cond;
 static unsigned iothread_requesting_mutex;
 
@@ -790,6 +828,17 @@ static QemuCond qemu_cpu_cond;
 /* system init */
 static QemuCond qemu_pause_cond;
 static QemuCond qemu_work_cond;
+/* protects the queued_work lists, which vCPUs running translated code
+ * without the global mutex may append to */
+static QemuMutex qemu_work_mutex;
+
+/* Exclusive sections for multi-threaded TCG, protected by the global
+ * mutex: tcg_running_cpus counts vCPUs inside cpu_exec.
+ */
+static int tcg_running_cpus;
+static bool tcg_exclusive_pending;
+static QemuCond qemu_exclusive_cond;
+static QemuCond qemu_exclusive_resume_cond;
 
 void qemu_init_cpu_loop(void)
 {
@@ -798,11 +847,30 @@ void qemu_init_cpu_loop(void)
     qemu_cond_init(&qemu_pause_cond);
     qemu_cond_init(&qemu_work_cond);
     qemu_cond_init(&qemu_io_proceeded_cond);
+    qemu_cond_init(&qemu_exclusive_cond);
+    qemu_cond_init(&qemu_exclusive_resume_cond);
+    qemu_mutex_init(&qemu_work_mutex);
     qemu_mutex_init(&qemu_global_mutex);
 
     qemu_thread_get_self(&io_thread);
 }
 
+static void queue_work_on_cpu(CPUState *cpu, struct qemu_work_item *wi)
+{
+    qemu_mutex_lock(&qemu_work_mutex);
+    if (cpu->queued_work_first == NULL) {
+        cpu->queued_work_first = wi;
+    } else {
+        cpu->queued_work_last->next = wi;
+    }
+    cpu->queued_work_last = wi;
+    wi->next = NULL;
+    wi->done = false;
+    qemu_mutex_unlock(&qemu_work_mutex);
+
+    qemu_cpu_kick(cpu);
+}
+
 void run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data)
 {
     struct qemu_work_item wi;
@@ -815,16 +883,7 @@ void run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data)
     wi.func = func;
     wi.data = data;
     wi.free = false;
-    if (cpu->queued_work_first == NULL) {
-        cpu->queued_work_first = &wi;
-    } else {
-        cpu->queued_work_last->next = &wi;
-    }
-    cpu->queued_work_last = &wi;
-    wi.next = NULL;
-    wi.done = false;
-
-    qemu_cpu_kick(cpu);
+    queue_work_on_cpu(cpu, &wi);
     while (!wi.done) {
         CPUState *self_cpu = current_cpu;
 
@@ -846,16 +905,73 @@ void async_run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data)
     wi->func = func;
     wi->data = data;
     wi->free = true;
-    if (cpu->queued_work_first == NULL) {
-        cpu->queued_work_first = wi;
-    } else {
-        cpu->queued_work_last->next = wi;
+    queue_work_on_cpu(cpu, wi);
+}
+
+/* Wait until no vCPU executes translated code, and keep it that way until
+ * qemu_tcg_end_exclusive.  Must be called with the global mutex held and
+ * from outside cpu_exec.
+ */
+static void qemu_tcg_start_exclusive(void)
+{
+    CPUState *cpu;
+
+    while (tcg_exclusive_pending) {
+        qemu_cond_wait(&qemu_exclusive_resume_cond, &qemu_global_mutex);
     }
-    cpu->queued_work_last = wi;
-    wi->next = NULL;
-    wi->done = false;
+    tcg_exclusive_pending = true;
 
-    qemu_cpu_kick(cpu);
+    CPU_FOREACH(cpu) {
+        cpu_exit(cpu);
+    }
+    while (tcg_running_cpus > 0) {
+        qemu_cond_wait(&qemu_exclusive_cond, &qemu_global_mutex);
+    }
+}
+
+static void qemu_tcg_end_exclusive(void)
+{
+    tcg_exclusive_pending = false;
+    qemu_cond_broadcast(&qemu_exclusive_resume_cond);
+}
+
+typedef struct SafeWorkItem {
+    void (*func)(void *data);
+    void *data;
+} SafeWorkItem;
+
+static void do_safe_run_on_cpu(void *data)
+{
+    SafeWorkItem *item = data;
+
+    qemu_tcg_start_exclusive();
+    item->func(item->data);
+    qemu_tcg_end_exclusive();
+    g_free(item);
+}
+
+void async_safe_run_on_cpu(CPUState *cpu, void (*func)(void *data),
+                           void *data)
+{
+    struct qemu_work_item *wi;
+    SafeWorkItem *item;
+
+    if (!qemu_tcg_mttcg_enabled()) {
+        async_run_on_cpu(cpu, func, data);
+        return;
+    }
+
+    /* Always queue the work, even when called from @cpu's own thread:
+     * the caller is then inside cpu_exec and must leave it first.
+     */
+    item = g_new(SafeWorkItem, 1);
+    item->func = func;
+    item->data = data;
+    wi = g_malloc0(sizeof(struct qemu_work_item));
+    wi->func = do_safe_run_on_cpu;
+    wi->data = item;
+    wi->free = true;
+    queue_work_on_cpu(cpu, wi);
 }
 
 static void flush_queued_work(CPUState *cpu)
@@ -866,15 +982,22 @@ static void flush_queued_work(CPUState *cpu)
         return;
     }
 
+    qemu_mutex_lock(&qemu_work_mutex);
     while ((wi = cpu->queued_work_first)) {
         cpu->queued_work_first = wi->next;
+        if (!cpu->queued_work_first) {
+            cpu->queued_work_last = NULL;
+        }
+        qemu_mutex_unlock(&qemu_work_mutex);
         wi->func(wi->data);
-        wi->done = true;
+        qemu_mutex_lock(&qemu_work_mutex);
         if (wi->free) {
             g_free(wi);
+        } else {
+            wi->done = true;
         }
     }
-    cpu->queued_work_last = NULL;
+    qemu_mutex_unlock(&qemu_work_mutex);
     qemu_cond_broadcast(&qemu_work_cond);
 }
 
@@ -924,7 +1047,7 @@ static void *qemu_kvm_cpu_thread_fn(void *arg)
     CPUState *cpu = arg;
     int r;
 
-    qemu_mutex_lock(&qemu_global_mutex);
+    qemu_mutex_lock_iothread();
     qemu_thread_get_self(cpu->thread);
     cpu->thread_id = qemu_get_thread_id();
     cpu->can_do_io = 1;
@@ -1004,10 +1127,13 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
 {
     CPUState *cpu = arg;
 
+    /* the TB hash table is read under RCU */
+    rcu_register_thread();
     qemu_tcg_init_cpu_signals();
     qemu_thread_get_self(cpu->thread);
 
     qemu_mutex_lock(&qemu_global_mutex);
+    iothread_locked = true;
     CPU_FOREACH(cpu) {
         cpu->thread_id = qemu_get_thread_id();
         cpu->created = true;
@@ -1044,6 +1170,62 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     return NULL;
 }
 
+static int tcg_cpu_exec(CPUArchState *env);
+
+static void qemu_mttcg_wait_io_event(CPUState *cpu)
+{
+    while (cpu_thread_is_idle(cpu)) {
+        qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+    }
+
+    qemu_wait_io_event_common(cpu);
+}
+
+/* Multi-threaded TCG: every vCPU has its own thread, which runs translated
+ * code without the global mutex.
+ */
+static void *qemu_mttcg_cpu_thread_fn(void *arg)
+{
+    CPUState *cpu = arg;
+    int r;
+
+    rcu_register_thread();
+    qemu_mutex_lock_iothread();
+    qemu_thread_get_self(cpu->thread);
+    cpu->thread_id = qemu_get_thread_id();
+    cpu->created = true;
+    cpu->can_do_io = 1;
+    qemu_cond_signal(&qemu_cpu_cond);
+
+    /* process any pending work */
+    cpu->exit_request = 1;
+
+    while (1) {
+        while (tcg_exclusive_pending) {
+            qemu_cond_wait(&qemu_exclusive_resume_cond, &qemu_global_mutex);
+        }
+        if (cpu_can_run(cpu)) {
+            tcg_running_cpus++;
+            qemu_mutex_unlock_iothread();
+            r = tcg_cpu_exec(cpu->env_ptr);
+            qemu_mutex_lock_iothread();
+            if (--tcg_running_cpus == 0 && tcg_exclusive_pending) {
+                qemu_cond_signal(&qemu_exclusive_cond);
+            }
+            if (r == EXCP_DEBUG) {
+                cpu_handle_guest_debug(cpu);
+            } else if (r == EXCP_ATOMIC) {
+                qemu_tcg_start_exclusive();
+                cpu_exec_step_atomic(cpu);
+                qemu_tcg_end_exclusive();
+            }
+        }
+        qemu_mttcg_wait_io_event(cpu);
+    }
+
+    return NULL;
+}
+
 static void qemu_cpu_kick_thread(CPUState *cpu)
 {
 #ifndef _WIN32
@@ -1086,7 +1268,10 @@ static void qemu_cpu_kick_thread(CPUState *cpu)
 void qemu_cpu_kick(CPUState *cpu)
 {
     qemu_cond_broadcast(cpu->halt_cond);
-    if (!tcg_enabled() && !cpu->thread_kicked) {
+    if (qemu_tcg_mttcg_enabled()) {
+        /* the vCPU polls exit_request between TBs; no signal needed */
+        cpu_exit(cpu);
+    } else if (!tcg_enabled() && !cpu->thread_kicked) {
         qemu_cpu_kick_thread(cpu);
         cpu->thread_kicked = true;
     }
@@ -1116,10 +1301,21 @@ bool qemu_in_vcpu_thread(void)
     return current_cpu && qemu_cpu_is_self(current_cpu);
 }
 
+bool qemu_mutex_iothread_locked(void)
+{
+    return iothread_locked;
+}
+
 void qemu_mutex_lock_iothread(void)
 {
+    CPUState *cpu = cpu_stats_enabled ? current_cpu : NULL;
+    int64_t start = cpu ? get_clock() : 0;
+
     atomic_inc(&iothread_requesting_mutex);
-    if (!tcg_enabled() || !first_cpu) {
+    /* With multi-threaded TCG the vCPUs do not hold the mutex while
+     * running guest code, so there is nobody to kick.
+     */
+    if (!tcg_enabled() || qemu_tcg_mttcg_enabled() || !first_cpu) {
         qemu_mutex_lock(&qemu_global_mutex);
         atomic_dec(&iothread_requesting_mutex);
     } else {
@@ -1130,10 +1326,16 @@ void qemu_mutex_lock_iothread(void)
         atomic_dec(&iothread_requesting_mutex);
         qemu_cond_broadcast(&qemu_io_proceeded_cond);
     }
+    iothread_locked = true;
+
+    if (cpu) {
+        cpu_stats_account_bql_wait(cpu, get_clock() - start);
+    }
 }
 
 void qemu_mutex_unlock_iothread(void)
 {
+    iothread_locked = false;
     qemu_mutex_unlock(&qemu_global_mutex);
 }
 
@@ -1162,7 +1364,7 @@ void pause_all_vcpus(void)
 
     if (qemu_in_vcpu_thread()) {
         cpu_stop_current();
-        if (!kvm_enabled()) {
+        if (!kvm_enabled() && !qemu_tcg_mttcg_enabled()) {
             CPU_FOREACH(cpu) {
                 cpu->stop = false;
                 cpu->stopped = true;
@@ -1205,6 +1407,20 @@ static void qemu_tcg_init_vcpu(CPUState *cpu)
 
     tcg_cpu_address_space_init(cpu, cpu->as);
 
+    if (qemu_tcg_mttcg_enabled()) {
+        cpu->thread = g_malloc0(sizeof(QemuThread));
+        cpu->halt_cond = g_malloc0(sizeof(QemuCond));
+        qemu_cond_init(cpu->halt_cond);
+        snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
+                 cpu->cpu_index);
+        qemu_thread_create(cpu->thread, thread_name, qemu_mttcg_cpu_thread_fn,
+                           cpu, QEMU_THREAD_JOINABLE);
+        while (!cpu->created) {
+            qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
+        }
+        return;
+    }
+
     /* share a single thread for all cpus with TCG */
     if (!tcg_cpu_thread) {
         cpu->thread = g_malloc0(sizeof(QemuThread));
@@ -1272,6 +1488,7 @@ void qemu_init_vcpu(CPUState *cpu)
     } else {
         qemu_dummy_start_vcpu(cpu);
     }
+    numa_place_vcpu(cpu);
 }
 
 void cpu_stop_current(void)
@@ -1314,9 +1531,26 @@ int vm_stop_force_state(RunState state)
     }
 }
 
+static VcpuExitReason tcg_exit_reason(int excp)
+{
+    switch (excp) {
+    case EXCP_INTERRUPT:
+        return VCPU_EXIT_REASON_INTERRUPT;
+    case EXCP_HLT:
+    case EXCP_HALTED:
+        return VCPU_EXIT_REASON_HALT;
+    case EXCP_DEBUG:
+        return VCPU_EXIT_REASON_DEBUG;
+    default:
+        return VCPU_EXIT_REASON_OTHER;
+    }
+}
+
 static int tcg_cpu_exec(CPUArchState *env)
 {
     CPUState *cpu = ENV_GET_CPU(env);
+    int64_t start = 0;
+    bool stats;
     int ret;
 #ifdef CONFIG_PROFILER
     int64_t ti;
@@ -1351,7 +1585,14 @@ static int tcg_cpu_exec(CPUArchState *env)
         cpu->icount_decr.u16.low = decr;
         cpu->icount_extra = count;
     }
+    stats = cpu_stats_enabled;
+    if (stats) {
+        start = get_clock();
+    }
     ret = cpu_exec(env);
+    if (stats) {
+        cpu_stats_account_exit(cpu, tcg_exit_reason(ret), get_clock() - start);
+    }
 #ifdef CONFIG_PROFILER
     qemu_time += profile_getclock() - ti;
 #endif
@@ -1467,6 +1708,94 @@ CpuInfoList *qmp_query_cpus(Error **errp)
     return head;
 }
 
+static VcpuLatencyHistogram *vcpu_stats_histogram(const CPUStatsHistogram *h)
+{
+    VcpuLatencyHistogram *info = g_malloc0(sizeof(*info));
+    intList **next = &info->buckets;
+    int i;
+
+    info->count = h->count;
+    info->total_ns = h->total_ns;
+    info->max_ns = h->max_ns;
+    for (i = 0; i < CPU_STATS_HIST_BUCKETS; i++) {
+        *next = g_malloc0(sizeof(**next));
+        (*next)->value = h->buckets[i];
+        next = &(*next)->next;
+    }
+    return info;
+}
+
+static int vcpu_stats_hotspot_cmp(const void *a, const void *b)
+{
+    const CPUStatsHotspot *ha = a, *hb = b;
+
+    if (ha->count != hb->count) {
+        return ha->count < hb->count ? 1 : -1;
+    }
+    return 0;
+}
+
+void qmp_vcpu_stats(bool enable, Error **errp)
+{
+    cpu_stats_enabled = enable;
+}
+
+VcpuStatsList *qmp_query_vcpu_stats(Error **errp)
+{
+    VcpuStatsList *head = NULL, **next_cpu_info = &head;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        CPUStatsHotspot hotspots[CPU_STATS_IO_HOTSPOTS];
+        VcpuExitCountList **next_exit;
+        VcpuIoHotspotList **next_hotspot;
+        VcpuStats *info;
+        int i;
+
+        info = g_malloc0(sizeof(*info));
+        info->cpu_index = cpu->cpu_index;
+        info->thread_id = cpu->thread_id;
+
+        next_exit = &info->exits;
+        for (i = 0; i < VCPU_EXIT_REASON_MAX; i++) {
+            uint64_t count = cpu->stats.exits[i];
+
+            if (!count) {
+                continue;
+            }
+            *next_exit = g_malloc0(sizeof(**next_exit));
+            (*next_exit)->value = g_malloc0(sizeof(*(*next_exit)->value));
+            (*next_exit)->value->reason = i;
+            (*next_exit)->value->count = count;
+            next_exit = &(*next_exit)->next;
+        }
+
+        info->run = vcpu_stats_histogram(&cpu->stats.run);
+        info->emulation = vcpu_stats_histogram(&cpu->stats.emulation);
+        info->bql_wait = vcpu_stats_histogram(&cpu->stats.bql_wait);
+
+        memcpy(hotspots, cpu->stats.hotspots, sizeof(hotspots));
+        qsort(hotspots, CPU_STATS_IO_HOTSPOTS, sizeof(hotspots[0]),
+              vcpu_stats_hotspot_cmp);
+        next_hotspot = &info->hotspots;
+        for (i = 0; i < CPU_STATS_IO_HOTSPOTS && hotspots[i].count; i++) {
+            *next_hotspot = g_malloc0(sizeof(**next_hotspot));
+            (*next_hotspot)->value =
+                g_malloc0(sizeof(*(*next_hotspot)->value));
+            (*next_hotspot)->value->addr = hotspots[i].addr;
+            (*next_hotspot)->value->pio = hotspots[i].pio;
+            (*next_hotspot)->value->count = hotspots[i].count;
+            next_hotspot = &(*next_hotspot)->next;
+        }
+
+        *next_cpu_info = g_malloc0(sizeof(**next_cpu_info));
+        (*next_cpu_info)->value = info;
+        next_cpu_info = &(*next_cpu_info)->next;
+    }
+
+    return head;
+}
+
 void qmp_memsave(int64_t addr, int64_t size, const char *filename,
                  bool has_cpu, int64_t cpu_index, Error **errp)
 {
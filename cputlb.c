@@ -29,6 +29,9 @@
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
 #include "tcg/tcg.h"
+#include "qemu/timer.h"
+#include "qemu/error-report.h"
+#include "sysemu/cpus.h"
 
 //#define DEBUG_TLB
 //#define DEBUG_TLB_CHECK
@@ -36,6 +39,144 @@
 /* statistics */
 int tlb_flush_count;
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+static unsigned int tlb_dyn_max_bits = CPU_TLB_DYN_DEFAULT_MAX_BITS;
+
+/* Length of the window over which the use rate of a TLB is measured
+ * before it may shrink.  Growing happens at any flush.
+ */
+#define TLB_WINDOW_NS (100 * 1000 * 1000)
+
+void tlb_configure(unsigned int max_bits, Error **errp)
+{
+    if (max_bits < CPU_TLB_DYN_DEFAULT_BITS ||
+        max_bits > CPU_TLB_DYN_MAX_BITS) {
+        error_setg(errp, "tlb-max-bits must be between %d and %d",
+                   CPU_TLB_DYN_DEFAULT_BITS, CPU_TLB_DYN_MAX_BITS);
+        return;
+    }
+    tlb_dyn_max_bits = max_bits;
+}
+
+static void tlb_dyn_alloc(CPUTLBDesc *desc, size_t n_entries)
+{
+    /* If memory is tight, settle for a smaller table; only the minimum
+     * size is required to succeed.
+     */
+    while (n_entries > (1 << CPU_TLB_DYN_MIN_BITS)) {
+        desc->table = g_try_new(CPUTLBEntry, n_entries);
+        desc->iotlb = g_try_new(hwaddr, n_entries);
+        if (desc->table && desc->iotlb) {
+            goto done;
+        }
+        g_free(desc->table);
+        g_free(desc->iotlb);
+        n_entries >>= 1;
+    }
+    desc->table = g_new(CPUTLBEntry, n_entries);
+    desc->iotlb = g_new(hwaddr, n_entries);
+done:
+    desc->n_entries = n_entries;
+}
+
+/* Resize the table at flush time.  A table is grown when more than 70%
+ * of it was in use, and shrunk when less than 30% was used during a whole
+ * window; a shrunk table is made large enough not to be grown again at
+ * the next flush.
+ */
+static void tlb_mmu_resize(CPUTLBDesc *desc, int64_t now)
+{
+    size_t old_size = desc->n_entries;
+    size_t new_size = old_size;
+    size_t max_size = (size_t)1 << tlb_dyn_max_bits;
+    size_t min_size = (size_t)1 << CPU_TLB_DYN_MIN_BITS;
+    bool window_expired = now > desc->window_begin_ns + TLB_WINDOW_NS;
+    size_t rate;
+
+    desc->window_max_entries = MAX(desc->window_max_entries,
+                                   desc->n_used_entries);
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > 70) {
+        new_size = MIN(old_size << 1, max_size);
+    } else if (rate < 30 && window_expired) {
+        size_t ceil = pow2ceil(MAX(desc->window_max_entries, 1));
+        size_t expected_rate = desc->window_max_entries * 100 / ceil;
+
+        if (expected_rate > 70) {
+            ceil <<= 1;
+        }
+        new_size = MAX(ceil, min_size);
+    }
+    new_size = MIN(new_size, max_size);
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            desc->window_begin_ns = now;
+            desc->window_max_entries = 0;
+        }
+        return;
+    }
+
+    g_free(desc->table);
+    g_free(desc->iotlb);
+    tlb_dyn_alloc(desc, new_size);
+    desc->window_begin_ns = now;
+    desc->window_max_entries = 0;
+    desc->resize_count++;
+}
+
+/* Point env at the current tables and invalidate all entries */
+static void tlb_mmu_reset(CPUArchState *env, int mmu_idx, CPUTLBDesc *desc)
+{
+    env->tlb_table[mmu_idx] = desc->table;
+    env->iotlb[mmu_idx] = desc->iotlb;
+    env->tlb_mask[mmu_idx] = (desc->n_entries - 1) << CPU_TLB_ENTRY_BITS;
+    memset(desc->table, -1, desc->n_entries * sizeof(CPUTLBEntry));
+    desc->n_used_entries = 0;
+}
+#else
+void tlb_configure(unsigned int max_bits, Error **errp)
+{
+    error_setg(errp, "tlb-max-bits is not supported by this TCG backend");
+}
+#endif
+
+void tlb_init(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    cpu->tlb = g_new0(struct CPUTLBState, 1);
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->tlb->d[mmu_idx];
+
+        tlb_dyn_alloc(desc, 1 << CPU_TLB_DYN_DEFAULT_BITS);
+        desc->window_begin_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        tlb_mmu_reset(env, mmu_idx, desc);
+    }
+#else
+    memset(env->tlb_table, -1, sizeof(env->tlb_table));
+#endif
+}
+
+void tlb_destroy(CPUState *cpu)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    int mmu_idx;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->tlb->d[mmu_idx];
+
+        g_free(desc->table);
+        g_free(desc->iotlb);
+    }
+#endif
+    g_free(cpu->tlb);
+    cpu->tlb = NULL;
+}
+
 /* NOTE:
  * If flush_global is true (the usual case), flush all tlb entries.
  * If flush_global is false, flush (at least) all tlb entries not
@@ -51,6 +192,10 @@ int tlb_flush_count;
 void tlb_flush(CPUState *cpu, int flush_global)
 {
     CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+#endif
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
@@ -59,17 +204,28 @@ void tlb_flush(CPUState *cpu, int flush_global)
        links while we are modifying them */
     cpu->current_tb = NULL;
 
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->tlb->d[mmu_idx];
+
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+        tlb_mmu_resize(desc, now);
+        tlb_mmu_reset(env, mmu_idx, desc);
+#endif
+        desc->flush_count++;
+    }
+#if !TCG_TARGET_IMPLEMENTS_DYN_TLB
     memset(env->tlb_table, -1, sizeof(env->tlb_table));
+#endif
     memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
     memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
 
     env->vtlb_index = 0;
-    env->tlb_flush_addr = -1;
-    env->tlb_flush_mask = 0;
+    cpu->tlb->n_large_pages = 0;
     tlb_flush_count++;
 }
 
-static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
+/* Returns true if the entry was flushed */
+static inline bool tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
     if (addr == (tlb_entry->addr_read &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
@@ -78,7 +234,120 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
         addr == (tlb_entry->addr_code &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
         memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
+    }
+    return false;
+}
+
+static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
+{
+    return te->addr_read == -1 && te->addr_write == -1 &&
+           te->addr_code == -1;
+}
+
+static inline bool tlb_addr_in_range(target_ulong tlb_addr,
+                                     target_ulong addr, target_ulong mask)
+{
+    return tlb_addr != -1 && (tlb_addr & mask) == addr;
+}
+
+/* Returns true if the entry maps a page of the aligned range addr/mask */
+static inline bool tlb_flush_entry_range(CPUTLBEntry *tlb_entry,
+                                         target_ulong addr, target_ulong mask)
+{
+    if (tlb_addr_in_range(tlb_entry->addr_read, addr, mask) ||
+        tlb_addr_in_range(tlb_entry->addr_write, addr, mask) ||
+        tlb_addr_in_range(tlb_entry->addr_code, addr, mask)) {
+        memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
+    }
+    return false;
+}
+
+static inline void tlb_entry_flushed(CPUArchState *env, int mmu_idx)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    /* victim TLB swaps make the count approximate */
+    CPUTLBDesc *desc = tlb_desc(env, mmu_idx);
+
+    if (desc->n_used_entries) {
+        desc->n_used_entries--;
     }
+#endif
+}
+
+/* Flush the entries of all the pages of a large page.  Depending on the
+ * size of the large page, either probe each of its pages or scan the
+ * whole table.
+ */
+static void tlb_flush_large_page(CPUState *cpu, const CPUTLBLargePage *lp)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong n_pages = (~lp->mask >> TARGET_PAGE_BITS) + 1;
+    target_ulong page;
+    size_t i, n_entries;
+    int mmu_idx;
+
+#if defined(DEBUG_TLB)
+    printf("tlb_flush_large_page: " TARGET_FMT_lx "/" TARGET_FMT_lx "\n",
+           lp->addr, lp->mask);
+#endif
+    cpu->tlb->large_page_flush_count++;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        n_entries = tlb_n_entries(env, mmu_idx);
+        if (n_pages < n_entries) {
+            for (i = 0; i < n_pages; i++) {
+                page = lp->addr + (i << TARGET_PAGE_BITS);
+                if (tlb_flush_entry(&env->tlb_table[mmu_idx]
+                                    [tlb_index(env, mmu_idx, page)], page)) {
+                    tlb_entry_flushed(env, mmu_idx);
+                }
+            }
+        } else {
+            for (i = 0; i < n_entries; i++) {
+                if (tlb_flush_entry_range(&env->tlb_table[mmu_idx][i],
+                                          lp->addr, lp->mask)) {
+                    tlb_entry_flushed(env, mmu_idx);
+                }
+            }
+        }
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            tlb_flush_entry_range(&env->tlb_v_table[mmu_idx][i],
+                                  lp->addr, lp->mask);
+        }
+    }
+
+    if (n_pages < TB_JMP_CACHE_SIZE / TB_JMP_PAGE_SIZE) {
+        for (i = 0; i < n_pages; i++) {
+            tb_flush_jmp_cache(cpu, lp->addr + (i << TARGET_PAGE_BITS));
+        }
+    } else {
+        memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    }
+}
+
+/* Flush and forget the large pages that contain @addr.  Returns false if
+ * there are none.
+ */
+static bool tlb_flush_large_pages(CPUState *cpu, target_ulong addr)
+{
+    struct CPUTLBState *tlb = cpu->tlb;
+    bool found = false;
+    int i = 0;
+
+    while (i < tlb->n_large_pages) {
+        CPUTLBLargePage *lp = &tlb->large_pages[i];
+
+        if ((addr & lp->mask) != lp->addr) {
+            i++;
+            continue;
+        }
+        tlb_flush_large_page(cpu, lp);
+        *lp = tlb->large_pages[--tlb->n_large_pages];
+        found = true;
+    }
+    return found;
 }
 
 void tlb_flush_page(CPUState *cpu, target_ulong addr)
@@ -90,24 +359,22 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
 #if defined(DEBUG_TLB)
     printf("tlb_flush_page: " TARGET_FMT_lx "\n", addr);
 #endif
-    /* Check if we need to flush due to large pages.  */
-    if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
-#if defined(DEBUG_TLB)
-        printf("tlb_flush_page: forced full flush ("
-               TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-               env->tlb_flush_addr, env->tlb_flush_mask);
-#endif
-        tlb_flush(cpu, 1);
-        return;
-    }
     /* must reset current TB so that interrupts cannot modify the
        links while we are modifying them */
     cpu->current_tb = NULL;
 
+    /* A page inside a large page takes all of the large page with it;
+       that also covers @addr itself.  */
+    if (tlb_flush_large_pages(cpu, addr)) {
+        return;
+    }
+
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        i = tlb_index(env, mmu_idx, addr);
+        if (tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr)) {
+            tlb_entry_flushed(env, mmu_idx);
+        }
     }
 
     /* check whether there are entries that need to be flushed in the vtlb */
@@ -121,12 +388,104 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
     tb_flush_jmp_cache(cpu, addr);
 }
 
+typedef struct TLBFlushRequest {
+    target_ulong addr;
+    int flush_global;
+    bool page;
+} TLBFlushRequest;
+
+static void tlb_flush_every_cpu(TLBFlushRequest *req)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (req->page) {
+            tlb_flush_page(cpu, req->addr);
+        } else {
+            tlb_flush(cpu, req->flush_global);
+        }
+    }
+}
+
+static void do_tlb_flush_safe(void *data)
+{
+    TLBFlushRequest *req = data;
+
+    tlb_flush_every_cpu(req);
+    g_free(req);
+}
+
+/* Broadcast TLB maintenance must be complete before @src executes its next
+ * instruction.  While other vCPUs run translated code out of their TLBs,
+ * the flush therefore happens in an exclusive section; the instructions
+ * that call this end the TB, so @src leaves cpu_exec and runs it first.
+ */
+static void tlb_flush_all_cpus_req(CPUState *src, bool page, target_ulong addr,
+                                   int flush_global)
+{
+    TLBFlushRequest req = {
+        .addr = addr,
+        .flush_global = flush_global,
+        .page = page,
+    };
+
+    if (!parallel_cpus) {
+        tlb_flush_every_cpu(&req);
+        return;
+    }
+    async_safe_run_on_cpu(src, do_tlb_flush_safe,
+                          g_memdup(&req, sizeof(req)));
+}
+
+/* Flush a page from the TLB of every vCPU, e.g. for broadcast TLB
+ * maintenance operations.
+ */
+void tlb_flush_page_all_cpus(CPUState *src, target_ulong addr)
+{
+    tlb_flush_all_cpus_req(src, true, addr, 0);
+}
+
+void tlb_flush_all_cpus(CPUState *src, int flush_global)
+{
+    tlb_flush_all_cpus_req(src, false, 0, flush_global);
+}
+
+void dump_tlb_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    CPUState *cpu;
+    int mmu_idx;
+
+    cpu_fprintf(f, "\nTLB statistics per CPU and MMU mode:\n");
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        cpu_fprintf(f, "cpu %d: large pages tracked %d flushed %" PRIu64 "\n",
+                    cpu->cpu_index, cpu->tlb->n_large_pages,
+                    cpu->tlb->large_page_flush_count);
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            CPUTLBDesc *desc = &cpu->tlb->d[mmu_idx];
+
+            cpu_fprintf(f, "cpu %d mode %d: size %zu flushes %" PRIu64
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+                        " resizes %" PRIu64
+#endif
+                        " misses %" PRIu64 " victim hits %" PRIu64 "\n",
+                        cpu->cpu_index, mmu_idx,
+                        tlb_n_entries(env, mmu_idx), desc->flush_count,
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+                        desc->resize_count,
+#endif
+                        desc->miss_count, desc->vtlb_hit_count);
+        }
+    }
+}
+
 /* update the TLBs so that writes to code in the virtual page 'addr'
    can be detected */
 void tlb_protect_code(ram_addr_t ram_addr)
 {
-    cpu_physical_memory_reset_dirty(ram_addr, TARGET_PAGE_SIZE,
-                                    DIRTY_MEMORY_CODE);
+    cpu_physical_memory_test_and_clear_dirty(ram_addr, TARGET_PAGE_SIZE,
+                                             DIRTY_MEMORY_CODE);
 }
 
 /* update the TLB so that writes in physical page 'phys_addr' are no longer
@@ -178,7 +537,7 @@ void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length)
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
             unsigned int i;
 
-            for (i = 0; i < CPU_TLB_SIZE; i++) {
+            for (i = 0; i < tlb_n_entries(env, mmu_idx); i++) {
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
             }
@@ -206,8 +565,8 @@ void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        i = tlb_index(env, mmu_idx, vaddr);
         tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
     }
 
@@ -219,27 +578,57 @@ void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
     }
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, target_ulong vaddr,
+/* Our TLB does not support large pages, so remember the areas covered by
+   large pages and flush all their entries if one of these is invalidated.  */
+static void tlb_add_large_page(CPUState *cpu, target_ulong vaddr,
                                target_ulong size)
 {
+    struct CPUTLBState *tlb = cpu->tlb;
+    CPUTLBLargePage *lp, *best = NULL;
     target_ulong mask = ~(size - 1);
+    target_ulong best_mask = 0;
+    int i = 0;
+
+    vaddr &= mask;
+
+    /* Aligned power-of-two ranges are either nested or disjoint: keep only
+       the outermost one.  */
+    while (i < tlb->n_large_pages) {
+        lp = &tlb->large_pages[i];
+        if (((lp->addr ^ vaddr) & lp->mask & mask) != 0) {
+            i++;
+        } else if ((lp->mask & mask) == lp->mask) {
+            return;
+        } else {
+            *lp = tlb->large_pages[--tlb->n_large_pages];
+        }
+    }
 
-    if (env->tlb_flush_addr == (target_ulong)-1) {
-        env->tlb_flush_addr = vaddr & mask;
-        env->tlb_flush_mask = mask;
+    if (tlb->n_large_pages < CPU_TLB_LARGE_PAGES) {
+        lp = &tlb->large_pages[tlb->n_large_pages++];
+        lp->addr = vaddr;
+        lp->mask = mask;
         return;
     }
-    /* Extend the existing region to include the new page.
-       This is a compromise between unnecessary flushes and the cost
-       of maintaining a full variable size TLB.  */
-    mask &= env->tlb_flush_mask;
-    while (((env->tlb_flush_addr ^ vaddr) & mask) != 0) {
-        mask <<= 1;
+
+    /* The set is full: extend the range that needs to grow the least to
+       include the new page.  This is a compromise between unnecessary
+       flushes and the cost of maintaining a full variable size TLB.  */
+    for (i = 0; i < tlb->n_large_pages; i++) {
+        target_ulong m;
+
+        lp = &tlb->large_pages[i];
+        m = lp->mask & mask;
+        while (((lp->addr ^ vaddr) & m) != 0) {
+            m <<= 1;
+        }
+        if (!best || m > best_mask) {
+            best = lp;
+            best_mask = m;
+        }
     }
-    env->tlb_flush_addr &= mask;
-    env->tlb_flush_mask = mask;
+    best->addr &= best_mask;
+    best->mask = best_mask;
 }
 
 /* Add a new TLB entry. At most one entry for a given virtual address
@@ -265,7 +654,7 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
 
     assert(size >= TARGET_PAGE_SIZE);
     if (size != TARGET_PAGE_SIZE) {
-        tlb_add_large_page(env, vaddr, size);
+        tlb_add_large_page(cpu, vaddr, size);
     }
 
     sz = size;
@@ -293,8 +682,13 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr, paddr, xlat,
                                             prot, &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    if (tlb_entry_is_empty(te)) {
+        tlb_desc(env, mmu_idx)->n_used_entries++;
+    }
+#endif
 
     /* do not discard the translation in te, evict it into a victim tlb */
     env->tlb_v_table[mmu_idx][vidx] = *te;
@@ -343,11 +737,13 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     MemoryRegion *mr;
     CPUState *cpu = ENV_GET_CPU(env1);
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         cpu_ldub_code(env1, addr);
+        /* the fill may have flushed and resized the TLB */
+        page_index = tlb_index(env1, mmu_idx, addr);
     }
     pd = env1->iotlb[mmu_idx][page_index] & ~TARGET_PAGE_MASK;
     mr = iotlb_to_region(cpu, pd);
@@ -548,6 +548,7 @@ void cpu_exec_init(CPUArchState *env)
 #ifndef CONFIG_USER_ONLY
     cpu->as = &address_space_memory;
     cpu->thread_id = qemu_get_thread_id();
+    tlb_init(cpu);
 #endif
     QTAILQ_INSERT_TAIL(&cpus, cpu, node);
 #if defined(CONFIG_USER_ONLY)
@@ -567,6 +568,15 @@ void cpu_exec_init(CPUArchState *env)
     }
 }
 
+void cpu_exec_finalize(CPUState *cpu)
+{
+#ifndef CONFIG_USER_ONLY
+    if (cpu->tlb) {
+        tlb_destroy(cpu);
+    }
+#endif
+}
+
 #if defined(CONFIG_USER_ONLY)
 static void breakpoint_invalidate(CPUState *cpu, target_ulong pc)
 {
@@ -866,16 +876,42 @@ static void tlb_reset_dirty_range_all(ram_addr_t start, ram_addr_t length)
 }
 
 /* Note: start and end must be within the same ram block.  */
-void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t length,
-                                     unsigned client)
+bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
+                                              ram_addr_t length,
+                                              unsigned client)
 {
-    if (length == 0)
-        return;
-    cpu_physical_memory_clear_dirty_range_type(start, length, client);
+    DirtyMemoryBlocks *blocks;
+    unsigned long end, page;
+    bool dirty = false;
 
-    if (tcg_enabled()) {
+    if (length == 0) {
+        return false;
+    }
+
+    end = TARGET_PAGE_ALIGN(start + length) >> TARGET_PAGE_BITS;
+    page = start >> TARGET_PAGE_BITS;
+
+    rcu_read_lock();
+
+    blocks = atomic_rcu_read(&ram_list.dirty_memory[client]);
+
+    while (page < end) {
+        unsigned long idx = page / DIRTY_MEMORY_BLOCK_SIZE;
+        unsigned long offset = page % DIRTY_MEMORY_BLOCK_SIZE;
+        unsigned long num = MIN(end - page, DIRTY_MEMORY_BLOCK_SIZE - offset);
+
+        dirty |= bitmap_test_and_clear_atomic(blocks->blocks[idx],
+                                              offset, num);
+        page += num;
+    }
+
+    rcu_read_unlock();
+
+    if (dirty && tcg_enabled()) {
         tlb_reset_dirty_range_all(start, length);
     }
+
+    return dirty;
 }
 
 static void cpu_physical_memory_set_dirty_tracking(bool enable)
@@ -1180,7 +1216,7 @@ static void *file_ram_alloc(RAMBlock *block,
     }
 
     if (mem_prealloc) {
-        os_mem_prealloc(fd, area, memory);
+        os_mem_prealloc(fd, area, memory, smp_cpus);
     }
 
     block->fd = fd;
@@ -1379,15 +1415,55 @@ int qemu_ram_resize(ram_addr_t base, ram_addr_t newsize, Error **errp)
     return 0;
 }
 
+/* Called with ram_list.mutex held */
+static void dirty_memory_extend(ram_addr_t old_ram_size,
+                                ram_addr_t new_ram_size)
+{
+    ram_addr_t old_num_blocks = DIV_ROUND_UP(old_ram_size,
+                                             DIRTY_MEMORY_BLOCK_SIZE);
+    ram_addr_t new_num_blocks = DIV_ROUND_UP(new_ram_size,
+                                             DIRTY_MEMORY_BLOCK_SIZE);
+    int i;
+
+    /* Only need to extend if block count increased */
+    if (new_num_blocks <= old_num_blocks) {
+        return;
+    }
+
+    for (i = 0; i < DIRTY_MEMORY_NUM; i++) {
+        DirtyMemoryBlocks *old_blocks;
+        DirtyMemoryBlocks *new_blocks;
+        int j;
+
+        old_blocks = atomic_rcu_read(&ram_list.dirty_memory[i]);
+        new_blocks = g_malloc(sizeof(*new_blocks) +
+                              sizeof(new_blocks->blocks[0]) * new_num_blocks);
+
+        if (old_num_blocks) {
+            memcpy(new_blocks->blocks, old_blocks->blocks,
+                   old_num_blocks * sizeof(old_blocks->blocks[0]));
+        }
+
+        for (j = old_num_blocks; j < new_num_blocks; j++) {
+            new_blocks->blocks[j] = bitmap_new(DIRTY_MEMORY_BLOCK_SIZE);
+        }
+
+        atomic_rcu_set(&ram_list.dirty_memory[i], new_blocks);
+
+        if (old_blocks) {
+            g_free_rcu(old_blocks, rcu);
+        }
+    }
+}
+
 static ram_addr_t ram_block_add(RAMBlock *new_block, Error **errp)
 {
     RAMBlock *block;
     RAMBlock *last_block = NULL;
     ram_addr_t old_ram_size, new_ram_size;
 
-    old_ram_size = last_ram_offset() >> TARGET_PAGE_BITS;
-
     qemu_mutex_lock_ramlist();
+    old_ram_size = last_ram_offset() >> TARGET_PAGE_BITS;
     new_block->offset = find_ram_offset(new_block->max_length);
 
     if (!new_block->host) {
@@ -1408,6 +1484,12 @@ static ram_addr_t ram_block_add(RAMBlock *new_block, Error **errp)
         }
     }
 
+    /* Grow the dirty bitmaps before the block becomes visible */
+    new_ram_size = MAX(old_ram_size,
+                       (new_block->offset + new_block->max_length) >>
+                       TARGET_PAGE_BITS);
+    dirty_memory_extend(old_ram_size, new_ram_size);
+
     /* Keep the list sorted from biggest to smallest block.  Unlike QTAILQ,
      * QLIST (which has an RCU-friendly variant) does not have insertion at
      * tail, so save the last element in last_block.
@@ -1432,18 +1514,6 @@ static ram_addr_t ram_block_add(RAMBlock *new_block, Error **errp)
     ram_list.version++;
     qemu_mutex_unlock_ramlist();
 
-    new_ram_size = last_ram_offset() >> TARGET_PAGE_BITS;
-
-    if (new_ram_size > old_ram_size) {
-        int i;
-
-        /* ram_list.dirty_memory[] is protected by the iothread lock.  */
-        for (i = 0; i < DIRTY_MEMORY_NUM; i++) {
-            ram_list.dirty_memory[i] =
-                bitmap_zero_extend(ram_list.dirty_memory[i],
-                                   old_ram_size, new_ram_size);
-       }
-    }
     cpu_physical_memory_set_dirty_range(new_block->offset,
                                         new_block->used_length);
 
@@ -1819,7 +1889,12 @@ static void notdirty_mem_write(void *opaque, hwaddr ram_addr,
                                uint64_t val, unsigned size)
 {
     if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
+        bool locked = tb_lock_recursive();
+
         tb_invalidate_phys_page_fast(ram_addr, size);
+        if (locked) {
+            tb_unlock();
+        }
     }
     switch (size) {
     case 1:
@@ -2081,6 +2156,19 @@ MemoryRegion *iotlb_to_region(CPUState *cpu, hwaddr index)
     return sections[index & ~TARGET_PAGE_MASK].mr;
 }
 
+/* The physical address of an access at @mr_offset into the region of the
+ * iotlb entry @index.  For regions behind an IOMMU this is the address in
+ * the translated address space.
+ */
+hwaddr iotlb_to_phys(CPUState *cpu, hwaddr index, hwaddr mr_offset)
+{
+    AddressSpaceDispatch *d = atomic_rcu_read(&cpu->memory_dispatch);
+    MemoryRegionSection *section = &d->map.sections[index & ~TARGET_PAGE_MASK];
+
+    return section->offset_within_address_space
+           + (mr_offset - section->offset_within_region);
+}
+
 static void io_mem_init(void)
 {
     memory_region_init_io(&io_mem_rom, NULL, &unassigned_mem_ops, NULL, NULL, UINT64_MAX);
@@ -2130,6 +2218,15 @@ static void mem_commit(MemoryListener *listener)
     if (cur) {
         call_rcu(cur, address_space_dispatch_free, rcu);
     }
+
+    /* Make MemoryRegionCaches for this address space translate again.  */
+    smp_wmb();
+    atomic_inc(&as->cache_generation);
+}
+
+static void tcg_commit_cpu(void *opaque)
+{
+    cpu_reload_memory_map(opaque);
 }
 
 static void tcg_commit(MemoryListener *listener)
@@ -2145,7 +2242,14 @@ static void tcg_commit(MemoryListener *listener)
         if (cpu->tcg_as_listener != listener) {
             continue;
         }
-        cpu_reload_memory_map(cpu);
+        if (qemu_tcg_mttcg_enabled()) {
+            /* The vCPU may be running; the old dispatch stays valid until
+             * it leaves its RCU critical section in cpu_exec.
+             */
+            async_run_on_cpu(cpu, tcg_commit_cpu, cpu);
+        } else {
+            cpu_reload_memory_map(cpu);
+        }
     }
 }
 
@@ -2176,6 +2280,14 @@ void address_space_init_dispatch(AddressSpace *as)
         .priority = 0,
     };
     memory_listener_register(&as->dispatch_listener, as);
+
+    /* The listener only runs when the view of the address space changes.
+     * An address space that is empty from the start, e.g. the bus master
+     * space of a PCI device whose Bus Master bit is clear, keeps the view
+     * it was created with; give it an empty dispatch tree right away.
+     */
+    mem_begin(&as->dispatch_listener);
+    mem_commit(&as->dispatch_listener);
 }
 
 void address_space_unregister(AddressSpace *as)
@@ -2267,7 +2379,12 @@ static void invalidate_and_set_dirty(hwaddr addr,
                                      hwaddr length)
 {
     if (cpu_physical_memory_range_includes_clean(addr, length)) {
+        bool locked = tb_lock_recursive();
+
         tb_invalidate_phys_range(addr, addr + length, 0);
+        if (locked) {
+            tb_unlock();
+        }
         cpu_physical_memory_set_dirty_range_nocode(addr, length);
     }
     xen_modified_memory(addr, length);
@@ -2312,6 +2429,10 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
     MemoryRegion *mr;
     bool error = false;
 
+    /* The regions found here are kept alive by RCU, not by the global
+     * mutex, which is not held for regions that do their own locking.
+     */
+    rcu_read_lock();
     while (len > 0) {
         l = len;
         mr = address_space_translate(as, addr, &addr1, &l, is_write);
@@ -2390,6 +2511,7 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
         buf += l;
         addr += l;
     }
+    rcu_read_unlock();
 
     return error;
 }
@@ -2641,6 +2763,70 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
     cpu_notify_map_clients();
 }
 
+void address_space_cache_refresh(MemoryRegionCache *cache)
+{
+    AddressSpaceDispatch *d;
+    MemoryRegionSection *section;
+    MemoryRegion *mr;
+    hwaddr xlat, l = cache->len;
+
+    cache->generation = atomic_read(&cache->as->cache_generation);
+    smp_rmb();
+
+    rcu_read_lock();
+    d = atomic_rcu_read(&cache->as->dispatch);
+    section = address_space_translate_internal(d, cache->addr, &xlat, &l,
+                                               true);
+    mr = section->mr;
+    memory_region_ref(mr);
+    if (cache->mr) {
+        memory_region_unref(cache->mr);
+    }
+    cache->mr = mr;
+    cache->xlat = xlat;
+
+    /* IOMMU translations can change without a topology change, so only
+     * plain RAM is accessed directly; everything else takes the slow path.
+     */
+    if (memory_access_is_direct(mr, cache->is_write) && !xen_enabled()) {
+        cache->ptr = qemu_get_ram_ptr((memory_region_get_ram_addr(mr)
+                                       & TARGET_PAGE_MASK) + xlat);
+        cache->mapped = l;
+    } else {
+        cache->ptr = NULL;
+        cache->mapped = 0;
+    }
+    rcu_read_unlock();
+}
+
+void address_space_cache_init(MemoryRegionCache *cache, AddressSpace *as,
+                              hwaddr addr, hwaddr len, bool is_write)
+{
+    *cache = MEMORY_REGION_CACHE_INVALID;
+    cache->as = as;
+    cache->addr = addr;
+    cache->len = len;
+    cache->is_write = is_write;
+    address_space_cache_refresh(cache);
+}
+
+void address_space_cache_destroy(MemoryRegionCache *cache)
+{
+    if (cache->mr) {
+        memory_region_unref(cache->mr);
+    }
+    *cache = MEMORY_REGION_CACHE_INVALID;
+}
+
+/* Called after a direct store to the cached range */
+void address_space_cache_invalidate(MemoryRegionCache *cache,
+                                    hwaddr addr, hwaddr len)
+{
+    assert(cache->is_write);
+    invalidate_and_set_dirty((memory_region_get_ram_addr(cache->mr)
+                              & TARGET_PAGE_MASK) + cache->xlat + addr, len);
+}
+
 void *cpu_physical_memory_map(hwaddr addr,
                               hwaddr *plen,
                               int is_write)
@@ -2859,8 +3045,13 @@ void stl_phys_notdirty(AddressSpace *as, hwaddr addr, uint32_t val)
 
         if (unlikely(in_migration)) {
             if (cpu_physical_memory_is_clean(addr1)) {
+                bool locked = tb_lock_recursive();
+
                 /* invalidate code */
                 tb_invalidate_phys_page_range(addr1, addr1 + 4, 0);
+                if (locked) {
+                    tb_unlock();
+                }
                 /* set dirty bit */
                 cpu_physical_memory_set_dirty_range_nocode(addr1, 4);
             }
@@ -373,6 +373,38 @@ STEXI
 @findex singlestep
 Run the emulation in single step mode.
 If called with option off, the emulation returns to normal mode.
+ETEXI
+
+    {
+        .name       = "jit_profile",
+        .args_type  = "enable:b",
+        .params     = "on|off",
+        .help       = "count executions of translated blocks",
+        .mhandler.cmd = hmp_jit_profile,
+    },
+
+STEXI
+@item jit_profile on|off
+@findex jit_profile
+Start or stop counting how often each translated block runs and returns
+to the main loop, and how long translation takes.  Switching profiling on
+flushes the translated code.  The results are shown by @code{info jit}.
+ETEXI
+
+    {
+        .name       = "vcpu_stats",
+        .args_type  = "enable:b",
+        .params     = "on|off",
+        .help       = "collect vCPU run loop statistics",
+        .mhandler.cmd = hmp_vcpu_stats,
+    },
+
+STEXI
+@item vcpu_stats on|off
+@findex vcpu_stats
+Start or stop collecting vCPU exit counts, latencies and I/O hot spots.
+Collection is off by default.  The results are shown by
+@code{info vcpu-stats}.
 ETEXI
 
     {
@@ -1698,10 +1730,13 @@ show emulated PCI device info
 show virtual to physical memory mappings (i386, SH4, SPARC, PPC, and Xtensa only)
 @item info mem
 show the active virtual memory mappings (i386 only)
-@item info jit
-show dynamic compiler info
+@item info jit [@var{count}]
+show dynamic compiler info, and the @var{count} (default 10) most
+executed blocks when @code{jit_profile} is on
 @item info numa
-show NUMA information
+show NUMA information, including the host nodes and CPUs each node is
+placed on, the VCPU and I/O threads running there, and a sample of where
+the node's memory resides on the host
 @item info kvm
 show KVM information
 @item info usb
@@ -1726,6 +1761,11 @@ show the current VM name
 show the current VM UUID
 @item info cpustats
 show CPU statistics
+@item info vcpu-stats
+show why and how often each vCPU left guest mode, histograms of the time
+spent running, emulating devices and waiting for the global mutex, and the
+most accessed MMIO and PIO addresses, as collected while @code{vcpu_stats}
+is on
 @item info usernet
 show user network stack connection states
 @item info migrate
@@ -77,6 +77,20 @@ void hmp_info_kvm(Monitor *mon, const QDict *qdict)
     } else {
         monitor_printf(mon, "not compiled\n");
     }
+    if (info->has_msi_routes) {
+        KvmMsiRouteInfo *r = info->msi_routes;
+
+        if (r->direct) {
+            monitor_printf(mon, "MSI injection: direct\n");
+        } else {
+            monitor_printf(mon, "MSI routes: %" PRId64 " cached, %" PRId64
+                           " hits, %" PRId64 " misses, %" PRId64
+                           " evictions\n",
+                           r->routes, r->hits, r->misses, r->evictions);
+        }
+        monitor_printf(mon, "GSI routing table commits: %" PRId64 "\n",
+                       r->commits);
+    }
 
     qapi_free_KvmInfo(info);
 }
@@ -295,6 +309,75 @@ void hmp_info_cpus(Monitor *mon, const QDict *qdict)
     qapi_free_CpuInfoList(cpu_list);
 }
 
+static void hmp_print_vcpu_histogram(Monitor *mon, const char *name,
+                                     VcpuLatencyHistogram *hist)
+{
+    intList *bucket;
+    int i;
+
+    monitor_printf(mon, "  %-10s count=%" PRId64, name, hist->count);
+    if (!hist->count) {
+        monitor_printf(mon, "\n");
+        return;
+    }
+    monitor_printf(mon, " avg=%" PRId64 "ns max=%" PRId64 "ns\n",
+                   hist->total_ns / hist->count, hist->max_ns);
+
+    monitor_printf(mon, "            ");
+    for (bucket = hist->buckets, i = 0; bucket; bucket = bucket->next, i++) {
+        if (!bucket->value) {
+            continue;
+        }
+        if (!bucket->next) {
+            monitor_printf(mon, " >=%" PRIu64 "us:%" PRId64,
+                           (uint64_t)1 << (i - 1), bucket->value);
+        } else {
+            monitor_printf(mon, " <%" PRIu64 "us:%" PRId64,
+                           (uint64_t)1 << i, bucket->value);
+        }
+    }
+    monitor_printf(mon, "\n");
+}
+
+void hmp_info_vcpu_stats(Monitor *mon, const QDict *qdict)
+{
+    VcpuStatsList *stats_list, *stats;
+    VcpuExitCountList *exit;
+    VcpuIoHotspotList *hotspot;
+
+    stats_list = qmp_query_vcpu_stats(NULL);
+
+    for (stats = stats_list; stats; stats = stats->next) {
+        VcpuStats *s = stats->value;
+
+        monitor_printf(mon, "CPU #%" PRId64 ": thread_id=%" PRId64 "\n",
+                       s->cpu_index, s->thread_id);
+
+        monitor_printf(mon, "  exits:    ");
+        for (exit = s->exits; exit; exit = exit->next) {
+            monitor_printf(mon, " %s=%" PRId64,
+                           VcpuExitReason_lookup[exit->value->reason],
+                           exit->value->count);
+        }
+        monitor_printf(mon, "\n");
+
+        hmp_print_vcpu_histogram(mon, "run:", s->run);
+        hmp_print_vcpu_histogram(mon, "emulation:", s->emulation);
+        hmp_print_vcpu_histogram(mon, "bql-wait:", s->bql_wait);
+
+        if (s->hotspots) {
+            monitor_printf(mon, "  hotspots:\n");
+        }
+        for (hotspot = s->hotspots; hotspot; hotspot = hotspot->next) {
+            monitor_printf(mon, "    %s 0x%" PRIx64 ": %" PRId64 "\n",
+                           hotspot->value->pio ? "pio " : "mmio",
+                           hotspot->value->addr, hotspot->value->count);
+        }
+    }
+
+    qapi_free_VcpuStatsList(stats_list);
+}
+
 static void print_block_info(Monitor *mon, BlockInfo *info,
                              BlockDeviceInfo *inserted, bool verbose)
 {
@@ -974,6 +1057,24 @@ void hmp_set_link(Monitor *mon, const QDict *qdict)
     hmp_handle_error(mon, &err);
 }
 
+void hmp_jit_profile(Monitor *mon, const QDict *qdict)
+{
+    bool enable = qdict_get_bool(qdict, "enable");
+    Error *err = NULL;
+
+    qmp_jit_profile(enable, &err);
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_vcpu_stats(Monitor *mon, const QDict *qdict)
+{
+    bool enable = qdict_get_bool(qdict, "enable");
+    Error *err = NULL;
+
+    qmp_vcpu_stats(enable, &err);
+    hmp_handle_error(mon, &err);
+}
+
 void hmp_block_passwd(Monitor *mon, const QDict *qdict)
 {
     const char *device = qdict_get_str(qdict, "device");
@@ -1803,6 +1904,14 @@ void hmp_info_memdev(Monitor *mon, const QDict *qdict)
                        HostMemPolicy_lookup[m->value->policy]);
         str = string_output_get_string(ov);
         monitor_printf(mon, "  host nodes: %s\n", str);
+        monitor_printf(mon, "  thp: %s\n",
+                       m->value->thp ? "true" : "false");
+        monitor_printf(mon, "  prealloc threads: %" PRId64 "\n",
+                       m->value->prealloc_threads);
+        if (m->value->has_prealloc_time) {
+            monitor_printf(mon, "  prealloc time: %" PRId64 " ms\n",
+                           m->value->prealloc_time);
+        }
 
         g_free(str);
         string_output_visitor_cleanup(ov);
@@ -25,6 +25,7 @@
 #include "block/aio.h"
 #include "hw/virtio/virtio-bus.h"
 #include "qom/object_interfaces.h"
+#include "sysemu/numa.h"
 
 struct VirtIOBlockDataPlane {
     bool started;
@@ -138,6 +139,23 @@ static void handle_notify(EventNotifier *e)
     blk_io_unplug(s->conf->conf.blk);
 }
 
+/* Busy poll the vring so that requests submitted while the IOThread is
+ * polling are picked up without waiting for the guest's kick.
+ */
+static bool handle_notify_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    VirtIOBlockDataPlane *s = container_of(e, VirtIOBlockDataPlane,
+                                           host_notifier);
+
+    if (!vring_more_avail(s->vdev, &s->vring)) {
+        return false;
+    }
+
+    handle_notify(e);
+    return true;
+}
+
 /* Context: QEMU global mutex held */
 void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
                                   VirtIOBlockDataPlane **dataplane,
@@ -253,6 +271,11 @@ void virtio_blk_data_plane_start(VirtIOBlockDataPlane *s)
         goto fail_vring;
     }
 
+    /* Run next to the memory that the guest driver allocated the ring in */
+    iothread_place_near(s->iothread,
+                        numa_get_node_for_addr(
+                            virtio_queue_get_desc_addr(s->vdev, 0)));
+
     /* Set up guest notifier (irq) */
     r = k->set_guest_notifiers(qbus->parent, 1, true);
     if (r != 0) {
@@ -285,6 +308,7 @@ void virtio_blk_data_plane_start(VirtIOBlockDataPlane *s)
     /* Get this show started by hooking up our callbacks */
     aio_context_acquire(s->ctx);
     aio_set_event_notifier(s->ctx, &s->host_notifier, handle_notify);
+    aio_set_event_notifier_poll(s->ctx, &s->host_notifier, handle_notify_poll);
     aio_context_release(s->ctx);
     return;
 
@@ -31,6 +31,22 @@ static void machine_set_accel(Object *obj, const char *value, Error **errp)
     ms->accel = g_strdup(value);
 }
 
+static char *machine_get_tcg_thread(Object *obj, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    return g_strdup(ms->tcg_thread);
+}
+
+static void machine_set_tcg_thread(Object *obj, const char *value,
+                                   Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    g_free(ms->tcg_thread);
+    ms->tcg_thread = g_strdup(value);
+}
+
 static bool machine_get_kernel_irqchip(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -147,6 +163,33 @@ static void machine_set_dumpdtb(Object *obj, const char *value, Error **errp)
     ms->dumpdtb = g_strdup(value);
 }
 
+static void machine_get_tlb_max_bits(Object *obj, Visitor *v,
+                                     void *opaque, const char *name,
+                                     Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    int64_t value = ms->tlb_max_bits;
+
+    visit_type_int(v, &value, name, errp);
+}
+
+static void machine_set_tlb_max_bits(Object *obj, Visitor *v,
+                                     void *opaque, const char *name,
+                                     Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    Error *error = NULL;
+    int64_t value;
+
+    visit_type_int(v, &value, name, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+
+    ms->tlb_max_bits = value;
+}
+
 static void machine_get_phandle_start(Object *obj, Visitor *v,
                                        void *opaque, const char *name,
                                        Error **errp)
@@ -294,6 +337,19 @@ static void machine_initfn(Object *obj)
     object_property_set_description(obj, "accel",
                                     "Accelerator list",
                                     NULL);
+    object_property_add_str(obj, "tcg-thread",
+                            machine_get_tcg_thread, machine_set_tcg_thread,
+                            NULL);
+    object_property_set_description(obj, "tcg-thread",
+                                    "TCG vCPU threading (single or multi)",
+                                    NULL);
+    object_property_add(obj, "tlb-max-bits", "int",
+                        machine_get_tlb_max_bits,
+                        machine_set_tlb_max_bits,
+                        NULL, NULL, NULL);
+    object_property_set_description(obj, "tlb-max-bits",
+                                    "log2 of the maximum TCG TLB size per MMU mode",
+                                    NULL);
     object_property_add_bool(obj, "kernel-irqchip",
                              machine_get_kernel_irqchip,
                              machine_set_kernel_irqchip,
@@ -389,6 +445,7 @@ static void machine_finalize(Object *obj)
     MachineState *ms = MACHINE(obj);
 
     g_free(ms->accel);
+    g_free(ms->tcg_thread);
     g_free(ms->kernel_filename);
     g_free(ms->initrd_filename);
     g_free(ms->kernel_cmdline);
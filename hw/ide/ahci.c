@@ -178,20 +178,11 @@ static void ahci_trigger_irq(AHCIState *s, AHCIDevice *d,
     ahci_check_irq(s);
 }
 
-static void map_page(AddressSpace *as, uint8_t **ptr, uint64_t addr,
-                     uint32_t wanted)
+static void map_page(AddressSpace *as, MemoryRegionCache *cache,
+                     uint64_t addr, uint32_t wanted)
 {
-    hwaddr len = wanted;
-
-    if (*ptr) {
-        dma_memory_unmap(as, *ptr, len, DMA_DIRECTION_FROM_DEVICE, len);
-    }
-
-    *ptr = dma_memory_map(as, addr, &len, DMA_DIRECTION_FROM_DEVICE);
-    if (len < wanted) {
-        dma_memory_unmap(as, *ptr, len, DMA_DIRECTION_FROM_DEVICE, len);
-        *ptr = NULL;
-    }
+    address_space_cache_destroy(cache);
+    address_space_cache_init(cache, as, addr, wanted, true);
 }
 
 static void  ahci_port_write(AHCIState *s, int port, int offset, uint32_t val)
@@ -204,13 +195,11 @@ static void  ahci_port_write(AHCIState *s, int port, int offset, uint32_t val)
             pr->lst_addr = val;
             map_page(s->as, &s->dev[port].lst,
                      ((uint64_t)pr->lst_addr_hi << 32) | pr->lst_addr, 1024);
-            s->dev[port].cur_cmd = NULL;
             break;
         case PORT_LST_ADDR_HI:
             pr->lst_addr_hi = val;
             map_page(s->as, &s->dev[port].lst,
                      ((uint64_t)pr->lst_addr_hi << 32) | pr->lst_addr, 1024);
-            s->dev[port].cur_cmd = NULL;
             break;
         case PORT_FIS_ADDR:
             pr->fis_addr = val;
@@ -570,24 +559,25 @@ static void ahci_write_fis_sdb(AHCIState *s, int port, uint32_t finished)
     AHCIDevice *ad = &s->dev[port];
     AHCIPortRegs *pr = &ad->port_regs;
     IDEState *ide_state;
-    SDBFIS *sdb_fis;
+    SDBFIS sdb_fis;
 
-    if (!s->dev[port].res_fis ||
+    if (!address_space_cache_valid(&s->dev[port].res_fis) ||
         !(pr->cmd & PORT_CMD_FIS_RX)) {
         return;
     }
 
-    sdb_fis = (SDBFIS *)&ad->res_fis[RES_FIS_SDBFIS];
     ide_state = &ad->port.ifs[0];
 
-    sdb_fis->type = SATA_FIS_TYPE_SDB;
+    sdb_fis.type = SATA_FIS_TYPE_SDB;
     /* Interrupt pending & Notification bit */
-    sdb_fis->flags = (ad->hba->control_regs.irqstatus ? (1 << 6) : 0);
-    sdb_fis->status = ide_state->status & 0x77;
-    sdb_fis->error = ide_state->error;
+    sdb_fis.flags = (ad->hba->control_regs.irqstatus ? (1 << 6) : 0);
+    sdb_fis.status = ide_state->status & 0x77;
+    sdb_fis.error = ide_state->error;
     /* update SAct field in SDB_FIS */
     s->dev[port].finished |= finished;
-    sdb_fis->payload = cpu_to_le32(ad->finished);
+    sdb_fis.payload = cpu_to_le32(ad->finished);
+    address_space_write_cached(&ad->res_fis, RES_FIS_SDBFIS,
+                               &sdb_fis, sizeof(sdb_fis));
 
     /* Update shadow registers (except BSY 0x80 and DRQ 0x08) */
     pr->tfdata = (ad->port.ifs[0].error << 8) |
@@ -600,17 +590,18 @@ static void ahci_write_fis_sdb(AHCIState *s, int port, uint32_t finished)
 static void ahci_write_fis_pio(AHCIDevice *ad, uint16_t len)
 {
     AHCIPortRegs *pr = &ad->port_regs;
-    uint8_t *pio_fis, *cmd_fis;
+    uint8_t pio_fis[20], *cmd_fis;
     uint64_t tbl_addr;
     dma_addr_t cmd_len = 0x80;
     IDEState *s = &ad->port.ifs[0];
 
-    if (!ad->res_fis || !(pr->cmd & PORT_CMD_FIS_RX)) {
+    if (!address_space_cache_valid(&ad->res_fis) ||
+        !(pr->cmd & PORT_CMD_FIS_RX)) {
         return;
     }
 
     /* map cmd_fis */
-    tbl_addr = le64_to_cpu(ad->cur_cmd->tbl_addr);
+    tbl_addr = le64_to_cpu(ad->cur_cmd.tbl_addr);
     cmd_fis = dma_memory_map(ad->hba->as, tbl_addr, &cmd_len,
                              DMA_DIRECTION_TO_DEVICE);
 
@@ -629,8 +620,6 @@ static void ahci_write_fis_pio(AHCIDevice *ad, uint16_t len)
         return;
     }
 
-    pio_fis = &ad->res_fis[RES_FIS_PSFIS];
-
     pio_fis[0] = SATA_FIS_TYPE_PIO_SETUP;
     pio_fis[1] = (ad->hba->control_regs.irqstatus ? (1 << 6) : 0);
     pio_fis[2] = s->status;
@@ -652,6 +641,8 @@ static void ahci_write_fis_pio(AHCIDevice *ad, uint16_t len)
     pio_fis[17] = len >> 8;
     pio_fis[18] = 0;
     pio_fis[19] = 0;
+    address_space_write_cached(&ad->res_fis, RES_FIS_PSFIS,
+                               pio_fis, sizeof(pio_fis));
 
     /* Update shadow registers: */
     pr->tfdata = (ad->port.ifs[0].error << 8) |
@@ -670,26 +661,25 @@ static void ahci_write_fis_pio(AHCIDevice *ad, uint16_t len)
 static void ahci_write_fis_d2h(AHCIDevice *ad, uint8_t *cmd_fis)
 {
     AHCIPortRegs *pr = &ad->port_regs;
-    uint8_t *d2h_fis;
+    uint8_t d2h_fis[20];
     int i;
     dma_addr_t cmd_len = 0x80;
     int cmd_mapped = 0;
     IDEState *s = &ad->port.ifs[0];
 
-    if (!ad->res_fis || !(pr->cmd & PORT_CMD_FIS_RX)) {
+    if (!address_space_cache_valid(&ad->res_fis) ||
+        !(pr->cmd & PORT_CMD_FIS_RX)) {
         return;
     }
 
     if (!cmd_fis) {
         /* map cmd_fis */
-        uint64_t tbl_addr = le64_to_cpu(ad->cur_cmd->tbl_addr);
+        uint64_t tbl_addr = le64_to_cpu(ad->cur_cmd.tbl_addr);
         cmd_fis = dma_memory_map(ad->hba->as, tbl_addr, &cmd_len,
                                  DMA_DIRECTION_TO_DEVICE);
         cmd_mapped = 1;
     }
 
-    d2h_fis = &ad->res_fis[RES_FIS_RFIS];
-
     d2h_fis[0] = SATA_FIS_TYPE_REGISTER_D2H;
     d2h_fis[1] = (ad->hba->control_regs.irqstatus ? (1 << 6) : 0);
     d2h_fis[2] = s->status;
@@ -708,6 +698,8 @@ static void ahci_write_fis_d2h(AHCIDevice *ad, uint8_t *cmd_fis)
     for (i = 14; i < 20; i++) {
         d2h_fis[i] = 0;
     }
+    address_space_write_cached(&ad->res_fis, RES_FIS_RFIS,
+                               d2h_fis, sizeof(d2h_fis));
 
     /* Update shadow registers: */
     pr->tfdata = (ad->port.ifs[0].error << 8) |
@@ -733,7 +725,7 @@ static int prdt_tbl_entry_size(const AHCI_SG *tbl)
 static int ahci_populate_sglist(AHCIDevice *ad, QEMUSGList *sglist,
                                 int32_t offset)
 {
-    AHCICmdHdr *cmd = ad->cur_cmd;
+    AHCICmdHdr *cmd = &ad->cur_cmd;
     uint32_t opts = le32_to_cpu(cmd->opts);
     uint64_t prdt_addr = le64_to_cpu(cmd->tbl_addr) + 0x80;
     int sglist_alloc_hint = opts >> AHCI_CMD_HDR_PRDT_LEN;
@@ -950,7 +942,7 @@ static void handle_reg_h2d_fis(AHCIState *s, int port,
                                int slot, uint8_t *cmd_fis)
 {
     IDEState *ide_state = &s->dev[port].port.ifs[0];
-    AHCICmdHdr *cmd = s->dev[port].cur_cmd;
+    AHCICmdHdr *cmd = &s->dev[port].cur_cmd;
     uint32_t opts = le32_to_cpu(cmd->opts);
 
     if (cmd_fis[1] & 0x0F) {
@@ -1045,13 +1037,15 @@ static int handle_cmd(AHCIState *s, int port, int slot)
         return -1;
     }
 
-    if (!s->dev[port].lst) {
+    if (!address_space_cache_valid(&s->dev[port].lst)) {
         DPRINTF(port, "error: lst not given but cmd handled");
         return -1;
     }
-    cmd = &((AHCICmdHdr *)s->dev[port].lst)[slot];
-    /* remember current slot handle for later */
-    s->dev[port].cur_cmd = cmd;
+    cmd = &s->dev[port].cur_cmd;
+    address_space_read_cached(&s->dev[port].lst, slot * sizeof(AHCICmdHdr),
+                              cmd, sizeof(AHCICmdHdr));
+    /* remember current slot for later */
+    s->dev[port].cur_slot = slot;
 
     /* The device we are working for */
     ide_state = &s->dev[port].port.ifs[0];
@@ -1108,7 +1102,7 @@ static void ahci_start_transfer(IDEDMA *dma)
     IDEState *s = &ad->port.ifs[0];
     uint32_t size = (uint32_t)(s->data_end - s->data_ptr);
     /* write == ram -> device */
-    uint32_t opts = le32_to_cpu(ad->cur_cmd->opts);
+    uint32_t opts = le32_to_cpu(ad->cur_cmd.opts);
     int is_write = opts & AHCI_CMD_WRITE;
     int is_atapi = opts & AHCI_CMD_ATAPI;
     int has_sglist = 0;
@@ -1147,7 +1141,7 @@ out:
 
     if (!(s->status & DRQ_STAT)) {
         /* done with PIO send/receive */
-        ahci_write_fis_pio(ad, le32_to_cpu(ad->cur_cmd->status));
+        ahci_write_fis_pio(ad, le32_to_cpu(ad->cur_cmd.status));
     }
 }
 
@@ -1192,8 +1186,11 @@ static void ahci_commit_buf(IDEDMA *dma, uint32_t tx_bytes)
     AHCIDevice *ad = DO_UPCAST(AHCIDevice, dma, dma);
     IDEState *s = &ad->port.ifs[0];
 
-    tx_bytes += le32_to_cpu(ad->cur_cmd->status);
-    ad->cur_cmd->status = cpu_to_le32(tx_bytes);
+    tx_bytes += le32_to_cpu(ad->cur_cmd.status);
+    ad->cur_cmd.status = cpu_to_le32(tx_bytes);
+    address_space_stl_le_cached(&ad->lst,
+                                ad->cur_slot * sizeof(AHCICmdHdr) +
+                                offsetof(AHCICmdHdr, status), tx_bytes);
 
     qemu_sglist_destroy(&s->sg);
 }
@@ -1299,6 +1296,12 @@ void ahci_init(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
 
 void ahci_uninit(AHCIState *s)
 {
+    int i;
+
+    for (i = 0; i < s->ports; i++) {
+        address_space_cache_destroy(&s->dev[i].lst);
+        address_space_cache_destroy(&s->dev[i].res_fis);
+    }
     g_free(s->dev);
 }
 
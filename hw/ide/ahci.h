@@ -266,12 +266,14 @@ struct AHCIDevice {
     AHCIPortRegs port_regs;
     struct AHCIState *hba;
     QEMUBH *check_bh;
-    uint8_t *lst;
-    uint8_t *res_fis;
+    MemoryRegionCache lst;
+    MemoryRegionCache res_fis;
     bool done_atapi_packet;
     int32_t busy_slot;
     bool init_d2h_sent;
-    AHCICmdHdr *cur_cmd;
+    /* Copy of the command header being processed, and its slot */
+    AHCICmdHdr cur_cmd;
+    int cur_slot;
     NCQTransferState ncq_tfs[AHCI_MAX_CMDS];
 };
 
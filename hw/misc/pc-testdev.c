@@ -176,6 +176,8 @@ static void testdev_realizefn(DeviceState *d, Error **errp)
                           "pc-testdev-irq-line", 24);
     memory_region_init_io(&dev->iomem, OBJECT(dev), &test_iomem_ops, dev,
                           "pc-testdev-iomem", IOMEM_LEN);
+    /* iomem only touches iomem_buf, which behaves like RAM under races */
+    memory_region_clear_global_locking(&dev->iomem);
 
     memory_region_add_subregion(io,  0xe0,       &dev->ioport);
     memory_region_add_subregion(io,  0xe4,       &dev->flush);
@@ -85,6 +85,9 @@ typedef struct E1000State_st {
     NICConf conf;
     MemoryRegion mmio;
     MemoryRegion io;
+    /* Cached translations of the descriptor rings */
+    MemoryRegionCache tx_ring;
+    MemoryRegionCache rx_ring;
 
     uint32_t mac_reg[0x8000];
     uint16_t phy_reg[0x20];
@@ -416,6 +419,8 @@ static void e1000_reset(void *opaque)
     d->phy_reg[PHY_ID2] = edc->phy_id2;
     memset(d->mac_reg, 0, sizeof d->mac_reg);
     memmove(d->mac_reg, mac_reg_init, sizeof mac_reg_init);
+    address_space_cache_destroy(&d->tx_ring);
+    address_space_cache_destroy(&d->rx_ring);
     d->rxbuf_min_shift = 1;
     memset(&d->tx, 0, sizeof d->tx);
 
@@ -759,20 +764,33 @@ process_tx_desc(E1000State *s, struct e1000_tx_desc *dp)
     tp->cptse = 0;
 }
 
-static uint32_t
-txdesc_writeback(E1000State *s, dma_addr_t base, struct e1000_tx_desc *dp)
+/*
+ * The descriptor rings are accessed through a cache of their translation.
+ * It spans every descriptor that the 16-bit head registers can index, so
+ * it only needs to be rebuilt when the guest moves the ring.
+ */
+#define E1000_RING_CACHE_SIZE   (0x10000 * sizeof(struct e1000_tx_desc))
+
+static void
+e1000_ring_rw(E1000State *s, MemoryRegionCache *ring, uint64_t base,
+              dma_addr_t offset, void *buf, dma_addr_t len, DMADirection dir)
 {
     PCIDevice *d = PCI_DEVICE(s);
-    uint32_t txd_upper, txd_lower = le32_to_cpu(dp->lower.data);
 
-    if (!(txd_lower & (E1000_TXD_CMD_RS|E1000_TXD_CMD_RPS)))
-        return 0;
-    txd_upper = (le32_to_cpu(dp->upper.data) | E1000_TXD_STAT_DD) &
-                ~(E1000_TXD_STAT_EC | E1000_TXD_STAT_LC | E1000_TXD_STAT_TU);
-    dp->upper.data = cpu_to_le32(txd_upper);
-    pci_dma_write(d, base + ((char *)&dp->upper - (char *)dp),
-                  &dp->upper, sizeof(dp->upper));
-    return E1000_ICR_TXDW;
+    if (offset + len > E1000_RING_CACHE_SIZE) {
+        pci_dma_rw(d, base + offset, buf, len, dir);
+        return;
+    }
+    if (!address_space_cache_valid(ring)) {
+        address_space_cache_init(ring, pci_get_address_space(d), base,
+                                 E1000_RING_CACHE_SIZE, true);
+    }
+    dma_barrier(pci_get_address_space(d), dir);
+    if (dir == DMA_DIRECTION_FROM_DEVICE) {
+        address_space_write_cached(ring, offset, buf, len);
+    } else {
+        address_space_read_cached(ring, offset, buf, len);
+    }
 }
 
 static uint64_t tx_desc_base(E1000State *s)
@@ -783,11 +801,26 @@ static uint64_t tx_desc_base(E1000State *s)
     return (bah << 32) + bal;
 }
 
+static uint32_t
+txdesc_writeback(E1000State *s, dma_addr_t offset, struct e1000_tx_desc *dp)
+{
+    uint32_t txd_upper, txd_lower = le32_to_cpu(dp->lower.data);
+
+    if (!(txd_lower & (E1000_TXD_CMD_RS|E1000_TXD_CMD_RPS)))
+        return 0;
+    txd_upper = (le32_to_cpu(dp->upper.data) | E1000_TXD_STAT_DD) &
+                ~(E1000_TXD_STAT_EC | E1000_TXD_STAT_LC | E1000_TXD_STAT_TU);
+    dp->upper.data = cpu_to_le32(txd_upper);
+    e1000_ring_rw(s, &s->tx_ring, tx_desc_base(s),
+                  offset + ((char *)&dp->upper - (char *)dp),
+                  &dp->upper, sizeof(dp->upper), DMA_DIRECTION_FROM_DEVICE);
+    return E1000_ICR_TXDW;
+}
+
 static void
 start_xmit(E1000State *s)
 {
-    PCIDevice *d = PCI_DEVICE(s);
-    dma_addr_t base;
+    dma_addr_t offset;
     struct e1000_tx_desc desc;
     uint32_t tdh_start = s->mac_reg[TDH], cause = E1000_ICS_TXQE;
 
@@ -797,16 +830,16 @@ start_xmit(E1000State *s)
     }
 
     while (s->mac_reg[TDH] != s->mac_reg[TDT]) {
-        base = tx_desc_base(s) +
-               sizeof(struct e1000_tx_desc) * s->mac_reg[TDH];
-        pci_dma_read(d, base, &desc, sizeof(desc));
+        offset = sizeof(struct e1000_tx_desc) * s->mac_reg[TDH];
+        e1000_ring_rw(s, &s->tx_ring, tx_desc_base(s), offset,
+                      &desc, sizeof(desc), DMA_DIRECTION_TO_DEVICE);
 
         DBGOUT(TX, "index %d: %p : %x %x\n", s->mac_reg[TDH],
                (void *)(intptr_t)desc.buffer_addr, desc.lower.data,
                desc.upper.data);
 
         process_tx_desc(s, &desc);
-        cause |= txdesc_writeback(s, base, &desc);
+        cause |= txdesc_writeback(s, offset, &desc);
 
         if (++s->mac_reg[TDH] * sizeof(desc) >= s->mac_reg[TDLEN])
             s->mac_reg[TDH] = 0;
@@ -943,7 +976,7 @@ e1000_receive_iov(NetClientState *nc, const struct iovec *iov, int iovcnt)
     E1000State *s = qemu_get_nic_opaque(nc);
     PCIDevice *d = PCI_DEVICE(s);
     struct e1000_rx_desc desc;
-    dma_addr_t base;
+    dma_addr_t offset;
     unsigned int n, rdt;
     uint32_t rdh_start;
     uint16_t vlan_special = 0;
@@ -1020,8 +1053,9 @@ e1000_receive_iov(NetClientState *nc, const struct iovec *iov, int iovcnt)
         if (desc_size > s->rxbuf_size) {
             desc_size = s->rxbuf_size;
         }
-        base = rx_desc_base(s) + sizeof(desc) * s->mac_reg[RDH];
-        pci_dma_read(d, base, &desc, sizeof(desc));
+        offset = sizeof(desc) * s->mac_reg[RDH];
+        e1000_ring_rw(s, &s->rx_ring, rx_desc_base(s), offset,
+                      &desc, sizeof(desc), DMA_DIRECTION_TO_DEVICE);
         desc.special = vlan_special;
         desc.status |= (vlan_status | E1000_RXD_STAT_DD);
         if (desc.buffer_addr) {
@@ -1056,7 +1090,8 @@ e1000_receive_iov(NetClientState *nc, const struct iovec *iov, int iovcnt)
         } else { // as per intel docs; skip descriptors with null buf addr
             DBGOUT(RX, "Null RX descriptor!!\n");
         }
-        pci_dma_write(d, base, &desc, sizeof(desc));
+        e1000_ring_rw(s, &s->rx_ring, rx_desc_base(s), offset,
+                      &desc, sizeof(desc), DMA_DIRECTION_FROM_DEVICE);
 
         if (++s->mac_reg[RDH] * sizeof(desc) >= s->mac_reg[RDLEN])
             s->mac_reg[RDH] = 0;
@@ -1173,6 +1208,17 @@ set_dlen(E1000State *s, int index, uint32_t val)
     s->mac_reg[index] = val & 0xfff80;
 }
 
+static void
+set_dba(E1000State *s, int index, uint32_t val)
+{
+    s->mac_reg[index] = val;
+    if (index == TDBAL || index == TDBAH) {
+        address_space_cache_destroy(&s->tx_ring);
+    } else {
+        address_space_cache_destroy(&s->rx_ring);
+    }
+}
+
 static void
 set_tctl(E1000State *s, int index, uint32_t val)
 {
@@ -1226,8 +1272,9 @@ enum { NREADOPS = ARRAY_SIZE(macreg_readops) };
 #define putreg(x)	[x] = mac_writereg
 static void (*macreg_writeops[])(E1000State *, int, uint32_t) = {
     putreg(PBA),	putreg(EERD),	putreg(SWSM),	putreg(WUFC),
-    putreg(TDBAL),	putreg(TDBAH),	putreg(TXDCTL),	putreg(RDBAH),
-    putreg(RDBAL),	putreg(LEDCTL), putreg(VET),
+    putreg(TXDCTL),	putreg(LEDCTL), putreg(VET),
+    [TDBAL] = set_dba,	[TDBAH] = set_dba,	[RDBAL] = set_dba,
+    [RDBAH] = set_dba,
     [TDLEN] = set_dlen,	[RDLEN] = set_dlen,	[TCTL] = set_tctl,
     [TDT] = set_tctl,	[MDIC] = set_mdic,	[ICS] = set_ics,
     [TDH] = set_16bit,	[RDH] = set_16bit,	[RDT] = set_rdt,
@@ -1343,6 +1390,8 @@ static int e1000_post_load(void *opaque, int version_id)
     }
     s->mit_ide = 0;
     s->mit_timer_on = false;
+    address_space_cache_destroy(&s->tx_ring);
+    address_space_cache_destroy(&s->rx_ring);
 
     /* nc.link_down can't be migrated, so infer link_down according
      * to link status bit in mac_reg[STATUS].
@@ -1511,6 +1560,8 @@ pci_e1000_uninit(PCIDevice *dev)
     timer_free(d->autoneg_timer);
     timer_del(d->mit_timer);
     timer_free(d->mit_timer);
+    address_space_cache_destroy(&d->tx_ring);
+    address_space_cache_destroy(&d->rx_ring);
     qemu_del_nic(d->nic);
 }
 
@@ -157,6 +157,14 @@ struct vhost_net *vhost_net_init(VhostNetOptions *options)
 
     net->dev.nvqs = 2;
     net->dev.vqs = net->vqs;
+    net->dev.vq_index = net->nc->queue_index * net->dev.nvqs;
+    if (options->first_queue) {
+        /* Only the first queue pair asks the backend about the device */
+        net->dev.features = options->first_queue->dev.features;
+        net->dev.protocol_features =
+            options->first_queue->dev.protocol_features;
+        net->dev.max_queues = options->first_queue->dev.max_queues;
+    }
 
     r = vhost_dev_init(&net->dev, options->opaque,
                        options->backend_type, options->force);
@@ -175,6 +183,10 @@ struct vhost_net *vhost_net_init(VhostNetOptions *options)
             vhost_dev_cleanup(&net->dev);
             goto fail;
         }
+    } else {
+        /* Keep the vhost-user protocol extensions once features are set */
+        net->dev.backend_features = net->dev.features &
+                                    (1ULL << VHOST_USER_F_PROTOCOL_FEATURES);
     }
     /* Set sane init value. Override when guest acks. */
     vhost_net_ack_features(net, 0);
@@ -320,6 +332,15 @@ int vhost_net_start(VirtIODevice *dev, NetClientState *ncs,
         if (r < 0) {
             goto err_start;
         }
+
+        if (ncs[i].peer->vring_enable) {
+            /* restore vring enable state */
+            r = vhost_set_vring_enable(ncs[i].peer, ncs[i].peer->vring_enable);
+            if (r < 0) {
+                vhost_net_stop_one(get_vhost_net(ncs[i].peer), dev);
+                goto err_start;
+            }
+        }
     }
 
     return 0;
@@ -363,6 +384,16 @@ void vhost_net_cleanup(struct vhost_net *net)
     g_free(net);
 }
 
+uint64_t vhost_net_get_acked_features(VHostNetState *net)
+{
+    return net->dev.acked_features;
+}
+
+unsigned int vhost_net_get_max_queues(VHostNetState *net)
+{
+    return net->dev.max_queues;
+}
+
 bool vhost_net_virtqueue_pending(VHostNetState *net, int idx)
 {
     return vhost_virtqueue_pending(&net->dev, idx);
@@ -395,6 +426,25 @@ VHostNetState *get_vhost_net(NetClientState *nc)
 
     return vhost_net;
 }
+
+int vhost_set_vring_enable(NetClientState *nc, int enable)
+{
+    VHostNetState *net = get_vhost_net(nc);
+    const VhostOps *vhost_ops;
+
+    nc->vring_enable = enable;
+
+    if (!net) {
+        return 0;
+    }
+
+    vhost_ops = net->dev.vhost_ops;
+    if (vhost_ops->vhost_backend_set_vring_enable) {
+        return vhost_ops->vhost_backend_set_vring_enable(&net->dev, enable);
+    }
+
+    return 0;
+}
 #else
 struct vhost_net *vhost_net_init(VhostNetOptions *options)
 {
@@ -445,4 +495,19 @@ VHostNetState *get_vhost_net(NetClientState *nc)
 {
     return 0;
 }
+
+int vhost_set_vring_enable(NetClientState *nc, int enable)
+{
+    return 0;
+}
+
+uint64_t vhost_net_get_acked_features(VHostNetState *net)
+{
+    return 0;
+}
+
+unsigned int vhost_net_get_max_queues(VHostNetState *net)
+{
+    return 1;
+}
 #endif
@@ -25,6 +25,12 @@
 
 #define VHOST_MEMORY_MAX_NREGIONS    8
 
+#define VHOST_USER_PROTOCOL_F_MQ        0
+#define VHOST_USER_PROTOCOL_F_LOG_SHMFD 1
+#define VHOST_USER_PROTOCOL_FEATURE_MASK \
+    ((1ULL << VHOST_USER_PROTOCOL_F_MQ) | \
+     (1ULL << VHOST_USER_PROTOCOL_F_LOG_SHMFD))
+
 typedef enum VhostUserRequest {
     VHOST_USER_NONE = 0,
     VHOST_USER_GET_FEATURES = 1,
@@ -41,6 +47,10 @@ typedef enum VhostUserRequest {
     VHOST_USER_SET_VRING_KICK = 12,
     VHOST_USER_SET_VRING_CALL = 13,
     VHOST_USER_SET_VRING_ERR = 14,
+    VHOST_USER_GET_PROTOCOL_FEATURES = 15,
+    VHOST_USER_SET_PROTOCOL_FEATURES = 16,
+    VHOST_USER_GET_QUEUE_NUM = 17,
+    VHOST_USER_SET_VRING_ENABLE = 18,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -57,6 +67,11 @@ typedef struct VhostUserMemory {
     VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
 } VhostUserMemory;
 
+typedef struct VhostUserLog {
+    uint64_t mmap_size;
+    uint64_t mmap_offset;
+} VhostUserLog;
+
 typedef struct VhostUserMsg {
     VhostUserRequest request;
 
@@ -71,6 +86,7 @@ typedef struct VhostUserMsg {
         struct vhost_vring_state state;
         struct vhost_vring_addr addr;
         VhostUserMemory memory;
+        VhostUserLog log;
     };
 } QEMU_PACKED VhostUserMsg;
 
@@ -104,7 +120,11 @@ static unsigned long int ioctl_to_vhost_user_request[VHOST_USER_MAX] = {
     VHOST_GET_VRING_BASE,   /* VHOST_USER_GET_VRING_BASE */
     VHOST_SET_VRING_KICK,   /* VHOST_USER_SET_VRING_KICK */
     VHOST_SET_VRING_CALL,   /* VHOST_USER_SET_VRING_CALL */
-    VHOST_SET_VRING_ERR     /* VHOST_USER_SET_VRING_ERR */
+    VHOST_SET_VRING_ERR,    /* VHOST_USER_SET_VRING_ERR */
+    -1,                     /* VHOST_USER_GET_PROTOCOL_FEATURES */
+    -1,                     /* VHOST_USER_SET_PROTOCOL_FEATURES */
+    -1,                     /* VHOST_USER_GET_QUEUE_NUM */
+    -1                      /* VHOST_USER_SET_VRING_ENABLE */
 };
 
 static VhostUserRequest vhost_user_request_translate(unsigned long int request)
@@ -180,6 +200,33 @@ static int vhost_user_write(struct vhost_dev *dev, VhostUserMsg *msg,
             0 : -1;
 }
 
+/* With multiple queue pairs every pair has its own vhost_dev, but they all
+ * share one connection.  Requests that describe the device as a whole are
+ * only sent on behalf of the first pair; the other pairs get the answers
+ * of the first one from vhost_net_init().
+ */
+static bool vhost_user_one_time_request(VhostUserRequest request)
+{
+    switch (request) {
+    case VHOST_USER_GET_FEATURES:
+    case VHOST_USER_SET_OWNER:
+    case VHOST_USER_RESET_OWNER:
+    case VHOST_USER_SET_MEM_TABLE:
+    case VHOST_USER_SET_LOG_BASE:
+    case VHOST_USER_GET_PROTOCOL_FEATURES:
+    case VHOST_USER_SET_PROTOCOL_FEATURES:
+    case VHOST_USER_GET_QUEUE_NUM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool vhost_user_has_protocol_feature(struct vhost_dev *dev, int bit)
+{
+    return dev->protocol_features & (1ULL << bit);
+}
+
 static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
         void *arg)
 {
@@ -194,6 +241,13 @@ static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
 
     msg_request = vhost_user_request_translate(request);
+    if (vhost_user_one_time_request(msg_request) && dev->vq_index != 0) {
+        if (request == VHOST_GET_FEATURES) {
+            *((__u64 *) arg) = dev->features;
+        }
+        return 0;
+    }
+
     msg.request = msg_request;
     msg.flags = VHOST_USER_VERSION;
     msg.size = 0;
@@ -285,13 +339,18 @@ static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
         break;
     }
 
+    /* If the backend has gone away, requests without a reply are dropped:
+     * vhost_dev_start() sends the whole device state again once it
+     * reconnects.  Requests with a reply fail so that the caller does not
+     * use stale data.
+     */
     if (vhost_user_write(dev, &msg, fds, fd_num) < 0) {
-        return 0;
+        return need_reply ? -1 : 0;
     }
 
     if (need_reply) {
         if (vhost_user_read(dev, &msg) < 0) {
-            return 0;
+            return -1;
         }
 
         if (msg_request != msg.request) {
@@ -306,6 +365,13 @@ static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
                 error_report("Received bad msg size.\n");
                 return -1;
             }
+            /* A backend in another process can only write a dirty log
+             * that is passed to it as shared memory.
+             */
+            if (!vhost_user_has_protocol_feature(dev,
+                                             VHOST_USER_PROTOCOL_F_LOG_SHMFD)) {
+                msg.u64 &= ~(1ULL << VHOST_F_LOG_ALL);
+            }
             *((__u64 *) arg) = msg.u64;
             break;
         case VHOST_USER_GET_VRING_BASE:
@@ -325,11 +391,171 @@ static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
     return 0;
 }
 
+static int vhost_user_get_u64(struct vhost_dev *dev, VhostUserRequest request,
+                              uint64_t *u64)
+{
+    VhostUserMsg msg = {
+        .request = request,
+        .flags = VHOST_USER_VERSION,
+    };
+
+    if (vhost_user_write(dev, &msg, NULL, 0) < 0 ||
+        vhost_user_read(dev, &msg) < 0) {
+        return -1;
+    }
+
+    if (msg.request != request) {
+        error_report("Received unexpected msg type. Expected %d received %d",
+                     request, msg.request);
+        return -1;
+    }
+
+    if (msg.size != sizeof(m.u64)) {
+        error_report("Received bad msg size.");
+        return -1;
+    }
+
+    *u64 = msg.u64;
+    return 0;
+}
+
+static int vhost_user_set_u64(struct vhost_dev *dev, VhostUserRequest request,
+                              uint64_t u64)
+{
+    VhostUserMsg msg = {
+        .request = request,
+        .flags = VHOST_USER_VERSION,
+        .u64 = u64,
+        .size = sizeof(m.u64),
+    };
+
+    return vhost_user_write(dev, &msg, NULL, 0);
+}
+
+static int vhost_user_get_vq_index(struct vhost_dev *dev, int idx)
+{
+    assert(idx >= dev->vq_index && idx < dev->vq_index + dev->nvqs);
+
+    /* All queue pairs share the connection, use the device-wide index */
+    return idx;
+}
+
+static int vhost_user_set_vring_enable(struct vhost_dev *dev, int enable)
+{
+    int i;
+
+    if (!(dev->features & (1ULL << VHOST_USER_F_PROTOCOL_FEATURES))) {
+        /* Rings are enabled as soon as they are started */
+        return 0;
+    }
+
+    for (i = 0; i < dev->nvqs; ++i) {
+        VhostUserMsg msg = {
+            .request = VHOST_USER_SET_VRING_ENABLE,
+            .flags = VHOST_USER_VERSION,
+            .state.index = dev->vq_index + i,
+            .state.num = enable,
+            .size = sizeof(m.state),
+        };
+
+        if (vhost_user_write(dev, &msg, NULL, 0) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static bool vhost_user_requires_shm_log(struct vhost_dev *dev)
+{
+    /* Only the first queue pair passes its log to the backend, which
+     * logs the writes of all rings there.
+     */
+    return dev->vq_index == 0 &&
+           vhost_user_has_protocol_feature(dev,
+                                           VHOST_USER_PROTOCOL_F_LOG_SHMFD);
+}
+
+static bool vhost_user_shares_log(struct vhost_dev *dev)
+{
+    return dev->vq_index != 0;
+}
+
+static int vhost_user_set_log_base(struct vhost_dev *dev, uint64_t base,
+                                   int fd, uint64_t size)
+{
+    VhostUserMsg msg = {
+        .request = VHOST_USER_SET_LOG_BASE,
+        .flags = VHOST_USER_VERSION,
+        .log.mmap_size = size,
+        .log.mmap_offset = 0,
+        .size = sizeof(m.log),
+    };
+
+    if (dev->vq_index != 0) {
+        return 0;
+    }
+
+    if (fd < 0) {
+        return vhost_user_call(dev, VHOST_SET_LOG_BASE, &base);
+    }
+
+    /* The old log is freed as soon as we return, so wait until the
+     * backend has switched to the new one.  If the connection is gone
+     * the log is sent again after reconnecting.
+     */
+    if (vhost_user_write(dev, &msg, &fd, 1) < 0 ||
+        vhost_user_read(dev, &msg) < 0) {
+        return 0;
+    }
+
+    if (msg.request != VHOST_USER_SET_LOG_BASE) {
+        error_report("Received unexpected msg type. Expected %d received %d",
+                     VHOST_USER_SET_LOG_BASE, msg.request);
+        return -1;
+    }
+
+    return 0;
+}
+
 static int vhost_user_init(struct vhost_dev *dev, void *opaque)
 {
+    uint64_t features;
+
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
 
     dev->opaque = opaque;
+    if (dev->vq_index != 0) {
+        /* features, protocol_features and max_queues are the first pair's */
+        return 0;
+    }
+    dev->protocol_features = 0;
+    dev->max_queues = 1;
+
+    if (vhost_user_get_u64(dev, VHOST_USER_GET_FEATURES, &features) < 0) {
+        return -1;
+    }
+
+    if (features & (1ULL << VHOST_USER_F_PROTOCOL_FEATURES)) {
+        if (vhost_user_get_u64(dev, VHOST_USER_GET_PROTOCOL_FEATURES,
+                               &features) < 0) {
+            return -1;
+        }
+
+        dev->protocol_features = features & VHOST_USER_PROTOCOL_FEATURE_MASK;
+        if (vhost_user_set_u64(dev, VHOST_USER_SET_PROTOCOL_FEATURES,
+                               dev->protocol_features) < 0) {
+            return -1;
+        }
+
+        if (vhost_user_has_protocol_feature(dev, VHOST_USER_PROTOCOL_F_MQ)) {
+            if (vhost_user_get_u64(dev, VHOST_USER_GET_QUEUE_NUM,
+                                   &features) < 0) {
+                return -1;
+            }
+            dev->max_queues = features;
+        }
+    }
 
     return 0;
 }
@@ -347,5 +573,10 @@ const VhostOps user_ops = {
         .backend_type = VHOST_BACKEND_TYPE_USER,
         .vhost_call = vhost_user_call,
         .vhost_backend_init = vhost_user_init,
-        .vhost_backend_cleanup = vhost_user_cleanup
+        .vhost_backend_cleanup = vhost_user_cleanup,
+        .vhost_backend_get_vq_index = vhost_user_get_vq_index,
+        .vhost_backend_set_vring_enable = vhost_user_set_vring_enable,
+        .vhost_requires_shm_log = vhost_user_requires_shm_log,
+        .vhost_backend_shares_log = vhost_user_shares_log,
+        .vhost_set_log_base = vhost_user_set_log_base,
         };
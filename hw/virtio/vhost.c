@@ -21,6 +21,8 @@
 #include "exec/address-spaces.h"
 #include "hw/virtio/virtio-bus.h"
 #include "migration/migration.h"
+#include "qemu/error-report.h"
+#include <sys/mman.h>
 
 static void vhost_dev_sync_region(struct vhost_dev *dev,
                                   MemoryRegionSection *section,
@@ -74,7 +76,7 @@ static int vhost_sync_dirty_bitmap(struct vhost_dev *dev,
     hwaddr start_addr;
     hwaddr end_addr;
 
-    if (!dev->log_enabled || !dev->started) {
+    if (!dev->log_enabled || !dev->started || !dev->log) {
         return 0;
     }
     start_addr = section->offset_within_address_space;
@@ -281,23 +283,129 @@ static uint64_t vhost_get_log_size(struct vhost_dev *dev)
     return log_size;
 }
 
-static inline void vhost_dev_log_resize(struct vhost_dev* dev, uint64_t size)
+/* Backends living in another process (vhost-user) need the log in shared
+ * memory; its file descriptor is handed over with the log base.
+ */
+static vhost_log_chunk_t *vhost_log_alloc(struct vhost_dev *dev,
+                                          uint64_t size, int *fd)
 {
     vhost_log_chunk_t *log;
-    uint64_t log_base;
+    uint64_t logsize = size * sizeof(*log);
+    char *path;
+
+    *fd = -1;
+    if (!size) {
+        return NULL;
+    }
+    if (!dev->vhost_ops->vhost_requires_shm_log ||
+        !dev->vhost_ops->vhost_requires_shm_log(dev)) {
+        return g_malloc0(logsize);
+    }
+
+    path = g_strdup_printf("%s/qemu-vhost-log-XXXXXX", g_get_tmp_dir());
+    *fd = mkstemp(path);
+    if (*fd < 0) {
+        error_report("vhost: cannot create dirty log file %s: %s",
+                     path, strerror(errno));
+        g_free(path);
+        return NULL;
+    }
+    unlink(path);
+    g_free(path);
+
+    if (ftruncate(*fd, logsize) < 0) {
+        goto fail;
+    }
+    log = mmap(NULL, logsize, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (log == MAP_FAILED) {
+        goto fail;
+    }
+    return log;
+
+fail:
+    error_report("vhost: cannot allocate %" PRIu64 " byte dirty log: %s",
+                 logsize, strerror(errno));
+    close(*fd);
+    *fd = -1;
+    return NULL;
+}
+
+static void vhost_log_unmap(vhost_log_chunk_t *log, int fd, uint64_t size)
+{
+    if (fd >= 0) {
+        munmap(log, size * sizeof(*log));
+        close(fd);
+    } else {
+        g_free(log);
+    }
+}
+
+static void vhost_log_free(struct vhost_dev *dev)
+{
+    vhost_log_unmap(dev->log, dev->log_fd, dev->log_size);
+    dev->log = NULL;
+    dev->log_fd = -1;
+    dev->log_size = 0;
+}
+
+static int vhost_dev_set_log_base(struct vhost_dev *dev,
+                                  vhost_log_chunk_t *log, int fd,
+                                  uint64_t size)
+{
+    uint64_t log_base = (uint64_t)(unsigned long)log;
+
+    if (dev->vhost_ops->vhost_set_log_base) {
+        return dev->vhost_ops->vhost_set_log_base(dev, log_base, fd,
+                                                  size * sizeof(*log));
+    }
+    return dev->vhost_ops->vhost_call(dev, VHOST_SET_LOG_BASE, &log_base);
+}
+
+/* Devices whose backend logs into another device's log have none */
+static bool vhost_dev_has_log(struct vhost_dev *dev)
+{
+    return !dev->vhost_ops->vhost_backend_shares_log ||
+           !dev->vhost_ops->vhost_backend_shares_log(dev);
+}
+
+/* On failure the old log stays in place */
+static int vhost_dev_log_resize(struct vhost_dev *dev, uint64_t size)
+{
+    vhost_log_chunk_t *log;
+    int fd;
     int r;
 
-    log = g_malloc0(size * sizeof *log);
-    log_base = (uint64_t)(unsigned long)log;
-    r = dev->vhost_ops->vhost_call(dev, VHOST_SET_LOG_BASE, &log_base);
-    assert(r >= 0);
+    log = vhost_log_alloc(dev, size, &fd);
+    if (!log && size) {
+        return -ENOMEM;
+    }
+    r = vhost_dev_set_log_base(dev, log, fd, size);
+    if (r < 0) {
+        vhost_log_unmap(log, fd, size);
+        return r;
+    }
     /* Sync only the range covered by the old log */
     if (dev->log_size) {
         vhost_log_sync_range(dev, 0, dev->log_size * VHOST_LOG_CHUNK - 1);
     }
-    g_free(dev->log);
+    vhost_log_free(dev);
     dev->log = log;
+    dev->log_fd = fd;
     dev->log_size = size;
+    return 0;
+}
+
+/* Memory listeners cannot fail, so a dirty log that cannot be set up
+ * fails the migration that asked for it instead of losing dirty pages.
+ */
+static void vhost_log_fail_migration(int r)
+{
+    MigrationState *s = migrate_get_current();
+
+    error_report("vhost: cannot log dirty memory, failing migration");
+    if (s->file) {
+        qemu_file_set_error(s->file, r);
+    }
 }
 
 static int vhost_verify_ring_mappings(struct vhost_dev *dev,
@@ -430,6 +538,8 @@ static void vhost_begin(MemoryListener *listener)
     dev->mem_changed_start_addr = -1;
 }
 
+static int vhost_dev_set_log(struct vhost_dev *dev, bool enable_log);
+
 static void vhost_commit(MemoryListener *listener)
 {
     struct vhost_dev *dev = container_of(listener, struct vhost_dev,
@@ -468,12 +578,21 @@ static void vhost_commit(MemoryListener *listener)
      * to reduce the * number of reallocations. */
 #define VHOST_LOG_BUFFER (0x1000 / sizeof *dev->log)
     /* To log more, must increase log size before table update. */
-    if (dev->log_size < log_size) {
-        vhost_dev_log_resize(dev, log_size + VHOST_LOG_BUFFER);
+    if (vhost_dev_has_log(dev) && dev->log_size < log_size) {
+        r = vhost_dev_log_resize(dev, log_size + VHOST_LOG_BUFFER);
+        if (r < 0) {
+            /* The old log is too small for the new table */
+            vhost_dev_set_log(dev, false);
+            vhost_log_free(dev);
+            dev->log_enabled = false;
+            vhost_log_fail_migration(r);
+        }
     }
     r = dev->vhost_ops->vhost_call(dev, VHOST_SET_MEM_TABLE, dev->mem);
     assert(r >= 0);
-    /* To log less, can only decrease log size after table update. */
+    /* To log less, can only decrease log size after table update.
+     * If that fails the larger log simply stays.
+     */
     if (dev->log_size > log_size + VHOST_LOG_BUFFER) {
         vhost_dev_log_resize(dev, log_size);
     }
@@ -565,7 +684,9 @@ static int vhost_dev_set_log(struct vhost_dev *dev, bool enable_log)
         goto err_features;
     }
     for (i = 0; i < dev->nvqs; ++i) {
-        r = vhost_virtqueue_set_addr(dev, dev->vqs + i, i,
+        int idx = dev->vhost_ops->vhost_backend_get_vq_index(dev,
+                                                             dev->vq_index + i);
+        r = vhost_virtqueue_set_addr(dev, dev->vqs + i, idx,
                                      enable_log);
         if (r < 0) {
             goto err_vq;
@@ -574,7 +695,9 @@ static int vhost_dev_set_log(struct vhost_dev *dev, bool enable_log)
     return 0;
 err_vq:
     for (; i >= 0; --i) {
-        t = vhost_virtqueue_set_addr(dev, dev->vqs + i, i,
+        int idx = dev->vhost_ops->vhost_backend_get_vq_index(dev,
+                                                             dev->vq_index + i);
+        t = vhost_virtqueue_set_addr(dev, dev->vqs + i, idx,
                                      dev->log_enabled);
         assert(t >= 0);
     }
@@ -601,13 +724,17 @@ static int vhost_migration_log(MemoryListener *listener, int enable)
         if (r < 0) {
             return r;
         }
-        g_free(dev->log);
-        dev->log = NULL;
-        dev->log_size = 0;
+        vhost_log_free(dev);
     } else {
-        vhost_dev_log_resize(dev, vhost_get_log_size(dev));
+        if (vhost_dev_has_log(dev)) {
+            r = vhost_dev_log_resize(dev, vhost_get_log_size(dev));
+            if (r < 0) {
+                return r;
+            }
+        }
         r = vhost_dev_set_log(dev, true);
         if (r < 0) {
+            vhost_log_free(dev);
             return r;
         }
     }
@@ -621,7 +748,7 @@ static void vhost_log_global_start(MemoryListener *listener)
 
     r = vhost_migration_log(listener, true);
     if (r < 0) {
-        abort();
+        vhost_log_fail_migration(r);
     }
 }
 
@@ -654,7 +781,7 @@ static int vhost_virtqueue_start(struct vhost_dev *dev,
 {
     hwaddr s, l, a;
     int r;
-    int vhost_vq_index = idx - dev->vq_index;
+    int vhost_vq_index = dev->vhost_ops->vhost_backend_get_vq_index(dev, idx);
     struct vhost_vring_file file = {
         .index = vhost_vq_index
     };
@@ -748,18 +875,23 @@ static void vhost_virtqueue_stop(struct vhost_dev *dev,
                                     unsigned idx)
 {
     struct vhost_vring_state state = {
-        .index = idx - dev->vq_index
+        .index = dev->vhost_ops->vhost_backend_get_vq_index(dev, idx)
     };
     int r;
     assert(idx >= dev->vq_index && idx < dev->vq_index + dev->nvqs);
     r = dev->vhost_ops->vhost_call(dev, VHOST_GET_VRING_BASE, &state);
     if (r < 0) {
-        fprintf(stderr, "vhost VQ %d ring restore failed: %d\n", idx, r);
-        fflush(stderr);
+        /* The backend went away (e.g. a vhost-user switch was restarted).
+         * Everything it consumed has been completed in the used ring, so
+         * resume from there.
+         */
+        error_report("vhost VQ %d ring restore failed: %d, "
+                     "falling back to the used index", idx, r);
+        virtio_queue_restore_last_avail_idx(vdev, idx);
+    } else {
+        virtio_queue_set_last_avail_idx(vdev, idx, state.num);
     }
-    virtio_queue_set_last_avail_idx(vdev, idx, state.num);
     virtio_queue_invalidate_signalled_used(vdev, idx);
-    assert (r >= 0);
     cpu_physical_memory_unmap(vq->ring, virtio_queue_get_ring_size(vdev, idx),
                               0, virtio_queue_get_ring_size(vdev, idx));
     cpu_physical_memory_unmap(vq->used, virtio_queue_get_used_size(vdev, idx),
@@ -786,7 +918,7 @@ static int vhost_virtqueue_init(struct vhost_dev *dev,
                                 struct vhost_virtqueue *vq, int n)
 {
     struct vhost_vring_file file = {
-        .index = n,
+        .index = dev->vhost_ops->vhost_backend_get_vq_index(dev, n),
     };
     int r = event_notifier_init(&vq->masked_notifier, 0);
     if (r < 0) {
@@ -822,8 +954,11 @@ int vhost_dev_init(struct vhost_dev *hdev, void *opaque,
     }
 
     if (hdev->vhost_ops->vhost_backend_init(hdev, opaque) < 0) {
-        close((uintptr_t)opaque);
-        return -errno;
+        r = -errno;
+        if (backend_type == VHOST_BACKEND_TYPE_KERNEL) {
+            close((uintptr_t)opaque);
+        }
+        return r ? r : -EIO;
     }
 
     r = hdev->vhost_ops->vhost_call(hdev, VHOST_SET_OWNER, NULL);
@@ -837,7 +972,7 @@ int vhost_dev_init(struct vhost_dev *hdev, void *opaque,
     }
 
     for (i = 0; i < hdev->nvqs; ++i) {
-        r = vhost_virtqueue_init(hdev, hdev->vqs + i, i);
+        r = vhost_virtqueue_init(hdev, hdev->vqs + i, hdev->vq_index + i);
         if (r < 0) {
             goto fail_vq;
         }
@@ -869,6 +1004,7 @@ int vhost_dev_init(struct vhost_dev *hdev, void *opaque,
     hdev->n_mem_sections = 0;
     hdev->mem_sections = NULL;
     hdev->log = NULL;
+    hdev->log_fd = -1;
     hdev->log_size = 0;
     hdev->log_enabled = false;
     hdev->started = false;
@@ -992,7 +1128,7 @@ void vhost_virtqueue_mask(struct vhost_dev *hdev, VirtIODevice *vdev, int n,
     assert(n >= hdev->vq_index && n < hdev->vq_index + hdev->nvqs);
 
     struct vhost_vring_file file = {
-        .index = index
+        .index = hdev->vhost_ops->vhost_backend_get_vq_index(hdev, n)
     };
     if (mask) {
         file.fd = event_notifier_get_fd(&hdev->vqs[index].masked_notifier);
@@ -1056,11 +1192,15 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
         }
     }
 
-    if (hdev->log_enabled) {
+    if (hdev->log_enabled && vhost_dev_has_log(hdev)) {
         hdev->log_size = vhost_get_log_size(hdev);
-        hdev->log = hdev->log_size ?
-            g_malloc0(hdev->log_size * sizeof *hdev->log) : NULL;
-        r = hdev->vhost_ops->vhost_call(hdev, VHOST_SET_LOG_BASE, hdev->log);
+        hdev->log = vhost_log_alloc(hdev, hdev->log_size, &hdev->log_fd);
+        if (!hdev->log && hdev->log_size) {
+            r = -ENOMEM;
+            goto fail_log;
+        }
+        r = vhost_dev_set_log_base(hdev, hdev->log, hdev->log_fd,
+                                   hdev->log_size);
         if (r < 0) {
             r = -errno;
             goto fail_log;
@@ -1069,6 +1209,7 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
 
     return 0;
 fail_log:
+    vhost_log_free(hdev);
 fail_vq:
     while (--i >= 0) {
         vhost_virtqueue_stop(hdev,
@@ -1098,8 +1239,6 @@ void vhost_dev_stop(struct vhost_dev *hdev, VirtIODevice *vdev)
     vhost_log_sync_range(hdev, 0, ~0x0ull);
 
     hdev->started = false;
-    g_free(hdev->log);
-    hdev->log = NULL;
-    hdev->log_size = 0;
+    vhost_log_free(hdev);
 }
 
@@ -21,6 +21,7 @@
 #include "hw/virtio/virtio-bus.h"
 #include "migration/migration.h"
 #include "hw/virtio/virtio-access.h"
+#include "qapi/qmp/qerror.h"
 
 /*
  * The alignment to use between consumer and producer parts of vring.
@@ -29,6 +30,19 @@
  */
 #define VIRTIO_PCI_VRING_ALIGN         4096
 
+/*
+ * Adaptive interrupt moderation: the completion rate of a queue is
+ * sampled over VIRTIO_IRQ_RATE_WINDOW_NS.  Above VIRTIO_IRQ_RATE_HIGH
+ * completions per second the coalescing delay is doubled (up to the
+ * irq-coalesce-usecs property), below VIRTIO_IRQ_RATE_LOW it is halved
+ * until interrupts are again delivered immediately.
+ */
+#define VIRTIO_IRQ_RATE_WINDOW_NS      (10 * SCALE_MS)
+#define VIRTIO_IRQ_RATE_HIGH           16000
+#define VIRTIO_IRQ_RATE_LOW            4000
+#define VIRTIO_IRQ_USECS_MIN           8
+#define VIRTIO_IRQ_USECS_MAX           1000000
+
 typedef struct VRingDesc
 {
     uint64_t addr;
@@ -70,6 +84,9 @@ struct VirtQueue
 {
     VRing vring;
     hwaddr pa;
+    MemoryRegionCache desc_cache;
+    MemoryRegionCache avail_cache;
+    MemoryRegionCache used_cache;
     uint16_t last_avail_idx;
     /* Last used index value we have signalled on */
     uint16_t signalled_used;
@@ -89,9 +106,50 @@ struct VirtQueue
     VirtIODevice *vdev;
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
+
+    /* Interrupt moderation, only used if irq_timer is non-NULL */
+    QEMUTimer *irq_timer;
+    /* Completions folded into the interrupt scheduled on irq_timer */
+    uint32_t irq_pending;
+    /* Current coalescing delay */
+    uint32_t irq_usecs;
+    int64_t irq_rate_start;
+    uint32_t irq_rate_count;
+
+    uint64_t irq_delivered;
+    uint64_t irq_suppressed;
+    uint64_t irq_coalesced;
 };
 
 /* virt queue functions */
+static void virtqueue_destroy_caches(VirtQueue *vq)
+{
+    address_space_cache_destroy(&vq->desc_cache);
+    address_space_cache_destroy(&vq->avail_cache);
+    address_space_cache_destroy(&vq->used_cache);
+}
+
+/* The rings are accessed through caches of their translation, which must
+ * be rebuilt whenever their address or size changes.  The avail and used
+ * rings are followed by the used_event and avail_event fields.
+ */
+static void virtqueue_update_caches(VirtQueue *vq)
+{
+    unsigned int num = vq->vring.num;
+
+    virtqueue_destroy_caches(vq);
+    address_space_cache_init(&vq->desc_cache, &address_space_memory,
+                             vq->vring.desc, num * sizeof(VRingDesc), false);
+    address_space_cache_init(&vq->avail_cache, &address_space_memory,
+                             vq->vring.avail,
+                             offsetof(VRingAvail, ring[num]) + sizeof(uint16_t),
+                             false);
+    address_space_cache_init(&vq->used_cache, &address_space_memory,
+                             vq->vring.used,
+                             offsetof(VRingUsed, ring[num]) + sizeof(uint16_t),
+                             true);
+}
+
 static void virtqueue_init(VirtQueue *vq)
 {
     hwaddr pa = vq->pa;
@@ -101,58 +159,60 @@ static void virtqueue_init(VirtQueue *vq)
     vq->vring.used = vring_align(vq->vring.avail +
                                  offsetof(VRingAvail, ring[vq->vring.num]),
                                  vq->vring.align);
+    virtqueue_update_caches(vq);
 }
 
-static inline uint64_t vring_desc_addr(VirtIODevice *vdev, hwaddr desc_pa,
-                                       int i)
+static inline uint64_t vring_desc_addr(VirtIODevice *vdev,
+                                       MemoryRegionCache *desc_cache, int i)
 {
     hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, addr);
-    return virtio_ldq_phys(vdev, pa);
+    pa = sizeof(VRingDesc) * i + offsetof(VRingDesc, addr);
+    return virtio_ldq_phys_cached(vdev, desc_cache, pa);
 }
 
-static inline uint32_t vring_desc_len(VirtIODevice *vdev, hwaddr desc_pa, int i)
+static inline uint32_t vring_desc_len(VirtIODevice *vdev,
+                                      MemoryRegionCache *desc_cache, int i)
 {
     hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, len);
-    return virtio_ldl_phys(vdev, pa);
+    pa = sizeof(VRingDesc) * i + offsetof(VRingDesc, len);
+    return virtio_ldl_phys_cached(vdev, desc_cache, pa);
 }
 
-static inline uint16_t vring_desc_flags(VirtIODevice *vdev, hwaddr desc_pa,
-                                        int i)
+static inline uint16_t vring_desc_flags(VirtIODevice *vdev,
+                                        MemoryRegionCache *desc_cache, int i)
 {
     hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, flags);
-    return virtio_lduw_phys(vdev, pa);
+    pa = sizeof(VRingDesc) * i + offsetof(VRingDesc, flags);
+    return virtio_lduw_phys_cached(vdev, desc_cache, pa);
 }
 
-static inline uint16_t vring_desc_next(VirtIODevice *vdev, hwaddr desc_pa,
-                                       int i)
+static inline uint16_t vring_desc_next(VirtIODevice *vdev,
+                                       MemoryRegionCache *desc_cache, int i)
 {
     hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, next);
-    return virtio_lduw_phys(vdev, pa);
+    pa = sizeof(VRingDesc) * i + offsetof(VRingDesc, next);
+    return virtio_lduw_phys_cached(vdev, desc_cache, pa);
 }
 
 static inline uint16_t vring_avail_flags(VirtQueue *vq)
 {
     hwaddr pa;
-    pa = vq->vring.avail + offsetof(VRingAvail, flags);
-    return virtio_lduw_phys(vq->vdev, pa);
+    pa = offsetof(VRingAvail, flags);
+    return virtio_lduw_phys_cached(vq->vdev, &vq->avail_cache, pa);
 }
 
 static inline uint16_t vring_avail_idx(VirtQueue *vq)
 {
     hwaddr pa;
-    pa = vq->vring.avail + offsetof(VRingAvail, idx);
-    return virtio_lduw_phys(vq->vdev, pa);
+    pa = offsetof(VRingAvail, idx);
+    return virtio_lduw_phys_cached(vq->vdev, &vq->avail_cache, pa);
 }
 
 static inline uint16_t vring_avail_ring(VirtQueue *vq, int i)
 {
     hwaddr pa;
-    pa = vq->vring.avail + offsetof(VRingAvail, ring[i]);
-    return virtio_lduw_phys(vq->vdev, pa);
+    pa = offsetof(VRingAvail, ring[i]);
+    return virtio_lduw_phys_cached(vq->vdev, &vq->avail_cache, pa);
 }
 
 static inline uint16_t vring_get_used_event(VirtQueue *vq)
@@ -163,45 +223,49 @@ static inline uint16_t vring_get_used_event(VirtQueue *vq)
 static inline void vring_used_ring_id(VirtQueue *vq, int i, uint32_t val)
 {
     hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, ring[i].id);
-    virtio_stl_phys(vq->vdev, pa, val);
+    pa = offsetof(VRingUsed, ring[i].id);
+    virtio_stl_phys_cached(vq->vdev, &vq->used_cache, pa, val);
 }
 
 static inline void vring_used_ring_len(VirtQueue *vq, int i, uint32_t val)
 {
     hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, ring[i].len);
-    virtio_stl_phys(vq->vdev, pa, val);
+    pa = offsetof(VRingUsed, ring[i].len);
+    virtio_stl_phys_cached(vq->vdev, &vq->used_cache, pa, val);
 }
 
 static uint16_t vring_used_idx(VirtQueue *vq)
 {
     hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, idx);
-    return virtio_lduw_phys(vq->vdev, pa);
+    pa = offsetof(VRingUsed, idx);
+    return virtio_lduw_phys_cached(vq->vdev, &vq->used_cache, pa);
 }
 
 static inline void vring_used_idx_set(VirtQueue *vq, uint16_t val)
 {
     hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, idx);
-    virtio_stw_phys(vq->vdev, pa, val);
+    pa = offsetof(VRingUsed, idx);
+    virtio_stw_phys_cached(vq->vdev, &vq->used_cache, pa, val);
 }
 
 static inline void vring_used_flags_set_bit(VirtQueue *vq, int mask)
 {
     VirtIODevice *vdev = vq->vdev;
     hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, flags);
-    virtio_stw_phys(vdev, pa, virtio_lduw_phys(vdev, pa) | mask);
+    pa = offsetof(VRingUsed, flags);
+    virtio_stw_phys_cached(vdev, &vq->used_cache, pa,
+                           virtio_lduw_phys_cached(vdev, &vq->used_cache,
+                                                   pa) | mask);
 }
 
 static inline void vring_used_flags_unset_bit(VirtQueue *vq, int mask)
 {
     VirtIODevice *vdev = vq->vdev;
     hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, flags);
-    virtio_stw_phys(vdev, pa, virtio_lduw_phys(vdev, pa) & ~mask);
+    pa = offsetof(VRingUsed, flags);
+    virtio_stw_phys_cached(vdev, &vq->used_cache, pa,
+                           virtio_lduw_phys_cached(vdev, &vq->used_cache,
+                                                   pa) & ~mask);
 }
 
 static inline void vring_set_avail_event(VirtQueue *vq, uint16_t val)
@@ -210,8 +274,8 @@ static inline void vring_set_avail_event(VirtQueue *vq, uint16_t val)
     if (!vq->notification) {
         return;
     }
-    pa = vq->vring.used + offsetof(VRingUsed, ring[vq->vring.num]);
-    virtio_stw_phys(vq->vdev, pa, val);
+    pa = offsetof(VRingUsed, ring[vq->vring.num]);
+    virtio_stw_phys_cached(vq->vdev, &vq->used_cache, pa, val);
 }
 
 void virtio_queue_set_notification(VirtQueue *vq, int enable)
@@ -328,18 +392,19 @@ static unsigned int virtqueue_get_head(VirtQueue *vq, unsigned int idx)
     return head;
 }
 
-static unsigned virtqueue_next_desc(VirtIODevice *vdev, hwaddr desc_pa,
+static unsigned virtqueue_next_desc(VirtIODevice *vdev,
+                                    MemoryRegionCache *desc_cache,
                                     unsigned int i, unsigned int max)
 {
     unsigned int next;
 
     /* If this descriptor says it doesn't chain, we're done. */
-    if (!(vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_NEXT)) {
+    if (!(vring_desc_flags(vdev, desc_cache, i) & VRING_DESC_F_NEXT)) {
         return max;
     }
 
     /* Check they're not leading us off end of descriptors. */
-    next = vring_desc_next(vdev, desc_pa, i);
+    next = vring_desc_next(vdev, desc_cache, i);
     /* Make sure compiler knows to grab that: we don't want it changing! */
     smp_wmb();
 
@@ -357,6 +422,7 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 {
     unsigned int idx;
     unsigned int total_bufs, in_total, out_total;
+    MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
 
     idx = vq->last_avail_idx;
 
@@ -364,16 +430,18 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
     while (virtqueue_num_heads(vq, idx)) {
         VirtIODevice *vdev = vq->vdev;
         unsigned int max, num_bufs, indirect = 0;
-        hwaddr desc_pa;
+        MemoryRegionCache *desc_cache;
+        uint32_t desc_len;
         int i;
 
         max = vq->vring.num;
         num_bufs = total_bufs;
         i = virtqueue_get_head(vq, idx++);
-        desc_pa = vq->vring.desc;
+        desc_cache = &vq->desc_cache;
 
-        if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_INDIRECT) {
-            if (vring_desc_len(vdev, desc_pa, i) % sizeof(VRingDesc)) {
+        if (vring_desc_flags(vdev, desc_cache, i) & VRING_DESC_F_INDIRECT) {
+            desc_len = vring_desc_len(vdev, desc_cache, i);
+            if (!desc_len || desc_len % sizeof(VRingDesc)) {
                 error_report("Invalid size for indirect buffer table");
                 exit(1);
             }
@@ -386,8 +454,12 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
             /* loop over the indirect descriptor table */
             indirect = 1;
-            max = vring_desc_len(vdev, desc_pa, i) / sizeof(VRingDesc);
-            desc_pa = vring_desc_addr(vdev, desc_pa, i);
+            max = desc_len / sizeof(VRingDesc);
+            address_space_cache_init(&indirect_desc_cache,
+                                     &address_space_memory,
+                                     vring_desc_addr(vdev, desc_cache, i),
+                                     desc_len, false);
+            desc_cache = &indirect_desc_cache;
             num_bufs = i = 0;
         }
 
@@ -398,22 +470,24 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
                 exit(1);
             }
 
-            if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_WRITE) {
-                in_total += vring_desc_len(vdev, desc_pa, i);
+            if (vring_desc_flags(vdev, desc_cache, i) & VRING_DESC_F_WRITE) {
+                in_total += vring_desc_len(vdev, desc_cache, i);
             } else {
-                out_total += vring_desc_len(vdev, desc_pa, i);
+                out_total += vring_desc_len(vdev, desc_cache, i);
             }
             if (in_total >= max_in_bytes && out_total >= max_out_bytes) {
                 goto done;
             }
-        } while ((i = virtqueue_next_desc(vdev, desc_pa, i, max)) != max);
+        } while ((i = virtqueue_next_desc(vdev, desc_cache, i, max)) != max);
 
         if (!indirect)
             total_bufs = num_bufs;
         else
             total_bufs++;
+        address_space_cache_destroy(&indirect_desc_cache);
     }
 done:
+    address_space_cache_destroy(&indirect_desc_cache);
     if (in_bytes) {
         *in_bytes = in_total;
     }
@@ -456,8 +530,10 @@ void virtqueue_map_sg(struct iovec *sg, hwaddr *addr,
 int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
 {
     unsigned int i, head, max;
-    hwaddr desc_pa = vq->vring.desc;
+    MemoryRegionCache *desc_cache = &vq->desc_cache;
+    MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     VirtIODevice *vdev = vq->vdev;
+    uint32_t desc_len;
 
     if (!virtqueue_num_heads(vq, vq->last_avail_idx))
         return 0;
@@ -472,15 +548,19 @@ int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
-    if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_INDIRECT) {
-        if (vring_desc_len(vdev, desc_pa, i) % sizeof(VRingDesc)) {
+    if (vring_desc_flags(vdev, desc_cache, i) & VRING_DESC_F_INDIRECT) {
+        desc_len = vring_desc_len(vdev, desc_cache, i);
+        if (!desc_len || desc_len % sizeof(VRingDesc)) {
             error_report("Invalid size for indirect buffer table");
             exit(1);
         }
 
         /* loop over the indirect descriptor table */
-        max = vring_desc_len(vdev, desc_pa, i) / sizeof(VRingDesc);
-        desc_pa = vring_desc_addr(vdev, desc_pa, i);
+        max = desc_len / sizeof(VRingDesc);
+        address_space_cache_init(&indirect_desc_cache, &address_space_memory,
+                                 vring_desc_addr(vdev, desc_cache, i),
+                                 desc_len, false);
+        desc_cache = &indirect_desc_cache;
         i = 0;
     }
 
@@ -488,30 +568,33 @@ int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
     do {
         struct iovec *sg;
 
-        if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_WRITE) {
+        if (vring_desc_flags(vdev, desc_cache, i) & VRING_DESC_F_WRITE) {
             if (elem->in_num >= ARRAY_SIZE(elem->in_sg)) {
                 error_report("Too many write descriptors in indirect table");
                 exit(1);
             }
-            elem->in_addr[elem->in_num] = vring_desc_addr(vdev, desc_pa, i);
+            elem->in_addr[elem->in_num] = vring_desc_addr(vdev, desc_cache,
+                                                          i);
             sg = &elem->in_sg[elem->in_num++];
         } else {
             if (elem->out_num >= ARRAY_SIZE(elem->out_sg)) {
                 error_report("Too many read descriptors in indirect table");
                 exit(1);
             }
-            elem->out_addr[elem->out_num] = vring_desc_addr(vdev, desc_pa, i);
+            elem->out_addr[elem->out_num] = vring_desc_addr(vdev, desc_cache,
+                                                            i);
             sg = &elem->out_sg[elem->out_num++];
         }
 
-        sg->iov_len = vring_desc_len(vdev, desc_pa, i);
+        sg->iov_len = vring_desc_len(vdev, desc_cache, i);
 
         /* If we've got too many, that implies a descriptor loop. */
         if ((elem->in_num + elem->out_num) > max) {
             error_report("Looped descriptor");
             exit(1);
         }
-    } while ((i = virtqueue_next_desc(vdev, desc_pa, i, max)) != max);
+    } while ((i = virtqueue_next_desc(vdev, desc_cache, i, max)) != max);
+    address_space_cache_destroy(&indirect_desc_cache);
 
     /* Now map what we have collected */
     virtqueue_map_sg(elem->in_sg, elem->in_addr, elem->in_num, 1);
@@ -603,11 +686,16 @@ void virtio_reset(void *opaque)
         vdev->vq[i].vring.desc = 0;
         vdev->vq[i].vring.avail = 0;
         vdev->vq[i].vring.used = 0;
+        virtqueue_update_caches(&vdev->vq[i]);
         vdev->vq[i].last_avail_idx = 0;
         vdev->vq[i].pa = 0;
         vdev->vq[i].vector = VIRTIO_NO_VECTOR;
         vdev->vq[i].signalled_used = 0;
         vdev->vq[i].signalled_used_valid = false;
+        vdev->vq[i].irq_pending = 0;
+        if (vdev->vq[i].irq_timer) {
+            timer_del(vdev->vq[i].irq_timer);
+        }
         vdev->vq[i].notification = true;
     }
 }
@@ -707,6 +795,9 @@ void virtio_config_writel(VirtIODevice *vdev, uint32_t addr, uint32_t data)
 
 void virtio_queue_set_addr(VirtIODevice *vdev, int n, hwaddr addr)
 {
+    if (!vdev->vq[n].vring.num) {
+        return;
+    }
     vdev->vq[n].pa = addr;
     virtqueue_init(&vdev->vq[n]);
 }
@@ -759,7 +850,7 @@ void virtio_queue_set_align(VirtIODevice *vdev, int n, int align)
 
 void virtio_queue_notify_vq(VirtQueue *vq)
 {
-    if (vq->vring.desc) {
+    if (vq->vring.desc && vq->handle_output) {
         VirtIODevice *vdev = vq->vdev;
         trace_virtio_queue_notify(vdev, vq - vdev->vq, vq);
         vq->handle_output(vdev, vq);
@@ -783,6 +874,8 @@ void virtio_queue_set_vector(VirtIODevice *vdev, int n, uint16_t vector)
         vdev->vq[n].vector = vector;
 }
 
+static void virtio_irq_coalesce_timer(void *opaque);
+
 VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
                             void (*handle_output)(VirtIODevice *, VirtQueue *))
 {
@@ -799,17 +892,44 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].vring.num = queue_size;
     vdev->vq[i].vring.align = VIRTIO_PCI_VRING_ALIGN;
     vdev->vq[i].handle_output = handle_output;
+    virtqueue_update_caches(&vdev->vq[i]);
+
+    if (vdev->irq_coalesce_usecs) {
+        vdev->vq[i].irq_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                             virtio_irq_coalesce_timer,
+                                             &vdev->vq[i]);
+        vdev->vq[i].irq_usecs = vdev->irq_coalesce_adaptive ?
+                                0 : vdev->irq_coalesce_usecs;
+    }
 
     return &vdev->vq[i];
 }
 
+static void virtio_queue_free_irq_timer(VirtQueue *vq)
+{
+    if (vq->irq_timer) {
+        timer_del(vq->irq_timer);
+        timer_free(vq->irq_timer);
+        vq->irq_timer = NULL;
+    }
+    vq->irq_pending = 0;
+}
+
 void virtio_del_queue(VirtIODevice *vdev, int n)
 {
     if (n < 0 || n >= VIRTIO_PCI_QUEUE_MAX) {
         abort();
     }
 
+    /* The guest may still kick the queue; it must look unconfigured */
     vdev->vq[n].vring.num = 0;
+    vdev->vq[n].vring.desc = 0;
+    vdev->vq[n].vring.avail = 0;
+    vdev->vq[n].vring.used = 0;
+    vdev->vq[n].pa = 0;
+    vdev->vq[n].handle_output = NULL;
+    virtqueue_destroy_caches(&vdev->vq[n]);
+    virtio_queue_free_irq_timer(&vdev->vq[n]);
 }
 
 void virtio_irq(VirtQueue *vq)
@@ -842,15 +962,102 @@ static bool vring_notify(VirtIODevice *vdev, VirtQueue *vq)
     return !v || vring_need_event(vring_get_used_event(vq), new, old);
 }
 
+static void virtio_notify_deliver(VirtIODevice *vdev, VirtQueue *vq)
+{
+    trace_virtio_notify(vdev, vq);
+    vq->irq_delivered++;
+    vdev->isr |= 0x01;
+    virtio_notify_vector(vdev, vq->vector);
+}
+
+static void virtio_irq_coalesce_flush(VirtQueue *vq)
+{
+    if (!vq->irq_pending) {
+        return;
+    }
+    vq->irq_pending = 0;
+    timer_del(vq->irq_timer);
+    virtio_notify_deliver(vq->vdev, vq);
+}
+
+static void virtio_irq_coalesce_timer(void *opaque)
+{
+    virtio_irq_coalesce_flush(opaque);
+}
+
+static void virtio_irq_coalesce_adapt(VirtQueue *vq, int64_t now)
+{
+    VirtIODevice *vdev = vq->vdev;
+    int64_t elapsed;
+    uint64_t rate;
+
+    vq->irq_rate_count++;
+    elapsed = now - vq->irq_rate_start;
+    if (!vdev->irq_coalesce_adaptive || elapsed < VIRTIO_IRQ_RATE_WINDOW_NS) {
+        return;
+    }
+
+    rate = (uint64_t)vq->irq_rate_count * get_ticks_per_sec() / elapsed;
+    if (rate > VIRTIO_IRQ_RATE_HIGH) {
+        vq->irq_usecs = MIN(MAX(vq->irq_usecs * 2, VIRTIO_IRQ_USECS_MIN),
+                            vdev->irq_coalesce_usecs);
+    } else if (rate < VIRTIO_IRQ_RATE_LOW) {
+        vq->irq_usecs = vq->irq_usecs > VIRTIO_IRQ_USECS_MIN ?
+                        vq->irq_usecs / 2 : 0;
+    }
+    trace_virtio_irq_coalesce(vq, rate, vq->irq_usecs);
+
+    vq->irq_rate_start = now;
+    vq->irq_rate_count = 0;
+}
+
+static void virtio_notify_coalesced(VirtIODevice *vdev, VirtQueue *vq)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    virtio_irq_coalesce_adapt(vq, now);
+
+    if (vq->irq_pending) {
+        /* The guest has not seen the interrupt for an earlier completion
+         * yet, so its used event index is stale.  Fold this completion
+         * into the pending interrupt instead of asking vring_notify().
+         */
+        vq->irq_pending++;
+        vq->irq_coalesced++;
+        if (vdev->irq_coalesce_frames &&
+            vq->irq_pending >= vdev->irq_coalesce_frames) {
+            virtio_irq_coalesce_flush(vq);
+        }
+        return;
+    }
+
+    if (!vring_notify(vdev, vq)) {
+        vq->irq_suppressed++;
+        return;
+    }
+
+    if (!vq->irq_usecs || vdev->irq_coalesce_frames == 1) {
+        virtio_notify_deliver(vdev, vq);
+        return;
+    }
+
+    vq->irq_pending = 1;
+    timer_mod(vq->irq_timer, now + (int64_t)vq->irq_usecs * SCALE_US);
+}
+
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
+    if (vq->irq_timer) {
+        virtio_notify_coalesced(vdev, vq);
+        return;
+    }
+
     if (!vring_notify(vdev, vq)) {
+        vq->irq_suppressed++;
         return;
     }
 
-    trace_virtio_notify(vdev, vq);
-    vdev->isr |= 0x01;
-    virtio_notify_vector(vdev, vq->vector);
+    virtio_notify_deliver(vdev, vq);
 }
 
 void virtio_notify_config(VirtIODevice *vdev)
@@ -1036,6 +1243,8 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
                          "inconsistent with Host index 0x%x",
                          i, vdev->vq[i].last_avail_idx);
                 return -1;
+        } else {
+            virtqueue_update_caches(&vdev->vq[i]);
 	}
         if (k->load_queue) {
             ret = k->load_queue(qbus->parent, i, f);
@@ -1084,6 +1293,12 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
 
 void virtio_cleanup(VirtIODevice *vdev)
 {
+    int i;
+
+    for (i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
+        virtqueue_destroy_caches(&vdev->vq[i]);
+        virtio_queue_free_irq_timer(&vdev->vq[i]);
+    }
     qemu_del_vm_change_state_handler(vdev->vmstate);
     g_free(vdev->config);
     g_free(vdev->vq);
@@ -1105,6 +1320,19 @@ static void virtio_vmstate_change(void *opaque, int running, RunState state)
         k->vmstate_change(qbus->parent, backend_run);
     }
 
+    if (!running) {
+        int i;
+
+        /* Do not leave coalesced interrupts behind across a stop or
+         * migration; the timer runs on the virtual clock.
+         */
+        for (i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
+            if (vdev->vq[i].irq_timer) {
+                virtio_irq_coalesce_flush(&vdev->vq[i]);
+            }
+        }
+    }
+
     if (!backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
@@ -1203,6 +1431,17 @@ void virtio_queue_set_last_avail_idx(VirtIODevice *vdev, int n, uint16_t idx)
     vdev->vq[n].last_avail_idx = idx;
 }
 
+/* Used when the ring state could not be fetched from a vhost backend.
+ * This assumes that every buffer taken from the avail ring was also
+ * placed in the used ring, which holds for in-order devices.
+ */
+void virtio_queue_restore_last_avail_idx(VirtIODevice *vdev, int n)
+{
+    if (vdev->vq[n].vring.desc) {
+        vdev->vq[n].last_avail_idx = vring_used_idx(&vdev->vq[n]);
+    }
+}
+
 void virtio_queue_invalidate_signalled_used(VirtIODevice *vdev, int n)
 {
     vdev->vq[n].signalled_used_valid = false;
@@ -1288,6 +1527,14 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
     VirtioDeviceClass *vdc = VIRTIO_DEVICE_GET_CLASS(dev);
     Error *err = NULL;
 
+    /* Both only shape the delay, which irq-coalesce-usecs enables */
+    if (!vdev->irq_coalesce_usecs &&
+        (vdev->irq_coalesce_frames || vdev->irq_coalesce_adaptive)) {
+        error_setg(errp, "irq-coalesce-frames and irq-coalesce-adaptive "
+                   "require irq-coalesce-usecs");
+        return;
+    }
+
     if (vdc->realize != NULL) {
         vdc->realize(dev, &err);
         if (err != NULL) {
@@ -1318,6 +1565,107 @@ static void virtio_device_unrealize(DeviceState *dev, Error **errp)
     vdev->bus_name = NULL;
 }
 
+int qmp_virtio_irq_stats_list(Object *obj, void *opaque)
+{
+    VirtioIrqStatsList ***prev = opaque;
+
+    if (object_dynamic_cast(obj, TYPE_VIRTIO_DEVICE)) {
+        VirtIODevice *vdev = VIRTIO_DEVICE(obj);
+
+        if (DEVICE(obj)->realized) {
+            VirtioIrqStatsList *elem = g_new0(VirtioIrqStatsList, 1);
+            VirtioIrqStats *info = g_new0(VirtioIrqStats, 1);
+            VirtQueueIrqStatsList **qprev = &info->queues;
+            int i;
+
+            info->path = object_get_canonical_path(obj);
+            info->name = g_strdup(vdev->name);
+            for (i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
+                VirtQueue *vq = &vdev->vq[i];
+                VirtQueueIrqStatsList *qelem;
+                VirtQueueIrqStats *qinfo;
+
+                if (vq->vring.num == 0) {
+                    continue;
+                }
+                qelem = g_new0(VirtQueueIrqStatsList, 1);
+                qinfo = g_new0(VirtQueueIrqStats, 1);
+                qinfo->queue = i;
+                qinfo->delivered = vq->irq_delivered;
+                qinfo->suppressed = vq->irq_suppressed;
+                qinfo->coalesced = vq->irq_coalesced;
+                qinfo->usecs = vq->irq_usecs;
+                qelem->value = qinfo;
+                *qprev = qelem;
+                qprev = &qelem->next;
+            }
+
+            elem->value = info;
+            elem->next = NULL;
+            **prev = elem;
+            *prev = &elem->next;
+        }
+    }
+
+    object_child_foreach(obj, qmp_virtio_irq_stats_list, opaque);
+    return 0;
+}
+
+static void virtio_get_irq_usecs(Object *obj, Visitor *v, void *opaque,
+                                 const char *name, Error **errp)
+{
+    DeviceState *dev = DEVICE(obj);
+    Property *prop = opaque;
+    uint32_t *ptr = qdev_get_prop_ptr(dev, prop);
+
+    visit_type_uint32(v, ptr, name, errp);
+}
+
+static void virtio_set_irq_usecs(Object *obj, Visitor *v, void *opaque,
+                                 const char *name, Error **errp)
+{
+    DeviceState *dev = DEVICE(obj);
+    Property *prop = opaque;
+    uint32_t value, *ptr = qdev_get_prop_ptr(dev, prop);
+    Error *local_err = NULL;
+
+    if (dev->realized) {
+        qdev_prop_set_after_realize(dev, name, errp);
+        return;
+    }
+
+    visit_type_uint32(v, &value, name, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+    if (value > VIRTIO_IRQ_USECS_MAX) {
+        error_set(errp, QERR_PROPERTY_VALUE_OUT_OF_RANGE,
+                  dev->id ?: "", name, (int64_t)value, (int64_t)0,
+                  (int64_t)VIRTIO_IRQ_USECS_MAX);
+        return;
+    }
+
+    *ptr = value;
+}
+
+static PropertyInfo virtio_prop_irq_usecs = {
+    .name  = "uint32",
+    .description = "Interrupt delay in microseconds, at most 1000000",
+    .get   = virtio_get_irq_usecs,
+    .set   = virtio_set_irq_usecs,
+};
+
+static Property virtio_properties[] = {
+    DEFINE_PROP_UINT32("irq-coalesce-frames", VirtIODevice,
+                       irq_coalesce_frames, 0),
+    DEFINE_PROP("irq-coalesce-usecs", VirtIODevice, irq_coalesce_usecs,
+                virtio_prop_irq_usecs, uint32_t),
+    DEFINE_PROP_BOOL("irq-coalesce-adaptive", VirtIODevice,
+                     irq_coalesce_adaptive, false),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void virtio_device_class_init(ObjectClass *klass, void *data)
 {
     /* Set the default value here. */
@@ -1326,6 +1674,7 @@ static void virtio_device_class_init(ObjectClass *klass, void *data)
     dc->realize = virtio_device_realize;
     dc->unrealize = virtio_device_unrealize;
     dc->bus_type = TYPE_VIRTIO_BUS;
+    dc->props = virtio_properties;
 }
 
 static const TypeInfo virtio_device_info = {
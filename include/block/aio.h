@@ -47,6 +47,7 @@ void qemu_aio_ref(void *p);
 typedef struct AioHandler AioHandler;
 typedef void QEMUBHFunc(void *opaque);
 typedef void IOHandler(void *opaque);
+typedef bool AioPollFn(void *opaque);
 
 struct AioContext {
     GSource source;
@@ -88,10 +89,49 @@ struct AioContext {
     /* Thread pool for performing work and receiving completion callbacks */
     struct ThreadPool *thread_pool;
 
+    /* Thread pool configuration: worker count bounds, how long an idle
+     * worker above the minimum lingers (ms), and the host NUMA node that
+     * workers are bound to (-1 for none).
+     */
+    int thread_pool_min;
+    int thread_pool_max;
+    int thread_pool_idle_timeout;
+    int thread_pool_node;
+
     /* TimerLists for calling timers - one per clock type */
     QEMUTimerListGroup tlg;
+
+    /* Adaptive busy polling.  A blocking aio_poll() first runs the poll
+     * handlers for up to poll_ns nanoseconds before sleeping in ppoll().
+     * poll_ns grows by poll_grow when sleeping would have been avoided with
+     * a longer window, and shrinks by poll_shrink when the wait was longer
+     * than poll_max_ns.  poll_max_ns == 0 disables polling.
+     */
+    int64_t poll_ns;
+    int64_t poll_max_ns;
+    int64_t poll_grow;
+    int64_t poll_shrink;
+
+    /* Statistics: blocking aio_poll() calls that made progress while
+     * polling, and those that had to go to sleep.
+     */
+    uint64_t poll_hits;
+    uint64_t poll_misses;
+
+    /* epoll(7) state.  Once enough handlers are registered, aio_poll()
+     * waits on epollfd instead of rebuilding pollfds on every iteration.
+     */
+    int epollfd;
+    bool epoll_enabled;
+    bool epoll_available;
 };
 
+/* Set up and tear down the host specific parts of an AioContext.  Used
+ * internally by aio_context_new() and the GSource finalizer.
+ */
+void aio_context_setup(AioContext *ctx);
+void aio_context_destroy(AioContext *ctx);
+
 /* Used internally to synchronize aio_poll against qemu_bh_schedule.  */
 void aio_set_dispatching(AioContext *ctx, bool dispatching);
 
@@ -266,11 +306,63 @@ void aio_set_event_notifier(AioContext *ctx,
                             EventNotifier *notifier,
                             EventNotifierHandler *io_read);
 
+/* Attach a poll handler to the file descriptor @fd, which must already have
+ * a handler registered with aio_set_fd_handler().  @io_poll is called with the
+ * same opaque as the fd handler while aio_poll() is busy polling; it should
+ * check for work without blocking, process it, and return true if progress
+ * was made.  Passing NULL removes the poll handler.
+ *
+ * Busy polling is only implemented on POSIX hosts; elsewhere this is a no-op.
+ */
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollFn *io_poll);
+
+/* Like aio_set_fd_poll(), for an event notifier registered with
+ * aio_set_event_notifier().  @io_poll receives the notifier.
+ */
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll);
+
+/**
+ * aio_context_set_poll_params:
+ * @ctx: the aio context
+ * @max_ns: upper bound for the busy polling window, 0 disables polling
+ * @grow: factor by which the window grows, 0 selects the default
+ * @shrink: divisor by which the window shrinks, 0 resets it to zero
+ * @errp: error object
+ *
+ * Configure adaptive busy polling for @ctx.
+ */
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
+                                 int64_t grow, int64_t shrink,
+                                 Error **errp);
+
+/* Return whether a bottom half is scheduled.  Used internally by aio_poll()
+ * to stop busy polling when another thread queues work.
+ */
+bool aio_bh_scheduled(AioContext *ctx);
+
 /* Return a GSource that lets the main loop poll the file descriptors attached
  * to this AioContext.
  */
 GSource *aio_get_g_source(AioContext *ctx);
 
+/**
+ * aio_context_set_thread_pool_params:
+ * @ctx: the aio context
+ * @min: number of worker threads kept alive even when idle
+ * @max: upper bound for the number of worker threads
+ * @idle_timeout: milliseconds after which an idle worker above @min exits
+ * @node: host NUMA node to bind the workers to, or -1
+ * @errp: error object
+ *
+ * Configure the thread pool of @ctx.  Takes effect immediately if the pool
+ * already exists.
+ */
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, int64_t idle_timeout,
+                                        int64_t node, Error **errp);
+
 /* Return the ThreadPool bound to this AioContext */
 struct ThreadPool *aio_get_thread_pool(AioContext *ctx);
 
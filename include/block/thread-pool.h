@@ -19,6 +19,11 @@
 #define QEMU_THREAD_POOL_H 1
 
 #include "block/block.h"
+#include "qapi-types.h"
+
+/* Default worker limit and idle timeout (ms) for new AioContexts */
+#define THREAD_POOL_MAX_THREADS_DEFAULT  64
+#define THREAD_POOL_IDLE_TIMEOUT_DEFAULT 10000
 
 typedef int ThreadPoolFunc(void *opaque);
 
@@ -27,6 +32,16 @@ typedef struct ThreadPool ThreadPool;
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
 
+/* Apply the thread pool parameters of @ctx, see
+ * aio_context_set_thread_pool_params().
+ */
+void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
+
+/* Return the configuration and queue statistics of @pool.  The id field is
+ * left for the caller to fill in.
+ */
+ThreadPoolInfo *thread_pool_get_info(ThreadPool *pool);
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
         BlockCompletionFunc *cb, void *opaque);
@@ -59,6 +59,7 @@ typedef uint64_t target_ulong;
 #define EXCP_DEBUG      0x10002 /* cpu stopped after a breakpoint or singlestep */
 #define EXCP_HALTED     0x10003 /* cpu is halted (waiting for external event) */
 #define EXCP_YIELD      0x10004 /* cpu wants to yield timeslice to another */
+#define EXCP_ATOMIC     0x10005 /* stop the world and emulate atomic */
 
 /* Only the bottom TB_JMP_PAGE_BITS of the jump cache hash bits vary for
    addresses on the same page.  The top bits are the same.  This allows
@@ -69,8 +70,10 @@ typedef uint64_t target_ulong;
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
 #if !defined(CONFIG_USER_ONLY)
-#define CPU_TLB_BITS 8
-#define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
+/* TCG_TARGET_IMPLEMENTS_DYN_TLB tells whether the backend reads the TLB
+   size from env, see below */
+#include "tcg-target.h"
+
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
 
@@ -102,16 +105,43 @@ typedef struct CPUTLBEntry {
 
 QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* The TLB of each MMU mode is a direct-mapped table of between
+   2^CPU_TLB_DYN_MIN_BITS and a configurable maximum of entries (at most
+   2^CPU_TLB_DYN_MAX_BITS), which tlb_flush resizes according to its
+   recent use rate.  The tables are owned by CPUState::tlb, because CPU
+   reset clears CPU_COMMON; tlb_flush copies the pointers back.
+   2^16 entries and their iotlb take 2.5 MiB per MMU mode and vCPU.  */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+#define CPU_TLB_DYN_DEFAULT_MAX_BITS 16
+#define CPU_TLB_DYN_MAX_BITS 16
+
+#define CPU_COMMON_TLB \
+    /* The meaning of the MMU modes is defined in the target code. */   \
+    /* tlb_mask[i] is (n_entries - 1) << CPU_TLB_ENTRY_BITS; generated  \
+       code reads it to index tlb_table[i]. */                          \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    hwaddr *iotlb[NB_MMU_MODES];                                        \
+    hwaddr iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                        \
+    target_ulong vtlb_index;                                            \
+
+#else
+#define CPU_TLB_BITS 8
+#define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
     CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
     CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
     hwaddr iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                           \
     hwaddr iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                        \
-    target_ulong tlb_flush_addr;                                        \
-    target_ulong tlb_flush_mask;                                        \
     target_ulong vtlb_index;                                            \
 
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 #else
 
 #define CPU_COMMON_TLB
@@ -20,6 +20,54 @@
 #define CPUTLB_H
 
 #if !defined(CONFIG_USER_ONLY)
+/* TLB state of one MMU mode that generated code does not need.  It hangs
+ * off CPUState rather than CPUArchState so that CPU reset, which clears
+ * CPU_COMMON, does not lose it.
+ */
+typedef struct CPUTLBDesc {
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    CPUTLBEntry *table;
+    hwaddr *iotlb;
+    size_t n_entries;
+    /* Start of the current use-rate window, and the largest number of
+     * valid entries seen at a flush during it.
+     */
+    int64_t window_begin_ns;
+    size_t window_max_entries;
+    /* valid entries in the main table */
+    size_t n_used_entries;
+    uint64_t resize_count;
+#endif
+    uint64_t flush_count;
+    uint64_t vtlb_hit_count;
+    uint64_t miss_count;
+} CPUTLBDesc;
+
+/* Our TLB entries only map TARGET_PAGE_SIZE, so a large page is cached as
+ * many small entries.  Remember the large pages that were added since the
+ * last flush, so that invalidating any page inside one of them drops all
+ * the entries it was split into.  When the set overflows, the closest
+ * ranges are merged.
+ */
+#define CPU_TLB_LARGE_PAGES 8
+
+typedef struct CPUTLBLargePage {
+    target_ulong addr;
+    target_ulong mask;
+} CPUTLBLargePage;
+
+struct CPUTLBState {
+    CPUTLBDesc d[NB_MMU_MODES];
+    CPUTLBLargePage large_pages[CPU_TLB_LARGE_PAGES];
+    int n_large_pages;
+    uint64_t large_page_flush_count;
+};
+
+static inline CPUTLBDesc *tlb_desc(CPUArchState *env, int mmu_idx)
+{
+    return &ENV_GET_CPU(env)->tlb->d[mmu_idx];
+}
+
 /* cputlb.c */
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code_phys(CPUState *cpu, ram_addr_t ram_addr,
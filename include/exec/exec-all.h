@@ -73,9 +73,15 @@ typedef struct TranslationBlock TranslationBlock;
 #include "qemu/log.h"
 
 void gen_intermediate_code(CPUArchState *env, struct TranslationBlock *tb);
+#ifdef TARGET_INSN_START_EXTRA_WORDS
+/* @data holds the insn_start words of the insn being restored */
+void restore_state_to_opc(CPUArchState *env, struct TranslationBlock *tb,
+                          target_ulong *data);
+#else
 void gen_intermediate_code_pc(CPUArchState *env, struct TranslationBlock *tb);
 void restore_state_to_opc(CPUArchState *env, struct TranslationBlock *tb,
                           int pc_pos);
+#endif
 
 void cpu_gen_init(void);
 int cpu_gen_code(CPUArchState *env, struct TranslationBlock *tb,
@@ -90,6 +96,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                               int cflags);
 void cpu_exec_init(CPUArchState *env);
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
+void QEMU_NORETURN cpu_loop_exit_atomic(CPUState *cpu, uintptr_t retaddr);
+void cpu_exec_step_atomic(CPUState *cpu);
 int page_unprotect(target_ulong address, uintptr_t pc, void *puc);
 void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
                                    int is_cpu_write_access);
@@ -102,9 +110,14 @@ void tcg_cpu_address_space_init(CPUState *cpu, AddressSpace *as);
 /* cputlb.c */
 void tlb_flush_page(CPUState *cpu, target_ulong addr);
 void tlb_flush(CPUState *cpu, int flush_global);
+void tlb_flush_page_all_cpus(CPUState *src, target_ulong addr);
+void tlb_flush_all_cpus(CPUState *src, int flush_global);
 void tlb_set_page(CPUState *cpu, target_ulong vaddr,
                   hwaddr paddr, int prot,
                   int mmu_idx, target_ulong size);
+void tlb_init(CPUState *cpu);
+void tlb_destroy(CPUState *cpu);
+void dump_tlb_info(FILE *f, fprintf_function cpu_fprintf);
 void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr);
 #else
 static inline void tlb_flush_page(CPUState *cpu, target_ulong addr)
@@ -114,12 +127,22 @@ static inline void tlb_flush_page(CPUState *cpu, target_ulong addr)
 static inline void tlb_flush(CPUState *cpu, int flush_global)
 {
 }
+
+static inline void tlb_flush_page_all_cpus(CPUState *src, target_ulong addr)
+{
+}
+
+static inline void tlb_flush_all_cpus(CPUState *src, int flush_global)
+{
+}
 #endif
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
-#define CODE_GEN_PHYS_HASH_BITS     15
-#define CODE_GEN_PHYS_HASH_SIZE     (1 << CODE_GEN_PHYS_HASH_BITS)
+/* initial number of TBs the physical hash table holds without chaining;
+   it grows as needed */
+#define CODE_GEN_HTABLE_BITS     15
+#define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
 
 /* estimated block size for TB allocation */
 /* XXX: use a per code average code fragment size and modulate it
@@ -150,10 +173,10 @@ struct TranslationBlock {
 #define CF_LAST_IO     0x8000 /* Last insn may be an IO access.  */
 #define CF_NOCACHE     0x10000 /* To be freed after execution */
 #define CF_USE_ICOUNT  0x20000
+#define CF_PROFILE     0x40000 /* Count executions, see tb_profile_enable() */
 
     void *tc_ptr;    /* pointer to the translated code */
-    /* next matching tb for physical address. */
-    struct TranslationBlock *phys_hash_next;
+    uint8_t *tc_search;  /* pointer to search data, after the code */
     /* first and second physical page containing code. The lower bit
        of the pointer tells the index in page_next[] */
     struct TranslationBlock *page_next[2];
@@ -173,27 +196,76 @@ struct TranslationBlock {
        jmp_first */
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
+
+    struct TBRegion *region; /* region of the code buffer holding the code */
+    uint32_t tc_size;       /* size of the host code, search data excluded */
+    /* execution profile, only maintained for CF_PROFILE blocks */
+    uint64_t exec_count;    /* incremented by the block's prologue */
+    uint64_t exit_count;    /* returns to the main loop from this block */
 };
 
-#include "exec/spinlock.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include "qemu/qht.h"
+#include "qemu/bitops.h"
 
+typedef struct TBRegion TBRegion;
 typedef struct TBContext TBContext;
 
+/* The code buffer is split into regions, each with its own share of the
+ * TB descriptors.  New TBs are allocated from the current region; when it
+ * is full, another region is emptied and becomes the current one.
+ */
+struct TBRegion {
+    uint8_t *start;             /* first byte of the region */
+    uint8_t *limit;             /* no TB may start at or after this */
+    uint8_t *end;               /* end of the code, unless current */
+    TranslationBlock *tbs;      /* the region's TBs, in code order */
+    int nb_tbs;
+    bool used;                  /* a TB was looked up since the last
+                                   eviction scan passed the region */
+};
+
 struct TBContext {
 
     TranslationBlock *tbs;
-    TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
+    /* TBs by physical pc, pc, cs_base and flags; lookups do not need
+     * tb_lock, see tb_find_slow() */
+    QHT htable;
     int nb_tbs;
-    /* any access to the tbs or the page table must use this lock */
-    spinlock_t tb_lock;
+    /* any access to the tbs or the page table must use this lock,
+     * see tb_lock() */
+    QemuMutex tb_lock;
+
+    TBRegion *regions;
+    int nb_regions;
+    int region_max_tbs;         /* TB descriptors per region */
+    int cur_region;             /* region new TBs are allocated from */
+    int evict_hand;             /* last region visited by eviction */
 
     /* statistics */
     int tb_flush_count;
+    int tb_evict_count;
     int tb_phys_invalidate_count;
 
+    /* runtime profile, see tb_profile_enable() */
+    bool profile;
+    uint64_t prof_translations;
+    uint64_t prof_translate_time;   /* ns */
+    uint64_t prof_guest_bytes;
+    uint64_t prof_host_bytes;
+
     int tb_invalidated_flag;
 };
 
+/* Tell the code buffer eviction that @tb is still in use */
+static inline void tb_mark_used(TranslationBlock *tb)
+{
+    if (!atomic_read(&tb->region->used)) {
+        atomic_set(&tb->region->used, true);
+    }
+}
+
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
 {
     target_ulong tmp;
@@ -209,14 +281,66 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 	    | (tmp & TB_JMP_ADDR_MASK));
 }
 
-static inline unsigned int tb_phys_hash_func(tb_page_addr_t pc)
+static inline uint64_t tb_hash_mix(uint64_t h, uint64_t v)
 {
-    return (pc >> 2) & (CODE_GEN_PHYS_HASH_SIZE - 1);
+    h ^= v * 0x87c37b91114253d5ULL;
+    return rol64(h, 31) * 0x4cf5ad432745937fULL;
 }
 
+static inline uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc,
+                                    uint64_t flags, target_ulong cs_base)
+{
+    uint64_t h = 0;
+
+    h = tb_hash_mix(h, phys_pc);
+    h = tb_hash_mix(h, pc);
+    h = tb_hash_mix(h, flags);
+    h = tb_hash_mix(h, cs_base);
+    /* final avalanche, so that the low bits depend on all inputs */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+extern bool parallel_cpus;
+
+void tb_lock(void);
+void tb_unlock(void);
+bool tb_lock_recursive(void);
+void tb_lock_reset(void);
+#ifdef CONFIG_USER_ONLY
+void tcg_atomic_lock(void);
+void tcg_atomic_unlock(void);
+#endif
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUArchState *env);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
+#if !defined(CONFIG_USER_ONLY)
+void tb_profile_enable(bool enable);
+#endif
+
+/* persistent translation cache, see linux-user/tbcache.c */
+#if defined(CONFIG_LINUX_USER)
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb, int *code_size_ptr);
+bool tb_cache_wanted(CPUState *cpu, TranslationBlock *tb);
+void tb_cache_store(TranslationBlock *tb, int code_size);
+#else
+static inline bool tb_cache_load(CPUState *cpu, TranslationBlock *tb,
+                                 int *code_size_ptr)
+{
+    return false;
+}
+
+static inline bool tb_cache_wanted(CPUState *cpu, TranslationBlock *tb)
+{
+    return false;
+}
+
+static inline void tb_cache_store(TranslationBlock *tb, int code_size)
+{
+}
+#endif
 
 #if defined(USE_DIRECT_JUMP)
 
@@ -233,8 +357,9 @@ void ppc_tb_set_jmp_target(uintptr_t jmp_addr, uintptr_t addr);
 #elif defined(__i386__) || defined(__x86_64__)
 static inline void tb_set_jmp_target1(uintptr_t jmp_addr, uintptr_t addr)
 {
-    /* patch the branch destination */
-    stl_le_p((void*)jmp_addr, addr - (jmp_addr + 4));
+    /* patch the branch destination; the displacement is aligned by the
+       backend so this store is atomic wrt. other vCPU threads */
+    atomic_set((int32_t *)jmp_addr, addr - (jmp_addr + 4));
     /* no need to flush icache explicitly */
 }
 #elif defined(__s390x__)
@@ -341,6 +466,7 @@ void phys_mem_set_alloc(void *(*alloc)(size_t, uint64_t *align));
 
 struct MemoryRegion *iotlb_to_region(CPUState *cpu,
                                      hwaddr index);
+hwaddr iotlb_to_phys(CPUState *cpu, hwaddr index, hwaddr mr_offset);
 bool io_mem_read(struct MemoryRegion *mr, hwaddr addr,
                  uint64_t *pvalue, unsigned size);
 bool io_mem_write(struct MemoryRegion *mr, hwaddr addr,
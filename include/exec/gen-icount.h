@@ -9,21 +9,24 @@ static TCGArg *icount_arg;
 static int icount_label;
 static int exitreq_label;
 
-static inline void gen_tb_start(TranslationBlock *tb)
+/* Bump the block's execution counter.  The increment is not atomic, so
+   with several vCPU threads the count is only approximate.  */
+static inline void gen_exec_count(TranslationBlock *tb)
 {
-    TCGv_i32 count, flag, imm;
-    int i;
-
-    exitreq_label = gen_new_label();
-    flag = tcg_temp_new_i32();
-    tcg_gen_ld_i32(flag, cpu_env,
-                   offsetof(CPUState, tcg_exit_req) - ENV_OFFSET);
-    tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
-    tcg_temp_free_i32(flag);
+    TCGv_ptr ptr = tcg_const_ptr(&tb->exec_count);
+    TCGv_i64 count = tcg_temp_new_i64();
+
+    tcg_gen_ld_i64(count, ptr, 0);
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, ptr, 0);
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(ptr);
+}
 
-    if (!(tb->cflags & CF_USE_ICOUNT)) {
-        return;
-    }
+static inline void gen_icount_start(void)
+{
+    TCGv_i32 count, imm;
+    int i;
 
     icount_label = gen_new_label();
     count = tcg_temp_local_new_i32();
@@ -47,6 +50,25 @@ static inline void gen_tb_start(TranslationBlock *tb)
     tcg_temp_free_i32(count);
 }
 
+static inline void gen_tb_start(TranslationBlock *tb)
+{
+    TCGv_i32 flag;
+
+    exitreq_label = gen_new_label();
+    flag = tcg_temp_new_i32();
+    tcg_gen_ld_i32(flag, cpu_env,
+                   offsetof(CPUState, tcg_exit_req) - ENV_OFFSET);
+    tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
+    tcg_temp_free_i32(flag);
+
+    if (tb->cflags & CF_USE_ICOUNT) {
+        gen_icount_start();
+    }
+    if (tb->cflags & CF_PROFILE) {
+        gen_exec_count(tb);
+    }
+}
+
 static void gen_tb_end(TranslationBlock *tb, int num_insns)
 {
     gen_set_label(exitreq_label);
@@ -158,6 +158,7 @@ struct MemoryRegion {
     bool rom_device;
     bool warning_printed; /* For reservations */
     bool flush_coalesced_mmio;
+    bool global_locking;
     MemoryRegion *alias;
     hwaddr alias_offset;
     int32_t priority;
@@ -212,14 +213,19 @@ struct AddressSpace {
     char *name;
     MemoryRegion *root;
 
-    /* Accessed via RCU.  */
+    /* Accessed via RCU.  May be shared with other address spaces.  */
     struct FlatView *current_map;
+    /* Used by memory_region_transaction_commit() */
+    struct FlatView *next_map;
+    bool map_changed;
 
     int ioeventfd_nb;
     struct MemoryRegionIoeventfd *ioeventfds;
     struct AddressSpaceDispatch *dispatch;
     struct AddressSpaceDispatch *next_dispatch;
     MemoryListener dispatch_listener;
+    /* Bumped when the dispatch tree changes; see #MemoryRegionCache.  */
+    unsigned cache_generation;
 
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
 };
@@ -777,6 +783,22 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_clear_global_locking: Declares that access processing does
+ *                                     not depend on the QEMU global lock.
+ *
+ * By clearing this property, accesses to the memory region will be processed
+ * outside of QEMU's global lock (unless the lock is held on when issuing the
+ * access request).  In this case, the device model implementing the access
+ * handlers is responsible for synchronizing concurrent accesses itself; the
+ * region and its owner are only kept alive by RCU while a handler runs.
+ * Such regions must not use MMIO coalescing, nor flush the coalesced MMIO
+ * buffer on access; both are asserted.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_clear_global_locking(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -1152,6 +1174,280 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len);
 
+/**
+ * MemoryRegionCache: a cached translation of a range of an address space
+ *
+ * Devices that access the same guest data structure over and over, for
+ * example a descriptor ring, can translate it once with
+ * address_space_cache_init() and then use the address_space_*_cached()
+ * accessors.  As long as the range is backed by RAM and the topology of
+ * the address space has not changed, these go straight to host memory
+ * instead of walking the dispatch tree.  Otherwise they fall back to the
+ * ordinary accessors, so they are always correct.  A topology change
+ * bumps the address space's generation count from its dispatch
+ * #MemoryListener; the cache then re-translates on its next use.
+ *
+ * Offsets passed to the accessors are relative to the start of the cached
+ * range, and the access must lie entirely within it.  All fields are
+ * private.
+ */
+typedef struct MemoryRegionCache {
+    uint8_t *ptr;
+    hwaddr mapped;
+    hwaddr xlat;
+    hwaddr addr;
+    hwaddr len;
+    MemoryRegion *mr;
+    AddressSpace *as;
+    bool is_write;
+    unsigned generation;
+} MemoryRegionCache;
+
+#define MEMORY_REGION_CACHE_INVALID ((MemoryRegionCache) { .as = NULL })
+
+/**
+ * address_space_cache_init: prepare for repeated access to a range
+ *
+ * @cache: #MemoryRegionCache to be filled
+ * @as: #AddressSpace to be accessed
+ * @addr: address within that address space
+ * @len: length of the range
+ * @is_write: whether the range will be written to; a cache created with
+ * @is_write == %false may only be used for loads.
+ *
+ * A cache that was already initialized must be destroyed first.
+ */
+void address_space_cache_init(MemoryRegionCache *cache, AddressSpace *as,
+                              hwaddr addr, hwaddr len, bool is_write);
+
+/**
+ * address_space_cache_destroy: free a #MemoryRegionCache
+ *
+ * Drops the reference to the cached #MemoryRegion and leaves @cache in the
+ * same state as %MEMORY_REGION_CACHE_INVALID.  Destroying an invalid cache
+ * is allowed.
+ *
+ * @cache: The #MemoryRegionCache to be destroyed
+ */
+void address_space_cache_destroy(MemoryRegionCache *cache);
+
+/* Whether @cache was initialized and not destroyed since.  */
+static inline bool address_space_cache_valid(MemoryRegionCache *cache)
+{
+    return cache->as != NULL;
+}
+
+/* Internal functions, part of the implementation of the cached accessors.  */
+void address_space_cache_refresh(MemoryRegionCache *cache);
+void address_space_cache_invalidate(MemoryRegionCache *cache,
+                                    hwaddr addr, hwaddr len);
+
+/* Return a host pointer for @size bytes at @addr in @cache, or %NULL if
+ * they are not backed by directly accessible RAM.
+ */
+static inline uint8_t *address_space_cache_ptr(MemoryRegionCache *cache,
+                                               hwaddr addr, hwaddr size)
+{
+    assert(addr <= cache->len && size <= cache->len - addr);
+    if (unlikely(cache->generation !=
+                 atomic_read(&cache->as->cache_generation))) {
+        address_space_cache_refresh(cache);
+    }
+    if (likely(addr + size <= cache->mapped)) {
+        return cache->ptr + addr;
+    }
+    return NULL;
+}
+
+static inline uint32_t address_space_ldub_cached(MemoryRegionCache *cache,
+                                                 hwaddr addr)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 1);
+
+    return ptr ? ldub_p(ptr) : ldub_phys(cache->as, cache->addr + addr);
+}
+
+static inline uint32_t address_space_lduw_le_cached(MemoryRegionCache *cache,
+                                                    hwaddr addr)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 2);
+
+    return ptr ? lduw_le_p(ptr) : lduw_le_phys(cache->as, cache->addr + addr);
+}
+
+static inline uint32_t address_space_lduw_be_cached(MemoryRegionCache *cache,
+                                                    hwaddr addr)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 2);
+
+    return ptr ? lduw_be_p(ptr) : lduw_be_phys(cache->as, cache->addr + addr);
+}
+
+static inline uint32_t address_space_ldl_le_cached(MemoryRegionCache *cache,
+                                                   hwaddr addr)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 4);
+
+    return ptr ? ldl_le_p(ptr) : ldl_le_phys(cache->as, cache->addr + addr);
+}
+
+static inline uint32_t address_space_ldl_be_cached(MemoryRegionCache *cache,
+                                                   hwaddr addr)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 4);
+
+    return ptr ? ldl_be_p(ptr) : ldl_be_phys(cache->as, cache->addr + addr);
+}
+
+static inline uint64_t address_space_ldq_le_cached(MemoryRegionCache *cache,
+                                                   hwaddr addr)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 8);
+
+    return ptr ? ldq_le_p(ptr) : ldq_le_phys(cache->as, cache->addr + addr);
+}
+
+static inline uint64_t address_space_ldq_be_cached(MemoryRegionCache *cache,
+                                                   hwaddr addr)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 8);
+
+    return ptr ? ldq_be_p(ptr) : ldq_be_phys(cache->as, cache->addr + addr);
+}
+
+static inline void address_space_stb_cached(MemoryRegionCache *cache,
+                                            hwaddr addr, uint32_t val)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 1);
+
+    if (ptr) {
+        stb_p(ptr, val);
+        address_space_cache_invalidate(cache, addr, 1);
+    } else {
+        stb_phys(cache->as, cache->addr + addr, val);
+    }
+}
+
+static inline void address_space_stw_le_cached(MemoryRegionCache *cache,
+                                               hwaddr addr, uint32_t val)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 2);
+
+    if (ptr) {
+        stw_le_p(ptr, val);
+        address_space_cache_invalidate(cache, addr, 2);
+    } else {
+        stw_le_phys(cache->as, cache->addr + addr, val);
+    }
+}
+
+static inline void address_space_stw_be_cached(MemoryRegionCache *cache,
+                                               hwaddr addr, uint32_t val)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 2);
+
+    if (ptr) {
+        stw_be_p(ptr, val);
+        address_space_cache_invalidate(cache, addr, 2);
+    } else {
+        stw_be_phys(cache->as, cache->addr + addr, val);
+    }
+}
+
+static inline void address_space_stl_le_cached(MemoryRegionCache *cache,
+                                               hwaddr addr, uint32_t val)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 4);
+
+    if (ptr) {
+        stl_le_p(ptr, val);
+        address_space_cache_invalidate(cache, addr, 4);
+    } else {
+        stl_le_phys(cache->as, cache->addr + addr, val);
+    }
+}
+
+static inline void address_space_stl_be_cached(MemoryRegionCache *cache,
+                                               hwaddr addr, uint32_t val)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 4);
+
+    if (ptr) {
+        stl_be_p(ptr, val);
+        address_space_cache_invalidate(cache, addr, 4);
+    } else {
+        stl_be_phys(cache->as, cache->addr + addr, val);
+    }
+}
+
+static inline void address_space_stq_le_cached(MemoryRegionCache *cache,
+                                               hwaddr addr, uint64_t val)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 8);
+
+    if (ptr) {
+        stq_le_p(ptr, val);
+        address_space_cache_invalidate(cache, addr, 8);
+    } else {
+        stq_le_phys(cache->as, cache->addr + addr, val);
+    }
+}
+
+static inline void address_space_stq_be_cached(MemoryRegionCache *cache,
+                                               hwaddr addr, uint64_t val)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, 8);
+
+    if (ptr) {
+        stq_be_p(ptr, val);
+        address_space_cache_invalidate(cache, addr, 8);
+    } else {
+        stq_be_phys(cache->as, cache->addr + addr, val);
+    }
+}
+
+/* address_space_read_cached: read from a cached range
+ *
+ * @cache: #MemoryRegionCache to be accessed
+ * @addr: offset within the cached range
+ * @buf: buffer receiving the data
+ * @len: length of the data
+ */
+static inline void address_space_read_cached(MemoryRegionCache *cache,
+                                             hwaddr addr, void *buf,
+                                             hwaddr len)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, len);
+
+    if (ptr) {
+        memcpy(buf, ptr, len);
+    } else {
+        address_space_read(cache->as, cache->addr + addr, buf, len);
+    }
+}
+
+/* address_space_write_cached: write to a cached range
+ *
+ * @cache: #MemoryRegionCache to be accessed, initialized with
+ * @is_write == %true
+ * @addr: offset within the cached range
+ * @buf: buffer with the data
+ * @len: length of the data
+ */
+static inline void address_space_write_cached(MemoryRegionCache *cache,
+                                              hwaddr addr, const void *buf,
+                                              hwaddr len)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache, addr, len);
+
+    if (ptr) {
+        memcpy(ptr, buf, len);
+        address_space_cache_invalidate(cache, addr, len);
+    } else {
+        address_space_write(cache->as, cache->addr + addr, buf, len);
+    }
+}
+
 
 #endif
 
@@ -124,6 +124,8 @@ struct MachineState {
     /*< public >*/
 
     char *accel;
+    char *tcg_thread;
+    int tlb_max_bits;
     bool kernel_irqchip;
     int kvm_shadow_mem;
     char *dtb;
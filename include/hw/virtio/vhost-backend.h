@@ -24,16 +24,36 @@ typedef int (*vhost_call)(struct vhost_dev *dev, unsigned long int request,
              void *arg);
 typedef int (*vhost_backend_init)(struct vhost_dev *dev, void *opaque);
 typedef int (*vhost_backend_cleanup)(struct vhost_dev *dev);
+typedef int (*vhost_backend_get_vq_index)(struct vhost_dev *dev, int idx);
+typedef int (*vhost_backend_set_vring_enable)(struct vhost_dev *dev,
+                                              int enable);
+typedef bool (*vhost_requires_shm_log)(struct vhost_dev *dev);
+typedef bool (*vhost_backend_shares_log)(struct vhost_dev *dev);
+typedef int (*vhost_set_log_base)(struct vhost_dev *dev, uint64_t base,
+                                  int fd, uint64_t size);
 
 typedef struct VhostOps {
     VhostBackendType backend_type;
     vhost_call vhost_call;
     vhost_backend_init vhost_backend_init;
     vhost_backend_cleanup vhost_backend_cleanup;
+    /* Map a device-wide virtqueue index to the index used by the backend */
+    vhost_backend_get_vq_index vhost_backend_get_vq_index;
+    /* Optional: enable or disable all rings of the device */
+    vhost_backend_set_vring_enable vhost_backend_set_vring_enable;
+    /* Optional: the dirty log must be shareable with another process */
+    vhost_requires_shm_log vhost_requires_shm_log;
+    /* Optional: the backend logs this device's writes in another log */
+    vhost_backend_shares_log vhost_backend_shares_log;
+    /* Optional: replaces VHOST_SET_LOG_BASE, fd is -1 for private logs */
+    vhost_set_log_base vhost_set_log_base;
 } VhostOps;
 
 extern const VhostOps user_ops;
 
+/* vhost-user feature bit announcing VHOST_USER_GET_PROTOCOL_FEATURES */
+#define VHOST_USER_F_PROTOCOL_FEATURES 30
+
 int vhost_set_backend_type(struct vhost_dev *dev,
                            VhostBackendType backend_type);
 
@@ -41,9 +41,14 @@ struct vhost_dev {
     unsigned long long features;
     unsigned long long acked_features;
     unsigned long long backend_features;
+    /* vhost-user protocol features and number of queue pairs */
+    unsigned long long protocol_features;
+    unsigned int max_queues;
     bool started;
     bool log_enabled;
     vhost_log_chunk_t *log;
+    /* file descriptor of a shared memory log, -1 if log is private */
+    int log_fd;
     unsigned long long log_size;
     Error *migration_blocker;
     bool force;
@@ -84,6 +84,10 @@ struct VirtIODevice
     VMChangeStateEntry *vmstate;
     char *bus_name;
     uint8_t device_endian;
+    /* Interrupt moderation, see virtio_notify() */
+    uint32_t irq_coalesce_frames;
+    uint32_t irq_coalesce_usecs;
+    bool irq_coalesce_adaptive;
 };
 
 typedef struct VirtioDeviceClass {
@@ -206,6 +210,7 @@ hwaddr virtio_queue_get_used_size(VirtIODevice *vdev, int n);
 hwaddr virtio_queue_get_ring_size(VirtIODevice *vdev, int n);
 uint16_t virtio_queue_get_last_avail_idx(VirtIODevice *vdev, int n);
 void virtio_queue_set_last_avail_idx(VirtIODevice *vdev, int n, uint16_t idx);
+void virtio_queue_restore_last_avail_idx(VirtIODevice *vdev, int n);
 void virtio_queue_invalidate_signalled_used(VirtIODevice *vdev, int n);
 VirtQueue *virtio_get_queue(VirtIODevice *vdev, int n);
 uint16_t virtio_get_queue_index(VirtQueue *vq);
@@ -219,6 +224,8 @@ void virtio_queue_set_host_notifier_fd_handler(VirtQueue *vq, bool assign,
 void virtio_queue_notify_vq(VirtQueue *vq);
 void virtio_irq(VirtQueue *vq);
 
+int qmp_virtio_irq_stats_list(Object *obj, void *opaque);
+
 static inline void virtio_add_feature(uint32_t *features, unsigned int fbit)
 {
     assert(fbit < 32);
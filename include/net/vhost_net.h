@@ -12,6 +12,8 @@ typedef struct VhostNetOptions {
     NetClientState *net_backend;
     void *opaque;
     bool force;
+    /* vhost-user: first queue pair of the connection, NULL for itself */
+    VHostNetState *first_queue;
 } VhostNetOptions;
 
 struct vhost_net *vhost_net_init(VhostNetOptions *options);
@@ -29,4 +31,8 @@ bool vhost_net_virtqueue_pending(VHostNetState *net, int n);
 void vhost_net_virtqueue_mask(VHostNetState *net, VirtIODevice *dev,
                               int idx, bool mask);
 VHostNetState *get_vhost_net(NetClientState *nc);
+
+int vhost_set_vring_enable(NetClientState *nc, int enable);
+uint64_t vhost_net_get_acked_features(VHostNetState *net);
+unsigned int vhost_net_get_max_queues(VHostNetState *net);
 #endif
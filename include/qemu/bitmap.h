@@ -40,6 +40,8 @@
  * bitmap_full(src, nbits)			Are all bits set in *src?
  * bitmap_set(dst, pos, nbits)			Set specified bit area
  * bitmap_clear(dst, pos, nbits)		Clear specified bit area
+ * bitmap_set_atomic(dst, pos, nbits)		Set specified bit area atomically
+ * bitmap_test_and_clear_atomic(dst, pos, nbits)	Test and clear area
  * bitmap_find_next_zero_area(buf, len, pos, n, mask)	Find bit free area
  */
 
@@ -47,6 +49,7 @@
  * Also the following operations apply to bitmaps.
  *
  * set_bit(bit, addr)			*addr |= bit
+ * set_bit_atomic(bit, addr)		*addr |= bit, atomically
  * clear_bit(bit, addr)			*addr &= ~bit
  * change_bit(bit, addr)		*addr ^= bit
  * test_bit(bit, addr)			Is bit set in *addr?
@@ -226,7 +229,9 @@ static inline int bitmap_intersects(const unsigned long *src1,
 }
 
 void bitmap_set(unsigned long *map, long i, long len);
+void bitmap_set_atomic(unsigned long *map, long i, long len);
 void bitmap_clear(unsigned long *map, long start, long nr);
+bool bitmap_test_and_clear_atomic(unsigned long *map, long start, long nr);
 unsigned long bitmap_find_next_zero_area(unsigned long *map,
                                          unsigned long size,
                                          unsigned long start,
@@ -0,0 +1,152 @@
+/*
+ * Resizable hash table with lock-free lookups
+ *
+ * Copyright (c) 2015 the QEMU developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_QHT_H
+#define QEMU_QHT_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "qemu/thread.h"
+
+typedef struct QHT QHT;
+typedef struct QHTMap QHTMap;
+typedef struct QHTStats QHTStats;
+
+struct QHT {
+    QHTMap *map;        /* RCU-protected */
+    QemuMutex lock;     /* serialises writers */
+    unsigned int mode;
+};
+
+/* Grow the table when too many overflow buckets have been chained */
+#define QHT_MODE_AUTO_RESIZE 0x1
+
+#define QHT_STATS_CHAIN_HIST 8
+
+struct QHTStats {
+    size_t head_buckets;        /* size of the bucket array */
+    size_t used_head_buckets;   /* head buckets with at least one entry */
+    size_t entries;
+    size_t slots;               /* entry slots, overflow buckets included */
+    size_t max_chain;           /* longest bucket chain, in buckets */
+    size_t chain_sum;           /* sum of chain lengths of used buckets */
+    /* used head buckets by chain length; the last slot accumulates
+     * everything longer */
+    size_t chain_hist[QHT_STATS_CHAIN_HIST];
+};
+
+/**
+ * QHTLookupFunc:
+ * @obj: an object stored in the table whose hash matches
+ * @userp: the pointer passed to qht_lookup()
+ *
+ * Return true if @obj is the object being looked up.  The function runs
+ * without any lock held, concurrently with writers.
+ */
+typedef bool (*QHTLookupFunc)(const void *obj, const void *userp);
+
+typedef void (*QHTIterFunc)(QHT *ht, void *obj, uint32_t hash, void *userp);
+
+/**
+ * qht_init:
+ * @ht: the table to initialise
+ * @n_elems: number of entries the table should hold without chaining
+ * @mode: bitmask of QHT_MODE_* flags
+ */
+void qht_init(QHT *ht, size_t n_elems, unsigned int mode);
+
+/**
+ * qht_destroy:
+ * @ht: the table to destroy
+ *
+ * Free the table's memory.  The caller must ensure that no lookups are
+ * in flight; the stored objects are not freed.
+ */
+void qht_destroy(QHT *ht);
+
+/**
+ * qht_insert:
+ * @ht: the table
+ * @obj: the object to insert, must not be NULL
+ * @hash: @obj's hash
+ *
+ * Returns false if @obj was already in the table.
+ */
+bool qht_insert(QHT *ht, void *obj, uint32_t hash);
+
+/**
+ * qht_lookup:
+ * @ht: the table
+ * @func: comparison function
+ * @userp: opaque pointer passed to @func
+ * @hash: hash of the object being looked up
+ *
+ * Return the first object with hash @hash for which @func returns true,
+ * or NULL.  Lookups never write to shared memory and may run concurrently
+ * with insertions, removals and resizes.  Must be called within an RCU
+ * read-side critical section, which protects the bucket array that is
+ * being walked; @func may therefore longjmp out of the lookup.
+ *
+ * A lookup that races with a resize may not see changes made after the
+ * resize started; callers that need an authoritative answer must also
+ * exclude writers.
+ */
+void *qht_lookup(QHT *ht, QHTLookupFunc func, const void *userp,
+                 uint32_t hash);
+
+/**
+ * qht_remove:
+ * @ht: the table
+ * @obj: the object to remove
+ * @hash: @obj's hash
+ *
+ * Returns false if @obj was not in the table.
+ */
+bool qht_remove(QHT *ht, const void *obj, uint32_t hash);
+
+/**
+ * qht_reset:
+ * @ht: the table
+ *
+ * Remove all entries, keeping the current size.
+ */
+void qht_reset(QHT *ht);
+
+/**
+ * qht_resize:
+ * @ht: the table
+ * @n_elems: number of entries the table should hold without chaining
+ *
+ * Returns false if the table already has the requested size.
+ */
+bool qht_resize(QHT *ht, size_t n_elems);
+
+/**
+ * qht_iter:
+ * @ht: the table
+ * @func: function called for each entry
+ * @userp: opaque pointer passed to @func
+ *
+ * Call @func for every entry, with writers excluded.  @func must not
+ * modify the table.
+ */
+void qht_iter(QHT *ht, QHTIterFunc func, void *userp);
+
+/**
+ * qht_statistics_init:
+ * @ht: the table
+ * @stats: filled in with the table's occupancy and chain lengths
+ *
+ * The numbers are collected without excluding writers and are therefore
+ * only approximate while the table is being modified.
+ */
+void qht_statistics_init(QHT *ht, QHTStats *stats);
+
+#endif
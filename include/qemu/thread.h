@@ -58,6 +58,26 @@ bool qemu_thread_is_self(QemuThread *thread);
 void qemu_thread_exit(void *retval);
 void qemu_thread_naming(bool enable);
 
+/* Largest host CPU number that affinity masks can describe */
+#define MAX_HOST_CPUS 1024
+
+/* Add the host CPUs of host NUMA node @node to the bitmap @host_cpus,
+ * which is @nbits long.  Returns 0 on success or a negative errno value.
+ */
+int qemu_host_node_cpus(int node, unsigned long *host_cpus,
+                        unsigned long nbits);
+
+/* Restrict @thread to the host CPUs set in @host_cpus.
+ * Returns 0 on success or a negative errno value.
+ */
+int qemu_thread_set_affinity(QemuThread *thread, const unsigned long *host_cpus,
+                             unsigned long nbits);
+
+/* Restrict the calling thread to the host CPUs of NUMA node @node.
+ * Returns 0 on success or a negative errno value.
+ */
+int qemu_thread_bind_node(int node);
+
 struct Notifier;
 void qemu_thread_atexit_add(struct Notifier *notifier);
 void qemu_thread_atexit_remove(struct Notifier *notifier);
@@ -187,6 +187,46 @@ typedef struct CPUWatchpoint {
     QTAILQ_ENTRY(CPUWatchpoint) entry;
 } CPUWatchpoint;
 
+/* Histogram bucket 0 counts samples below 1 microsecond, bucket i counts
+ * samples in [2^(i-1), 2^i) microseconds, and the last bucket everything
+ * above.
+ */
+#define CPU_STATS_HIST_BUCKETS 24
+#define CPU_STATS_IO_HOTSPOTS 16
+
+typedef struct CPUStatsHistogram {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[CPU_STATS_HIST_BUCKETS];
+} CPUStatsHistogram;
+
+typedef struct CPUStatsHotspot {
+    uint64_t addr;
+    uint64_t count;
+    bool pio;
+} CPUStatsHotspot;
+
+/**
+ * CPUStats:
+ * @exits: Number of exits from guest mode, by reason.
+ * @run: Time spent in guest mode per entry.
+ * @emulation: Time spent handling one exit (KVM), or one MMIO or PIO
+ * access (TCG).
+ * @bql_wait: Time spent waiting for the global mutex.
+ * @hotspots: The most accessed MMIO and PIO addresses.
+ *
+ * Run loop statistics of a vCPU.  They are only updated by the vCPU's own
+ * thread, and read without synchronization.
+ */
+typedef struct CPUStats {
+    uint64_t exits[VCPU_EXIT_REASON_MAX];
+    CPUStatsHistogram run;
+    CPUStatsHistogram emulation;
+    CPUStatsHistogram bql_wait;
+    CPUStatsHotspot hotspots[CPU_STATS_IO_HOTSPOTS];
+} CPUStats;
+
 struct KVMState;
 struct kvm_run;
 
@@ -216,6 +256,7 @@ struct kvm_run;
  * @can_do_io: Nonzero if memory-mapped IO is safe.
  * @env_ptr: Pointer to subclass-specific CPUArchState field.
  * @current_tb: Currently executing TB.
+ * @tlb: Softmmu TLB state that must survive CPU reset, see cputlb.c.
  * @gdb_regs: Additional GDB registers.
  * @gdb_num_regs: Number of total registers accessible to GDB.
  * @gdb_num_g_regs: Number of registers in GDB 'g' packets.
@@ -224,6 +265,7 @@ struct kvm_run;
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @mem_io_vaddr: Target virtual address at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
+ * @stats: Run loop statistics, see query-vcpu-stats.
  *
  * State of one CPU core or thread.
  */
@@ -262,6 +304,7 @@ struct CPUState {
     void *env_ptr; /* CPUArchState */
     struct TranslationBlock *current_tb;
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    struct CPUTLBState *tlb;
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
     int gdb_num_g_regs;
@@ -286,6 +329,8 @@ struct CPUState {
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
 
+    CPUStats stats;
+
     /* TODO Move common fields from CPUArchState here. */
     int cpu_index; /* used by alpha TCG */
     uint32_t halted; /* used by alpha, cris, ppc TCG */
@@ -314,6 +359,16 @@ extern struct CPUTailQ cpus;
 DECLARE_TLS(CPUState *, current_cpu);
 #define current_cpu tls_var(current_cpu)
 
+extern bool mttcg_enabled;
+
+/**
+ * qemu_tcg_mttcg_enabled:
+ * Check whether TCG runs each vCPU in its own host thread.
+ *
+ * Returns: %true if multi-threaded TCG is enabled, %false otherwise.
+ */
+#define qemu_tcg_mttcg_enabled() (mttcg_enabled)
+
 /**
  * cpu_paging_enabled:
  * @cpu: The CPU whose state is to be inspected.
@@ -454,6 +509,15 @@ ObjectClass *cpu_class_by_name(const char *typename, const char *cpu_model);
  */
 CPUState *cpu_generic_init(const char *typename, const char *cpu_model);
 
+/**
+ * cpu_exec_finalize:
+ * @cpu: The CPU being destroyed.
+ *
+ * Frees the execution state allocated by cpu_exec_init(), such as the
+ * softmmu TLB.
+ */
+void cpu_exec_finalize(CPUState *cpu);
+
 /**
  * cpu_has_work:
  * @cpu: The vCPU to check.
@@ -519,6 +583,21 @@ void run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data);
  */
 void async_run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data);
 
+/**
+ * async_safe_run_on_cpu:
+ * @cpu: The vCPU to run on.
+ * @func: The function to be executed.
+ * @data: Data to pass to the function.
+ *
+ * Schedules the function @func for execution on the vCPU @cpu
+ * asynchronously, at a point where no vCPU is executing translated code.
+ * With multi-threaded TCG the work is always queued, even when called
+ * from @cpu's own thread, so callers inside cpu_exec must leave the
+ * execution loop for it to run.
+ */
+void async_safe_run_on_cpu(CPUState *cpu, void (*func)(void *data),
+                           void *data);
+
 /**
  * qemu_get_cpu:
  * @index: The CPUState@cpu_index value of the CPU to obtain.
@@ -610,6 +689,53 @@ void cpu_exit(CPUState *cpu);
  */
 void cpu_resume(CPUState *cpu);
 
+/* Whether the cpu_stats_account_*() functions are called; see the
+ * vcpu-stats QMP command.  Callers check it before reading the clock.
+ */
+extern bool cpu_stats_enabled;
+
+/**
+ * cpu_stats_account_exit:
+ * @cpu: The vCPU that left guest mode.
+ * @reason: Why it left.
+ * @run_ns: How long it ran, in nanoseconds.
+ *
+ * Accounts an exit from guest mode.  Must be called by @cpu's thread.
+ */
+void cpu_stats_account_exit(CPUState *cpu, VcpuExitReason reason,
+                            int64_t run_ns);
+
+/**
+ * cpu_stats_account_emulation:
+ * @cpu: The vCPU.
+ * @ns: Time spent emulating, in nanoseconds.
+ *
+ * Accounts time spent in QEMU on behalf of the guest.  Must be called by
+ * @cpu's thread.
+ */
+void cpu_stats_account_emulation(CPUState *cpu, int64_t ns);
+
+/**
+ * cpu_stats_account_bql_wait:
+ * @cpu: The vCPU.
+ * @ns: Time spent waiting, in nanoseconds.
+ *
+ * Accounts time spent waiting for the global mutex.  Must be called by
+ * @cpu's thread.
+ */
+void cpu_stats_account_bql_wait(CPUState *cpu, int64_t ns);
+
+/**
+ * cpu_stats_account_io:
+ * @cpu: The vCPU.
+ * @addr: Guest physical address or I/O port that was accessed.
+ * @pio: %true if @addr is an I/O port.
+ *
+ * Accounts an MMIO or PIO access to the hot spot table.  Must be called
+ * by @cpu's thread.
+ */
+void cpu_stats_account_io(CPUState *cpu, uint64_t addr, bool pio);
+
 /**
  * qemu_init_vcpu:
  * @cpu: The vCPU to initialize.
@@ -1,8 +1,13 @@
 #ifndef QEMU_CPUS_H
 #define QEMU_CPUS_H
 
+#include "qapi/error.h"
+
 /* cpus.c */
 void qemu_init_cpu_loop(void);
+void qemu_tcg_configure(const char *thread, Error **errp);
+/* cputlb.c */
+void tlb_configure(unsigned int max_bits, Error **errp);
 void resume_all_vcpus(void);
 void pause_all_vcpus(void);
 void cpu_stop_current(void);
@@ -56,6 +56,9 @@ struct HostMemoryBackend {
     uint64_t size;
     bool merge, dump;
     bool prealloc, force_prealloc;
+    bool thp;
+    int64_t prealloc_threads;
+    int64_t prealloc_time_ns;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
 
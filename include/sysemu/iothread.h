@@ -16,6 +16,8 @@
 
 #include "block/aio.h"
 #include "qemu/thread.h"
+#include "qemu/bitmap.h"
+#include "qemu/notify.h"
 
 #define TYPE_IOTHREAD "iothread"
 
@@ -28,6 +30,23 @@ typedef struct {
     QemuCond init_done_cond;    /* is thread initialization done? */
     bool stopping;
     int thread_id;
+
+    /* AioContext busy polling parameters */
+    int64_t poll_max_ns;
+    int64_t poll_grow;
+    int64_t poll_shrink;
+
+    /* Thread pool parameters */
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+    int64_t thread_pool_idle_timeout;
+    int64_t thread_pool_node;
+
+    /* Placement: explicit host CPUs, else those of a guest NUMA node */
+    DECLARE_BITMAP(host_cpus, MAX_HOST_CPUS);
+    int64_t numa_node;
+    int placed_node;
+    Notifier machine_done;
 } IOThread;
 
 #define IOTHREAD(obj) \
@@ -37,4 +56,9 @@ IOThread *iothread_find(const char *id);
 char *iothread_get_id(IOThread *iothread);
 AioContext *iothread_get_aio_context(IOThread *iothread);
 
+/* Run @iothread on the host CPUs of guest NUMA node @node, unless it
+ * was given a placement explicitly or was already placed.
+ */
+void iothread_place_near(IOThread *iothread, int node);
+
 #endif /* IOTHREAD_H */
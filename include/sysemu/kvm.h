@@ -175,6 +175,14 @@ extern KVMState *kvm_state;
 /* external API */
 
 bool kvm_has_free_slot(MachineState *ms);
+/**
+ * kvm_dirty_log_harvest:
+ *
+ * Fetch the dirty log of every logged memory slot from KVM and merge it into
+ * the dirty memory bitmaps.  Does not need the BQL, so the migration thread
+ * can do the bulk of the work before it syncs the bitmap under the lock.
+ */
+void kvm_dirty_log_harvest(void);
 int kvm_has_sync_mmu(void);
 int kvm_has_vcpu_events(void);
 int kvm_has_robust_singlestep(void);
@@ -399,6 +407,14 @@ int kvm_irqchip_add_msi_route(KVMState *s, MSIMessage msg);
 int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg);
 void kvm_irqchip_release_virq(KVMState *s, int virq);
 
+/**
+ * kvm_msi_route_info:
+ *
+ * Returns: statistics of the MSI route cache, or %NULL if KVM does not
+ * use GSI routing.
+ */
+KvmMsiRouteInfo *kvm_msi_route_info(void);
+
 int kvm_irqchip_add_adapter_route(KVMState *s, AdapterInfo *adapter);
 
 int kvm_irqchip_add_irqfd_notifier(KVMState *s, EventNotifier *n,
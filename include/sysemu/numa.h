@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include "qemu/bitmap.h"
 #include "qemu/option.h"
+#include "qemu/thread.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/hostmem.h"
 
@@ -14,11 +15,40 @@ typedef struct node_info {
     DECLARE_BITMAP(node_cpu, MAX_CPUMASK_BITS);
     struct HostMemoryBackend *node_memdev;
     bool present;
+    /* host placement: memory policy of mem= nodes, and the host CPUs
+     * that run the node's VCPUs and nearby I/O threads
+     */
+    DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
+    HostMemPolicy policy;
+    DECLARE_BITMAP(host_cpus, MAX_HOST_CPUS);
 } NodeInfo;
 extern NodeInfo numa_info[MAX_NODES];
 void parse_numa_opts(void);
 void numa_post_machine_init(void);
+
+/* Assign @cpu to its guest node and pin its thread to the node's host
+ * CPUs.  Called for VCPUs that are hotplugged after the machine is
+ * created; numa_post_machine_init places the others.
+ */
+void numa_place_vcpu(struct CPUState *cpu);
 void query_numa_node_mem(uint64_t node_mem[]);
+
+/* Copy the host CPUs of guest node @node to @host_cpus, which has
+ * MAX_HOST_CPUS bits.  Returns false if the node is not placed.
+ */
+bool numa_node_host_cpus(int node, unsigned long *host_cpus);
+
+/* The guest node whose memory contains guest physical address @addr,
+ * or -1.
+ */
+int numa_get_node_for_addr(hwaddr addr);
+
+/* Sample where the pages of guest node @node reside on the host, adding
+ * the number of sampled pages found on each host node to @host_pages,
+ * which has MAX_NODES entries.  Returns the number of sampled pages or a
+ * negative errno value.
+ */
+int numa_node_host_residency(int node, uint64_t *host_pages);
 extern QemuOptsList qemu_numa_opts;
 
 #endif
@@ -0,0 +1,112 @@
+/*
+ * QTest binary protocol
+ *
+ * Copyright (c) 2015 the QEMU developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QTEST_BINARY_H
+#define QTEST_BINARY_H
+
+#include <stdint.h>
+
+/*
+ * Binary frames share the qtest stream with the text protocol.  A frame
+ * starts with QTEST_BIN_MAGIC, which cannot start a text command, so
+ * clients can mix both freely.  All fields are little-endian.
+ *
+ * Request (QTEST_BIN_REQ_LEN bytes, then the payload if the op has one):
+ *
+ *   0  magic   QTEST_BIN_MAGIC
+ *   1  op      QTEST_BIN_*
+ *   2  size    access size of burst ops: 1, 2, 4 or 8 (8 is MMIO only)
+ *   3  reserved, must be zero
+ *   4  count   bytes for READ/WRITE/MEMSET, accesses for bursts
+ *   8  addr    guest physical address or I/O port
+ *  16  arg     address stride of burst ops, byte pattern of MEMSET
+ *
+ * Response (QTEST_BIN_RSP_LEN bytes, then len bytes of payload):
+ *
+ *   0  magic   QTEST_BIN_MAGIC
+ *   1  status  QTEST_BIN_OK, or QTEST_BIN_FAIL with a message as payload
+ *   2  reserved
+ *   4  len     payload length
+ *
+ * Burst values are packed at @size bytes each and have the same meaning
+ * as the values of the readX/writeX and inX/outX text commands.
+ */
+
+#define QTEST_BIN_MAGIC         0xb5
+#define QTEST_BIN_REQ_LEN       24
+#define QTEST_BIN_RSP_LEN       8
+
+/* Largest payload of a single frame in either direction */
+#define QTEST_BIN_MAX_LEN       (1 << 20)
+
+enum {
+    QTEST_BIN_READ = 1,         /* read count bytes of memory */
+    QTEST_BIN_WRITE,            /* write count bytes of payload to memory */
+    QTEST_BIN_MEMSET,           /* fill count bytes of memory with arg */
+    QTEST_BIN_MMIO_READ,        /* count readX at addr + i * arg */
+    QTEST_BIN_MMIO_WRITE,       /* count writeX at addr + i * arg */
+    QTEST_BIN_PIO_IN,           /* count inX at addr + i * arg */
+    QTEST_BIN_PIO_OUT,          /* count outX at addr + i * arg */
+    QTEST_BIN_OP_MAX,
+};
+
+enum {
+    QTEST_BIN_OK = 0,
+    QTEST_BIN_FAIL = 1,
+};
+
+typedef struct QTestBinReq {
+    uint8_t op;
+    uint8_t size;
+    uint32_t count;
+    uint64_t addr;
+    uint64_t arg;
+} QTestBinReq;
+
+static inline uint64_t qtest_bin_ld(const uint8_t *p, unsigned size)
+{
+    uint64_t val = 0;
+
+    while (size--) {
+        val = (val << 8) | p[size];
+    }
+    return val;
+}
+
+static inline void qtest_bin_st(uint8_t *p, unsigned size, uint64_t val)
+{
+    unsigned i;
+
+    for (i = 0; i < size; i++) {
+        p[i] = val >> (i * 8);
+    }
+}
+
+static inline void qtest_bin_req_encode(uint8_t *buf, const QTestBinReq *req)
+{
+    buf[0] = QTEST_BIN_MAGIC;
+    buf[1] = req->op;
+    buf[2] = req->size;
+    buf[3] = 0;
+    qtest_bin_st(buf + 4, 4, req->count);
+    qtest_bin_st(buf + 8, 8, req->addr);
+    qtest_bin_st(buf + 16, 8, req->arg);
+}
+
+static inline void qtest_bin_req_decode(QTestBinReq *req, const uint8_t *buf)
+{
+    req->op = buf[1];
+    req->size = buf[2];
+    req->count = qtest_bin_ld(buf + 4, 4);
+    req->addr = qtest_bin_ld(buf + 8, 8);
+    req->arg = qtest_bin_ld(buf + 16, 8);
+}
+
+#endif
@@ -29,6 +29,8 @@
 #include "trace.h"
 #include "exec/memory.h"
 #include "exec/address-spaces.h"
+#include "qom/cpu.h"
+#include "qemu/timer.h"
 
 //#define DEBUG_IOPORT
 
@@ -60,11 +62,27 @@ const MemoryRegionOps unassigned_io_ops = {
     .endianness = DEVICE_NATIVE_ENDIAN,
 };
 
+/* Port I/O from TCG translated code.  KVM accounts its PIO exits in
+ * kvm_cpu_exec() instead.
+ */
+static void cpu_ioport_rw(pio_addr_t addr, uint8_t *buf, int len,
+                          bool is_write)
+{
+    CPUState *cpu = tcg_enabled() && cpu_stats_enabled ? current_cpu : NULL;
+    int64_t start = cpu ? get_clock() : 0;
+
+    address_space_rw(&address_space_io, addr, buf, len, is_write);
+    if (cpu) {
+        cpu_stats_account_io(cpu, addr, true);
+        cpu_stats_account_emulation(cpu, get_clock() - start);
+    }
+}
+
 void cpu_outb(pio_addr_t addr, uint8_t val)
 {
     LOG_IOPORT("outb: %04"FMT_pioaddr" %02"PRIx8"\n", addr, val);
     trace_cpu_out(addr, val);
-    address_space_write(&address_space_io, addr, &val, 1);
+    cpu_ioport_rw(addr, &val, 1, true);
 }
 
 void cpu_outw(pio_addr_t addr, uint16_t val)
@@ -74,7 +92,7 @@ void cpu_outw(pio_addr_t addr, uint16_t val)
     LOG_IOPORT("outw: %04"FMT_pioaddr" %04"PRIx16"\n", addr, val);
     trace_cpu_out(addr, val);
     stw_p(buf, val);
-    address_space_write(&address_space_io, addr, buf, 2);
+    cpu_ioport_rw(addr, buf, 2, true);
 }
 
 void cpu_outl(pio_addr_t addr, uint32_t val)
@@ -84,14 +102,14 @@ void cpu_outl(pio_addr_t addr, uint32_t val)
     LOG_IOPORT("outl: %04"FMT_pioaddr" %08"PRIx32"\n", addr, val);
     trace_cpu_out(addr, val);
     stl_p(buf, val);
-    address_space_write(&address_space_io, addr, buf, 4);
+    cpu_ioport_rw(addr, buf, 4, true);
 }
 
 uint8_t cpu_inb(pio_addr_t addr)
 {
     uint8_t val;
 
-    address_space_read(&address_space_io, addr, &val, 1);
+    cpu_ioport_rw(addr, &val, 1, false);
     trace_cpu_in(addr, val);
     LOG_IOPORT("inb : %04"FMT_pioaddr" %02"PRIx8"\n", addr, val);
     return val;
@@ -102,7 +120,7 @@ uint16_t cpu_inw(pio_addr_t addr)
     uint8_t buf[2];
     uint16_t val;
 
-    address_space_read(&address_space_io, addr, buf, 2);
+    cpu_ioport_rw(addr, buf, 2, false);
     val = lduw_p(buf);
     trace_cpu_in(addr, val);
     LOG_IOPORT("inw : %04"FMT_pioaddr" %04"PRIx16"\n", addr, val);
@@ -114,7 +132,7 @@ uint32_t cpu_inl(pio_addr_t addr)
     uint8_t buf[4];
     uint32_t val;
 
-    address_space_read(&address_space_io, addr, buf, 4);
+    cpu_ioport_rw(addr, buf, 4, false);
     val = ldl_p(buf);
     trace_cpu_in(addr, val);
     LOG_IOPORT("inl : %04"FMT_pioaddr" %08"PRIx32"\n", addr, val);
@@ -18,6 +18,14 @@
 #include "sysemu/iothread.h"
 #include "qmp-commands.h"
 #include "qemu/error-report.h"
+#include "qapi/visitor.h"
+#include "qapi-visit.h"
+#include "qemu/atomic.h"
+#include "qemu/main-loop.h"
+#include "block/thread-pool.h"
+#include "sysemu/numa.h"
+#include "sysemu/sysemu.h"
+#include "hw/qdev-core.h"
 
 #define IOTHREADS_PATH "/objects"
 
@@ -50,6 +58,57 @@ static void *iothread_run(void *opaque)
     return NULL;
 }
 
+/* The guest node the thread runs next to, or -1 */
+static int iothread_numa_node(IOThread *iothread)
+{
+    return iothread->numa_node >= 0 ? iothread->numa_node :
+                                      iothread->placed_node;
+}
+
+/* Thread pool workers are spawned from the IOThread, so the ones started
+ * from now on inherit the new affinity.
+ */
+static void iothread_apply_affinity(IOThread *iothread)
+{
+    unsigned long host_cpus[BITS_TO_LONGS(MAX_HOST_CPUS)];
+    char *id;
+    int ret;
+
+    if (!bitmap_empty(iothread->host_cpus, MAX_HOST_CPUS)) {
+        bitmap_copy(host_cpus, iothread->host_cpus, MAX_HOST_CPUS);
+    } else if (!numa_node_host_cpus(iothread_numa_node(iothread),
+                                    host_cpus)) {
+        return;
+    }
+
+    ret = qemu_thread_set_affinity(&iothread->thread, host_cpus,
+                                   MAX_HOST_CPUS);
+    if (ret < 0) {
+        id = iothread_get_id(iothread);
+        error_report("warning: cannot set the affinity of iothread %s: %s",
+                     id ? id : "(internal)", strerror(-ret));
+        g_free(id);
+    }
+}
+
+/* Guest NUMA nodes are only placed once the machine is created */
+static void iothread_machine_done(Notifier *notifier, void *data)
+{
+    IOThread *iothread = container_of(notifier, IOThread, machine_done);
+
+    iothread_apply_affinity(iothread);
+}
+
+void iothread_place_near(IOThread *iothread, int node)
+{
+    if (node < 0 || iothread->placed_node >= 0 || iothread->numa_node >= 0 ||
+        !bitmap_empty(iothread->host_cpus, MAX_HOST_CPUS)) {
+        return;
+    }
+    iothread->placed_node = node;
+    iothread_apply_affinity(iothread);
+}
+
 static void iothread_instance_finalize(Object *obj)
 {
     IOThread *iothread = IOTHREAD(obj);
@@ -57,6 +116,9 @@ static void iothread_instance_finalize(Object *obj)
     if (!iothread->ctx) {
         return;
     }
+    if (iothread->machine_done.notify) {
+        notifier_remove(&iothread->machine_done);
+    }
     iothread->stopping = true;
     aio_notify(iothread->ctx);
     qemu_thread_join(&iothread->thread);
@@ -78,6 +140,24 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
+    aio_context_set_poll_params(iothread->ctx, iothread->poll_max_ns,
+                                iothread->poll_grow, iothread->poll_shrink,
+                                &local_error);
+    if (!local_error) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           iothread->thread_pool_idle_timeout,
+                                           iothread->thread_pool_node,
+                                           &local_error);
+    }
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     qemu_mutex_init(&iothread->init_done_lock);
     qemu_cond_init(&iothread->init_done_cond);
 
@@ -94,6 +174,250 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
                        &iothread->init_done_lock);
     }
     qemu_mutex_unlock(&iothread->init_done_lock);
+
+    if (qdev_hotplug) {
+        iothread_apply_affinity(iothread);
+    } else {
+        iothread->machine_done.notify = iothread_machine_done;
+        qemu_add_machine_init_done_notifier(&iothread->machine_done);
+    }
+}
+
+typedef struct {
+    const char *name;
+    ptrdiff_t offset; /* field's byte offset in IOThread struct */
+} IOThreadParamInfo;
+
+static IOThreadParamInfo poll_max_ns_info = {
+    "poll-max-ns", offsetof(IOThread, poll_max_ns),
+};
+static IOThreadParamInfo poll_grow_info = {
+    "poll-grow", offsetof(IOThread, poll_grow),
+};
+static IOThreadParamInfo poll_shrink_info = {
+    "poll-shrink", offsetof(IOThread, poll_shrink),
+};
+static IOThreadParamInfo thread_pool_min_info = {
+    "thread-pool-min", offsetof(IOThread, thread_pool_min),
+};
+static IOThreadParamInfo thread_pool_max_info = {
+    "thread-pool-max", offsetof(IOThread, thread_pool_max),
+};
+static IOThreadParamInfo thread_pool_idle_timeout_info = {
+    "thread-pool-idle-timeout", offsetof(IOThread, thread_pool_idle_timeout),
+};
+static IOThreadParamInfo thread_pool_node_info = {
+    "thread-pool-node", offsetof(IOThread, thread_pool_node),
+};
+
+static void iothread_get_param(Object *obj, Visitor *v,
+        void *opaque, const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+
+    visit_type_int64(v, field, name, errp);
+}
+
+static void iothread_set_poll_param(Object *obj, Visitor *v,
+        void *opaque, const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    int64_t value;
+
+    visit_type_int64(v, &value, name, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    if (value < 0) {
+        error_setg(&local_err, "%s value must be in range [0, %"PRId64"]",
+                   info->name, INT64_MAX);
+        goto out;
+    }
+
+    *field = value;
+
+    /* Takes effect immediately when the thread is already running */
+    if (iothread->ctx) {
+        aio_context_set_poll_params(iothread->ctx, iothread->poll_max_ns,
+                                    iothread->poll_grow,
+                                    iothread->poll_shrink, &local_err);
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+static void iothread_set_thread_pool_param(Object *obj, Visitor *v,
+        void *opaque, const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    int64_t value, old;
+
+    visit_type_int64(v, &value, name, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    old = *field;
+    *field = value;
+
+    /* Validated by iothread_complete() if the thread is not running yet */
+    if (iothread->ctx) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           iothread->thread_pool_idle_timeout,
+                                           iothread->thread_pool_node,
+                                           &local_err);
+        if (local_err) {
+            *field = old;
+        }
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+static void iothread_set_numa_node(Object *obj, Visitor *v,
+        void *opaque, const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+    int64_t value;
+
+    visit_type_int64(v, &value, name, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    if (value < -1 || value >= MAX_NODES) {
+        error_setg(&local_err, "numa-node value must be in range [-1, %d]",
+                   MAX_NODES - 1);
+        goto out;
+    }
+
+    iothread->numa_node = value;
+    if (iothread->ctx && qdev_hotplug) {
+        iothread_apply_affinity(iothread);
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+static void iothread_get_host_cpus(Object *obj, Visitor *v,
+        void *opaque, const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    uint16List *host_cpus = NULL;
+    uint16List **cpu = &host_cpus;
+    unsigned long value;
+
+    for (value = find_first_bit(iothread->host_cpus, MAX_HOST_CPUS);
+         value < MAX_HOST_CPUS;
+         value = find_next_bit(iothread->host_cpus, MAX_HOST_CPUS,
+                               value + 1)) {
+        *cpu = g_malloc0(sizeof(**cpu));
+        (*cpu)->value = value;
+        cpu = &(*cpu)->next;
+    }
+
+    visit_type_uint16List(v, &host_cpus, name, errp);
+    qapi_free_uint16List(host_cpus);
+}
+
+static void iothread_set_host_cpus(Object *obj, Visitor *v,
+        void *opaque, const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+    uint16List *host_cpus = NULL, *l;
+
+    visit_type_uint16List(v, &host_cpus, name, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    for (l = host_cpus; l; l = l->next) {
+        if (l->value >= MAX_HOST_CPUS) {
+            error_setg(&local_err, "host CPU %" PRIu16 " is bigger than %d",
+                       l->value, MAX_HOST_CPUS - 1);
+            goto out;
+        }
+    }
+
+    bitmap_zero(iothread->host_cpus, MAX_HOST_CPUS);
+    for (l = host_cpus; l; l = l->next) {
+        set_bit(l->value, iothread->host_cpus);
+    }
+    if (iothread->ctx) {
+        iothread_apply_affinity(iothread);
+    }
+
+out:
+    qapi_free_uint16List(host_cpus);
+    error_propagate(errp, local_err);
+}
+
+static IOThreadParamInfo numa_node_info = {
+    "numa-node", offsetof(IOThread, numa_node),
+};
+
+static void iothread_instance_init(Object *obj)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+    iothread->thread_pool_idle_timeout = THREAD_POOL_IDLE_TIMEOUT_DEFAULT;
+    iothread->thread_pool_node = -1;
+    iothread->numa_node = -1;
+    iothread->placed_node = -1;
+
+    object_property_add(obj, "poll-max-ns", "int",
+                        iothread_get_param,
+                        iothread_set_poll_param,
+                        NULL, &poll_max_ns_info, &error_abort);
+    object_property_add(obj, "poll-grow", "int",
+                        iothread_get_param,
+                        iothread_set_poll_param,
+                        NULL, &poll_grow_info, &error_abort);
+    object_property_add(obj, "poll-shrink", "int",
+                        iothread_get_param,
+                        iothread_set_poll_param,
+                        NULL, &poll_shrink_info, &error_abort);
+    object_property_add(obj, "thread-pool-min", "int",
+                        iothread_get_param,
+                        iothread_set_thread_pool_param,
+                        NULL, &thread_pool_min_info, &error_abort);
+    object_property_add(obj, "thread-pool-max", "int",
+                        iothread_get_param,
+                        iothread_set_thread_pool_param,
+                        NULL, &thread_pool_max_info, &error_abort);
+    object_property_add(obj, "thread-pool-idle-timeout", "int",
+                        iothread_get_param,
+                        iothread_set_thread_pool_param,
+                        NULL, &thread_pool_idle_timeout_info, &error_abort);
+    object_property_add(obj, "thread-pool-node", "int",
+                        iothread_get_param,
+                        iothread_set_thread_pool_param,
+                        NULL, &thread_pool_node_info, &error_abort);
+    object_property_add(obj, "numa-node", "int",
+                        iothread_get_param,
+                        iothread_set_numa_node,
+                        NULL, &numa_node_info, &error_abort);
+    object_property_add(obj, "host-cpus", "uint16List",
+                        iothread_get_host_cpus,
+                        iothread_set_host_cpus,
+                        NULL, NULL, &error_abort);
 }
 
 static void iothread_class_init(ObjectClass *klass, void *class_data)
@@ -107,6 +431,7 @@ static const TypeInfo iothread_info = {
     .parent = TYPE_OBJECT,
     .class_init = iothread_class_init,
     .instance_size = sizeof(IOThread),
+    .instance_init = iothread_instance_init,
     .instance_finalize = iothread_instance_finalize,
     .interfaces = (InterfaceInfo[]) {
         {TYPE_USER_CREATABLE},
@@ -158,6 +483,14 @@ static int query_one_iothread(Object *object, void *opaque)
     info = g_new0(IOThreadInfo, 1);
     info->id = iothread_get_id(iothread);
     info->thread_id = iothread->thread_id;
+    info->poll_max_ns = iothread->poll_max_ns;
+    info->poll_grow = iothread->poll_grow;
+    info->poll_shrink = iothread->poll_shrink;
+    info->poll_ns = atomic_read(&iothread->ctx->poll_ns);
+    info->poll_hits = atomic_read(&iothread->ctx->poll_hits);
+    info->poll_misses = atomic_read(&iothread->ctx->poll_misses);
+    info->numa_node = iothread_numa_node(iothread);
+    info->has_numa_node = info->numa_node >= 0;
 
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
@@ -177,3 +510,55 @@ IOThreadInfoList *qmp_query_iothreads(Error **errp)
     object_child_foreach(container, query_one_iothread, &prev);
     return head;
 }
+
+static void query_one_thread_pool(ThreadPoolInfoList ***prev, const char *id,
+                                  AioContext *ctx)
+{
+    ThreadPoolInfoList *elem;
+    ThreadPoolInfo *info;
+
+    /* Pools are created on first use */
+    if (!ctx->thread_pool) {
+        return;
+    }
+
+    info = thread_pool_get_info(ctx->thread_pool);
+    info->id = g_strdup(id);
+
+    elem = g_new0(ThreadPoolInfoList, 1);
+    elem->value = info;
+    elem->next = NULL;
+
+    **prev = elem;
+    *prev = &elem->next;
+}
+
+static int query_one_iothread_pool(Object *object, void *opaque)
+{
+    ThreadPoolInfoList ***prev = opaque;
+    IOThread *iothread;
+    char *id;
+
+    iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
+    if (!iothread || !iothread->ctx) {
+        return 0;
+    }
+
+    id = iothread_get_id(iothread);
+    aio_context_acquire(iothread->ctx);
+    query_one_thread_pool(prev, id, iothread->ctx);
+    aio_context_release(iothread->ctx);
+    g_free(id);
+    return 0;
+}
+
+ThreadPoolInfoList *qmp_query_thread_pools(Error **errp)
+{
+    ThreadPoolInfoList *head = NULL;
+    ThreadPoolInfoList **prev = &head;
+    Object *container = container_get(object_get_root(), IOTHREADS_PATH);
+
+    query_one_thread_pool(&prev, "main-loop", qemu_get_aio_context());
+    object_child_foreach(container, query_one_iothread_pool, &prev);
+    return head;
+}
@@ -36,6 +36,10 @@
 #include "exec/ram_addr.h"
 #include "exec/address-spaces.h"
 #include "qemu/event_notifier.h"
+#include "qemu/bitops.h"
+#include "qemu/thread.h"
+#include "qemu/rcu.h"
+#include "qemu/rcu_queue.h"
 #include "trace.h"
 
 #include "hw/boards.h"
@@ -59,12 +63,23 @@
 #endif
 
 #define KVM_MSI_HASHTAB_SIZE    256
+/* GSIs kept free, or about to be, by evicting dynamic MSI routes early */
+#define KVM_MSI_GSI_RESERVE     16
+
+/* Dirty log harvesting walks a slot's bitmap in pieces of this many host
+ * pages, so that KVM_CLEAR_DIRTY_LOG only ever holds the kernel's MMU lock
+ * for a bounded time.  Must be a multiple of 64, see KVM_CLEAR_DIRTY_LOG.
+ */
+#define KVM_DIRTY_LOG_CHUNK_PAGES   (1 << 18)
 
 typedef struct KVMSlot
 {
     hwaddr start_addr;
     ram_addr_t memory_size;
     void *ram;
+    ram_addr_t ram_start_offset;
+    /* last bitmap returned by KVM_GET_DIRTY_LOG, allocated on first use */
+    unsigned long *dirty_bmap;
     int slot;
     int flags;
 } KVMSlot;
@@ -77,6 +92,12 @@ struct KVMState
 
     KVMSlot *slots;
     int nr_slots;
+    /* Protects slots, migration_log and the slots' dirty bitmaps.  Taken
+     * inside the BQL by the memory listeners, and without it by
+     * kvm_dirty_log_harvest().
+     */
+    QemuMutex slots_lock;
+    bool manual_dirty_log_protect;
     int fd;
     int vmfd;
     int coalesced_mmio;
@@ -100,11 +121,27 @@ struct KVMState
     unsigned irq_set_ioctl;
     unsigned int sigmask_len;
 #ifdef KVM_CAP_IRQ_ROUTING
+    /* Protects irq_routes, used_gsi_bitmap and updates of the MSI route
+     * cache.  Lookups in msi_hashtab only need RCU.
+     */
+    QemuMutex irq_routes_lock;
     struct kvm_irq_routing *irq_routes;
     int nr_allocated_irq_routes;
     uint32_t *used_gsi_bitmap;
     unsigned int gsi_count;
-    QTAILQ_HEAD(msi_hashtab, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
+    unsigned int nr_free_gsis;
+    QLIST_HEAD(msi_hashtab, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
+    /* Dynamic MSI routes in CLOCK order; the head is the next candidate
+     * for eviction.
+     */
+    QTAILQ_HEAD(msi_lru, KVMMSIRoute) msi_lru;
+    unsigned int nr_msi_routes;
+    /* Evicted routes whose GSI is released after a grace period */
+    unsigned int nr_msi_retiring;
+    uint64_t msi_retired_hits;
+    uint64_t msi_misses;
+    uint64_t msi_evictions;
+    uint64_t irq_route_commits;
     bool direct_msi;
 #endif
 };
@@ -148,7 +185,13 @@ static KVMSlot *kvm_get_free_slot(KVMState *s)
 
 bool kvm_has_free_slot(MachineState *ms)
 {
-    return kvm_get_free_slot(KVM_STATE(ms->accelerator));
+    KVMState *s = KVM_STATE(ms->accelerator);
+    bool ret;
+
+    qemu_mutex_lock(&s->slots_lock);
+    ret = kvm_get_free_slot(s);
+    qemu_mutex_unlock(&s->slots_lock);
+    return ret;
 }
 
 static KVMSlot *kvm_alloc_slot(KVMState *s)
@@ -211,18 +254,21 @@ static KVMSlot *kvm_lookup_overlapping_slot(KVMState *s,
 int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
                                        hwaddr *phys_addr)
 {
-    int i;
+    int i, ret = 0;
 
+    qemu_mutex_lock(&s->slots_lock);
     for (i = 0; i < s->nr_slots; i++) {
         KVMSlot *mem = &s->slots[i];
 
         if (ram >= mem->ram && ram < mem->ram + mem->memory_size) {
             *phys_addr = mem->start_addr + (ram - mem->ram);
-            return 1;
+            ret = 1;
+            break;
         }
     }
+    qemu_mutex_unlock(&s->slots_lock);
 
-    return 0;
+    return ret;
 }
 
 static int kvm_set_user_memory_region(KVMState *s, KVMSlot *slot)
@@ -345,10 +391,13 @@ static int kvm_dirty_pages_log_change(hwaddr phys_addr,
 static void kvm_log_start(MemoryListener *listener,
                           MemoryRegionSection *section)
 {
+    KVMState *s = kvm_state;
     int r;
 
+    qemu_mutex_lock(&s->slots_lock);
     r = kvm_dirty_pages_log_change(section->offset_within_address_space,
                                    int128_get64(section->size), true);
+    qemu_mutex_unlock(&s->slots_lock);
     if (r < 0) {
         abort();
     }
@@ -357,10 +406,13 @@ static void kvm_log_start(MemoryListener *listener,
 static void kvm_log_stop(MemoryListener *listener,
                           MemoryRegionSection *section)
 {
+    KVMState *s = kvm_state;
     int r;
 
+    qemu_mutex_lock(&s->slots_lock);
     r = kvm_dirty_pages_log_change(section->offset_within_address_space,
                                    int128_get64(section->size), false);
+    qemu_mutex_unlock(&s->slots_lock);
     if (r < 0) {
         abort();
     }
@@ -370,8 +422,9 @@ static int kvm_set_migration_log(int enable)
 {
     KVMState *s = kvm_state;
     KVMSlot *mem;
-    int i, err;
+    int i, err = 0;
 
+    qemu_mutex_lock(&s->slots_lock);
     s->migration_log = enable;
 
     for (i = 0; i < s->nr_slots; i++) {
@@ -385,89 +438,138 @@ static int kvm_set_migration_log(int enable)
         }
         err = kvm_set_user_memory_region(s, mem);
         if (err) {
-            return err;
+            break;
         }
     }
-    return 0;
+    qemu_mutex_unlock(&s->slots_lock);
+    return err;
 }
 
-/* get kvm's dirty pages bitmap and update qemu's */
-static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
-                                         unsigned long *bitmap)
+#define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
+
+/* Fetch the dirty log of @mem from KVM and merge it into the dirty memory
+ * bitmaps.  The bitmap is walked in KVM_DIRTY_LOG_CHUNK_PAGES pieces: clean
+ * pieces are skipped, and with manual protection each dirty piece is
+ * write-protected again right after it has been merged.
+ *
+ * Called with the slots lock held.
+ */
+static int kvm_slot_sync_dirty_log(KVMState *s, KVMSlot *mem)
 {
-    ram_addr_t start = section->offset_within_region + section->mr->ram_addr;
-    ram_addr_t pages = int128_get64(section->size) / getpagesize();
+    ram_addr_t pages = mem->memory_size / getpagesize();
+    unsigned long bmap_bits = ALIGN(pages, 64);
+    KVMDirtyLog d = {};
+    ram_addr_t start, end, n;
+
+    /* XXX bad kernel interface alert
+     * For dirty bitmap, kernel allocates array of size aligned to
+     * bits-per-long.  But for case when the kernel is 64bits and
+     * the userspace is 32bits, userspace can't align to the same
+     * bits-per-long, since sizeof(long) is different between kernel
+     * and user space.  This way, userspace will provide buffer which
+     * may be 4 bytes less than the kernel will use, resulting in
+     * userspace memory corruption (which is not detectable by valgrind
+     * too, in most cases).
+     * So for now, let's align to 64 instead of HOST_LONG_BITS here, in
+     * a hope that sizeof(long) wont become >8 any time soon.
+     *
+     * KVM overwrites the whole bitmap, so it need not be cleared.
+     */
+    if (!mem->dirty_bmap) {
+        mem->dirty_bmap = g_malloc(bmap_bits / 8);
+    }
+
+    d.dirty_bitmap = mem->dirty_bmap;
+    d.slot = mem->slot;
+    if (kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d) == -1) {
+        DPRINTF("ioctl failed %d\n", errno);
+        return -1;
+    }
+
+    for (start = 0; start < pages; start += n) {
+        unsigned long *chunk = mem->dirty_bmap + BIT_WORD(start);
+
+        n = MIN(pages - start, KVM_DIRTY_LOG_CHUNK_PAGES);
+        end = start + ALIGN(n, 64);
+        if (find_next_bit(mem->dirty_bmap, end, start) >= end) {
+            continue;
+        }
+
+        cpu_physical_memory_set_dirty_lebitmap(chunk,
+            mem->ram_start_offset + start * getpagesize(), n);
+
+        if (s->manual_dirty_log_protect) {
+            struct kvm_clear_dirty_log c = {
+                .slot = mem->slot,
+                .first_page = start,
+                .num_pages = n,
+                .dirty_bitmap = chunk,
+            };
+
+            if (kvm_vm_ioctl(s, KVM_CLEAR_DIRTY_LOG, &c) < 0) {
+                DPRINTF("KVM_CLEAR_DIRTY_LOG failed %d\n", errno);
+                return -1;
+            }
+        }
+    }
 
-    cpu_physical_memory_set_dirty_lebitmap(bitmap, start, pages);
     return 0;
 }
 
-#define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
-
 /**
  * kvm_physical_sync_dirty_bitmap - Grab dirty bitmap from kernel space
  * This function updates qemu's dirty bitmap using
  * memory_region_set_dirty().  This means all bits are set
  * to dirty.
  *
- * @start_add: start of logged region.
- * @end_addr: end of logged region.
+ * Called with the slots lock held.
+ *
+ * @section: the logged section.
  */
 static int kvm_physical_sync_dirty_bitmap(MemoryRegionSection *section)
 {
     KVMState *s = kvm_state;
-    unsigned long size, allocated_size = 0;
-    KVMDirtyLog d = {};
     KVMSlot *mem;
     int ret = 0;
     hwaddr start_addr = section->offset_within_address_space;
     hwaddr end_addr = start_addr + int128_get64(section->size);
 
-    d.dirty_bitmap = NULL;
     while (start_addr < end_addr) {
         mem = kvm_lookup_overlapping_slot(s, start_addr, end_addr);
         if (mem == NULL) {
             break;
         }
 
-        /* XXX bad kernel interface alert
-         * For dirty bitmap, kernel allocates array of size aligned to
-         * bits-per-long.  But for case when the kernel is 64bits and
-         * the userspace is 32bits, userspace can't align to the same
-         * bits-per-long, since sizeof(long) is different between kernel
-         * and user space.  This way, userspace will provide buffer which
-         * may be 4 bytes less than the kernel will use, resulting in
-         * userspace memory corruption (which is not detectable by valgrind
-         * too, in most cases).
-         * So for now, let's align to 64 instead of HOST_LONG_BITS here, in
-         * a hope that sizeof(long) wont become >8 any time soon.
-         */
-        size = ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
-                     /*HOST_LONG_BITS*/ 64) / 8;
-        if (!d.dirty_bitmap) {
-            d.dirty_bitmap = g_malloc(size);
-        } else if (size > allocated_size) {
-            d.dirty_bitmap = g_realloc(d.dirty_bitmap, size);
-        }
-        allocated_size = size;
-        memset(d.dirty_bitmap, 0, allocated_size);
-
-        d.slot = mem->slot;
-
-        if (kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d) == -1) {
-            DPRINTF("ioctl failed %d\n", errno);
-            ret = -1;
+        ret = kvm_slot_sync_dirty_log(s, mem);
+        if (ret < 0) {
             break;
         }
-
-        kvm_get_dirty_pages_log_range(section, d.dirty_bitmap);
         start_addr = mem->start_addr + mem->memory_size;
     }
-    g_free(d.dirty_bitmap);
 
     return ret;
 }
 
+void kvm_dirty_log_harvest(void)
+{
+    KVMState *s = kvm_state;
+    KVMSlot *mem;
+    int i, r;
+
+    for (i = 0; i < s->nr_slots; i++) {
+        qemu_mutex_lock(&s->slots_lock);
+        mem = &s->slots[i];
+        if (mem->memory_size &&
+            (s->migration_log || (mem->flags & KVM_MEM_LOG_DIRTY_PAGES))) {
+            r = kvm_slot_sync_dirty_log(s, mem);
+            if (r < 0) {
+                abort();
+            }
+        }
+        qemu_mutex_unlock(&s->slots_lock);
+    }
+}
+
 static void kvm_coalesce_mmio_region(MemoryListener *listener,
                                      MemoryRegionSection *secion,
                                      hwaddr start, hwaddr size)
@@ -636,6 +738,7 @@ kvm_check_extension_list(KVMState *s, const KVMCapabilityInfo *list)
     return NULL;
 }
 
+/* Called with the slots lock held */
 static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
 {
     KVMState *s = kvm_state;
@@ -648,6 +751,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
     hwaddr start_addr = section->offset_within_address_space;
     ram_addr_t size = int128_get64(section->size);
     void *ram = NULL;
+    ram_addr_t ram_start_offset;
     unsigned delta;
 
     /* kvm works in page size chunks, but the function may be called
@@ -676,6 +780,8 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
     }
 
     ram = memory_region_get_ram_ptr(mr) + section->offset_within_region + delta;
+    ram_start_offset = memory_region_get_ram_addr(mr) +
+                       section->offset_within_region + delta;
 
     while (1) {
         mem = kvm_lookup_overlapping_slot(s, start_addr, start_addr + size);
@@ -694,11 +800,13 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
 
         old = *mem;
 
-        if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-            kvm_physical_sync_dirty_bitmap(section);
+        if ((mem->flags & KVM_MEM_LOG_DIRTY_PAGES) || s->migration_log) {
+            kvm_slot_sync_dirty_log(s, mem);
         }
 
         /* unregister the overlapping slot */
+        g_free(mem->dirty_bmap);
+        mem->dirty_bmap = NULL;
         mem->memory_size = 0;
         err = kvm_set_user_memory_region(s, mem);
         if (err) {
@@ -721,6 +829,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
             mem->memory_size = old.memory_size;
             mem->start_addr = old.start_addr;
             mem->ram = old.ram;
+            mem->ram_start_offset = ram_start_offset;
             mem->flags = kvm_mem_flags(s, log_dirty, readonly_flag);
 
             err = kvm_set_user_memory_region(s, mem);
@@ -732,6 +841,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
 
             start_addr += old.memory_size;
             ram += old.memory_size;
+            ram_start_offset += old.memory_size;
             size -= old.memory_size;
             continue;
         }
@@ -742,6 +852,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
             mem->memory_size = start_addr - old.start_addr;
             mem->start_addr = old.start_addr;
             mem->ram = old.ram;
+            mem->ram_start_offset = old.ram_start_offset;
             mem->flags =  kvm_mem_flags(s, log_dirty, readonly_flag);
 
             err = kvm_set_user_memory_region(s, mem);
@@ -766,6 +877,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
             size_delta = mem->start_addr - old.start_addr;
             mem->memory_size = old.memory_size - size_delta;
             mem->ram = old.ram + size_delta;
+            mem->ram_start_offset = old.ram_start_offset + size_delta;
             mem->flags = kvm_mem_flags(s, log_dirty, readonly_flag);
 
             err = kvm_set_user_memory_region(s, mem);
@@ -788,6 +900,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
     mem->memory_size = size;
     mem->start_addr = start_addr;
     mem->ram = ram;
+    mem->ram_start_offset = ram_start_offset;
     mem->flags = kvm_mem_flags(s, log_dirty, readonly_flag);
 
     err = kvm_set_user_memory_region(s, mem);
@@ -801,23 +914,34 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
 static void kvm_region_add(MemoryListener *listener,
                            MemoryRegionSection *section)
 {
+    KVMState *s = kvm_state;
+
     memory_region_ref(section->mr);
+    qemu_mutex_lock(&s->slots_lock);
     kvm_set_phys_mem(section, true);
+    qemu_mutex_unlock(&s->slots_lock);
 }
 
 static void kvm_region_del(MemoryListener *listener,
                            MemoryRegionSection *section)
 {
+    KVMState *s = kvm_state;
+
+    qemu_mutex_lock(&s->slots_lock);
     kvm_set_phys_mem(section, false);
+    qemu_mutex_unlock(&s->slots_lock);
     memory_region_unref(section->mr);
 }
 
 static void kvm_log_sync(MemoryListener *listener,
                          MemoryRegionSection *section)
 {
+    KVMState *s = kvm_state;
     int r;
 
+    qemu_mutex_lock(&s->slots_lock);
     r = kvm_physical_sync_dirty_bitmap(section);
+    qemu_mutex_unlock(&s->slots_lock);
     if (r < 0) {
         abort();
     }
@@ -957,19 +1081,40 @@ int kvm_set_irq(KVMState *s, int irq, int level)
 }
 
 #ifdef KVM_CAP_IRQ_ROUTING
+/* A dynamic route, used to inject MSIs when KVM_SIGNAL_MSI is missing.
+ *
+ * Senders find routes in msi_hashtab and inject through the route's GSI
+ * within one RCU critical section.  Eviction unpublishes the route and
+ * only releases the GSI after a grace period, so that a sender never
+ * injects through a GSI that was reprogrammed for another message.
+ */
 typedef struct KVMMSIRoute {
+    struct rcu_head rcu;
     struct kvm_irq_routing_entry kroute;
-    QTAILQ_ENTRY(KVMMSIRoute) entry;
+    QLIST_ENTRY(KVMMSIRoute) entry;
+    QTAILQ_ENTRY(KVMMSIRoute) lru;
+    bool referenced;
+    uint64_t hits;
 } KVMMSIRoute;
 
 static void set_gsi(KVMState *s, unsigned int gsi)
 {
-    s->used_gsi_bitmap[gsi / 32] |= 1U << (gsi % 32);
+    uint32_t bit = 1U << (gsi % 32);
+
+    if (!(s->used_gsi_bitmap[gsi / 32] & bit)) {
+        s->used_gsi_bitmap[gsi / 32] |= bit;
+        s->nr_free_gsis--;
+    }
 }
 
 static void clear_gsi(KVMState *s, unsigned int gsi)
 {
-    s->used_gsi_bitmap[gsi / 32] &= ~(1U << (gsi % 32));
+    uint32_t bit = 1U << (gsi % 32);
+
+    if (s->used_gsi_bitmap[gsi / 32] & bit) {
+        s->used_gsi_bitmap[gsi / 32] &= ~bit;
+        s->nr_free_gsis++;
+    }
 }
 
 void kvm_init_irq_routing(KVMState *s)
@@ -984,6 +1129,7 @@ void kvm_init_irq_routing(KVMState *s)
         gsi_bits = ALIGN(gsi_count, 32);
         s->used_gsi_bitmap = g_malloc0(gsi_bits / 8);
         s->gsi_count = gsi_count;
+        s->nr_free_gsis = gsi_bits;
 
         /* Mark any over-allocated bits as already in use */
         for (i = gsi_count; i < gsi_bits; i++) {
@@ -993,23 +1139,34 @@ void kvm_init_irq_routing(KVMState *s)
 
     s->irq_routes = g_malloc0(sizeof(*s->irq_routes));
     s->nr_allocated_irq_routes = 0;
+    qemu_mutex_init(&s->irq_routes_lock);
 
     if (!s->direct_msi) {
         for (i = 0; i < KVM_MSI_HASHTAB_SIZE; i++) {
-            QTAILQ_INIT(&s->msi_hashtab[i]);
+            QLIST_INIT(&s->msi_hashtab[i]);
         }
+        QTAILQ_INIT(&s->msi_lru);
     }
 
     kvm_arch_init_irq_routing(s);
 }
 
-void kvm_irqchip_commit_routes(KVMState *s)
+/* Called with the routes lock held */
+static void kvm_commit_routes_locked(KVMState *s)
 {
     int ret;
 
     s->irq_routes->flags = 0;
     ret = kvm_vm_ioctl(s, KVM_SET_GSI_ROUTING, s->irq_routes);
     assert(ret == 0);
+    s->irq_route_commits++;
+}
+
+void kvm_irqchip_commit_routes(KVMState *s)
+{
+    qemu_mutex_lock(&s->irq_routes_lock);
+    kvm_commit_routes_locked(s);
+    qemu_mutex_unlock(&s->irq_routes_lock);
 }
 
 static void kvm_add_routing_entry(KVMState *s,
@@ -1054,7 +1211,7 @@ static int kvm_update_routing_entry(KVMState *s,
 
         *entry = *new_entry;
 
-        kvm_irqchip_commit_routes(s);
+        kvm_commit_routes_locked(s);
 
         return 0;
     }
@@ -1073,18 +1230,17 @@ void kvm_irqchip_add_irq_route(KVMState *s, int irq, int irqchip, int pin)
     e.flags = 0;
     e.u.irqchip.irqchip = irqchip;
     e.u.irqchip.pin = pin;
+    qemu_mutex_lock(&s->irq_routes_lock);
     kvm_add_routing_entry(s, &e);
+    qemu_mutex_unlock(&s->irq_routes_lock);
 }
 
-void kvm_irqchip_release_virq(KVMState *s, int virq)
+/* Called with the routes lock held */
+static void kvm_release_virq_locked(KVMState *s, int virq)
 {
     struct kvm_irq_routing_entry *e;
     int i;
 
-    if (kvm_gsi_direct_mapping()) {
-        return;
-    }
-
     for (i = 0; i < s->irq_routes->nr; i++) {
         e = &s->irq_routes->entries[i];
         if (e->gsi == virq) {
@@ -1095,6 +1251,17 @@ void kvm_irqchip_release_virq(KVMState *s, int virq)
     clear_gsi(s, virq);
 }
 
+void kvm_irqchip_release_virq(KVMState *s, int virq)
+{
+    if (kvm_gsi_direct_mapping()) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->irq_routes_lock);
+    kvm_release_virq_locked(s, virq);
+    qemu_mutex_unlock(&s->irq_routes_lock);
+}
+
 static unsigned int kvm_hash_msi(uint32_t data)
 {
     /* This is optimized for IA32 MSI layout. However, no other arch shall
@@ -1102,28 +1269,75 @@ static unsigned int kvm_hash_msi(uint32_t data)
     return data & 0xff;
 }
 
-static void kvm_flush_dynamic_msi_routes(KVMState *s)
+static void kvm_msi_route_free(KVMMSIRoute *route)
 {
-    KVMMSIRoute *route, *next;
-    unsigned int hash;
+    KVMState *s = kvm_state;
 
-    for (hash = 0; hash < KVM_MSI_HASHTAB_SIZE; hash++) {
-        QTAILQ_FOREACH_SAFE(route, &s->msi_hashtab[hash], entry, next) {
-            kvm_irqchip_release_virq(s, route->kroute.gsi);
-            QTAILQ_REMOVE(&s->msi_hashtab[hash], route, entry);
-            g_free(route);
+    qemu_mutex_lock(&s->irq_routes_lock);
+    kvm_release_virq_locked(s, route->kroute.gsi);
+    s->nr_msi_retiring--;
+    qemu_mutex_unlock(&s->irq_routes_lock);
+    g_free(route);
+}
+
+/* Evict the least recently used dynamic MSI route.  Uses the CLOCK
+ * approximation of LRU: senders only set @referenced, and a referenced
+ * route gets a second chance at the tail of the list.
+ *
+ * The GSI is released once the senders that may still hold the route
+ * are done, i.e. after a grace period.  Senders run in RCU critical
+ * sections, often in the middle of address_space_rw, so we cannot wait
+ * for the grace period here.
+ *
+ * Called with the routes lock held.  Returns false if there is no
+ * dynamic route to evict.
+ */
+static bool kvm_evict_msi_route(KVMState *s)
+{
+    KVMMSIRoute *route;
+    unsigned int scanned = 0;
+
+    while ((route = QTAILQ_FIRST(&s->msi_lru)) != NULL) {
+        QTAILQ_REMOVE(&s->msi_lru, route, lru);
+        /* Bound the scan in case senders keep setting the bits */
+        if (atomic_read(&route->referenced) &&
+            scanned++ < 2 * s->nr_msi_routes) {
+            atomic_set(&route->referenced, false);
+            QTAILQ_INSERT_TAIL(&s->msi_lru, route, lru);
+            continue;
         }
+        break;
     }
+    if (!route) {
+        return false;
+    }
+
+    QLIST_REMOVE_RCU(route, entry);
+    s->nr_msi_routes--;
+    s->nr_msi_retiring++;
+    s->msi_evictions++;
+    s->msi_retired_hits += atomic_read(&route->hits);
+    trace_kvm_msi_route_evict(route->kroute.gsi);
+    call_rcu(route, kvm_msi_route_free, rcu);
+    return true;
 }
 
+/* Called with the routes lock held */
 static int kvm_irqchip_get_virq(KVMState *s)
 {
     uint32_t *word = s->used_gsi_bitmap;
     int max_words = ALIGN(s->gsi_count, 32) / 32;
     int i, bit;
-    bool retry = true;
 
-again:
+    /* Evicted GSIs only come back after a grace period, so start evicting
+     * before the bitmap runs out.
+     */
+    while (!s->direct_msi &&
+           s->nr_free_gsis + s->nr_msi_retiring <= KVM_MSI_GSI_RESERVE &&
+           kvm_evict_msi_route(s)) {
+        /* nothing */
+    }
+
     /* Return the lowest unused GSI in the bitmap */
     for (i = 0; i < max_words; i++) {
         bit = ffs(~word[i]);
@@ -1133,13 +1347,8 @@ again:
 
         return bit - 1 + i * 32;
     }
-    if (!s->direct_msi && retry) {
-        retry = false;
-        kvm_flush_dynamic_msi_routes(s);
-        goto again;
-    }
-    return -ENOSPC;
 
+    return -ENOSPC;
 }
 
 static KVMMSIRoute *kvm_lookup_msi_route(KVMState *s, MSIMessage msg)
@@ -1147,7 +1356,7 @@ static KVMMSIRoute *kvm_lookup_msi_route(KVMState *s, MSIMessage msg)
     unsigned int hash = kvm_hash_msi(msg.data);
     KVMMSIRoute *route;
 
-    QTAILQ_FOREACH(route, &s->msi_hashtab[hash], entry) {
+    QLIST_FOREACH_RCU(route, &s->msi_hashtab[hash], entry) {
         if (route->kroute.u.msi.address_lo == (uint32_t)msg.address &&
             route->kroute.u.msi.address_hi == (msg.address >> 32) &&
             route->kroute.u.msi.data == le32_to_cpu(msg.data)) {
@@ -1157,10 +1366,34 @@ static KVMMSIRoute *kvm_lookup_msi_route(KVMState *s, MSIMessage msg)
     return NULL;
 }
 
+/* Inject through a cached route.  Returns -EAGAIN if there is no route
+ * for @msg.  An evicted route keeps its GSI until the end of the critical
+ * section.
+ */
+static int kvm_send_msi_cached(KVMState *s, MSIMessage msg)
+{
+    KVMMSIRoute *route;
+    int ret = -EAGAIN;
+
+    rcu_read_lock();
+    route = kvm_lookup_msi_route(s, msg);
+    if (route) {
+        if (!atomic_read(&route->referenced)) {
+            atomic_set(&route->referenced, true);
+        }
+        atomic_inc(&route->hits);
+        ret = kvm_set_irq(s, route->kroute.gsi, 1);
+    }
+    rcu_read_unlock();
+
+    return ret;
+}
+
 int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
 {
     struct kvm_msi msi;
     KVMMSIRoute *route;
+    int ret;
 
     if (s->direct_msi) {
         msi.address_lo = (uint32_t)msg.address;
@@ -1172,12 +1405,22 @@ int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
         return kvm_vm_ioctl(s, KVM_SIGNAL_MSI, &msi);
     }
 
+    ret = kvm_send_msi_cached(s, msg);
+    if (ret != -EAGAIN) {
+        return ret;
+    }
+
+    qemu_mutex_lock(&s->irq_routes_lock);
+    /* Another sender may have added the route meanwhile */
+    rcu_read_lock();
     route = kvm_lookup_msi_route(s, msg);
+    rcu_read_unlock();
     if (!route) {
         int virq;
 
         virq = kvm_irqchip_get_virq(s);
         if (virq < 0) {
+            qemu_mutex_unlock(&s->irq_routes_lock);
             return virq;
         }
 
@@ -1189,16 +1432,54 @@ int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
         route->kroute.u.msi.address_hi = msg.address >> 32;
         route->kroute.u.msi.data = le32_to_cpu(msg.data);
 
+        /* KVM_SET_GSI_ROUTING always takes the whole table, but only this
+         * entry and the one evicted for it, if any, changed.
+         */
         kvm_add_routing_entry(s, &route->kroute);
-        kvm_irqchip_commit_routes(s);
+        kvm_commit_routes_locked(s);
 
-        QTAILQ_INSERT_TAIL(&s->msi_hashtab[kvm_hash_msi(msg.data)], route,
-                           entry);
+        QTAILQ_INSERT_TAIL(&s->msi_lru, route, lru);
+        QLIST_INSERT_HEAD_RCU(&s->msi_hashtab[kvm_hash_msi(msg.data)], route,
+                              entry);
+        s->nr_msi_routes++;
+        s->msi_misses++;
+        trace_kvm_msi_route_add(virq, msg.address, le32_to_cpu(msg.data));
     }
 
     assert(route->kroute.type == KVM_IRQ_ROUTING_MSI);
 
-    return kvm_set_irq(s, route->kroute.gsi, 1);
+    /* The route cannot be evicted while we hold the lock */
+    ret = kvm_set_irq(s, route->kroute.gsi, 1);
+    qemu_mutex_unlock(&s->irq_routes_lock);
+    return ret;
+}
+
+KvmMsiRouteInfo *kvm_msi_route_info(void)
+{
+    KVMState *s = kvm_state;
+    KvmMsiRouteInfo *info;
+    KVMMSIRoute *route;
+
+    if (!kvm_gsi_routing_enabled()) {
+        return NULL;
+    }
+
+    info = g_malloc0(sizeof(*info));
+    qemu_mutex_lock(&s->irq_routes_lock);
+    info->direct = s->direct_msi;
+    info->routes = s->nr_msi_routes;
+    info->hits = s->msi_retired_hits;
+    if (!s->direct_msi) {
+        QTAILQ_FOREACH(route, &s->msi_lru, lru) {
+            info->hits += atomic_read(&route->hits);
+        }
+    }
+    info->misses = s->msi_misses;
+    info->evictions = s->msi_evictions;
+    info->commits = s->irq_route_commits;
+    qemu_mutex_unlock(&s->irq_routes_lock);
+
+    return info;
 }
 
 int kvm_irqchip_add_msi_route(KVMState *s, MSIMessage msg)
@@ -1214,9 +1495,10 @@ int kvm_irqchip_add_msi_route(KVMState *s, MSIMessage msg)
         return -ENOSYS;
     }
 
+    qemu_mutex_lock(&s->irq_routes_lock);
     virq = kvm_irqchip_get_virq(s);
     if (virq < 0) {
-        return virq;
+        goto out;
     }
 
     kroute.gsi = virq;
@@ -1226,19 +1508,23 @@ int kvm_irqchip_add_msi_route(KVMState *s, MSIMessage msg)
     kroute.u.msi.address_hi = msg.address >> 32;
     kroute.u.msi.data = le32_to_cpu(msg.data);
     if (kvm_arch_fixup_msi_route(&kroute, msg.address, msg.data)) {
-        kvm_irqchip_release_virq(s, virq);
-        return -EINVAL;
+        kvm_release_virq_locked(s, virq);
+        virq = -EINVAL;
+        goto out;
     }
 
     kvm_add_routing_entry(s, &kroute);
-    kvm_irqchip_commit_routes(s);
+    kvm_commit_routes_locked(s);
 
+out:
+    qemu_mutex_unlock(&s->irq_routes_lock);
     return virq;
 }
 
 int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg)
 {
     struct kvm_irq_routing_entry kroute = {};
+    int ret;
 
     if (kvm_gsi_direct_mapping()) {
         return 0;
@@ -1258,7 +1544,10 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg)
         return -EINVAL;
     }
 
-    return kvm_update_routing_entry(s, &kroute);
+    qemu_mutex_lock(&s->irq_routes_lock);
+    ret = kvm_update_routing_entry(s, &kroute);
+    qemu_mutex_unlock(&s->irq_routes_lock);
+    return ret;
 }
 
 static int kvm_irqchip_assign_irqfd(KVMState *s, int fd, int rfd, int virq,
@@ -1291,8 +1580,10 @@ int kvm_irqchip_add_adapter_route(KVMState *s, AdapterInfo *adapter)
         return -ENOSYS;
     }
 
+    qemu_mutex_lock(&s->irq_routes_lock);
     virq = kvm_irqchip_get_virq(s);
     if (virq < 0) {
+        qemu_mutex_unlock(&s->irq_routes_lock);
         return virq;
     }
 
@@ -1306,7 +1597,8 @@ int kvm_irqchip_add_adapter_route(KVMState *s, AdapterInfo *adapter)
     kroute.u.adapter.adapter_id = adapter->adapter_id;
 
     kvm_add_routing_entry(s, &kroute);
-    kvm_irqchip_commit_routes(s);
+    kvm_commit_routes_locked(s);
+    qemu_mutex_unlock(&s->irq_routes_lock);
 
     return virq;
 }
@@ -1345,6 +1637,11 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg)
 {
     return -ENOSYS;
 }
+
+KvmMsiRouteInfo *kvm_msi_route_info(void)
+{
+    return NULL;
+}
 #endif /* !KVM_CAP_IRQ_ROUTING */
 
 int kvm_irqchip_add_irqfd_notifier(KVMState *s, EventNotifier *n,
@@ -1479,6 +1776,7 @@ static int kvm_init(MachineState *ms)
     }
 
     s->slots = g_malloc0(s->nr_slots * sizeof(KVMSlot));
+    qemu_mutex_init(&s->slots_lock);
 
     for (i = 0; i < s->nr_slots; i++) {
         s->slots[i].slot = i;
@@ -1598,6 +1896,17 @@ static int kvm_init(MachineState *ms)
     kvm_resamplefds_allowed =
         (kvm_check_extension(s, KVM_CAP_IRQFD_RESAMPLE) > 0);
 
+    ret = kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2);
+    if (ret > 0) {
+        /* Let KVM report every page dirty when logging starts instead of
+         * write-protecting all of guest memory up front.
+         */
+        ret = kvm_vm_enable_cap(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2, 0,
+                                ret & (KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE |
+                                       KVM_DIRTY_LOG_INITIALLY_SET));
+        s->manual_dirty_log_protect = (ret == 0);
+    }
+
     ret = kvm_arch_init(s);
     if (ret < 0) {
         goto err;
@@ -1749,9 +2058,91 @@ void kvm_cpu_clean_state(CPUState *cpu)
     cpu->kvm_vcpu_dirty = false;
 }
 
+/* Exits other than PIO and MMIO are handled with the global mutex held */
+static int kvm_handle_exit_locked(CPUState *cpu, struct kvm_run *run)
+{
+    int ret;
+
+    switch (run->exit_reason) {
+    case KVM_EXIT_IRQ_WINDOW_OPEN:
+        DPRINTF("irq_window_open\n");
+        ret = EXCP_INTERRUPT;
+        break;
+    case KVM_EXIT_SHUTDOWN:
+        DPRINTF("shutdown\n");
+        qemu_system_reset_request();
+        ret = EXCP_INTERRUPT;
+        break;
+    case KVM_EXIT_UNKNOWN:
+        fprintf(stderr, "KVM: unknown exit, hardware reason %" PRIx64 "\n",
+                (uint64_t)run->hw.hardware_exit_reason);
+        ret = -1;
+        break;
+    case KVM_EXIT_INTERNAL_ERROR:
+        ret = kvm_handle_internal_error(cpu, run);
+        break;
+    case KVM_EXIT_SYSTEM_EVENT:
+        switch (run->system_event.type) {
+        case KVM_SYSTEM_EVENT_SHUTDOWN:
+            qemu_system_shutdown_request();
+            ret = EXCP_INTERRUPT;
+            break;
+        case KVM_SYSTEM_EVENT_RESET:
+            qemu_system_reset_request();
+            ret = EXCP_INTERRUPT;
+            break;
+        default:
+            DPRINTF("kvm_arch_handle_exit\n");
+            ret = kvm_arch_handle_exit(cpu, run);
+            break;
+        }
+        break;
+    default:
+        DPRINTF("kvm_arch_handle_exit\n");
+        ret = kvm_arch_handle_exit(cpu, run);
+        break;
+    }
+    return ret;
+}
+
+static VcpuExitReason kvm_exit_reason(struct kvm_run *run, int run_ret)
+{
+    if (run_ret < 0) {
+        return run_ret == -EINTR || run_ret == -EAGAIN ?
+               VCPU_EXIT_REASON_INTERRUPT : VCPU_EXIT_REASON_INTERNAL_ERROR;
+    }
+
+    switch (run->exit_reason) {
+    case KVM_EXIT_IO:
+        return VCPU_EXIT_REASON_IO;
+    case KVM_EXIT_MMIO:
+        return VCPU_EXIT_REASON_MMIO;
+    case KVM_EXIT_HLT:
+        return VCPU_EXIT_REASON_HALT;
+    case KVM_EXIT_IRQ_WINDOW_OPEN:
+        return VCPU_EXIT_REASON_IRQ_WINDOW;
+    case KVM_EXIT_INTR:
+        return VCPU_EXIT_REASON_INTERRUPT;
+    case KVM_EXIT_SHUTDOWN:
+        return VCPU_EXIT_REASON_SHUTDOWN;
+    case KVM_EXIT_SYSTEM_EVENT:
+        return VCPU_EXIT_REASON_SYSTEM_EVENT;
+    case KVM_EXIT_DEBUG:
+        return VCPU_EXIT_REASON_DEBUG;
+    case KVM_EXIT_UNKNOWN:
+    case KVM_EXIT_FAIL_ENTRY:
+    case KVM_EXIT_INTERNAL_ERROR:
+        return VCPU_EXIT_REASON_INTERNAL_ERROR;
+    default:
+        return VCPU_EXIT_REASON_OTHER;
+    }
+}
+
 int kvm_cpu_exec(CPUState *cpu)
 {
     struct kvm_run *run = cpu->kvm_run;
+    int64_t entry_time = 0, exit_time = 0;
+    bool stats;
     int ret, run_ret;
 
     DPRINTF("kvm_cpu_exec()\n");
@@ -1761,6 +2152,13 @@ int kvm_cpu_exec(CPUState *cpu)
         return EXCP_HLT;
     }
 
+    /* The run loop does not hold the global mutex.  kvm_arch_pre_run and
+     * kvm_arch_post_run take it where they touch device state; PIO and MMIO
+     * exits are dispatched under RCU, and the memory core takes the mutex
+     * for the regions that need it.
+     */
+    qemu_mutex_unlock_iothread();
+
     do {
         if (cpu->kvm_vcpu_dirty) {
             kvm_arch_put_registers(cpu, KVM_PUT_RUNTIME_STATE);
@@ -1777,11 +2175,18 @@ int kvm_cpu_exec(CPUState *cpu)
              */
             qemu_cpu_kick_self();
         }
-        qemu_mutex_unlock_iothread();
 
+        stats = cpu_stats_enabled;
+        if (stats) {
+            entry_time = get_clock();
+        }
         run_ret = kvm_vcpu_ioctl(cpu, KVM_RUN, 0);
+        if (stats) {
+            exit_time = get_clock();
+            cpu_stats_account_exit(cpu, kvm_exit_reason(run, run_ret),
+                                   exit_time - entry_time);
+        }
 
-        qemu_mutex_lock_iothread();
         kvm_arch_post_run(cpu, run);
 
         if (run_ret < 0) {
@@ -1800,6 +2205,9 @@ int kvm_cpu_exec(CPUState *cpu)
         switch (run->exit_reason) {
         case KVM_EXIT_IO:
             DPRINTF("handle_io\n");
+            if (stats) {
+                cpu_stats_account_io(cpu, run->io.port, true);
+            }
             kvm_handle_io(run->io.port,
                           (uint8_t *)run + run->io.data_offset,
                           run->io.direction,
@@ -1809,52 +2217,28 @@ int kvm_cpu_exec(CPUState *cpu)
             break;
         case KVM_EXIT_MMIO:
             DPRINTF("handle_mmio\n");
+            if (stats) {
+                cpu_stats_account_io(cpu, run->mmio.phys_addr, false);
+            }
             cpu_physical_memory_rw(run->mmio.phys_addr,
                                    run->mmio.data,
                                    run->mmio.len,
                                    run->mmio.is_write);
             ret = 0;
             break;
-        case KVM_EXIT_IRQ_WINDOW_OPEN:
-            DPRINTF("irq_window_open\n");
-            ret = EXCP_INTERRUPT;
-            break;
-        case KVM_EXIT_SHUTDOWN:
-            DPRINTF("shutdown\n");
-            qemu_system_reset_request();
-            ret = EXCP_INTERRUPT;
-            break;
-        case KVM_EXIT_UNKNOWN:
-            fprintf(stderr, "KVM: unknown exit, hardware reason %" PRIx64 "\n",
-                    (uint64_t)run->hw.hardware_exit_reason);
-            ret = -1;
-            break;
-        case KVM_EXIT_INTERNAL_ERROR:
-            ret = kvm_handle_internal_error(cpu, run);
-            break;
-        case KVM_EXIT_SYSTEM_EVENT:
-            switch (run->system_event.type) {
-            case KVM_SYSTEM_EVENT_SHUTDOWN:
-                qemu_system_shutdown_request();
-                ret = EXCP_INTERRUPT;
-                break;
-            case KVM_SYSTEM_EVENT_RESET:
-                qemu_system_reset_request();
-                ret = EXCP_INTERRUPT;
-                break;
-            default:
-                DPRINTF("kvm_arch_handle_exit\n");
-                ret = kvm_arch_handle_exit(cpu, run);
-                break;
-            }
-            break;
         default:
-            DPRINTF("kvm_arch_handle_exit\n");
-            ret = kvm_arch_handle_exit(cpu, run);
+            qemu_mutex_lock_iothread();
+            ret = kvm_handle_exit_locked(cpu, run);
+            qemu_mutex_unlock_iothread();
             break;
         }
+        if (stats) {
+            cpu_stats_account_emulation(cpu, get_clock() - exit_time);
+        }
     } while (ret == 0);
 
+    qemu_mutex_lock_iothread();
+
     if (ret < 0) {
         cpu_dump_state(cpu, stderr, fprintf, CPU_DUMP_CODE);
         vm_stop(RUN_STATE_INTERNAL_ERROR);
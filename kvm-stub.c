@@ -152,4 +152,13 @@ bool kvm_has_free_slot(MachineState *ms)
 {
     return false;
 }
+
+void kvm_dirty_log_harvest(void)
+{
+}
+
+KvmMsiRouteInfo *kvm_msi_route_info(void)
+{
+    return NULL;
+}
 #endif
@@ -575,6 +575,7 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
     printf("\n");
 #endif
     tb_invalidate_phys_range(start, start + len, 0);
+    tb_cache_map(start, len, prot, flags, fd, offset);
     mmap_unlock();
     return start;
 fail:
@@ -680,6 +681,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
     if (ret == 0) {
         page_set_flags(start, start + len, 0);
         tb_invalidate_phys_range(start, start + len, 0);
+        tb_cache_unmap(start, len);
     }
     mmap_unlock();
     return ret;
@@ -757,6 +759,7 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
         prot = page_get_flags(old_addr);
         page_set_flags(old_addr, old_addr + old_size, 0);
         page_set_flags(new_addr, new_addr + new_size, prot | PAGE_VALID);
+        tb_cache_unmap(old_addr, old_size);
     }
     tb_invalidate_phys_range(new_addr, new_addr + new_size, 0);
     mmap_unlock();
@@ -0,0 +1,723 @@
+/*
+ * Persistent translation cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "qemu.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "exec/exec-all.h"
+#include "tcg.h"
+
+/* Translated code is saved per file mapping: every readable and
+ * executable file mapping of the guest gets a cache file, named after a
+ * hash of the identity of the mapped file (device, inode, size and
+ * modification time), of the file offset, of the mapping's address and
+ * of everything else that the translation depends on.  The mapped bytes
+ * are not hashed, so that mapping a large library costs no more than a
+ * stat.  The cache file is mapped when the guest maps the executable
+ * segment, and its index is only built when a TB is first looked up in
+ * the segment.
+ *
+ * A record holds the guest code of the TB, which is compared with guest
+ * memory when the record is loaded: code that was patched, e.g. by the
+ * dynamic linker, modified by the guest in an earlier run, or changed in
+ * the file without changing its identity does not match and is
+ * translated again.  Stale records are dropped when the
+ * cache file is rewritten.  Modifications made after loading are
+ * handled by the usual TB invalidation.
+ *
+ * Host addresses in the code are recorded by the TCG backend as
+ * TCGCodeRelocs, and saved relative to the TB, to the prologue or to the
+ * QEMU executable.  TBs that embed other host addresses are not saved.
+ * The code is copied back with the relocations applied; if a
+ * pc-relative displacement no longer fits, the TB is translated again.
+ *
+ * New records are kept in memory and written out, together with the
+ * records that are still valid, when the guest unmaps the segment, execs
+ * or exits.  Cache files are replaced atomically; concurrent processes
+ * can lose each other's additions but never see a partial file.
+ */
+
+#if defined(TCG_TARGET_CODE_RELOC) && defined(TARGET_INSN_START_EXTRA_WORDS)
+#define TB_CACHE_SUPPORTED
+#endif
+
+#define TB_CACHE_MAGIC      "QEMUTBC"
+#define TB_CACHE_VERSION    1
+#define TB_CACHE_KEY_LEN    20      /* SHA-1 */
+
+/* the prologue takes the last 1024 bytes of the code buffer, see
+   code_gen_alloc() */
+#define TB_CACHE_PROLOGUE_SIZE 1024
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_records;
+    uint8_t key[TB_CACHE_KEY_LEN];
+    uint8_t pad[4];
+} TBCacheHeader;
+
+/* Followed by the relocations, the guest code, and the host code with its
+ * search data.  Records are 8-byte aligned.
+ */
+typedef struct TBCacheRecord {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t flags;
+    uint32_t len;                   /* of the whole record */
+    uint16_t size;                  /* of the guest code */
+    uint16_t icount;
+    uint32_t code_size;
+    uint32_t search_size;
+    uint16_t tb_next_offset[2];
+    uint16_t tb_jmp_offset[2];
+    uint32_t nb_relocs;
+    uint32_t pad;
+} TBCacheRecord;
+
+enum {
+    TB_CACHE_BASE_TB,               /* the TranslationBlock */
+    TB_CACHE_BASE_PROLOGUE,         /* tcg_ctx.code_gen_prologue */
+    TB_CACHE_BASE_IMAGE,            /* the QEMU executable */
+};
+
+typedef struct TBCacheReloc {
+    uint32_t offset;
+    uint8_t type;                   /* TCGCodeRelocType */
+    uint8_t base;                   /* TB_CACHE_BASE_* */
+    uint16_t pad;
+    int64_t addend;
+} TBCacheReloc;
+
+typedef struct TBCacheFile {
+    char *path;
+    uint8_t key[TB_CACHE_KEY_LEN];
+    void *map;                      /* the cache file, or NULL */
+    size_t map_size;
+    GHashTable *index;              /* records by pc, cs_base and flags */
+    GPtrArray *added;               /* records of this run */
+    bool dirty;
+    int refcnt;                     /* segments that use the file */
+} TBCacheFile;
+
+/* The guest range covered by a cache file.  A mapping that is partly
+ * replaced, e.g. by the MAP_FIXED data mapping of the dynamic linker,
+ * keeps the rest of its range; splitting it in two gives two segments
+ * that share the file.
+ */
+typedef struct TBCacheSegment TBCacheSegment;
+
+struct TBCacheSegment {
+    abi_ulong start;
+    abi_ulong end;
+    TBCacheFile *file;
+    QTAILQ_ENTRY(TBCacheSegment) entry;
+};
+
+#ifdef TB_CACHE_SUPPORTED
+/* The lock nests inside tb_lock and mmap_lock; every caller holds one of
+ * them, so that fork_start() cannot fork while the lock is taken.
+ */
+static QemuMutex tb_cache_lock;
+static char *tb_cache_dir;
+static uint8_t tb_cache_build_key[TB_CACHE_KEY_LEN];
+static QTAILQ_HEAD(, TBCacheSegment) tb_cache_segments =
+    QTAILQ_HEAD_INITIALIZER(tb_cache_segments);
+
+/* provided by the linker */
+extern const char __executable_start[], etext[];
+
+static void tb_cache_checksum_str(GChecksum *cs, const char *str)
+{
+    g_checksum_update(cs, (const guchar *)str, strlen(str) + 1);
+}
+
+static void tb_cache_checksum_u64(GChecksum *cs, uint64_t val)
+{
+    g_checksum_update(cs, (const guchar *)&val, sizeof(val));
+}
+
+void tb_cache_init(const char *dir, const char *cpu_model)
+{
+    GChecksum *cs;
+    struct stat st;
+    gsize len = TB_CACHE_KEY_LEN;
+
+    /* the cache files hold code that is run as is: keep them private */
+    if (g_mkdir_with_parents(dir, 0700) < 0) {
+        fprintf(stderr, "qemu: cannot create translation cache "
+                "directory %s: %s\n", dir, strerror(errno));
+        return;
+    }
+
+    /* the code also depends on the QEMU binary, on the CPU model and on
+       the instructions that the host supports */
+    cs = g_checksum_new(G_CHECKSUM_SHA1);
+    tb_cache_checksum_str(cs, QEMU_VERSION);
+    tb_cache_checksum_str(cs, TARGET_NAME);
+    tb_cache_checksum_str(cs, cpu_model);
+    tb_cache_checksum_u64(cs, singlestep);
+    tb_cache_checksum_u64(cs, tcg_target_code_features());
+    if (stat("/proc/self/exe", &st) == 0) {
+        tb_cache_checksum_u64(cs, st.st_dev);
+        tb_cache_checksum_u64(cs, st.st_ino);
+        tb_cache_checksum_u64(cs, st.st_size);
+        tb_cache_checksum_u64(cs, st.st_mtime);
+    }
+    g_checksum_get_digest(cs, tb_cache_build_key, &len);
+    g_checksum_free(cs);
+
+    qemu_mutex_init(&tb_cache_lock);
+    tb_cache_dir = g_strdup(dir);
+}
+
+static guint tb_cache_record_hash(gconstpointer p)
+{
+    const TBCacheRecord *rec = p;
+
+    return rec->pc ^ (rec->pc >> 32) ^ rec->cs_base ^ rec->flags;
+}
+
+static gboolean tb_cache_record_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheRecord *ra = a;
+    const TBCacheRecord *rb = b;
+
+    return ra->pc == rb->pc && ra->cs_base == rb->cs_base &&
+           ra->flags == rb->flags;
+}
+
+static inline TBCacheReloc *tb_cache_record_relocs(const TBCacheRecord *rec)
+{
+    return (TBCacheReloc *)(rec + 1);
+}
+
+static inline uint8_t *tb_cache_record_guest(const TBCacheRecord *rec)
+{
+    return (uint8_t *)(tb_cache_record_relocs(rec) + rec->nb_relocs);
+}
+
+static inline uint8_t *tb_cache_record_code(const TBCacheRecord *rec)
+{
+    return tb_cache_record_guest(rec) + rec->size;
+}
+
+static size_t tb_cache_record_len(uint32_t nb_relocs, uint32_t size,
+                                  uint32_t code_size)
+{
+    return ROUND_UP(sizeof(TBCacheRecord) + nb_relocs * sizeof(TBCacheReloc)
+                    + size + code_size, 8);
+}
+
+/* Build the index of the records in the cache file on first use */
+static GHashTable *tb_cache_index(TBCacheFile *file)
+{
+    const TBCacheHeader *hdr = file->map;
+    size_t off = sizeof(*hdr);
+    uint32_t i;
+
+    if (file->index) {
+        return file->index;
+    }
+    file->index = g_hash_table_new(tb_cache_record_hash,
+                                   tb_cache_record_equal);
+    if (!hdr) {
+        return file->index;
+    }
+    for (i = 0; i < hdr->nb_records; i++) {
+        TBCacheRecord *rec = file->map + off;
+
+        if (file->map_size - off < sizeof(*rec) || rec->len & 7 ||
+            rec->len > file->map_size - off ||
+            rec->nb_relocs > TCG_MAX_CODE_RELOCS ||
+            tb_cache_record_len(rec->nb_relocs, rec->size,
+                                rec->code_size + rec->search_size) >
+            rec->len) {
+            /* truncated or corrupted file, ignore the rest */
+            file->dirty = true;
+            break;
+        }
+        g_hash_table_replace(file->index, rec, rec);
+        off += rec->len;
+    }
+    return file->index;
+}
+
+static void tb_cache_file_map(TBCacheFile *file)
+{
+    const TBCacheHeader *hdr;
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open(file->path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return;
+    }
+    hdr = p;
+    if (memcmp(hdr->magic, TB_CACHE_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != TB_CACHE_VERSION ||
+        memcmp(hdr->key, file->key, TB_CACHE_KEY_LEN)) {
+        munmap(p, st.st_size);
+        return;
+    }
+    file->map = p;
+    file->map_size = st.st_size;
+}
+
+static void tb_cache_file_save(TBCacheFile *file)
+{
+    TBCacheHeader hdr;
+    GHashTableIter iter;
+    gpointer rec;
+    char *tmp;
+    FILE *f;
+    bool ok;
+    int fd;
+
+    if (!file->dirty) {
+        return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TB_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TB_CACHE_VERSION;
+    hdr.nb_records = g_hash_table_size(file->index);
+    memcpy(hdr.key, file->key, TB_CACHE_KEY_LEN);
+
+    tmp = g_strdup_printf("%s.%d", file->path, getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    f = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!f) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        g_free(tmp);
+        return;
+    }
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    g_hash_table_iter_init(&iter, file->index);
+    while (ok && g_hash_table_iter_next(&iter, &rec, NULL)) {
+        ok = fwrite(rec, ((TBCacheRecord *)rec)->len, 1, f) == 1;
+    }
+    ok &= fclose(f) == 0;
+    if (!ok || rename(tmp, file->path) < 0) {
+        unlink(tmp);
+    }
+    g_free(tmp);
+}
+
+/* Write out and free the file when its last segment goes away */
+static void tb_cache_file_unref(TBCacheFile *file)
+{
+    if (--file->refcnt) {
+        return;
+    }
+    tb_cache_file_save(file);
+    if (file->index) {
+        g_hash_table_destroy(file->index);
+    }
+    g_ptr_array_free(file->added, TRUE);
+    if (file->map) {
+        munmap(file->map, file->map_size);
+    }
+    g_free(file->path);
+    g_free(file);
+}
+
+/* Called with tb_cache_lock held: forget the guest range [start, end) */
+static void tb_cache_drop(abi_ulong start, abi_ulong end)
+{
+    TBCacheSegment *seg, *next;
+
+    QTAILQ_FOREACH_SAFE(seg, &tb_cache_segments, entry, next) {
+        if (end <= seg->start || seg->end <= start) {
+            continue;
+        }
+        if (start <= seg->start && seg->end <= end) {
+            QTAILQ_REMOVE(&tb_cache_segments, seg, entry);
+            tb_cache_file_unref(seg->file);
+            g_free(seg);
+        } else if (start <= seg->start) {
+            seg->start = end;
+        } else if (seg->end <= end) {
+            seg->end = start;
+        } else {
+            /* a hole in the middle: keep both sides */
+            TBCacheSegment *tail = g_new0(TBCacheSegment, 1);
+
+            tail->start = end;
+            tail->end = seg->end;
+            tail->file = seg->file;
+            tail->file->refcnt++;
+            seg->end = start;
+            QTAILQ_INSERT_AFTER(&tb_cache_segments, seg, tail, entry);
+        }
+    }
+}
+
+/* Called with mmap_lock held, after the guest mapped @fd at @start */
+void tb_cache_map(abi_ulong start, abi_ulong len, int prot, int flags,
+                  int fd, abi_ulong offset)
+{
+    TBCacheSegment *seg;
+    TBCacheFile *file;
+    GChecksum *cs;
+    struct stat st;
+    gsize key_len = TB_CACHE_KEY_LEN;
+    char name[2 * TB_CACHE_KEY_LEN + 1];
+    int i;
+
+    if (!tb_cache_dir) {
+        return;
+    }
+    qemu_mutex_lock(&tb_cache_lock);
+    tb_cache_drop(start, start + len);
+    qemu_mutex_unlock(&tb_cache_lock);
+
+    if ((flags & MAP_ANONYMOUS) || (prot & (PROT_READ | PROT_EXEC)) !=
+        (PROT_READ | PROT_EXEC)) {
+        return;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || offset >= st.st_size) {
+        return;
+    }
+    /* pages beyond the end of the file cannot be read */
+    len = MIN(len, st.st_size - offset);
+
+    file = g_new0(TBCacheFile, 1);
+    file->added = g_ptr_array_new_with_free_func(g_free);
+    file->refcnt = 1;
+
+    cs = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(cs, tb_cache_build_key, TB_CACHE_KEY_LEN);
+    tb_cache_checksum_u64(cs, GUEST_BASE);
+    tb_cache_checksum_u64(cs, start);
+    tb_cache_checksum_u64(cs, len);
+    tb_cache_checksum_u64(cs, st.st_dev);
+    tb_cache_checksum_u64(cs, st.st_ino);
+    tb_cache_checksum_u64(cs, st.st_size);
+    tb_cache_checksum_u64(cs, st.st_mtim.tv_sec);
+    tb_cache_checksum_u64(cs, st.st_mtim.tv_nsec);
+    tb_cache_checksum_u64(cs, offset);
+    g_checksum_get_digest(cs, file->key, &key_len);
+    g_checksum_free(cs);
+
+    for (i = 0; i < TB_CACHE_KEY_LEN; i++) {
+        snprintf(name + 2 * i, 3, "%02x", file->key[i]);
+    }
+    file->path = g_strdup_printf("%s/%s.tbc", tb_cache_dir, name);
+    tb_cache_file_map(file);
+
+    seg = g_new0(TBCacheSegment, 1);
+    seg->start = start;
+    seg->end = start + len;
+    seg->file = file;
+
+    qemu_mutex_lock(&tb_cache_lock);
+    QTAILQ_INSERT_TAIL(&tb_cache_segments, seg, entry);
+    qemu_mutex_unlock(&tb_cache_lock);
+}
+
+/* Called with mmap_lock held, after the guest unmapped [start, start+len) */
+void tb_cache_unmap(abi_ulong start, abi_ulong len)
+{
+    if (!tb_cache_dir) {
+        return;
+    }
+    qemu_mutex_lock(&tb_cache_lock);
+    tb_cache_drop(start, start + len);
+    qemu_mutex_unlock(&tb_cache_lock);
+}
+
+/* Write out all cache files, before the process execs or exits */
+void tb_cache_save(void)
+{
+    if (!tb_cache_dir) {
+        return;
+    }
+    mmap_lock();
+    qemu_mutex_lock(&tb_cache_lock);
+    tb_cache_drop(0, -1);
+    qemu_mutex_unlock(&tb_cache_lock);
+    mmap_unlock();
+}
+
+static bool tb_cache_usable(CPUState *cpu, TranslationBlock *tb)
+{
+    /* breakpoints and single-stepping change the generated code */
+    return tb_cache_dir && tb->cflags == 0 && !cpu->singlestep_enabled &&
+           QTAILQ_EMPTY(&cpu->breakpoints);
+}
+
+/* Called with tb_cache_lock held */
+static TBCacheSegment *tb_cache_find(target_ulong pc)
+{
+    TBCacheSegment *seg;
+
+    QTAILQ_FOREACH(seg, &tb_cache_segments, entry) {
+        if (pc >= seg->start && pc < seg->end) {
+            return seg;
+        }
+    }
+    return NULL;
+}
+
+static uintptr_t tb_cache_base(TranslationBlock *tb, int base)
+{
+    switch (base) {
+    case TB_CACHE_BASE_TB:
+        return (uintptr_t)tb;
+    case TB_CACHE_BASE_PROLOGUE:
+        return (uintptr_t)tcg_ctx.code_gen_prologue;
+    default:
+        return (uintptr_t)__executable_start;
+    }
+}
+
+static bool tb_cache_reloc_save(TranslationBlock *tb, const TCGCodeReloc *r,
+                                TBCacheReloc *cr)
+{
+    uintptr_t target = r->target;
+    uintptr_t prologue = (uintptr_t)tcg_ctx.code_gen_prologue;
+
+    if (target >= (uintptr_t)tb && target < (uintptr_t)(tb + 1)) {
+        cr->base = TB_CACHE_BASE_TB;
+    } else if (target >= prologue &&
+               target < prologue + TB_CACHE_PROLOGUE_SIZE) {
+        cr->base = TB_CACHE_BASE_PROLOGUE;
+    } else if (target >= (uintptr_t)__executable_start &&
+               target < (uintptr_t)etext) {
+        cr->base = TB_CACHE_BASE_IMAGE;
+    } else {
+        /* e.g. a function of a shared library */
+        return false;
+    }
+    cr->offset = r->offset;
+    cr->type = r->type;
+    cr->addend = target - tb_cache_base(tb, cr->base);
+    return true;
+}
+
+static bool tb_cache_reloc_apply(TranslationBlock *tb, const TBCacheReloc *cr,
+                                 uint32_t code_size)
+{
+    uintptr_t target = tb_cache_base(tb, cr->base) + cr->addend;
+    uint8_t *field = (uint8_t *)tb->tc_ptr + cr->offset;
+    uint64_t abs = target;
+    intptr_t disp;
+    int32_t rel;
+
+    switch (cr->type) {
+    case TCG_CODE_RELOC_ABS64:
+        if (cr->offset > code_size - sizeof(abs)) {
+            return false;
+        }
+        memcpy(field, &abs, sizeof(abs));
+        return true;
+    case TCG_CODE_RELOC_REL32:
+        disp = target - (uintptr_t)(field + sizeof(rel));
+        if (cr->offset > code_size - sizeof(rel) || disp != (int32_t)disp) {
+            return false;
+        }
+        rel = disp;
+        memcpy(field, &rel, sizeof(rel));
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Called with tb_lock held, before translating @tb.  Returns true if its
+ * code was copied from the cache, setting *code_size_ptr like
+ * cpu_gen_code().
+ */
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb, int *code_size_ptr)
+{
+    TBCacheSegment *seg;
+    TBCacheRecord key, *rec;
+    TBCacheReloc *relocs;
+    uint32_t i, code_size;
+    bool ret = false;
+
+    if (!tb_cache_usable(cpu, tb)) {
+        return false;
+    }
+    qemu_mutex_lock(&tb_cache_lock);
+    seg = tb_cache_find(tb->pc);
+    if (!seg) {
+        goto out;
+    }
+    key.pc = tb->pc;
+    key.cs_base = tb->cs_base;
+    key.flags = tb->flags;
+    rec = g_hash_table_lookup(tb_cache_index(seg->file), &key);
+    if (!rec) {
+        goto out;
+    }
+
+    /* the guest code must be unchanged */
+    if (rec->size == 0 || rec->pc + rec->size > seg->end ||
+        page_check_range(rec->pc, rec->size, PAGE_READ) < 0 ||
+        memcmp(g2h(rec->pc), tb_cache_record_guest(rec), rec->size)) {
+        g_hash_table_remove(seg->file->index, rec);
+        seg->file->dirty = true;
+        goto out;
+    }
+
+    /* the code buffer leaves room for the largest TB after tc_ptr */
+    code_size = rec->code_size + rec->search_size;
+    if (code_size > TCG_MAX_OP_SIZE * OPC_BUF_SIZE) {
+        goto out;
+    }
+    memcpy(tb->tc_ptr, tb_cache_record_code(rec), code_size);
+    relocs = tb_cache_record_relocs(rec);
+    for (i = 0; i < rec->nb_relocs; i++) {
+        if (!tb_cache_reloc_apply(tb, &relocs[i], rec->code_size)) {
+            goto out;
+        }
+    }
+    flush_icache_range((uintptr_t)tb->tc_ptr,
+                       (uintptr_t)tb->tc_ptr + rec->code_size);
+
+    tb->size = rec->size;
+    tb->icount = rec->icount;
+    tb->tc_size = rec->code_size;
+    tb->tc_search = (uint8_t *)tb->tc_ptr + rec->code_size;
+    for (i = 0; i < 2; i++) {
+        tb->tb_next_offset[i] = rec->tb_next_offset[i];
+        tb->tb_jmp_offset[i] = rec->tb_jmp_offset[i];
+    }
+    *code_size_ptr = code_size;
+    ret = true;
+
+out:
+    qemu_mutex_unlock(&tb_cache_lock);
+    return ret;
+}
+
+/* Called with tb_lock held: tell whether @tb, which is about to be
+ * translated, is to be saved.
+ */
+bool tb_cache_wanted(CPUState *cpu, TranslationBlock *tb)
+{
+    bool ret;
+
+    if (!tb_cache_usable(cpu, tb)) {
+        return false;
+    }
+    qemu_mutex_lock(&tb_cache_lock);
+    ret = tb_cache_find(tb->pc) != NULL;
+    qemu_mutex_unlock(&tb_cache_lock);
+    return ret;
+}
+
+/* Called with tb_lock held, after translating @tb with relocations
+ * recorded; @code_size includes the search data.
+ */
+void tb_cache_store(TranslationBlock *tb, int code_size)
+{
+    TCGContext *s = &tcg_ctx;
+    TBCacheSegment *seg;
+    TBCacheRecord *rec;
+    TBCacheReloc *relocs;
+    size_t len;
+    int i;
+
+    if (s->code_unrelocatable || tb->size == 0) {
+        return;
+    }
+    qemu_mutex_lock(&tb_cache_lock);
+    seg = tb_cache_find(tb->pc);
+    if (!seg || tb->pc + tb->size > seg->end) {
+        goto out;
+    }
+
+    len = tb_cache_record_len(s->nb_code_relocs, tb->size, code_size);
+    rec = g_malloc0(len);
+    rec->pc = tb->pc;
+    rec->cs_base = tb->cs_base;
+    rec->flags = tb->flags;
+    rec->len = len;
+    rec->size = tb->size;
+    rec->icount = tb->icount;
+    rec->code_size = tb->tc_size;
+    rec->search_size = code_size - tb->tc_size;
+    for (i = 0; i < 2; i++) {
+        rec->tb_next_offset[i] = tb->tb_next_offset[i];
+        rec->tb_jmp_offset[i] = tb->tb_jmp_offset[i];
+    }
+    rec->nb_relocs = s->nb_code_relocs;
+    relocs = tb_cache_record_relocs(rec);
+    for (i = 0; i < s->nb_code_relocs; i++) {
+        if (!tb_cache_reloc_save(tb, &s->code_relocs[i], &relocs[i])) {
+            g_free(rec);
+            goto out;
+        }
+    }
+    memcpy(tb_cache_record_guest(rec), g2h(tb->pc), tb->size);
+    memcpy(tb_cache_record_code(rec), tb->tc_ptr, code_size);
+
+    g_ptr_array_add(seg->file->added, rec);
+    g_hash_table_replace(tb_cache_index(seg->file), rec, rec);
+    seg->file->dirty = true;
+
+out:
+    qemu_mutex_unlock(&tb_cache_lock);
+}
+#else
+void tb_cache_init(const char *dir, const char *cpu_model)
+{
+    fprintf(stderr, "qemu: the translation cache is not supported "
+            "for this host and target\n");
+}
+
+void tb_cache_map(abi_ulong start, abi_ulong len, int prot, int flags,
+                  int fd, abi_ulong offset)
+{
+}
+
+void tb_cache_unmap(abi_ulong start, abi_ulong len)
+{
+}
+
+void tb_cache_save(void)
+{
+}
+
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb, int *code_size_ptr)
+{
+    return false;
+}
+
+bool tb_cache_wanted(CPUState *cpu, TranslationBlock *tb)
+{
+    return false;
+}
+
+void tb_cache_store(TranslationBlock *tb, int code_size)
+{
+}
+#endif
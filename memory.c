@@ -25,6 +25,8 @@
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
 #include "sysemu/sysemu.h"
+#include "qemu/main-loop.h"
+#include "qom/cpu.h"
 
 //#define DEBUG_UNASSIGNED
 
@@ -33,6 +35,20 @@ static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
 static bool global_dirty_log = false;
 
+/* FlatViews are shared by all address spaces that render the same root, and
+ * survive a commit unless one of the trees they were rendered from changed.
+ * changed_tops holds the top-level containers of the regions modified
+ * since the last commit.
+ *
+ * Only the rendering is shared.  When a shared view changes, e.g. on a
+ * BAR remap in system memory, every address space that uses it still
+ * diffs the old and new views for its listeners and rebuilds its own
+ * dispatch tree, so such a commit remains O(regions x address spaces).
+ * What is saved is the work for address spaces whose view did not change.
+ */
+static GHashTable *flat_views;
+static GHashTable *changed_tops;
+
 static QTAILQ_HEAD(memory_listeners, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
 
@@ -233,6 +249,10 @@ struct FlatView {
     FlatRange *ranges;
     unsigned nr;
     unsigned nr_allocated;
+    MemoryRegion *root;
+    /* Top-level containers of the trees rendered into the view */
+    MemoryRegion **tops;
+    unsigned nr_tops;
 };
 
 typedef struct AddressSpaceOps AddressSpaceOps;
@@ -255,6 +275,63 @@ static void flatview_init(FlatView *view)
     view->ranges = NULL;
     view->nr = 0;
     view->nr_allocated = 0;
+    view->root = NULL;
+    view->tops = NULL;
+    view->nr_tops = 0;
+}
+
+static MemoryRegion *memory_region_top(MemoryRegion *mr)
+{
+    while (mr->container) {
+        mr = mr->container;
+    }
+    return mr;
+}
+
+static void flatview_add_top(FlatView *view, MemoryRegion *mr)
+{
+    MemoryRegion *top = memory_region_top(mr);
+    unsigned i;
+
+    for (i = 0; i < view->nr_tops; i++) {
+        if (view->tops[i] == top) {
+            return;
+        }
+    }
+    view->tops = g_renew(MemoryRegion *, view->tops, view->nr_tops + 1);
+    view->tops[view->nr_tops++] = top;
+}
+
+/* Whether a region rendered into @view changed since the last commit */
+static bool flatview_is_stale(FlatView *view)
+{
+    unsigned i;
+
+    if (!changed_tops) {
+        return false;
+    }
+    for (i = 0; i < view->nr_tops; i++) {
+        if (g_hash_table_lookup(changed_tops, view->tops[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i])
+            || a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
 }
 
 /* Insert a range into a given position.  Caller is responsible for maintaining
@@ -281,7 +358,9 @@ static void flatview_destroy(FlatView *view)
     for (i = 0; i < view->nr; i++) {
         memory_region_unref(view->ranges[i].mr);
     }
+    memory_region_unref(view->root);
     g_free(view->ranges);
+    g_free(view->tops);
     g_free(view);
 }
 
@@ -290,10 +369,13 @@ static void flatview_ref(FlatView *view)
     atomic_inc(&view->ref);
 }
 
+/* Views can be shared by several address spaces, so the last reference
+ * rather than each address space waits for readers to go away.
+ */
 static void flatview_unref(FlatView *view)
 {
     if (atomic_fetch_dec(&view->ref) == 1) {
-        flatview_destroy(view);
+        call_rcu(view, flatview_destroy, rcu);
     }
 }
 
@@ -519,6 +601,7 @@ static void render_memory_region(FlatView *view,
     if (mr->alias) {
         int128_subfrom(&base, int128_make64(mr->alias->addr));
         int128_subfrom(&base, int128_make64(mr->alias_offset));
+        flatview_add_top(view, mr->alias);
         render_memory_region(view, mr->alias, base, clip, readonly);
         return;
     }
@@ -580,6 +663,9 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     flatview_init(view);
 
     if (mr) {
+        memory_region_ref(mr);
+        view->root = mr;
+        flatview_add_top(view, mr);
         render_memory_region(view, mr, int128_zero(),
                              addrrange_make(int128_zero(), int128_2_64()), false);
     }
@@ -588,6 +674,61 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     return view;
 }
 
+/* Skip root aliases that map their target in its entirety, so that
+ * e.g. all PCI bus master address spaces share the system memory view.
+ * Returns NULL if the address space is empty.
+ */
+static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
+{
+    while (mr && mr->enabled) {
+        if (!mr->alias
+            || mr->alias_offset
+            || mr->readonly
+            || mr->addr != mr->alias->addr
+            || int128_lt(mr->size, mr->alias->size)) {
+            return mr;
+        }
+        mr = mr->alias;
+    }
+    return NULL;
+}
+
+/* Pick the view of every address space for this commit, rendering only
+ * the roots that are new or whose trees changed.
+ */
+static void flat_views_update(void)
+{
+    GHashTable *old_views = flat_views;
+    AddressSpace *as;
+
+    flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                       (GDestroyNotify)flatview_unref);
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        MemoryRegion *root = memory_region_get_flatview_root(as->root);
+        FlatView *view = g_hash_table_lookup(flat_views, root);
+
+        if (!view) {
+            view = old_views ? g_hash_table_lookup(old_views, root) : NULL;
+            if (view && !flatview_is_stale(view)) {
+                flatview_ref(view);
+            } else {
+                view = generate_memory_topology(root);
+            }
+            g_hash_table_insert(flat_views, root, view);
+        }
+
+        flatview_ref(view);
+        as->next_map = view;
+        as->map_changed = view != as->current_map
+                          && !flatview_equal(view, as->current_map);
+    }
+
+    if (old_views) {
+        g_hash_table_destroy(old_views);
+    }
+}
+
 static void address_space_add_del_ioeventfds(AddressSpace *as,
                                              MemoryRegionIoeventfd *fds_new,
                                              unsigned fds_new_nb,
@@ -748,24 +889,76 @@ static void address_space_update_topology_pass(AddressSpace *as,
 static void address_space_update_topology(AddressSpace *as)
 {
     FlatView *old_view = address_space_get_flatview(as);
-    FlatView *new_view = generate_memory_topology(as->root);
+    FlatView *new_view = as->next_map;
 
-    address_space_update_topology_pass(as, old_view, new_view, false);
-    address_space_update_topology_pass(as, old_view, new_view, true);
+    as->next_map = NULL;
+    if (as->map_changed) {
+        address_space_update_topology_pass(as, old_view, new_view, false);
+        address_space_update_topology_pass(as, old_view, new_view, true);
+    }
 
-    /* Writes are protected by the BQL.  */
+    /* Writes are protected by the BQL.  An equal view is installed too,
+     * so that views rendered from stale trees are not kept alive.
+     */
     atomic_rcu_set(&as->current_map, new_view);
-    call_rcu(old_view, flatview_unref, rcu);
 
-    /* Note that all the old MemoryRegions are still alive up to this
-     * point.  This relieves most MemoryListeners from the need to
-     * ref/unref the MemoryRegions they get---unless they use them
-     * outside the iothread mutex, in which case precise reference
-     * counting is necessary.
+    /* Drop both the reference of the address space and ours.  Note that
+     * all the old MemoryRegions are still alive up to this point, and
+     * stay alive until the old view is destroyed after a grace period.
+     * This relieves most MemoryListeners from the need to ref/unref the
+     * MemoryRegions they get---unless they use them outside the iothread
+     * mutex, in which case precise reference counting is necessary.
      */
     flatview_unref(old_view);
+    flatview_unref(old_view);
+
+    if (as->map_changed || ioeventfd_update_pending) {
+        address_space_update_ioeventfds(as);
+    }
+}
+
+/* Listeners bound to an address space whose map did not change get no
+ * callbacks at all, so that e.g. its dispatch tree is not rebuilt.
+ */
+static bool memory_listener_wants_commit(MemoryListener *listener)
+{
+    return !listener->address_space_filter
+        || listener->address_space_filter->map_changed;
+}
+
+static void memory_listeners_begin(void)
+{
+    MemoryListener *listener;
+
+    QTAILQ_FOREACH(listener, &memory_listeners, link) {
+        if (listener->begin && memory_listener_wants_commit(listener)) {
+            listener->begin(listener);
+        }
+    }
+}
 
-    address_space_update_ioeventfds(as);
+static void memory_listeners_commit(void)
+{
+    MemoryListener *listener;
+
+    QTAILQ_FOREACH(listener, &memory_listeners, link) {
+        if (listener->commit && memory_listener_wants_commit(listener)) {
+            listener->commit(listener);
+        }
+    }
+}
+
+/* Record that @mr changed, so that the views it is rendered into are
+ * regenerated at the end of the transaction.
+ */
+static void memory_region_update_pending_add(MemoryRegion *mr)
+{
+    if (!changed_tops) {
+        changed_tops = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    mr = memory_region_top(mr);
+    g_hash_table_insert(changed_tops, mr, mr);
+    memory_region_update_pending = true;
 }
 
 void memory_region_transaction_begin(void)
@@ -778,6 +971,9 @@ static void memory_region_clear_pending(void)
 {
     memory_region_update_pending = false;
     ioeventfd_update_pending = false;
+    if (changed_tops) {
+        g_hash_table_remove_all(changed_tops);
+    }
 }
 
 void memory_region_transaction_commit(void)
@@ -788,13 +984,14 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
-            MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
+            flat_views_update();
+            memory_listeners_begin();
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_topology(as);
             }
 
-            MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+            memory_listeners_commit();
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -953,6 +1150,7 @@ static void memory_region_initfn(Object *obj)
     mr->ops = &unassigned_mem_ops;
     mr->enabled = true;
     mr->romd_mode = true;
+    mr->global_locking = true;
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
@@ -1356,7 +1554,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_pending_add(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -1377,13 +1577,9 @@ void memory_region_set_dirty(MemoryRegion *mr, hwaddr addr,
 bool memory_region_test_and_clear_dirty(MemoryRegion *mr, hwaddr addr,
                                         hwaddr size, unsigned client)
 {
-    bool ret;
     assert(mr->terminates);
-    ret = cpu_physical_memory_get_dirty(mr->ram_addr + addr, size, client);
-    if (ret) {
-        cpu_physical_memory_reset_dirty(mr->ram_addr + addr, size, client);
-    }
-    return ret;
+    return cpu_physical_memory_test_and_clear_dirty(mr->ram_addr + addr,
+                                                    size, client);
 }
 
 
@@ -1408,7 +1604,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_add(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -1418,7 +1616,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_add(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -1427,7 +1627,8 @@ void memory_region_reset_dirty(MemoryRegion *mr, hwaddr addr,
                                hwaddr size, unsigned client)
 {
     assert(mr->terminates);
-    cpu_physical_memory_reset_dirty(mr->ram_addr + addr, size, client);
+    cpu_physical_memory_test_and_clear_dirty(mr->ram_addr + addr, size,
+                                             client);
 }
 
 int memory_region_get_fd(MemoryRegion *mr)
@@ -1508,8 +1709,11 @@ void memory_region_add_coalescing(MemoryRegion *mr,
                                   hwaddr offset,
                                   uint64_t size)
 {
-    CoalescedMemoryRange *cmr = g_malloc(sizeof(*cmr));
+    CoalescedMemoryRange *cmr;
 
+    /* the coalesced writes are replayed under the global mutex */
+    assert(mr->global_locking);
+    cmr = g_malloc(sizeof(*cmr));
     cmr->addr = addrrange_make(int128_make64(offset), int128_make64(size));
     QTAILQ_INSERT_TAIL(&mr->coalesced, cmr, link);
     memory_region_update_coalesced_range(mr);
@@ -1538,6 +1742,7 @@ void memory_region_clear_coalescing(MemoryRegion *mr)
 
 void memory_region_set_flush_coalesced(MemoryRegion *mr)
 {
+    assert(mr->global_locking);
     mr->flush_coalesced_mmio = true;
 }
 
@@ -1549,6 +1754,13 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_clear_global_locking(MemoryRegion *mr)
+{
+    /* flushing the coalesced MMIO buffer needs the global mutex */
+    assert(!mr->flush_coalesced_mmio && QTAILQ_EMPTY(&mr->coalesced));
+    mr->global_locking = false;
+}
+
 void memory_region_add_eventfd(MemoryRegion *mr,
                                hwaddr addr,
                                unsigned size,
@@ -1653,7 +1865,7 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    memory_region_update_pending_add(mr);
     memory_region_transaction_commit();
 }
 
@@ -1662,6 +1874,8 @@ static void memory_region_add_subregion_common(MemoryRegion *mr,
                                                MemoryRegion *subregion)
 {
     assert(!subregion->container);
+    /* Views that alias into @subregion recorded it as a top-level region */
+    memory_region_update_pending_add(subregion);
     subregion->container = mr;
     subregion->addr = offset;
     memory_region_update_container_subregions(subregion);
@@ -1691,10 +1905,10 @@ void memory_region_del_subregion(MemoryRegion *mr,
 {
     memory_region_transaction_begin();
     assert(subregion->container == mr);
+    memory_region_update_pending_add(mr);
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
 
@@ -1705,7 +1919,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_pending_add(mr);
     memory_region_transaction_commit();
 }
 
@@ -1721,7 +1935,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_update_pending_add(mr);
     memory_region_transaction_commit();
 }
 
@@ -1758,7 +1972,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_pending_add(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -1992,15 +2208,43 @@ void address_space_destroy(AddressSpace *as)
     call_rcu(as, do_address_space_destroy, rcu);
 }
 
+/* vCPUs dispatch MMIO and PIO without holding the global mutex, both with
+ * KVM and with multi-threaded TCG.  Most device models still expect it, so
+ * take it here unless the region opted out with
+ * memory_region_clear_global_locking().
+ */
+static bool io_mem_lock_iothread(MemoryRegion *mr)
+{
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        return true;
+    }
+    return false;
+}
+
 bool io_mem_read(MemoryRegion *mr, hwaddr addr, uint64_t *pval, unsigned size)
 {
-    return memory_region_dispatch_read(mr, addr, pval, size);
+    bool locked = io_mem_lock_iothread(mr);
+    bool ret;
+
+    ret = memory_region_dispatch_read(mr, addr, pval, size);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    return ret;
 }
 
 bool io_mem_write(MemoryRegion *mr, hwaddr addr,
                   uint64_t val, unsigned size)
 {
-    return memory_region_dispatch_write(mr, addr, val, size);
+    bool locked = io_mem_lock_iothread(mr);
+    bool ret;
+
+    ret = memory_region_dispatch_write(mr, addr, val, size);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    return ret;
 }
 
 typedef struct MemoryRegionList MemoryRegionList;
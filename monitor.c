@@ -1038,8 +1038,13 @@ static void hmp_info_registers(Monitor *mon, const QDict *qdict)
 
 static void hmp_info_jit(Monitor *mon, const QDict *qdict)
 {
+    int count = qdict_get_try_int(qdict, "count", 10);
+
     dump_exec_info((FILE *)mon, monitor_fprintf);
     dump_drift_info((FILE *)mon, monitor_fprintf);
+    if (tcg_enabled()) {
+        dump_tb_profile((FILE *)mon, monitor_fprintf, count);
+    }
 }
 
 static void hmp_info_opcount(Monitor *mon, const QDict *qdict)
@@ -1949,14 +1954,88 @@ static void hmp_info_mtree(Monitor *mon, const QDict *qdict)
     mtree_info((fprintf_function)monitor_printf, mon);
 }
 
+/* Print the bits set in @map like "0-3,8" */
+static void monitor_print_ranges(Monitor *mon, const unsigned long *map,
+                                 long nbits)
+{
+    const char *sep = " ";
+    long first, last;
+
+    for (first = find_first_bit(map, nbits); first < nbits;
+         first = find_next_bit(map, nbits, last + 1)) {
+        last = find_next_zero_bit(map, nbits, first + 1) - 1;
+        if (last == first) {
+            monitor_printf(mon, "%s%ld", sep, first);
+        } else {
+            monitor_printf(mon, "%s%ld-%ld", sep, first, last);
+        }
+        sep = ",";
+    }
+}
+
+static void hmp_info_numa_placement(Monitor *mon, int node,
+                                    IOThreadInfoList *iothreads)
+{
+    NodeInfo *info = &numa_info[node];
+    unsigned long *host_nodes = info->host_nodes;
+    HostMemPolicy policy = info->policy;
+    uint64_t host_pages[MAX_NODES] = { 0 };
+    IOThreadInfoList *l;
+    CPUState *cpu;
+    int i, n;
+
+    if (info->node_memdev) {
+        host_nodes = info->node_memdev->host_nodes;
+        policy = info->node_memdev->policy;
+    }
+    if (!bitmap_empty(host_nodes, MAX_NODES)) {
+        monitor_printf(mon, "node %d host nodes:", node);
+        monitor_print_ranges(mon, host_nodes, MAX_NODES);
+        monitor_printf(mon, " (%s)\n", HostMemPolicy_lookup[policy]);
+    }
+
+    if (!bitmap_empty(info->host_cpus, MAX_HOST_CPUS)) {
+        monitor_printf(mon, "node %d host cpus:", node);
+        monitor_print_ranges(mon, info->host_cpus, MAX_HOST_CPUS);
+        monitor_printf(mon, "\nnode %d vcpu threads:", node);
+        CPU_FOREACH(cpu) {
+            if (cpu->numa_node == node) {
+                monitor_printf(mon, " %d", cpu->thread_id);
+            }
+        }
+        monitor_printf(mon, "\n");
+    }
+
+    for (l = iothreads; l; l = l->next) {
+        if (l->value->has_numa_node && l->value->numa_node == node) {
+            monitor_printf(mon, "node %d iothread: %s (thread %" PRId64 ")\n",
+                           node, l->value->id, l->value->thread_id);
+        }
+    }
+
+    n = numa_node_host_residency(node, host_pages);
+    if (n > 0) {
+        monitor_printf(mon, "node %d memory on host nodes:", node);
+        for (i = 0; i < MAX_NODES; i++) {
+            if (host_pages[i]) {
+                monitor_printf(mon, " %d: %" PRIu64 "%%", i,
+                               host_pages[i] * 100 / n);
+            }
+        }
+        monitor_printf(mon, " (%d pages sampled)\n", n);
+    }
+}
+
 static void hmp_info_numa(Monitor *mon, const QDict *qdict)
 {
     int i;
     CPUState *cpu;
     uint64_t *node_mem;
+    IOThreadInfoList *iothreads;
 
     node_mem = g_new0(uint64_t, nb_numa_nodes);
     query_numa_node_mem(node_mem);
+    iothreads = qmp_query_iothreads(NULL);
     monitor_printf(mon, "%d nodes\n", nb_numa_nodes);
     for (i = 0; i < nb_numa_nodes; i++) {
         monitor_printf(mon, "node %d cpus:", i);
@@ -1968,7 +2047,9 @@ static void hmp_info_numa(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "\n");
         monitor_printf(mon, "node %d size: %" PRId64 " MB\n", i,
                        node_mem[i] >> 20);
+        hmp_info_numa_placement(mon, i, iothreads);
     }
+    qapi_free_IOThreadInfoList(iothreads);
     g_free(node_mem);
 }
 
@@ -2725,9 +2806,9 @@ static mon_cmd_t info_cmds[] = {
     },
     {
         .name       = "jit",
-        .args_type  = "",
-        .params     = "",
-        .help       = "show dynamic compiler info",
+        .args_type  = "count:i?",
+        .params     = "[count]",
+        .help       = "show dynamic compiler info and hot blocks",
         .mhandler.cmd = hmp_info_jit,
     },
     {
@@ -2837,6 +2918,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show CPU statistics",
         .mhandler.cmd = hmp_info_cpustats,
     },
+    {
+        .name       = "vcpu-stats",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show vCPU exit counts, latencies and I/O hot spots",
+        .mhandler.cmd = hmp_info_vcpu_stats,
+    },
 #if defined(CONFIG_SLIRP)
     {
         .name       = "usernet",
@@ -19,12 +19,15 @@ typedef struct VhostUserState {
     NetClientState nc;
     CharDriverState *chr;
     VHostNetState *vhost_net;
+    /* features acked by the guest, restored when the backend reconnects */
+    uint64_t acked_features;
 } VhostUserState;
 
 typedef struct VhostUserChardevProps {
     bool is_socket;
     bool is_unix;
     bool is_server;
+    bool is_reconnect;
 } VhostUserChardevProps;
 
 VHostNetState *vhost_user_get_vhost_net(NetClientState *nc)
@@ -39,7 +42,7 @@ static int vhost_user_running(VhostUserState *s)
     return (s->vhost_net) ? 1 : 0;
 }
 
-static int vhost_user_start(VhostUserState *s)
+static int vhost_user_start(VhostUserState *s, VhostUserState *first)
 {
     VhostNetOptions options;
 
@@ -51,15 +54,27 @@ static int vhost_user_start(VhostUserState *s)
     options.net_backend = &s->nc;
     options.opaque = s->chr;
     options.force = true;
+    options.first_queue = s == first ? NULL : first->vhost_net;
 
     s->vhost_net = vhost_net_init(&options);
+    if (!vhost_user_running(s)) {
+        return -1;
+    }
 
-    return vhost_user_running(s) ? 0 : -1;
+    if (s->acked_features) {
+        /* The backend was restarted under a running guest, which will
+         * not negotiate features again.
+         */
+        vhost_net_ack_features(s->vhost_net, s->acked_features);
+    }
+
+    return 0;
 }
 
 static void vhost_user_stop(VhostUserState *s)
 {
     if (vhost_user_running(s)) {
+        s->acked_features = vhost_net_get_acked_features(s->vhost_net);
         vhost_net_cleanup(s->vhost_net);
     }
 
@@ -71,6 +86,9 @@ static void vhost_user_cleanup(NetClientState *nc)
     VhostUserState *s = DO_UPCAST(VhostUserState, nc, nc);
 
     vhost_user_stop(s);
+    if (nc->queue_index == 0) {
+        qemu_chr_add_handlers(s->chr, NULL, NULL, NULL, NULL);
+    }
     qemu_purge_queued_packets(nc);
 }
 
@@ -96,59 +114,132 @@ static NetClientInfo net_vhost_user_info = {
         .has_ufo = vhost_user_has_ufo,
 };
 
-static void net_vhost_link_down(VhostUserState *s, bool link_down)
+static void net_vhost_link_down(NetClientState *ncs[], int queues,
+                                bool link_down)
 {
-    s->nc.link_down = link_down;
+    int i;
+
+    /* The peer NIC only looks at its first queue, but keep them all in
+     * sync; the peer stops or restarts vhost for every queue pair.
+     */
+    for (i = 0; i < queues; i++) {
+        ncs[i]->link_down = link_down;
+        if (ncs[i]->peer) {
+            ncs[i]->peer->link_down = link_down;
+        }
+    }
+
+    if (ncs[0]->info->link_status_changed) {
+        ncs[0]->info->link_status_changed(ncs[0]);
+    }
+
+    if (ncs[0]->peer && ncs[0]->peer->info->link_status_changed) {
+        ncs[0]->peer->info->link_status_changed(ncs[0]->peer);
+    }
+}
+
+static int vhost_user_start_all(NetClientState *ncs[], int queues)
+{
+    VhostUserState *first = DO_UPCAST(VhostUserState, nc, ncs[0]);
+    unsigned int max_queues;
+    int i;
+
+    if (vhost_user_start(first, first) < 0) {
+        return -1;
+    }
 
-    if (s->nc.peer) {
-        s->nc.peer->link_down = link_down;
+    max_queues = vhost_net_get_max_queues(first->vhost_net);
+    if (queues > max_queues) {
+        error_report("vhost-user backend \"%s\" supports %u queue pairs, "
+                     "%d requested", first->chr->label, max_queues, queues);
+        return -1;
     }
 
-    if (s->nc.info->link_status_changed) {
-        s->nc.info->link_status_changed(&s->nc);
+    for (i = 1; i < queues; i++) {
+        VhostUserState *s = DO_UPCAST(VhostUserState, nc, ncs[i]);
+
+        if (vhost_user_start(s, first) < 0) {
+            return -1;
+        }
     }
 
-    if (s->nc.peer && s->nc.peer->info->link_status_changed) {
-        s->nc.peer->info->link_status_changed(s->nc.peer);
+    return 0;
+}
+
+static void vhost_user_stop_all(NetClientState *ncs[], int queues)
+{
+    int i;
+
+    for (i = 0; i < queues; i++) {
+        vhost_user_stop(DO_UPCAST(VhostUserState, nc, ncs[i]));
     }
 }
 
+/* The switch can go away and come back (restart, upgrade) while the guest
+ * keeps running: the device is stopped as if its link went down, and all
+ * vhost state, including the dirty log during migration, is sent again
+ * once the connection is back.
+ */
 static void net_vhost_user_event(void *opaque, int event)
 {
     VhostUserState *s = opaque;
+    NetClientState *ncs[MAX_QUEUE_NUM];
+    int queues;
+
+    queues = qemu_find_net_clients_except(s->nc.name, ncs,
+                                          NET_CLIENT_OPTIONS_KIND_NIC,
+                                          MAX_QUEUE_NUM);
+    assert(queues >= 1);
 
     switch (event) {
     case CHR_EVENT_OPENED:
-        vhost_user_start(s);
-        net_vhost_link_down(s, false);
+        if (vhost_user_start_all(ncs, queues) < 0) {
+            vhost_user_stop_all(ncs, queues);
+            error_report("chardev \"%s\" went up, but vhost-user setup "
+                         "failed", s->chr->label);
+            break;
+        }
+        net_vhost_link_down(ncs, queues, false);
         error_report("chardev \"%s\" went up\n", s->chr->label);
         break;
     case CHR_EVENT_CLOSED:
-        net_vhost_link_down(s, true);
-        vhost_user_stop(s);
+        net_vhost_link_down(ncs, queues, true);
+        vhost_user_stop_all(ncs, queues);
         error_report("chardev \"%s\" went down\n", s->chr->label);
         break;
     }
 }
 
 static int net_vhost_user_init(NetClientState *peer, const char *device,
-                               const char *name, CharDriverState *chr)
+                               const char *name, CharDriverState *chr,
+                               int queues)
 {
     NetClientState *nc;
     VhostUserState *s;
+    int i;
 
-    nc = qemu_new_net_client(&net_vhost_user_info, peer, device, name);
+    for (i = 0; i < queues; i++) {
+        nc = qemu_new_net_client(&net_vhost_user_info, peer, device, name);
 
-    snprintf(nc->info_str, sizeof(nc->info_str), "vhost-user to %s",
-             chr->label);
+        snprintf(nc->info_str, sizeof(nc->info_str), "vhost-user%d to %s",
+                 i, chr->label);
 
-    s = DO_UPCAST(VhostUserState, nc, nc);
+        /* All queue pairs share the socket, the backend tells them apart
+         * by the virtqueue index, see vhost_user_get_vq_index().
+         */
+        nc->queue_index = i;
 
-    /* We don't provide a receive callback */
-    s->nc.receive_disabled = 1;
-    s->chr = chr;
+        s = DO_UPCAST(VhostUserState, nc, nc);
 
-    qemu_chr_add_handlers(s->chr, NULL, NULL, net_vhost_user_event, s);
+        /* We don't provide a receive callback */
+        s->nc.receive_disabled = 1;
+        s->chr = chr;
+
+        if (i == 0) {
+            qemu_chr_add_handlers(s->chr, NULL, NULL, net_vhost_user_event,
+                                  s);
+        }
+    }
 
     return 0;
 }
@@ -164,6 +255,8 @@ static int net_vhost_chardev_opts(const char *name, const char *value,
         props->is_unix = true;
     } else if (strcmp(name, "server") == 0) {
         props->is_server = true;
+    } else if (strcmp(name, "reconnect") == 0) {
+        props->is_reconnect = true;
     } else {
         error_report("vhost-user does not support a chardev"
                      " with the following option:\n %s = %s",
@@ -227,10 +320,23 @@ int net_init_vhost_user(const NetClientOptions *opts, const char *name,
 {
     const NetdevVhostUserOptions *vhost_user_opts;
     CharDriverState *chr;
+    int queues;
 
     assert(opts->kind == NET_CLIENT_OPTIONS_KIND_VHOST_USER);
     vhost_user_opts = opts->vhost_user;
 
+    queues = vhost_user_opts->has_queues ? vhost_user_opts->queues : 1;
+    if (queues < 1 || queues > MAX_QUEUE_NUM) {
+        error_report("vhost-user number of queues must be in range [1, %d]",
+                     MAX_QUEUE_NUM);
+        return -1;
+    }
+
+    if (peer && queues > 1) {
+        error_report("Multiqueue vhost-user is not supported with -net");
+        return -1;
+    }
+
     chr = net_vhost_parse_chardev(vhost_user_opts);
     if (!chr) {
         error_report("No suitable chardev found");
@@ -244,5 +350,5 @@ int net_init_vhost_user(const NetClientOptions *opts, const char *name,
     }
 
 
-    return net_vhost_user_init(peer, "vhost_user", name, chr);
+    return net_vhost_user_init(peer, "vhost_user", name, chr, queues);
 }
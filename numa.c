@@ -38,6 +38,12 @@
 #include "hw/mem/pc-dimm.h"
 #include "qemu/option.h"
 #include "qemu/config-file.h"
+#include "qemu/thread.h"
+#include "exec/address-spaces.h"
+
+#ifdef CONFIG_NUMA
+#include <numaif.h>
+#endif
 
 QemuOptsList qemu_numa_opts = {
     .name = "numa",
@@ -53,6 +59,9 @@ static int max_numa_nodeid; /* Highest specified NUMA node ID, plus one.
 int nb_numa_nodes;
 NodeInfo numa_info[MAX_NODES];
 
+/* The -m memory that mem= nodes are carved from, in node order */
+static MemoryRegion *numa_system_ram;
+
 static void numa_node_parse(NumaNodeOptions *node, QemuOpts *opts, Error **errp)
 {
     uint16_t nodenr;
@@ -98,6 +107,56 @@ static void numa_node_parse(NumaNodeOptions *node, QemuOpts *opts, Error **errp)
         return;
     }
 
+    if ((node->has_host_nodes || node->has_policy) && node->has_memdev) {
+        error_setg(errp, "host-nodes and policy cannot be used with memdev=, "
+                   "set them on the memory backend instead");
+        return;
+    }
+
+    if (node->has_host_nodes) {
+#ifdef CONFIG_NUMA
+        uint16List *l;
+
+        for (l = node->host_nodes; l; l = l->next) {
+            if (l->value >= MAX_NODES) {
+                error_setg(errp, "host node %" PRIu16 " is bigger than %d",
+                           l->value, MAX_NODES - 1);
+                return;
+            }
+            bitmap_set(numa_info[nodenr].host_nodes, l->value, 1);
+        }
+#else
+        error_setg(errp, "NUMA node binding is not supported by this QEMU");
+        return;
+#endif
+    }
+
+    /* Binding is the common case, so it is the default */
+    if (node->has_policy) {
+        numa_info[nodenr].policy = node->policy;
+    } else if (node->has_host_nodes) {
+        numa_info[nodenr].policy = HOST_MEM_POLICY_BIND;
+    }
+    if (node->has_host_nodes && numa_info[nodenr].policy ==
+        HOST_MEM_POLICY_DEFAULT) {
+        error_setg(errp, "host-nodes must be empty for policy default");
+        return;
+    } else if (!node->has_host_nodes && numa_info[nodenr].policy !=
+               HOST_MEM_POLICY_DEFAULT) {
+        error_setg(errp, "host-nodes must be set for policy %s",
+                   HostMemPolicy_lookup[numa_info[nodenr].policy]);
+        return;
+    }
+
+    for (cpus = node->host_cpus; cpus; cpus = cpus->next) {
+        if (cpus->value >= MAX_HOST_CPUS) {
+            error_setg(errp, "host CPU %" PRIu16 " is bigger than %d",
+                       cpus->value, MAX_HOST_CPUS - 1);
+            return;
+        }
+        bitmap_set(numa_info[nodenr].host_cpus, cpus->value, 1);
+    }
+
     if (node->has_mem) {
         uint64_t mem_size = node->mem;
         const char *mem_str = qemu_opt_get(opts, "mem");
@@ -245,19 +304,219 @@ void parse_numa_opts(void)
     }
 }
 
+/* Without explicit host-cpus, a node runs on the CPUs of the host nodes
+ * that its memory is bound to.
+ */
+static void numa_init_host_cpus(NodeInfo *info)
+{
+    unsigned long *host_nodes = info->host_nodes;
+    int node, ret;
+
+    if (!bitmap_empty(info->host_cpus, MAX_HOST_CPUS)) {
+        return;
+    }
+    if (info->node_memdev) {
+        host_nodes = info->node_memdev->host_nodes;
+    }
+
+    for (node = find_first_bit(host_nodes, MAX_NODES); node < MAX_NODES;
+         node = find_next_bit(host_nodes, MAX_NODES, node + 1)) {
+        ret = qemu_host_node_cpus(node, info->host_cpus, MAX_HOST_CPUS);
+        if (ret < 0) {
+            error_report("warning: cannot read the CPUs of host node %d: %s",
+                         node, strerror(-ret));
+        }
+    }
+}
+
+/* Set once the nodes' host CPUs are known; VCPUs created earlier are
+ * placed by numa_post_machine_init.
+ */
+static bool numa_placement_ready;
+
+void numa_place_vcpu(CPUState *cpu)
+{
+    int i, ret;
+
+    if (!numa_placement_ready) {
+        return;
+    }
+
+    for (i = 0; i < nb_numa_nodes; i++) {
+        if (test_bit(cpu->cpu_index, numa_info[i].node_cpu)) {
+            cpu->numa_node = i;
+        }
+    }
+
+    /* Single-threaded TCG runs all VCPUs in one thread */
+    if (tcg_enabled() && !qemu_tcg_mttcg_enabled()) {
+        return;
+    }
+    if (cpu->numa_node >= nb_numa_nodes ||
+        bitmap_empty(numa_info[cpu->numa_node].host_cpus, MAX_HOST_CPUS)) {
+        return;
+    }
+    ret = qemu_thread_set_affinity(cpu->thread,
+                                   numa_info[cpu->numa_node].host_cpus,
+                                   MAX_HOST_CPUS);
+    if (ret < 0) {
+        error_report("warning: cannot pin VCPU %d to the host CPUs of "
+                     "node %d: %s", cpu->cpu_index, cpu->numa_node,
+                     strerror(-ret));
+    }
+}
+
 void numa_post_machine_init(void)
 {
     CPUState *cpu;
     int i;
 
+    for (i = 0; i < nb_numa_nodes; i++) {
+        numa_init_host_cpus(&numa_info[i]);
+    }
+
+    numa_placement_ready = true;
     CPU_FOREACH(cpu) {
-        for (i = 0; i < nb_numa_nodes; i++) {
-            if (test_bit(cpu->cpu_index, numa_info[i].node_cpu)) {
-                cpu->numa_node = i;
+        numa_place_vcpu(cpu);
+    }
+}
+
+bool numa_node_host_cpus(int node, unsigned long *host_cpus)
+{
+    if (node < 0 || node >= nb_numa_nodes ||
+        bitmap_empty(numa_info[node].host_cpus, MAX_HOST_CPUS)) {
+        return false;
+    }
+    bitmap_copy(host_cpus, numa_info[node].host_cpus, MAX_HOST_CPUS);
+    return true;
+}
+
+int numa_get_node_for_addr(hwaddr addr)
+{
+    MemoryRegionSection section;
+    uint64_t offset = 0;
+    int i, node = -1;
+
+    section = memory_region_find(get_system_memory(), addr, 1);
+    if (!section.mr) {
+        return -1;
+    }
+
+    for (i = 0; i < nb_numa_nodes; i++) {
+        HostMemoryBackend *backend = numa_info[i].node_memdev;
+
+        if (backend) {
+            if (section.mr == &backend->mr) {
+                node = i;
+                break;
+            }
+        } else if (section.mr == numa_system_ram) {
+            offset += numa_info[i].node_mem;
+            if (section.offset_within_region < offset) {
+                node = i;
+                break;
             }
         }
     }
+
+    memory_region_unref(section.mr);
+    return node;
+}
+
+#ifdef CONFIG_NUMA
+/* Host address and size of the memory of guest node @node */
+static void *numa_node_host_ptr(int node, uint64_t *size)
+{
+    uint64_t offset = 0;
+    int i;
+
+    *size = numa_info[node].node_mem;
+    if (numa_info[node].node_memdev) {
+        return memory_region_get_ram_ptr(&numa_info[node].node_memdev->mr);
+    }
+    if (!numa_system_ram) {
+        return NULL;
+    }
+    for (i = 0; i < node; i++) {
+        offset += numa_info[i].node_mem;
+    }
+    return memory_region_get_ram_ptr(numa_system_ram) + offset;
+}
+#endif
+
+#define NUMA_RESIDENCY_SAMPLES 256
+
+int numa_node_host_residency(int node, uint64_t *host_pages)
+{
+#ifdef CONFIG_NUMA
+    void *pages[NUMA_RESIDENCY_SAMPLES];
+    int status[NUMA_RESIDENCY_SAMPLES];
+    uint64_t size, stride;
+    uint8_t *ptr;
+    int i, n;
+
+    ptr = numa_node_host_ptr(node, &size);
+    n = MIN(NUMA_RESIDENCY_SAMPLES, size / getpagesize());
+    if (!ptr || !n) {
+        return 0;
+    }
+
+    /* Sample pages evenly spread over the node */
+    stride = (size / n) & ~(uint64_t)(getpagesize() - 1);
+    for (i = 0; i < n; i++) {
+        pages[i] = ptr + i * stride;
+    }
+    if (move_pages(0, n, pages, NULL, status, 0) < 0) {
+        return -errno;
+    }
+
+    for (i = 0; i < n; i++) {
+        /* Pages that were never touched report -ENOENT */
+        if (status[i] >= 0 && status[i] < MAX_NODES) {
+            host_pages[status[i]]++;
+        }
+    }
+    return n;
+#else
+    return -ENOSYS;
+#endif
+}
+
+#ifdef CONFIG_NUMA
+/* Apply the host-nodes and policy of mem= nodes to their slice of RAM.
+ * mbind() works on whole pages, so a page that straddles two nodes keeps
+ * the default policy.  Failing to bind is not fatal: the guest still
+ * runs, only slower.
+ */
+static void numa_bind_system_memory(MemoryRegion *mr)
+{
+    uint8_t *ptr = memory_region_get_ram_ptr(mr);
+    uintptr_t pagesize = getpagesize();
+    uint64_t offset = 0;
+    int i;
+
+    for (i = 0; i < nb_numa_nodes; i++) {
+        NodeInfo *info = &numa_info[i];
+        unsigned long lastbit = find_last_bit(info->host_nodes, MAX_NODES);
+        /* see host_memory_backend_memory_complete() for the + 1 */
+        unsigned long maxnode = (lastbit + 1) % (MAX_NODES + 1);
+        uintptr_t start = ROUND_UP((uintptr_t)ptr + offset, pagesize);
+        uintptr_t end = ((uintptr_t)ptr + offset + info->node_mem) &
+                        ~(pagesize - 1);
+
+        offset += info->node_mem;
+        if (!maxnode || start >= end) {
+            continue;
+        }
+        if (mbind((void *)start, end - start, info->policy,
+                  info->host_nodes, maxnode + 1,
+                  MPOL_MF_STRICT | MPOL_MF_MOVE)) {
+            error_report("cannot bind memory of node %d to host NUMA "
+                         "nodes: %s", i, strerror(errno));
+        }
+    }
 }
+#endif
 
 static void allocate_system_memory_nonnuma(MemoryRegion *mr, Object *owner,
                                            const char *name,
@@ -295,6 +554,12 @@ void memory_region_allocate_system_memory(MemoryRegion *mr, Object *owner,
 
     if (nb_numa_nodes == 0 || !have_memdevs) {
         allocate_system_memory_nonnuma(mr, owner, name, ram_size);
+        if (nb_numa_nodes) {
+            numa_system_ram = mr;
+#ifdef CONFIG_NUMA
+            numa_bind_system_memory(mr);
+#endif
+        }
         return;
     }
 
@@ -367,6 +632,7 @@ static int query_memdev(Object *obj, void *opaque)
 {
     MemdevList **list = opaque;
     MemdevList *m = NULL;
+    HostMemoryBackend *backend;
     Error *err = NULL;
 
     if (object_dynamic_cast(obj, TYPE_MEMORY_BACKEND)) {
@@ -412,6 +678,24 @@ static int query_memdev(Object *obj, void *opaque)
             goto error;
         }
 
+        m->value->thp = object_property_get_bool(obj, "thp", &err);
+        if (err) {
+            goto error;
+        }
+
+        m->value->prealloc_threads = object_property_get_int(obj,
+                                                             "prealloc-threads",
+                                                             &err);
+        if (err) {
+            goto error;
+        }
+
+        backend = MEMORY_BACKEND(obj);
+        if (backend->prealloc_time_ns) {
+            m->value->has_prealloc_time = true;
+            m->value->prealloc_time = backend->prealloc_time_ns / SCALE_MS;
+        }
+
         m->next = *list;
         *list = m;
     }
@@ -33,6 +33,8 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                property accel=accel1[:accel2[:...]] selects accelerator\n"
     "                supported accelerators are kvm, xen, tcg (default: tcg)\n"
     "                kernel_irqchip=on|off controls accelerated irqchip support\n"
+    "                tcg-thread=single|multi runs TCG vCPUs in one or one per vCPU host thread (default: single)\n"
+    "                tlb-max-bits=n limits each TCG TLB to 2^n entries per MMU mode (default: 16)\n"
     "                vmport=on|off|auto controls emulation of vmport (default: auto)\n"
     "                kvm_shadow_mem=size of KVM shadow MMU\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
@@ -52,6 +54,19 @@ than one accelerator specified, the next one is used if the previous one fails
 to initialize.
 @item kernel_irqchip=on|off
 Enables in-kernel irqchip support for the chosen accelerator when available.
+@item tcg-thread=single|multi
+Controls how the tcg accelerator runs the emulated CPUs. @code{single} runs
+all vCPUs round-robin in one host thread; @code{multi} gives each vCPU its
+own host thread so that they run in parallel. Guest atomic instructions
+(x86 LOCK prefix, ARM load/store-exclusive and SWP) then briefly stop all
+other vCPUs. Multi-threaded TCG is only available for x86 and ARM guests
+on x86-64 Linux hosts, and cannot be combined with @option{-icount}. The
+default is single.
+@item tlb-max-bits=@var{n}
+The tcg accelerator grows and shrinks the software TLB of each MMU mode
+according to how much of it the guest uses. This option limits it to
+2^@var{n} entries; @var{n} may range from 8 to 16 and defaults to 16. Only
+the x86 TCG host backend supports resizable TLBs.
 @item vmport=on|off|auto
 Enables emulation of VMWare IO port, for vmmouse etc. auto says to select the
 value based on accel. For accel=xen the default is off otherwise the default
@@ -104,10 +119,12 @@ ETEXI
 
 DEF("numa", HAS_ARG, QEMU_OPTION_numa,
     "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node]\n"
-    "-numa node[,memdev=id][,cpus=cpu[-cpu]][,nodeid=node]\n", QEMU_ARCH_ALL)
+    "          [,host-nodes=node[-node]][,policy=default|preferred|bind|interleave]\n"
+    "          [,host-cpus=cpu[-cpu]]\n"
+    "-numa node[,memdev=id][,cpus=cpu[-cpu]][,nodeid=node][,host-cpus=cpu[-cpu]]\n", QEMU_ARCH_ALL)
 STEXI
-@item -numa node[,mem=@var{size}][,cpus=@var{cpu[-cpu]}][,nodeid=@var{node}]
-@item -numa node[,memdev=@var{id}][,cpus=@var{cpu[-cpu]}][,nodeid=@var{node}]
+@item -numa node[,mem=@var{size}][,cpus=@var{cpu[-cpu]}][,nodeid=@var{node}][,host-nodes=@var{node[-node]}][,policy=@var{policy}][,host-cpus=@var{cpu[-cpu]}]
+@item -numa node[,memdev=@var{id}][,cpus=@var{cpu[-cpu]}][,nodeid=@var{node}][,host-cpus=@var{cpu[-cpu]}]
 @findex -numa
 Simulate a multi node NUMA system. If @samp{mem}, @samp{memdev}
 and @samp{cpus} are omitted, resources are split equally. Also, note
@@ -119,6 +136,18 @@ to specify the memory backend for the @samp{memdev} suboption.
 
 @samp{mem} and @samp{memdev} are mutually exclusive.  Furthermore, if one
 node uses @samp{memdev}, all of them have to use it.
+
+@samp{host-nodes} and @samp{policy} bind the node's share of @option{-m}
+memory to host NUMA nodes, like the properties of the same name do for
+@samp{memdev} backends.  @samp{host-cpus} pins the VCPU threads of the node
+to the given host CPUs; if it is omitted, the CPUs of the host nodes that
+back the node's memory are used.  The CPU set is per node: every VCPU of
+the node may run on any of its host CPUs, and there is no way to pin a
+single VCPU to a CPU set of its own.  VCPUs are only pinned when each of
+them has a thread of its own, i.e. with KVM or multi-threaded TCG; VCPUs
+added later with @code{cpu-add} are pinned when they are created.  I/O threads
+with a @samp{numa-node} property, or those that serve a virtio-blk dataplane
+whose rings live in the node's memory, are pinned to the same CPUs.
 ETEXI
 
 DEF("add-fd", HAS_ARG, QEMU_OPTION_add_fd,
@@ -271,7 +300,9 @@ DEF("mem-prealloc", 0, QEMU_OPTION_mem_prealloc,
 STEXI
 @item -mem-prealloc
 @findex -mem-prealloc
-Preallocate memory when using -mem-path.
+Preallocate memory when using -mem-path.  The memory is touched by one
+thread per VCPU; memory backends can choose the number of threads with
+their @samp{prealloc-threads} property.
 ETEXI
 
 DEF("k", HAS_ARG, QEMU_OPTION_k,
@@ -1906,13 +1937,19 @@ The hubport netdev lets you connect a NIC to a QEMU "vlan" instead of a single
 netdev.  @code{-net} and @code{-device} with parameter @option{vlan} create the
 required hub automatically.
 
-@item -netdev vhost-user,chardev=@var{id}[,vhostforce=on|off]
+@item -netdev vhost-user,chardev=@var{id}[,vhostforce=on|off][,queues=n]
 
 Establish a vhost-user netdev, backed by a chardev @var{id}. The chardev should
 be a unix domain socket backed one. The vhost-user uses a specifically defined
 protocol to pass vhost ioctl replacement messages to an application on the other
 end of the socket. On non-MSIX guests, the feature can be forced with
-@var{vhostforce}.
+@var{vhostforce}. Use 'queues=@var{n}' to specify the number of queue pairs
+to be created for multiqueue vhost-user; the backend must support at least
+@var{n} queue pairs.
+
+If the backend closes the connection, the guest sees the link go down and the
+device is set up again when a new connection is made, either by the backend
+connecting to a server socket or with the chardev @option{reconnect} option.
 
 Example:
 @example
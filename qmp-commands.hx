@@ -2458,6 +2458,102 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_cpus,
     },
 
+SQMP
+query-vcpu-stats
+----------------
+
+Show run loop statistics for each vCPU: why and how often it leaves
+guest mode, how long it runs and waits, and which MMIO and PIO addresses
+it accesses most.  The statistics are only collected while enabled with
+vcpu-stats.
+
+Return a json-array. Each vCPU is represented by a json-object, which
+contains:
+
+- "cpu-index": CPU index (json-int)
+- "thread-id": ID of the underlying host thread (json-int)
+- "exits": json-array of json-objects, containing:
+  - "reason": one of "io", "mmio", "halt", "irq-window", "interrupt",
+              "shutdown", "system-event", "debug", "internal-error",
+              "other" (json-string)
+  - "count": number of exits (json-int)
+- "run": time in guest mode per entry (json-object, see below)
+- "emulation": time spent in QEMU per exit with KVM, or per MMIO or PIO
+               access with TCG (json-object, see below)
+- "bql-wait": time spent waiting for the global mutex (json-object, see
+              below)
+- "hotspots": json-array of json-objects, most accessed first, containing:
+  - "addr": guest physical address or I/O port (json-int)
+  - "pio": true for port I/O (json-bool)
+  - "count": upper bound of the number of accesses (json-int)
+
+The histograms contain:
+
+- "count": number of samples (json-int)
+- "total-ns": sum of the samples in nanoseconds (json-int)
+- "max-ns": longest sample in nanoseconds (json-int)
+- "buckets": json-array of json-int; the first counts samples below 1us,
+             entry i those between 2^(i-1) and 2^i us, the last one all
+             longer samples
+
+Example:
+
+-> { "execute": "query-vcpu-stats" }
+<- { "return": [
+        {
+           "cpu-index": 0,
+           "thread-id": 3134,
+           "exits": [
+              { "reason": "io", "count": 18042 },
+              { "reason": "mmio", "count": 96321 },
+              { "reason": "interrupt", "count": 2210 }
+           ],
+           "run": { "count": 116573, "total-ns": 9120343101,
+                    "max-ns": 10003127, "buckets": [ 3025, 12004, ... ] },
+           "emulation": { "count": 114363, "total-ns": 401283221,
+                          "max-ns": 880123, "buckets": [ 50210, ... ] },
+           "bql-wait": { "count": 20112, "total-ns": 12033211,
+                         "max-ns": 95210, "buckets": [ 19830, ... ] },
+           "hotspots": [
+              { "addr": 4273946624, "pio": false, "count": 80221 },
+              { "addr": 1016, "pio": true, "count": 15003 }
+           ]
+        }
+     ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-vcpu-stats",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_vcpu_stats,
+    },
+
+SQMP
+vcpu-stats
+----------
+
+Start or stop collecting vCPU run loop statistics.  Collection is off by
+default; disabling it keeps the statistics collected so far.
+
+Arguments:
+
+- "enable": whether to collect statistics (json-bool)
+
+Example:
+
+-> { "execute": "vcpu-stats", "arguments": { "enable": true } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "vcpu-stats",
+        .args_type  = "enable:b",
+        .mhandler.cmd_new = qmp_marshal_input_vcpu_stats,
+    },
+
 SQMP
 query-iothreads
 ---------------
@@ -2472,6 +2568,13 @@ Return a json-array. Each iothread is represented by a json-object, which contai
 
 - "id": name of iothread (json-str)
 - "thread-id": ID of the underlying host thread (json-int)
+- "poll-max-ns": maximum busy polling window in ns, 0 if disabled (json-int)
+- "poll-grow": polling window growth factor (json-int)
+- "poll-shrink": polling window shrink divisor (json-int)
+- "poll-ns": current busy polling window in ns (json-int)
+- "poll-hits": blocking iterations that found work while polling (json-int)
+- "poll-misses": blocking iterations that had to sleep (json-int)
+- "numa-node": guest NUMA node the iothread runs next to, optional (json-int)
 
 Example:
 
@@ -2480,11 +2583,24 @@ Example:
       "return":[
          {
             "id":"iothread0",
-            "thread-id":3134
+            "thread-id":3134,
+            "poll-max-ns":32768,
+            "poll-grow":0,
+            "poll-shrink":0,
+            "poll-ns":16000,
+            "poll-hits":8712,
+            "poll-misses":95,
+            "numa-node":0
          },
          {
             "id":"iothread1",
-            "thread-id":3135
+            "thread-id":3135,
+            "poll-max-ns":0,
+            "poll-grow":0,
+            "poll-shrink":0,
+            "poll-ns":0,
+            "poll-hits":0,
+            "poll-misses":0
          }
       ]
    }
@@ -2497,6 +2613,62 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_iothreads,
     },
 
+SQMP
+query-thread-pools
+------------------
+
+Returns the configuration and queue statistics of the worker thread pools
+used for blocking I/O by the main loop ("main-loop") and by each iothread.
+Pools are created on first use and are not listed before that.
+
+Return a json-array. Each pool is represented by a json-object, which contains:
+
+- "id": "main-loop" or the iothread id (json-str)
+- "min-threads": workers kept alive when idle (json-int)
+- "max-threads": maximum number of workers (json-int)
+- "idle-timeout": ms after which idle workers above the minimum exit (json-int)
+- "node": host NUMA node the workers are bound to, optional (json-int)
+- "threads": current number of workers (json-int)
+- "idle-threads": workers waiting for requests (json-int)
+- "queue-depth": requests waiting for a worker (json-int)
+- "max-queue-depth": highest queue depth seen (json-int)
+- "completed": requests that have run (json-int)
+- "stolen": requests run by another worker than they were queued on (json-int)
+- "wait-ns": total time requests spent queued (json-int)
+- "max-wait-ns": longest time a request spent queued (json-int)
+- "service-ns": total time spent running requests (json-int)
+
+Example:
+
+-> { "execute": "query-thread-pools" }
+<- {
+      "return":[
+         {
+            "id":"main-loop",
+            "min-threads":0,
+            "max-threads":64,
+            "idle-timeout":10000,
+            "threads":4,
+            "idle-threads":3,
+            "queue-depth":0,
+            "max-queue-depth":12,
+            "completed":20133,
+            "stolen":87,
+            "wait-ns":40266000,
+            "max-wait-ns":1843000,
+            "service-ns":2013300000
+         }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-thread-pools",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_thread_pools,
+    },
+
 SQMP
 query-pci
 ---------
@@ -2724,11 +2896,22 @@ Return a json-object with the following information:
 
 - "enabled": true if KVM support is enabled, false otherwise (json-bool)
 - "present": true if QEMU has KVM support, false otherwise (json-bool)
+- "msi-routes": statistics of the MSI route cache, if KVM uses GSI
+                routing (json-object, optional), containing:
+  - "direct": true if the kernel injects MSIs directly (json-bool)
+  - "routes": number of cached routes (json-int)
+  - "hits": MSIs sent through a cached route (json-int)
+  - "misses": MSIs that needed a new route (json-int)
+  - "evictions": routes evicted to make room for a new one (json-int)
+  - "commits": loads of the GSI routing table into KVM (json-int)
 
 Example:
 
 -> { "execute": "query-kvm" }
-<- { "return": { "enabled": true, "present": true } }
+<- { "return": { "enabled": true, "present": true,
+                 "msi-routes": { "direct": false, "routes": 64,
+                                 "hits": 1203381, "misses": 96,
+                                 "evictions": 32, "commits": 121 } } }
 
 EQMP
 
@@ -2738,6 +2921,104 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_kvm,
     },
 
+SQMP
+query-jit
+---------
+
+Show the state of the TCG translation cache and, if profiling was enabled
+with jit-profile, the most executed translated blocks.
+
+Arguments:
+
+- "count": maximum number of hot blocks to return, default 10
+           (json-int, optional)
+
+Return a json-object with the following information:
+
+- "profiling": true if block executions are being counted (json-bool)
+- "code-size": bytes of the translation buffer in use (json-int)
+- "code-capacity": usable size of the translation buffer (json-int)
+- "blocks": number of translated blocks (json-int)
+- "max-blocks": maximum number of translated blocks (json-int)
+- "flushes": number of translation buffer flushes (json-int)
+- "evictions": translation buffer regions emptied for new blocks (json-int)
+- "invalidations": blocks invalidated by guest code changes (json-int)
+- "translations": blocks translated while profiling (json-int)
+- "translation-time-ns": time spent translating while profiling (json-int)
+- "guest-bytes": guest code translated while profiling (json-int)
+- "host-bytes": host code generated while profiling (json-int)
+- "hot-blocks": json-array of json-objects, hottest first, containing:
+  - "pc": guest virtual address of the block (json-int)
+  - "phys-pc": guest physical address of the block (json-int)
+  - "instructions": guest instructions in the block (json-int)
+  - "guest-size": size of the guest code (json-int)
+  - "host-size": size of the host code (json-int)
+  - "executions": number of times the block was entered (json-int)
+  - "exits": returns to the main loop from the block (json-int)
+
+Example:
+
+-> { "execute": "query-jit", "arguments": { "count": 1 } }
+<- { "return": {
+        "profiling": true,
+        "code-size": 5132480,
+        "code-capacity": 33488896,
+        "blocks": 21014,
+        "max-blocks": 262144,
+        "flushes": 1,
+        "evictions": 3,
+        "invalidations": 1289,
+        "translations": 22303,
+        "translation-time-ns": 412301000,
+        "guest-bytes": 1070544,
+        "host-bytes": 5021760,
+        "hot-blocks": [
+           {
+              "pc": 1049856,
+              "phys-pc": 17043392,
+              "instructions": 7,
+              "guest-size": 23,
+              "host-size": 190,
+              "executions": 81230611,
+              "exits": 1032
+           }
+        ]
+     }
+   }
+
+EQMP
+
+    {
+        .name       = "query-jit",
+        .args_type  = "count:i?",
+        .mhandler.cmd_new = qmp_marshal_input_query_jit,
+    },
+
+SQMP
+jit-profile
+-----------
+
+Start or stop counting executions of translated blocks.  Enabling the
+profiler flushes the translation buffer and resets the translation
+statistics; disabling it keeps the counts collected so far.
+
+Arguments:
+
+- "enable": whether to count executions (json-bool)
+
+Example:
+
+-> { "execute": "jit-profile", "arguments": { "enable": true } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "jit-profile",
+        .args_type  = "enable:b",
+        .mhandler.cmd_new = qmp_marshal_input_jit_profile,
+    },
+
 SQMP
 query-status
 ------------
@@ -3739,7 +4020,9 @@ Example (1):
          "dump": true,
          "prealloc": false,
          "host-nodes": [0, 1],
-         "policy": "bind"
+         "policy": "bind",
+         "thp": true,
+         "prealloc-threads": 4
        },
        {
          "size": 536870912,
@@ -3747,7 +4030,10 @@ Example (1):
          "dump": true,
          "prealloc": true,
          "host-nodes": [2, 3],
-         "policy": "preferred"
+         "policy": "preferred",
+         "thp": false,
+         "prealloc-threads": 4,
+         "prealloc-time": 93
        }
      ]
    }
@@ -3952,4 +4238,55 @@ Example:
                  "write-threshold": 17179869184 } }
 <- { "return": {} }
 
+EQMP
+
+    {
+        .name       = "query-virtio-irq-stats",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_virtio_irq_stats,
+    },
+
+SQMP
+query-virtio-irq-stats
+----------------------
+
+Show interrupt delivery and moderation statistics of virtio devices.
+
+Interrupt moderation is configured per device with the
+"irq-coalesce-usecs" (maximum delay of an interrupt, at most 1000000;
+0 disables moderation), "irq-coalesce-frames" (completions after which an interrupt
+is sent without waiting for the delay, 0 means no limit) and
+"irq-coalesce-adaptive" (scale the delay with the completion rate)
+properties.  The last two require a nonzero "irq-coalesce-usecs".
+
+Returns a json-array with one entry per virtio device:
+
+- "path": QOM path of the device (json-string)
+- "name": virtio device name (json-string)
+- "queues": a json-array with one entry per active virtqueue:
+  - "queue": virtqueue index (json-int)
+  - "delivered": interrupts sent to the guest (json-int)
+  - "suppressed": notifications suppressed by the guest (json-int)
+  - "coalesced": completions folded into a pending interrupt (json-int)
+  - "usecs": current moderation delay in microseconds (json-int)
+
+Example:
+
+-> { "execute": "query-virtio-irq-stats" }
+<- { "return": [
+       {
+         "path": "/machine/peripheral/net0/virtio-backend",
+         "name": "virtio-net",
+         "queues": [
+           { "queue": 0, "delivered": 5120, "suppressed": 322,
+             "coalesced": 40960, "usecs": 64 },
+           { "queue": 1, "delivered": 812, "suppressed": 90211,
+             "coalesced": 0, "usecs": 0 },
+           { "queue": 2, "delivered": 0, "suppressed": 0,
+             "coalesced": 0, "usecs": 0 }
+         ]
+       }
+     ]
+   }
+
 EQMP
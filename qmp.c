@@ -29,6 +29,7 @@
 #include "hw/boards.h"
 #include "qom/object_interfaces.h"
 #include "hw/mem/pc-dimm.h"
+#include "hw/virtio/virtio.h"
 #include "hw/acpi/acpi_dev_interface.h"
 
 NameInfo *qmp_query_name(Error **errp)
@@ -65,6 +66,10 @@ KvmInfo *qmp_query_kvm(Error **errp)
 
     info->enabled = kvm_enabled();
     info->present = kvm_available();
+    if (kvm_enabled()) {
+        info->msi_routes = kvm_msi_route_info();
+        info->has_msi_routes = info->msi_routes != NULL;
+    }
 
     return info;
 }
@@ -725,6 +730,16 @@ MemoryDeviceInfoList *qmp_query_memory_devices(Error **errp)
     return head;
 }
 
+VirtioIrqStatsList *qmp_query_virtio_irq_stats(Error **errp)
+{
+    VirtioIrqStatsList *head = NULL;
+    VirtioIrqStatsList **prev = &head;
+
+    qmp_virtio_irq_stats_list(qdev_get_machine(), &prev);
+
+    return head;
+}
+
 ACPIOSTInfoList *qmp_query_acpi_ospm_status(Error **errp)
 {
     bool ambig;
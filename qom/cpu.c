@@ -24,6 +24,7 @@
 #include "qemu/notify.h"
 #include "qemu/log.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "sysemu/sysemu.h"
 
 bool cpu_exists(int64_t id)
@@ -297,6 +298,69 @@ static void cpu_common_parse_features(CPUState *cpu, char *features,
     }
 }
 
+bool cpu_stats_enabled;
+
+static void cpu_stats_hist_add(CPUStatsHistogram *hist, int64_t ns)
+{
+    uint64_t us;
+    int bucket;
+
+    if (ns < 0) {
+        ns = 0;
+    }
+    us = ns / 1000;
+    bucket = us ? 64 - clz64(us) : 0;
+
+    hist->count++;
+    hist->total_ns += ns;
+    hist->max_ns = MAX(hist->max_ns, ns);
+    hist->buckets[MIN(bucket, CPU_STATS_HIST_BUCKETS - 1)]++;
+}
+
+void cpu_stats_account_exit(CPUState *cpu, VcpuExitReason reason,
+                            int64_t run_ns)
+{
+    cpu->stats.exits[reason]++;
+    cpu_stats_hist_add(&cpu->stats.run, run_ns);
+}
+
+void cpu_stats_account_emulation(CPUState *cpu, int64_t ns)
+{
+    cpu_stats_hist_add(&cpu->stats.emulation, ns);
+}
+
+void cpu_stats_account_bql_wait(CPUState *cpu, int64_t ns)
+{
+    cpu_stats_hist_add(&cpu->stats.bql_wait, ns);
+}
+
+/* The hot spot table keeps the most frequent addresses with the
+ * "space-saving" algorithm: a new address evicts the least counted entry
+ * and inherits its count.  Counts are thus upper bounds, but an address
+ * that takes more than 1/CPU_STATS_IO_HOTSPOTS of the accesses is never
+ * lost.
+ */
+void cpu_stats_account_io(CPUState *cpu, uint64_t addr, bool pio)
+{
+    CPUStatsHotspot *h, *victim = NULL;
+    int i;
+
+    for (i = 0; i < CPU_STATS_IO_HOTSPOTS; i++) {
+        h = &cpu->stats.hotspots[i];
+        if (h->count && h->addr == addr && h->pio == pio) {
+            h->count++;
+            return;
+        }
+        if (!victim || h->count < victim->count) {
+            victim = h;
+        }
+    }
+
+    victim->addr = addr;
+    victim->pio = pio;
+    victim->count++;
+}
+
 static void cpu_common_realizefn(DeviceState *dev, Error **errp)
 {
     CPUState *cpu = CPU(dev);
@@ -315,6 +379,11 @@ static void cpu_common_initfn(Object *obj)
     cpu->gdb_num_regs = cpu->gdb_num_g_regs = cc->gdb_num_core_regs;
 }
 
+static void cpu_common_finalize(Object *obj)
+{
+    cpu_exec_finalize(CPU(obj));
+}
+
 static int64_t cpu_common_get_arch_id(CPUState *cpu)
 {
     return cpu->cpu_index;
@@ -356,6 +425,7 @@ static const TypeInfo cpu_type_info = {
     .parent = TYPE_DEVICE,
     .instance_size = sizeof(CPUState),
     .instance_init = cpu_common_initfn,
+    .instance_finalize = cpu_common_finalize,
     .abstract = true,
     .class_size = sizeof(CPUClass),
     .class_init = cpu_class_init,
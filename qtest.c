@@ -12,6 +12,7 @@
  */
 
 #include "sysemu/qtest.h"
+#include "sysemu/qtest-binary.h"
 #include "hw/qdev.h"
 #include "sysemu/char.h"
 #include "exec/ioport.h"
@@ -143,6 +144,14 @@ static bool qtest_opened;
  * where NUM is an IRQ number.  For the PC, interrupts can be intercepted
  * simply with "irq_intercept_in ioapic" (note that IRQ0 comes out with
  * NUM=0 even though it is remapped to GSI 2).
+ *
+ * Binary frames:
+ *
+ * Memory transfers and bursts of MMIO or PIO accesses can also be sent as
+ * binary frames, which are described in sysemu/qtest-binary.h.  A frame
+ * starts with a byte that no text command starts with, and is answered
+ * with a binary response frame.  Async IRQ messages stay text lines, even
+ * when they come before the response to a binary frame.
  */
 
 static int hex2nib(char ch)
@@ -449,15 +458,260 @@ static void qtest_process_command(CharDriverState *chr, gchar **words)
     }
 }
 
+static const char *const qtest_bin_op_names[QTEST_BIN_OP_MAX] = {
+    [QTEST_BIN_READ] = "read",
+    [QTEST_BIN_WRITE] = "write",
+    [QTEST_BIN_MEMSET] = "memset",
+    [QTEST_BIN_MMIO_READ] = "mmio_read",
+    [QTEST_BIN_MMIO_WRITE] = "mmio_write",
+    [QTEST_BIN_PIO_IN] = "pio_in",
+    [QTEST_BIN_PIO_OUT] = "pio_out",
+};
+
+static void qtest_send_bin(CharDriverState *chr, uint8_t status,
+                           const void *data, uint32_t len)
+{
+    uint8_t rsp[QTEST_BIN_RSP_LEN] = { QTEST_BIN_MAGIC, status };
+
+    qtest_bin_st(rsp + 4, 4, len);
+    qemu_chr_fe_write_all(chr, rsp, sizeof(rsp));
+    if (len) {
+        qemu_chr_fe_write_all(chr, data, len);
+    }
+    if (qtest_log_fp && qtest_opened) {
+        if (status == QTEST_BIN_OK) {
+            fprintf(qtest_log_fp, "OK %u bytes\n", len);
+        } else {
+            fprintf(qtest_log_fp, "FAIL %.*s\n", (int)len, (const char *)data);
+        }
+    }
+}
+
+static void qtest_send_bin_fail(CharDriverState *chr, const char *msg)
+{
+    qtest_send_prefix(chr);
+    qtest_send_bin(chr, QTEST_BIN_FAIL, msg, strlen(msg));
+}
+
+static uint64_t qtest_mmio_read(uint64_t addr, unsigned size)
+{
+    switch (size) {
+    case 1: {
+        uint8_t data;
+        cpu_physical_memory_read(addr, &data, 1);
+        return data;
+    }
+    case 2: {
+        uint16_t data;
+        cpu_physical_memory_read(addr, &data, 2);
+        return tswap16(data);
+    }
+    case 4: {
+        uint32_t data;
+        cpu_physical_memory_read(addr, &data, 4);
+        return tswap32(data);
+    }
+    default: {
+        uint64_t data;
+        cpu_physical_memory_read(addr, &data, 8);
+        return tswap64(data);
+    }
+    }
+}
+
+static void qtest_mmio_write(uint64_t addr, unsigned size, uint64_t value)
+{
+    switch (size) {
+    case 1: {
+        uint8_t data = value;
+        cpu_physical_memory_write(addr, &data, 1);
+        break;
+    }
+    case 2: {
+        uint16_t data = tswap16(value);
+        cpu_physical_memory_write(addr, &data, 2);
+        break;
+    }
+    case 4: {
+        uint32_t data = tswap32(value);
+        cpu_physical_memory_write(addr, &data, 4);
+        break;
+    }
+    default: {
+        uint64_t data = tswap64(value);
+        cpu_physical_memory_write(addr, &data, 8);
+        break;
+    }
+    }
+}
+
+static uint32_t qtest_pio_in(uint16_t addr, unsigned size)
+{
+    switch (size) {
+    case 1:
+        return cpu_inb(addr);
+    case 2:
+        return cpu_inw(addr);
+    default:
+        return cpu_inl(addr);
+    }
+}
+
+static void qtest_pio_out(uint16_t addr, unsigned size, uint32_t value)
+{
+    switch (size) {
+    case 1:
+        cpu_outb(addr, value);
+        break;
+    case 2:
+        cpu_outw(addr, value);
+        break;
+    default:
+        cpu_outl(addr, value);
+        break;
+    }
+}
+
+/*
+ * Process the binary frame at the head of @inbuf.  Returns the number of
+ * bytes consumed, or 0 if the frame has not been received completely yet.
+ */
+static size_t qtest_process_binary(CharDriverState *chr, GString *inbuf)
+{
+    QTestBinReq req;
+    const uint8_t *payload;
+    uint8_t *data = NULL;
+    uint64_t len, in_len;
+    uint32_t i;
+
+    if (inbuf->len < QTEST_BIN_REQ_LEN) {
+        return 0;
+    }
+    qtest_bin_req_decode(&req, (const uint8_t *)inbuf->str);
+
+    switch (req.op) {
+    case QTEST_BIN_READ:
+    case QTEST_BIN_WRITE:
+    case QTEST_BIN_MEMSET:
+        len = req.count;
+        break;
+    case QTEST_BIN_MMIO_READ:
+    case QTEST_BIN_MMIO_WRITE:
+    case QTEST_BIN_PIO_IN:
+    case QTEST_BIN_PIO_OUT:
+        if (req.size != 1 && req.size != 2 && req.size != 4 &&
+            (req.size != 8 || req.op == QTEST_BIN_PIO_IN ||
+             req.op == QTEST_BIN_PIO_OUT)) {
+            goto invalid;
+        }
+        len = (uint64_t)req.count * req.size;
+        break;
+    default:
+        goto invalid;
+    }
+    if (len > QTEST_BIN_MAX_LEN) {
+        goto invalid;
+    }
+
+    in_len = 0;
+    if (req.op == QTEST_BIN_WRITE || req.op == QTEST_BIN_MMIO_WRITE ||
+        req.op == QTEST_BIN_PIO_OUT) {
+        in_len = len;
+    }
+    if (inbuf->len < QTEST_BIN_REQ_LEN + in_len) {
+        return 0;
+    }
+    payload = (const uint8_t *)inbuf->str + QTEST_BIN_REQ_LEN;
+
+    if (qtest_log_fp) {
+        qemu_timeval tv;
+
+        qtest_get_time(&tv);
+        fprintf(qtest_log_fp, "[R +" FMT_timeval "] <bin> %s 0x%" PRIx64
+                " count %u size %u arg 0x%" PRIx64 "\n",
+                (long) tv.tv_sec, (long) tv.tv_usec,
+                qtest_bin_op_names[req.op], req.addr, req.count, req.size,
+                req.arg);
+    }
+
+    switch (req.op) {
+    case QTEST_BIN_READ:
+        data = g_malloc(len);
+        cpu_physical_memory_read(req.addr, data, len);
+        break;
+    case QTEST_BIN_WRITE:
+        cpu_physical_memory_write(req.addr, payload, len);
+        len = 0;
+        break;
+    case QTEST_BIN_MEMSET:
+        data = g_malloc(len);
+        memset(data, req.arg, len);
+        cpu_physical_memory_write(req.addr, data, len);
+        len = 0;
+        break;
+    case QTEST_BIN_MMIO_READ:
+        data = g_malloc(len);
+        for (i = 0; i < req.count; i++) {
+            qtest_bin_st(data + i * req.size, req.size,
+                         qtest_mmio_read(req.addr + i * req.arg, req.size));
+        }
+        break;
+    case QTEST_BIN_MMIO_WRITE:
+        for (i = 0; i < req.count; i++) {
+            qtest_mmio_write(req.addr + i * req.arg, req.size,
+                             qtest_bin_ld(payload + i * req.size, req.size));
+        }
+        len = 0;
+        break;
+    case QTEST_BIN_PIO_IN:
+        data = g_malloc(len);
+        for (i = 0; i < req.count; i++) {
+            qtest_bin_st(data + i * req.size, req.size,
+                         qtest_pio_in(req.addr + i * req.arg, req.size));
+        }
+        break;
+    case QTEST_BIN_PIO_OUT:
+        for (i = 0; i < req.count; i++) {
+            qtest_pio_out(req.addr + i * req.arg, req.size,
+                          qtest_bin_ld(payload + i * req.size, req.size));
+        }
+        len = 0;
+        break;
+    }
+
+    qtest_send_prefix(chr);
+    qtest_send_bin(chr, QTEST_BIN_OK, data, len);
+    g_free(data);
+    return QTEST_BIN_REQ_LEN + in_len;
+
+invalid:
+    /* The payload length is unknown, so the rest of the stream is lost */
+    qtest_send_bin_fail(chr, "Invalid binary request");
+    return inbuf->len;
+}
+
 static void qtest_process_inbuf(CharDriverState *chr, GString *inbuf)
 {
     char *end;
 
-    while ((end = strchr(inbuf->str, '\n')) != NULL) {
+    for (;;) {
         size_t offset;
         GString *cmd;
         gchar **words;
 
+        if (inbuf->len && (uint8_t)inbuf->str[0] == QTEST_BIN_MAGIC) {
+            offset = qtest_process_binary(chr, inbuf);
+            if (!offset) {
+                break;
+            }
+            g_string_erase(inbuf, 0, offset);
+            continue;
+        }
+
+        end = memchr(inbuf->str, '\n', inbuf->len);
+        if (!end) {
+            break;
+        }
         offset = end - inbuf->str;
 
         cmd = g_string_new_len(inbuf->str, offset);
@@ -24,6 +24,7 @@
 #include "qemu/timer.h"
 #include "exec/address-spaces.h"
 #include "exec/memory.h"
+#include "exec/cputlb.h"
 
 #define DATA_SIZE (1 << SHIFT)
 
@@ -137,6 +138,11 @@
             break;                                                            \
         }                                                                     \
     }                                                                         \
+    if (vidx >= 0) {                                                          \
+        tlb_desc(env, mmu_idx)->vtlb_hit_count++;                             \
+    } else {                                                                  \
+        tlb_desc(env, mmu_idx)->miss_count++;                                 \
+    }                                                                         \
     /* return true when there is a vtlb hit, i.e. vidx >=0 */                 \
     vidx >= 0;                                                                \
 })
@@ -149,7 +155,11 @@ static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
 {
     uint64_t val;
     CPUState *cpu = ENV_GET_CPU(env);
-    MemoryRegion *mr = iotlb_to_region(cpu, physaddr);
+    hwaddr iotlb = physaddr;
+    MemoryRegion *mr = iotlb_to_region(cpu, iotlb);
+    bool stats = cpu_stats_enabled && mr != &io_mem_rom &&
+                 mr != &io_mem_notdirty;
+    int64_t start = 0;
 
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
     cpu->mem_io_pc = retaddr;
@@ -158,7 +168,14 @@ static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
     }
 
     cpu->mem_io_vaddr = addr;
+    if (stats) {
+        start = get_clock();
+    }
     io_mem_read(mr, physaddr, &val, 1 << SHIFT);
+    if (stats) {
+        cpu_stats_account_io(cpu, iotlb_to_phys(cpu, iotlb, physaddr), false);
+        cpu_stats_account_emulation(cpu, get_clock() - start);
+    }
     return val;
 }
 #endif
@@ -169,7 +186,7 @@ static __attribute__((unused))
 WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
                             uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     uintptr_t haddr;
     DATA_TYPE res;
@@ -189,6 +206,8 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
         if (!VICTIM_TLB_HIT(ADDR_READ)) {
             tlb_fill(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
                      mmu_idx, retaddr);
+            /* the fill may have flushed and resized the TLB */
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     }
@@ -257,7 +276,7 @@ static __attribute__((unused))
 WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
                             uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     uintptr_t haddr;
     DATA_TYPE res;
@@ -277,6 +296,8 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
         if (!VICTIM_TLB_HIT(ADDR_READ)) {
             tlb_fill(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
                      mmu_idx, retaddr);
+            /* the fill may have flushed and resized the TLB */
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     }
@@ -369,7 +390,11 @@ static inline void glue(io_write, SUFFIX)(CPUArchState *env,
                                           uintptr_t retaddr)
 {
     CPUState *cpu = ENV_GET_CPU(env);
-    MemoryRegion *mr = iotlb_to_region(cpu, physaddr);
+    hwaddr iotlb = physaddr;
+    MemoryRegion *mr = iotlb_to_region(cpu, iotlb);
+    bool stats = cpu_stats_enabled && mr != &io_mem_rom &&
+                 mr != &io_mem_notdirty;
+    int64_t start = 0;
 
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
     if (mr != &io_mem_rom && mr != &io_mem_notdirty && !cpu_can_do_io(cpu)) {
@@ -378,13 +403,20 @@ static inline void glue(io_write, SUFFIX)(CPUArchState *env,
 
     cpu->mem_io_vaddr = addr;
     cpu->mem_io_pc = retaddr;
+    if (stats) {
+        start = get_clock();
+    }
     io_mem_write(mr, physaddr, val, 1 << SHIFT);
+    if (stats) {
+        cpu_stats_account_io(cpu, iotlb_to_phys(cpu, iotlb, physaddr), false);
+        cpu_stats_account_emulation(cpu, get_clock() - start);
+    }
 }
 
 void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                        int mmu_idx, uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     uintptr_t haddr;
 
@@ -402,6 +434,8 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 #endif
         if (!VICTIM_TLB_HIT(addr_write)) {
             tlb_fill(ENV_GET_CPU(env), addr, MMU_DATA_STORE, mmu_idx, retaddr);
+            /* the fill may have flushed and resized the TLB */
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     }
@@ -465,7 +499,7 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                        int mmu_idx, uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     uintptr_t haddr;
 
@@ -483,6 +517,8 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 #endif
         if (!VICTIM_TLB_HIT(addr_write)) {
             tlb_fill(ENV_GET_CPU(env), addr, MMU_DATA_STORE, mmu_idx, retaddr);
+            /* the fill may have flushed and resized the TLB */
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     }
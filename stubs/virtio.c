@@ -0,0 +1,7 @@
+#include "qom/object.h"
+#include "hw/virtio/virtio.h"
+
+int qmp_virtio_irq_stats_list(Object *obj, void *opaque)
+{
+    return 0;
+}
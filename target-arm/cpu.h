@@ -102,6 +102,11 @@ struct arm_boot_info;
 
 #define NB_MMU_MODES 7
 
+/* The insn_start data is the PC and, for AArch32, the IT state bits;
+ * see restore_state_to_opc.
+ */
+#define TARGET_INSN_START_EXTRA_WORDS 1
+
 /* We currently assume float and double are IEEE single and double
    precision respectively.
    Doing runtime conversions is tricky because VFP registers may contain
@@ -20,6 +20,7 @@
 #include "exec/helper-proto.h"
 #include "internals.h"
 #include "exec/cpu_ldst.h"
+#include "qemu/main-loop.h"
 
 #define SIGNBIT (uint32_t)0x80000000
 #define SIGNBIT64 ((uint64_t)1 << 63)
@@ -327,32 +328,88 @@ void HELPER(access_check_cp_reg)(CPUARMState *env, void *rip, uint32_t syndrome)
     raise_exception(env, EXCP_UDEF);
 }
 
+/* Registers with side effects outside the CPU (ARM_CP_IO) touch device
+ * state and must be accessed with the global mutex held; multi-threaded
+ * TCG does not hold it while executing guest code.
+ */
+static bool cp_reg_lock_iothread(const ARMCPRegInfo *ri)
+{
+    if ((ri->type & ARM_CP_IO) && qemu_tcg_mttcg_enabled() &&
+        !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        return true;
+    }
+    return false;
+}
+
 void HELPER(set_cp_reg)(CPUARMState *env, void *rip, uint32_t value)
 {
     const ARMCPRegInfo *ri = rip;
+    bool locked = cp_reg_lock_iothread(ri);
 
     ri->writefn(env, ri, value);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 uint32_t HELPER(get_cp_reg)(CPUARMState *env, void *rip)
 {
     const ARMCPRegInfo *ri = rip;
+    bool locked = cp_reg_lock_iothread(ri);
+    uint32_t res;
 
-    return ri->readfn(env, ri);
+    res = ri->readfn(env, ri);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    return res;
 }
 
 void HELPER(set_cp_reg64)(CPUARMState *env, void *rip, uint64_t value)
 {
     const ARMCPRegInfo *ri = rip;
+    bool locked = cp_reg_lock_iothread(ri);
 
     ri->writefn(env, ri, value);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 uint64_t HELPER(get_cp_reg64)(CPUARMState *env, void *rip)
 {
     const ARMCPRegInfo *ri = rip;
+    bool locked = cp_reg_lock_iothread(ri);
+    uint64_t res;
 
-    return ri->readfn(env, ri);
+    res = ri->readfn(env, ri);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    return res;
+}
+
+/* With multi-threaded TCG, a load-exclusive or SWP is restarted with all
+ * other vCPUs stopped, and they stay stopped until the exclusive monitor
+ * is released again (see cpu_exec_step_atomic).  The inline compare and
+ * store of the store-exclusive is then atomic against every other access.
+ */
+void HELPER(exclusive_begin)(CPUARMState *env)
+{
+    if (parallel_cpus) {
+        cpu_loop_exit_atomic(CPU(arm_env_get_cpu(env)), GETPC());
+    }
+}
+
+/* While the other vCPUs run, a monitor can only be left open by reset or
+ * an incoming migration.  Fail the store-exclusive in that case.
+ */
+void HELPER(exclusive_check)(CPUARMState *env)
+{
+    if (parallel_cpus) {
+        env->exclusive_addr = -1;
+    }
 }
 
 void HELPER(msr_i_pstate)(CPUARMState *env, uint32_t op, uint32_t imm)
@@ -1226,8 +1226,10 @@ static void handle_sync(DisasContext *s, uint32_t insn,
         return;
     case 4: /* DSB */
     case 5: /* DMB */
+        tcg_gen_mb();
+        return;
     case 6: /* ISB */
-        /* We don't emulate caches so barriers are no-ops */
+        /* We don't emulate caches so this is a no-op */
         return;
     default:
         unallocated_encoding(s);
@@ -1596,7 +1598,8 @@ static void disas_uncond_b_reg(DisasContext *s, uint32_t insn)
             return;
         }
         gen_helper_exception_return(cpu_env);
-        s->is_jmp = DISAS_JUMP;
+        /* may unmask interrupts: go back to the main loop */
+        s->is_jmp = DISAS_EXIT;
         return;
     case 5: /* DRPS */
         if (rn != 0x1f) {
@@ -1654,8 +1657,10 @@ static void disas_b_exc_sys(DisasContext *s, uint32_t insn)
  * and avoids having to monitor regular stores.
  *
  * In system emulation mode only one CPU will be running at once, so
- * this sequence is effectively atomic.  In user emulation mode we
- * throw an exception and handle the atomic operation elsewhere.
+ * this sequence is effectively atomic: with multi-threaded TCG the
+ * exclusive_begin helper stops the other vCPUs until the monitor is
+ * released.  In user emulation mode we throw an exception and handle
+ * the atomic operation elsewhere.
  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv_i64 addr, int size, bool is_pair)
@@ -1664,6 +1669,9 @@ static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
     TCGMemOp memop = MO_TE + size;
 
     g_assert(size <= 3);
+    if (qemu_tcg_mttcg_enabled()) {
+        gen_helper_exclusive_begin(cpu_env);
+    }
     tcg_gen_qemu_ld_i64(tmp, addr, get_mem_index(s), memop);
 
     if (is_pair) {
@@ -1720,6 +1728,9 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
      * basic block ends at the branch insn.
      */
     tcg_gen_mov_i64(addr, inaddr);
+    if (qemu_tcg_mttcg_enabled()) {
+        gen_helper_exclusive_check(cpu_env);
+    }
     tcg_gen_brcond_i64(TCG_COND_NE, addr, cpu_exclusive_addr, fail_label);
 
     tmp = tcg_temp_new_i64();
@@ -1802,8 +1813,9 @@ static void disas_ldst_excl(DisasContext *s, uint32_t insn)
     }
     tcg_addr = read_cpu_reg_sp(s, rn, 1);
 
-    /* Note that since TCG is single threaded load-acquire/store-release
-     * semantics require no extra if (is_lasr) { ... } handling.
+    /* Plain x86 host loads and stores already have acquire and release
+     * semantics; only a later load-acquire must not pass a store-release,
+     * see below.
      */
 
     if (is_excl) {
@@ -1829,6 +1841,10 @@ static void disas_ldst_excl(DisasContext *s, uint32_t insn)
                 do_gpr_ld(s, tcg_rt2, tcg_addr, size, false, false);
             }
         }
+        if (is_store) {
+            /* store-release */
+            tcg_gen_mb();
+        }
     }
 }
 
@@ -10913,14 +10929,12 @@ static void disas_a64_insn(CPUARMState *env, DisasContext *s)
 }
 
 void gen_intermediate_code_internal_a64(ARMCPU *cpu,
-                                        TranslationBlock *tb,
-                                        bool search_pc)
+                                        TranslationBlock *tb)
 {
     CPUState *cs = CPU(cpu);
     CPUARMState *env = &cpu->env;
     DisasContext dc1, *dc = &dc1;
     CPUBreakpoint *bp;
-    int j, lj;
     target_ulong pc_start;
     target_ulong next_page_start;
     int num_insns;
@@ -10974,7 +10988,6 @@ void gen_intermediate_code_internal_a64(ARMCPU *cpu,
     init_tmp_a64_array(dc);
 
     next_page_start = (pc_start & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
-    lj = -1;
     num_insns = 0;
     max_insns = tb->cflags & CF_COUNT_MASK;
     if (max_insns == 0) {
@@ -10998,27 +11011,12 @@ void gen_intermediate_code_internal_a64(ARMCPU *cpu,
             }
         }
 
-        if (search_pc) {
-            j = tcg_op_buf_count();
-            if (lj < j) {
-                lj++;
-                while (lj < j) {
-                    tcg_ctx.gen_opc_instr_start[lj++] = 0;
-                }
-            }
-            tcg_ctx.gen_opc_pc[lj] = dc->pc;
-            tcg_ctx.gen_opc_instr_start[lj] = 1;
-            tcg_ctx.gen_opc_icount[lj] = num_insns;
-        }
+        tcg_gen_insn_start(dc->pc, 0);
 
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO)) {
             gen_io_start();
         }
 
-        if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP | CPU_LOG_TB_OP_OPT))) {
-            tcg_gen_debug_insn_start(dc->pc);
-        }
-
         if (dc->ss_active && !dc->pstate_ss) {
             /* Singlestep state is Active-pending.
              * If we're in this state at the start of a TB then either
@@ -11068,7 +11066,7 @@ void gen_intermediate_code_internal_a64(ARMCPU *cpu,
          * (and thus a tb-jump is not possible when singlestepping).
          */
         assert(dc->is_jmp != DISAS_TB_JUMP);
-        if (dc->is_jmp != DISAS_JUMP) {
+        if (dc->is_jmp != DISAS_JUMP && dc->is_jmp != DISAS_EXIT) {
             gen_a64_set_pc_im(dc->pc);
         }
         if (cs->singlestep_enabled) {
@@ -11081,11 +11079,15 @@ void gen_intermediate_code_internal_a64(ARMCPU *cpu,
         case DISAS_NEXT:
             gen_goto_tb(dc, 1, dc->pc);
             break;
+        case DISAS_JUMP:
+            /* an indirect branch: look up the next TB from here */
+            tcg_gen_lookup_and_goto_ptr(cpu_env);
+            break;
         default:
         case DISAS_UPDATE:
             gen_a64_set_pc_im(dc->pc);
             /* fall through */
-        case DISAS_JUMP:
+        case DISAS_EXIT:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
             break;
@@ -11119,14 +11121,6 @@ done_generating:
         qemu_log("\n");
     }
 #endif
-    if (search_pc) {
-        j = tcg_op_buf_count();
-        lj++;
-        while (lj <= j) {
-            tcg_ctx.gen_opc_instr_start[lj++] = 0;
-        }
-    } else {
-        tb->size = dc->pc - pc_start;
-        tb->icount = num_insns;
-    }
+    tb->size = dc->pc - pc_start;
+    tb->icount = num_insns;
 }
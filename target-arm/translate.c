@@ -28,6 +28,7 @@
 #include "internals.h"
 #include "disas/disas.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "qemu/log.h"
 #include "qemu/bitops.h"
 #include "arm_ldst.h"
@@ -52,7 +53,6 @@
 #define ARCH(x) do { if (!ENABLE_ARCH_##x) goto illegal_op; } while(0)
 
 #include "translate.h"
-static uint32_t gen_opc_condexec_bits[OPC_BUF_SIZE];
 
 #if defined(CONFIG_USER_ONLY)
 #define IS_USER(s) 1
@@ -844,10 +844,12 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
     tcg_gen_movi_i32(cpu_R[15], addr & ~1);
 }
 
-/* Set PC and Thumb state from var.  var is marked as dead.  */
+/* Set PC and Thumb state from var.  var is marked as dead.  The Thumb
+   bit is part of the TB flags, so the next TB can still be looked up
+   from generated code.  */
 static inline void gen_bx(DisasContext *s, TCGv_i32 var)
 {
-    s->is_jmp = DISAS_UPDATE;
+    s->is_jmp = DISAS_JUMP;
     tcg_gen_andi_i32(cpu_R[15], var, ~1);
     tcg_gen_andi_i32(var, var, 1);
     store_cpu_field(var, thumb);
@@ -1010,7 +1012,7 @@ static void gen_exception_internal_insn(DisasContext *s, int offset, int excp)
     gen_set_condexec(s);
     gen_set_pc_im(s, s->pc - offset);
     gen_exception_internal(excp);
-    s->is_jmp = DISAS_JUMP;
+    s->is_jmp = DISAS_EXC;
 }
 
 static void gen_exception_insn(DisasContext *s, int offset, int excp, int syn)
@@ -1018,7 +1020,7 @@ static void gen_exception_insn(DisasContext *s, int offset, int excp, int syn)
     gen_set_condexec(s);
     gen_set_pc_im(s, s->pc - offset);
     gen_exception(excp, syn);
-    s->is_jmp = DISAS_JUMP;
+    s->is_jmp = DISAS_EXC;
 }
 
 /* Force a TB lookup after an instruction that changes the CPU state.  */
@@ -5075,6 +5077,80 @@ static const uint8_t neon_2rm_sizes[] = {
    We process data in a mixture of 32-bit and 64-bit chunks.
    Mostly we use 32-bit chunks so we can use normal scalar instructions.  */
 
+/* Expand the simple element-wise "three registers of the same length"
+ * operations on whole D or Q registers with the generic vector
+ * expanders.  Returns false for the ops that still go through the
+ * per-pass code below.
+ */
+static bool disas_neon_3r_gvec(int op, int u, int size, int q,
+                               int rd, int rn, int rm)
+{
+    int vec_size = q ? 16 : 8;
+    int rd_ofs = vfp_reg_offset(1, rd);
+    int rn_ofs = vfp_reg_offset(1, rn);
+    int rm_ofs = vfp_reg_offset(1, rm);
+
+    switch (op) {
+    case NEON_3R_VADD_VSUB:
+        if (u) {
+            tcg_gen_gvec_sub(cpu_env, size, rd_ofs, rn_ofs, rm_ofs,
+                             vec_size, vec_size);
+        } else {
+            tcg_gen_gvec_add(cpu_env, size, rd_ofs, rn_ofs, rm_ofs,
+                             vec_size, vec_size);
+        }
+        return true;
+
+    case NEON_3R_LOGIC:
+        switch ((u << 2) | size) {
+        case 0: /* VAND */
+            tcg_gen_gvec_and(cpu_env, 0, rd_ofs, rn_ofs, rm_ofs,
+                             vec_size, vec_size);
+            return true;
+        case 1: /* VBIC */
+            tcg_gen_gvec_andc(cpu_env, 0, rd_ofs, rn_ofs, rm_ofs,
+                              vec_size, vec_size);
+            return true;
+        case 2: /* VORR, or VMOV when rn == rm */
+            if (rn == rm) {
+                tcg_gen_gvec_mov(cpu_env, 0, rd_ofs, rn_ofs,
+                                 vec_size, vec_size);
+            } else {
+                tcg_gen_gvec_or(cpu_env, 0, rd_ofs, rn_ofs, rm_ofs,
+                                vec_size, vec_size);
+            }
+            return true;
+        case 3: /* VORN */
+            tcg_gen_gvec_orc(cpu_env, 0, rd_ofs, rn_ofs, rm_ofs,
+                             vec_size, vec_size);
+            return true;
+        case 4: /* VEOR */
+            tcg_gen_gvec_xor(cpu_env, 0, rd_ofs, rn_ofs, rm_ofs,
+                             vec_size, vec_size);
+            return true;
+        }
+        /* VBSL, VBIT and VBIF also read rd.  */
+        return false;
+
+    case NEON_3R_VTST_VCEQ:
+        if (!u) {
+            return false;
+        }
+        tcg_gen_gvec_cmp(cpu_env, TCG_COND_EQ, size, rd_ofs, rn_ofs, rm_ofs,
+                         vec_size, vec_size);
+        return true;
+    case NEON_3R_VCGT:
+        tcg_gen_gvec_cmp(cpu_env, u ? TCG_COND_GTU : TCG_COND_GT, size,
+                         rd_ofs, rn_ofs, rm_ofs, vec_size, vec_size);
+        return true;
+    case NEON_3R_VCGE:
+        tcg_gen_gvec_cmp(cpu_env, u ? TCG_COND_GEU : TCG_COND_GE, size,
+                         rd_ofs, rn_ofs, rm_ofs, vec_size, vec_size);
+        return true;
+    }
+    return false;
+}
+
 static int disas_neon_data_insn(DisasContext *s, uint32_t insn)
 {
     int op;
@@ -5164,6 +5240,9 @@ static int disas_neon_data_insn(DisasContext *s, uint32_t insn)
             tcg_temp_free_i32(tmp3);
             return 0;
         }
+        if (disas_neon_3r_gvec(op, u, size, q, rd, rn, rm)) {
+            return 0;
+        }
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -7378,15 +7457,25 @@ static void gen_logicq_cc(TCGv_i32 lo, TCGv_i32 hi)
    the architecturally mandated semantics, and avoids having to monitor
    regular stores.
 
-   In system emulation mode only one CPU will be running at once, so
-   this sequence is effectively atomic.  In user emulation mode we
-   throw an exception and handle the atomic operation elsewhere.  */
+   In system emulation mode only one CPU will be running at once while
+   the sequence executes: with multi-threaded TCG the exclusive_begin
+   helper stops the other vCPUs until the monitor is released.  In user
+   emulation mode we throw an exception and handle the atomic operation
+   elsewhere.  */
+static inline void gen_exclusive_begin(void)
+{
+    if (qemu_tcg_mttcg_enabled()) {
+        gen_helper_exclusive_begin(cpu_env);
+    }
+}
+
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv_i32 addr, int size)
 {
     TCGv_i32 tmp = tcg_temp_new_i32();
 
     s->is_ldex = true;
+    gen_exclusive_begin();
 
     switch (size) {
     case 0:
@@ -7451,6 +7540,9 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
        } */
     fail_label = gen_new_label();
     done_label = gen_new_label();
+    if (qemu_tcg_mttcg_enabled()) {
+        gen_helper_exclusive_check(cpu_env);
+    }
     extaddr = tcg_temp_new_i64();
     tcg_gen_extu_i32_i64(extaddr, addr);
     tcg_gen_brcond_i64(TCG_COND_NE, extaddr, cpu_exclusive_addr, fail_label);
@@ -7679,9 +7771,12 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                 return;
             case 4: /* dsb */
             case 5: /* dmb */
+                ARCH(7);
+                tcg_gen_mb();
+                return;
             case 6: /* isb */
                 ARCH(7);
-                /* We don't emulate caches so these are a no-op.  */
+                /* We don't emulate caches so this is a no-op.  */
                 return;
             default:
                 goto illegal_op;
@@ -8324,9 +8419,9 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                         addr = tcg_temp_local_new_i32();
                         load_reg_var(s, addr, rn);
 
-                        /* Since the emulation does not have barriers,
-                           the acquire/release semantics need no special
-                           handling */
+                        /* Plain x86 host loads and stores already have
+                           acquire and release semantics; only a later
+                           load-acquire must not pass a store-release.  */
                         if (op2 == 0) {
                             if (insn & (1 << 20)) {
                                 tmp = tcg_temp_new_i32();
@@ -8361,6 +8456,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                                     abort();
                                 }
                                 tcg_temp_free_i32(tmp);
+                                tcg_gen_mb();
                             }
                         } else if (insn & (1 << 20)) {
                             switch (op1) {
@@ -8403,9 +8499,10 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                         /* SWP instruction */
                         rm = (insn) & 0xf;
 
-                        /* ??? This is not really atomic.  However we know
-                           we never have multiple CPUs running in parallel,
-                           so it is good enough.  */
+                        /* ??? This is not really atomic for user-mode
+                           guest threads.  Multi-threaded TCG runs it with
+                           the other vCPUs stopped.  */
+                        gen_exclusive_begin();
                         addr = load_reg(s, rn);
                         tmp = load_reg(s, rm);
                         tmp2 = tcg_temp_new_i32();
@@ -9319,6 +9416,8 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                             abort();
                         }
                         tcg_temp_free_i32(tmp);
+                        /* a later load-acquire must not pass it */
+                        tcg_gen_mb();
                     }
                 } else if (insn & (1 << 20)) {
                     gen_load_exclusive(s, rs, rd, addr, op);
@@ -9893,8 +9992,10 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                             break;
                         case 4: /* dsb */
                         case 5: /* dmb */
+                            tcg_gen_mb();
+                            break;
                         case 6: /* isb */
-                            /* These execute as NOPs.  */
+                            /* This executes as a NOP.  */
                             break;
                         default:
                             goto illegal_op;
@@ -11015,17 +11116,15 @@ undef:
 }
 
 /* generate intermediate code in gen_opc_buf and gen_opparam_buf for
-   basic block 'tb'. If search_pc is TRUE, also generate PC
-   information for each intermediate instruction. */
+   basic block 'tb'.  Each instruction starts with an insn_start op
+   that records its PC and IT state, see restore_state_to_opc. */
 static inline void gen_intermediate_code_internal(ARMCPU *cpu,
-                                                  TranslationBlock *tb,
-                                                  bool search_pc)
+                                                  TranslationBlock *tb)
 {
     CPUState *cs = CPU(cpu);
     CPUARMState *env = &cpu->env;
     DisasContext dc1, *dc = &dc1;
     CPUBreakpoint *bp;
-    int j, lj;
     target_ulong pc_start;
     target_ulong next_page_start;
     int num_insns;
@@ -11037,7 +11136,7 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
      * the A32/T32 complexity to do with conditional execution/IT blocks/etc.
      */
     if (ARM_TBFLAG_AARCH64_STATE(tb->flags)) {
-        gen_intermediate_code_internal_a64(cpu, tb, search_pc);
+        gen_intermediate_code_internal_a64(cpu, tb);
         return;
     }
 
@@ -11098,7 +11197,6 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
     /* FIXME: cpu_M0 can probably be the same as cpu_V0.  */
     cpu_M0 = tcg_temp_new_i64();
     next_page_start = (pc_start & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
-    lj = -1;
     num_insns = 0;
     max_insns = tb->cflags & CF_COUNT_MASK;
     if (max_insns == 0)
@@ -11128,10 +11226,9 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
      * (3) if we leave the TB unexpectedly (eg a data abort on a load)
      * then the CPUARMState will be wrong and we need to reset it.
      * This is handled in the same way as restoration of the
-     * PC in these situations: we will be called again with search_pc=1
-     * and generate a mapping of the condexec bits for each PC in
-     * gen_opc_condexec_bits[]. restore_state_to_opc() then uses
-     * this to restore the condexec bits.
+     * PC in these situations: the condexec bits of each instruction
+     * are recorded alongside its PC by tcg_gen_insn_start(), and
+     * restore_state_to_opc() uses them to restore the condexec bits.
      *
      * Note that there are no instructions which can read the condexec
      * bits, and none which can write non-static values to them, so
@@ -11154,7 +11251,7 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
             /* We always get here via a jump, so know we are not in a
                conditional execution block.  */
             gen_exception_internal(EXCP_KERNEL_TRAP);
-            dc->is_jmp = DISAS_UPDATE;
+            dc->is_jmp = DISAS_EXC;
             break;
         }
 #else
@@ -11162,7 +11259,7 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
             /* We always get here via a jump, so know we are not in a
                conditional execution block.  */
             gen_exception_internal(EXCP_EXCEPTION_EXIT);
-            dc->is_jmp = DISAS_UPDATE;
+            dc->is_jmp = DISAS_EXC;
             break;
         }
 #endif
@@ -11178,26 +11275,12 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
                 }
             }
         }
-        if (search_pc) {
-            j = tcg_op_buf_count();
-            if (lj < j) {
-                lj++;
-                while (lj < j)
-                    tcg_ctx.gen_opc_instr_start[lj++] = 0;
-            }
-            tcg_ctx.gen_opc_pc[lj] = dc->pc;
-            gen_opc_condexec_bits[lj] = (dc->condexec_cond << 4) | (dc->condexec_mask >> 1);
-            tcg_ctx.gen_opc_instr_start[lj] = 1;
-            tcg_ctx.gen_opc_icount[lj] = num_insns;
-        }
+        tcg_gen_insn_start(dc->pc,
+                           (dc->condexec_cond << 4) | (dc->condexec_mask >> 1));
 
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO))
             gen_io_start();
 
-        if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP | CPU_LOG_TB_OP_OPT))) {
-            tcg_gen_debug_insn_start(dc->pc);
-        }
-
         if (dc->ss_active && !dc->pstate_ss) {
             /* Singlestep state is Active-pending.
              * If we're in this state at the start of a TB then either
@@ -11319,13 +11402,17 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
         case DISAS_NEXT:
             gen_goto_tb(dc, 1, dc->pc);
             break;
-        default:
         case DISAS_JUMP:
+            /* an indirect branch: look up the next TB from here */
+            tcg_gen_lookup_and_goto_ptr(cpu_env);
+            break;
+        default:
         case DISAS_UPDATE:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
             break;
         case DISAS_TB_JUMP:
+        case DISAS_EXC:
             /* nothing more to generate */
             break;
         case DISAS_WFI:
@@ -11364,25 +11451,13 @@ done_generating:
         qemu_log("\n");
     }
 #endif
-    if (search_pc) {
-        j = tcg_op_buf_count();
-        lj++;
-        while (lj <= j)
-            tcg_ctx.gen_opc_instr_start[lj++] = 0;
-    } else {
-        tb->size = dc->pc - pc_start;
-        tb->icount = num_insns;
-    }
+    tb->size = dc->pc - pc_start;
+    tb->icount = num_insns;
 }
 
 void gen_intermediate_code(CPUARMState *env, TranslationBlock *tb)
 {
-    gen_intermediate_code_internal(arm_env_get_cpu(env), tb, false);
-}
-
-void gen_intermediate_code_pc(CPUARMState *env, TranslationBlock *tb)
-{
-    gen_intermediate_code_internal(arm_env_get_cpu(env), tb, true);
+    gen_intermediate_code_internal(arm_env_get_cpu(env), tb);
 }
 
 static const char *cpu_mode_names[16] = {
@@ -11439,13 +11514,14 @@ void arm_cpu_dump_state(CPUState *cs, FILE *f, fprintf_function cpu_fprintf,
     }
 }
 
-void restore_state_to_opc(CPUARMState *env, TranslationBlock *tb, int pc_pos)
+void restore_state_to_opc(CPUARMState *env, TranslationBlock *tb,
+                          target_ulong *data)
 {
     if (is_a64(env)) {
-        env->pc = tcg_ctx.gen_opc_pc[pc_pos];
+        env->pc = data[0];
         env->condexec_bits = 0;
     } else {
-        env->regs[15] = tcg_ctx.gen_opc_pc[pc_pos];
-        env->condexec_bits = gen_opc_condexec_bits[pc_pos];
+        env->regs[15] = data[0];
+        env->condexec_bits = data[1];
     }
 }
@@ -81,19 +81,22 @@ static inline int get_mem_index(DisasContext *s)
 #define DISAS_WFI 4
 #define DISAS_SWI 5
 /* For instructions which unconditionally cause an exception we can skip
- * emitting unreachable code at the end of the TB in the A64 decoder
+ * emitting unreachable code at the end of the TB
  */
 #define DISAS_EXC 6
 /* WFE */
 #define DISAS_WFE 7
 #define DISAS_HVC 8
 #define DISAS_SMC 9
+/* The PC and CPU state were changed by a helper (e.g. an exception
+ * return): leave to the main loop without updating the PC.
+ */
+#define DISAS_EXIT 10
 
 #ifdef TARGET_AARCH64
 void a64_translate_init(void);
 void gen_intermediate_code_internal_a64(ARMCPU *cpu,
-                                        TranslationBlock *tb,
-                                        bool search_pc);
+                                        TranslationBlock *tb);
 void gen_a64_set_pc_im(uint64_t val);
 void aarch64_cpu_dump_state(CPUState *cs, FILE *f,
                             fprintf_function cpu_fprintf, int flags);
@@ -103,8 +106,7 @@ static inline void a64_translate_init(void)
 }
 
 static inline void gen_intermediate_code_internal_a64(ARMCPU *cpu,
-                                                      TranslationBlock *tb,
-                                                      bool search_pc)
+                                                      TranslationBlock *tb)
 {
 }
 
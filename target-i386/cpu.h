@@ -31,6 +31,9 @@
 /* Maximum instruction code size */
 #define TARGET_MAX_INSN_SIZE 16
 
+/* The insn_start data is the linear PC and the lazy cc_op */
+#define TARGET_INSN_START_EXTRA_WORDS 1
+
 /* target supports implicit self modifying code */
 #define TARGET_HAS_SMC
 /* support for self modifying code even if the modified instruction is
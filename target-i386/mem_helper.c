@@ -21,18 +21,27 @@
 #include "exec/helper-proto.h"
 #include "exec/cpu_ldst.h"
 
-/* broken thread support */
-
-static spinlock_t global_cpu_lock = SPIN_LOCK_UNLOCKED;
+/* With multi-threaded TCG, LOCK-prefixed instructions run while all other
+ * vCPUs are stopped, so that they are atomic against plain stores too.
+ * User-mode guest threads only serialise them against each other.
+ */
 
-void helper_lock(void)
+void helper_lock(CPUX86State *env)
 {
-    spin_lock(&global_cpu_lock);
+#ifdef CONFIG_USER_ONLY
+    tcg_atomic_lock();
+#else
+    if (parallel_cpus) {
+        cpu_loop_exit_atomic(CPU(x86_env_get_cpu(env)), GETPC());
+    }
+#endif
 }
 
 void helper_unlock(void)
 {
-    spin_unlock(&global_cpu_lock);
+#ifdef CONFIG_USER_ONLY
+    tcg_atomic_unlock();
+#endif
 }
 
 void helper_cmpxchg8b(CPUX86State *env, target_ulong a0)
@@ -21,6 +21,7 @@
 #include "exec/ioport.h"
 #include "exec/helper-proto.h"
 #include "exec/cpu_ldst.h"
+#include "qemu/main-loop.h"
 
 void helper_outb(uint32_t port, uint32_t data)
 {
@@ -99,6 +100,25 @@ void helper_movl_drN_T0(CPUX86State *env, int reg, target_ulong t0)
 {
 }
 #else
+/* The local APIC is a device model; with multi-threaded TCG it is only
+ * accessed with the global mutex held.
+ */
+static bool apic_lock_iothread(void)
+{
+    if (qemu_tcg_mttcg_enabled() && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        return true;
+    }
+    return false;
+}
+
+static void apic_unlock_iothread(bool locked)
+{
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 target_ulong helper_read_crN(CPUX86State *env, int reg)
 {
     target_ulong val;
@@ -110,7 +130,10 @@ target_ulong helper_read_crN(CPUX86State *env, int reg)
         break;
     case 8:
         if (!(env->hflags2 & HF2_VINTR_MASK)) {
+            bool locked = apic_lock_iothread();
+
             val = cpu_get_apic_tpr(x86_env_get_cpu(env)->apic_state);
+            apic_unlock_iothread(locked);
         } else {
             val = env->v_tpr;
         }
@@ -134,7 +157,10 @@ void helper_write_crN(CPUX86State *env, int reg, target_ulong t0)
         break;
     case 8:
         if (!(env->hflags2 & HF2_VINTR_MASK)) {
+            bool locked = apic_lock_iothread();
+
             cpu_set_apic_tpr(x86_env_get_cpu(env)->apic_state, t0);
+            apic_unlock_iothread(locked);
         }
         env->v_tpr = t0 & 0x0f;
         break;
@@ -242,9 +268,13 @@ void helper_wrmsr(CPUX86State *env)
     case MSR_IA32_SYSENTER_EIP:
         env->sysenter_eip = val;
         break;
-    case MSR_IA32_APICBASE:
+    case MSR_IA32_APICBASE: {
+        bool locked = apic_lock_iothread();
+
         cpu_set_apic_base(x86_env_get_cpu(env)->apic_state, val);
+        apic_unlock_iothread(locked);
         break;
+    }
     case MSR_EFER:
         {
             uint64_t update_mask;
@@ -393,9 +423,13 @@ void helper_rdmsr(CPUX86State *env)
     case MSR_IA32_SYSENTER_EIP:
         val = env->sysenter_eip;
         break;
-    case MSR_IA32_APICBASE:
+    case MSR_IA32_APICBASE: {
+        bool locked = apic_lock_iothread();
+
         val = cpu_get_apic_base(x86_env_get_cpu(env)->apic_state);
+        apic_unlock_iothread(locked);
         break;
+    }
     case MSR_EFER:
         val = env->efer;
         break;
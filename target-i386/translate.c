@@ -27,6 +27,7 @@
 #include "cpu.h"
 #include "disas/disas.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 
 #include "exec/helper-proto.h"
@@ -76,8 +77,6 @@ static TCGv_ptr cpu_ptr0, cpu_ptr1;
 static TCGv_i32 cpu_tmp2_i32, cpu_tmp3_i32;
 static TCGv_i64 cpu_tmp1_i64;
 
-static uint8_t gen_opc_cc_op[OPC_BUF_SIZE];
-
 #include "exec/gen-icount.h"
 
 #ifdef TARGET_X86_64
@@ -114,7 +113,7 @@ typedef struct DisasContext {
     int iopl;
     int tf;     /* TF cpu flag */
     int singlestep_enabled; /* "hardware" single step enabled */
-    int jmp_opt; /* use direct block chaining for direct jumps */
+    int jmp_opt; /* chain to the next TB without going through the main loop */
     int repz_opt; /* optimize jumps within repz instructions */
     int mem_index; /* select memory access functions */
     uint64_t flags; /* all execution flags */
@@ -2548,7 +2547,9 @@ static void gen_debug(DisasContext *s, target_ulong cur_eip)
 
 /* generate a generic end of block. Trace exception is also generated
    if needed */
-static void gen_eob(DisasContext *s)
+/* End of block.  If jr is true, EIP was set by an indirect branch and
+   the next TB may be looked up without going back to the main loop.  */
+static void do_gen_eob_worker(DisasContext *s, bool jr)
 {
     gen_update_cc_op(s);
     if (s->tb->flags & HF_INHIBIT_IRQ_MASK) {
@@ -2561,12 +2562,26 @@ static void gen_eob(DisasContext *s)
         gen_helper_debug(cpu_env);
     } else if (s->tf) {
         gen_helper_single_step(cpu_env);
+    } else if (jr && s->jmp_opt) {
+        tcg_gen_lookup_and_goto_ptr(cpu_env);
     } else {
         tcg_gen_exit_tb(0);
     }
     s->is_jmp = DISAS_TB_JUMP;
 }
 
+static void gen_eob(DisasContext *s)
+{
+    do_gen_eob_worker(s, false);
+}
+
+/* Jump to the register-indirect target dest and end the block.  */
+static void gen_jr(DisasContext *s, TCGv dest)
+{
+    gen_op_jmp_v(dest);
+    do_gen_eob_worker(s, true);
+}
+
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
@@ -2975,6 +2990,99 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/* Expand the common integer MMX/SSE2 operations "op1 = op1 OP op2" with
+   the generic vector expanders instead of calling out to helpers.
+   Return false if B is not one of them.  */
+static bool gen_sse_gvec(int b, int is_xmm, int op1_offset, int op2_offset)
+{
+    int sz = is_xmm ? 16 : 8;
+
+    switch (b) {
+    case 0xfc: /* paddb */
+    case 0xfd: /* paddw */
+    case 0xfe: /* paddl */
+        tcg_gen_gvec_add(cpu_env, b - 0xfc, op1_offset, op1_offset,
+                         op2_offset, sz, sz);
+        break;
+    case 0xd4: /* paddq */
+        tcg_gen_gvec_add(cpu_env, MO_64, op1_offset, op1_offset,
+                         op2_offset, sz, sz);
+        break;
+    case 0xf8: /* psubb */
+    case 0xf9: /* psubw */
+    case 0xfa: /* psubl */
+    case 0xfb: /* psubq */
+        tcg_gen_gvec_sub(cpu_env, b - 0xf8, op1_offset, op1_offset,
+                         op2_offset, sz, sz);
+        break;
+    case 0xdb: /* pand */
+        tcg_gen_gvec_and(cpu_env, MO_64, op1_offset, op1_offset,
+                         op2_offset, sz, sz);
+        break;
+    case 0xdf: /* pandn */
+        tcg_gen_gvec_andc(cpu_env, MO_64, op1_offset, op2_offset,
+                          op1_offset, sz, sz);
+        break;
+    case 0xeb: /* por */
+        tcg_gen_gvec_or(cpu_env, MO_64, op1_offset, op1_offset,
+                        op2_offset, sz, sz);
+        break;
+    case 0xef: /* pxor */
+        tcg_gen_gvec_xor(cpu_env, MO_64, op1_offset, op1_offset,
+                         op2_offset, sz, sz);
+        break;
+    case 0x74: /* pcmpeqb */
+    case 0x75: /* pcmpeqw */
+    case 0x76: /* pcmpeql */
+        tcg_gen_gvec_cmp(cpu_env, TCG_COND_EQ, b - 0x74, op1_offset,
+                         op1_offset, op2_offset, sz, sz);
+        break;
+    case 0x64: /* pcmpgtb */
+    case 0x65: /* pcmpgtw */
+    case 0x66: /* pcmpgtl */
+        tcg_gen_gvec_cmp(cpu_env, TCG_COND_GT, b - 0x64, op1_offset,
+                         op1_offset, op2_offset, sz, sz);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/* Likewise for the shifts by an immediate of group 12-14, OP being the
+   reg field of the modrm byte.  Counts larger than the element size
+   clear the element, or fill it with the sign bit.  */
+static bool gen_sse_shifti_gvec(int b, int op, int is_xmm, int ofs, int val)
+{
+    unsigned vece = b & 3;          /* 0x71: words ... 0x73: quads */
+    int sz = is_xmm ? 16 : 8;
+    int bits = 8 << vece;
+
+    switch (op) {
+    case 2: /* psrl */
+        if (val >= bits) {
+            tcg_gen_gvec_dupi(cpu_env, MO_64, ofs, sz, sz, 0);
+        } else {
+            tcg_gen_gvec_shri(cpu_env, vece, ofs, ofs, val, sz, sz);
+        }
+        break;
+    case 4: /* psra */
+        tcg_gen_gvec_sari(cpu_env, vece, ofs, ofs, MIN(val, bits - 1),
+                          sz, sz);
+        break;
+    case 6: /* psll */
+        if (val >= bits) {
+            tcg_gen_gvec_dupi(cpu_env, MO_64, ofs, sz, sz, 0);
+        } else {
+            tcg_gen_gvec_shli(cpu_env, vece, ofs, ofs, val, sz, sz);
+        }
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -3379,6 +3487,22 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
 	        goto illegal_op;
             }
             val = cpu_ldub_code(env, s->pc++);
+            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
+                                       (((modrm >> 3)) & 7)][b1];
+            if (!sse_fn_epp) {
+                goto illegal_op;
+            }
+            if (is_xmm) {
+                rm = (modrm & 7) | REX_B(s);
+                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
+            } else {
+                rm = (modrm & 7);
+                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
+            }
+            if (gen_sse_shifti_gvec(b, (modrm >> 3) & 7, is_xmm,
+                                    op2_offset, val)) {
+                break;
+            }
             if (is_xmm) {
                 tcg_gen_movi_tl(cpu_T[0], val);
                 tcg_gen_st32_tl(cpu_T[0], cpu_env, offsetof(CPUX86State,xmm_t0.XMM_L(0)));
@@ -3392,18 +3516,6 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                 tcg_gen_st32_tl(cpu_T[0], cpu_env, offsetof(CPUX86State,mmx_t0.MMX_L(1)));
                 op1_offset = offsetof(CPUX86State,mmx_t0);
             }
-            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
-                                       (((modrm >> 3)) & 7)][b1];
-            if (!sse_fn_epp) {
-                goto illegal_op;
-            }
-            if (is_xmm) {
-                rm = (modrm & 7) | REX_B(s);
-                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
-            } else {
-                rm = (modrm & 7);
-                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
-            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op2_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op1_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4391,6 +4503,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_gvec(b, is_xmm, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4414,9 +4529,6 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
     target_ulong next_eip, tval;
     int rex_w, rex_r;
 
-    if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP | CPU_LOG_TB_OP_OPT))) {
-        tcg_gen_debug_insn_start(pc_start);
-    }
     s->pc = pc_start;
     prefixes = 0;
     s->override = -1;
@@ -4569,7 +4681,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
 
     /* lock generation */
     if (prefixes & PREFIX_LOCK)
-        gen_helper_lock();
+        gen_helper_lock(cpu_env);
 
     /* now check op code */
  reswitch:
@@ -4945,8 +5057,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             next_eip = s->pc - s->cs_base;
             tcg_gen_movi_tl(cpu_T[1], next_eip);
             gen_push_v(s, cpu_T[1]);
-            gen_op_jmp_v(cpu_T[0]);
-            gen_eob(s);
+            gen_jr(s, cpu_T[0]);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
@@ -4972,8 +5083,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             if (dflag == MO_16) {
                 tcg_gen_ext16u_tl(cpu_T[0], cpu_T[0]);
             }
-            gen_op_jmp_v(cpu_T[0]);
-            gen_eob(s);
+            gen_jr(s, cpu_T[0]);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
@@ -5571,7 +5681,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             gen_op_mov_v_reg(ot, cpu_T[0], reg);
             /* for xchg, lock is implicit */
             if (!(prefixes & PREFIX_LOCK))
-                gen_helper_lock();
+                gen_helper_lock(cpu_env);
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
             gen_op_st_v(s, ot, cpu_T[0], cpu_A0);
             if (!(prefixes & PREFIX_LOCK))
@@ -6390,15 +6500,13 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         ot = gen_pop_T0(s);
         gen_stack_update(s, val + (1 << ot));
         /* Note that gen_pop_T0 uses a zero-extending load.  */
-        gen_op_jmp_v(cpu_T[0]);
-        gen_eob(s);
+        gen_jr(s, cpu_T[0]);
         break;
     case 0xc3: /* ret */
         ot = gen_pop_T0(s);
         gen_pop_update(s, ot);
         /* Note that gen_pop_T0 uses a zero-extending load.  */
-        gen_op_jmp_v(cpu_T[0]);
-        gen_eob(s);
+        gen_jr(s, cpu_T[0]);
         break;
     case 0xca: /* lret im */
         val = cpu_ldsw_code(env, s->pc);
@@ -7767,6 +7875,10 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         case 6: /* mfence */
             if ((modrm & 0xc7) != 0xc0 || !(s->cpuid_features & CPUID_SSE2))
                 goto illegal_op;
+            if (op == 6) {
+                /* the one reordering x86 allows: a store passing a load */
+                tcg_gen_mb();
+            }
             break;
         case 7: /* sfence / clflush */
             if ((modrm & 0xc7) == 0xc0) {
@@ -7903,18 +8015,16 @@ void optimize_flags_init(void)
 }
 
 /* generate intermediate code in gen_opc_buf and gen_opparam_buf for
-   basic block 'tb'. If search_pc is TRUE, also generate PC
-   information for each intermediate instruction. */
+   basic block 'tb'.  Each instruction starts with an insn_start op
+   that records its PC and cc_op, see restore_state_to_opc. */
 static inline void gen_intermediate_code_internal(X86CPU *cpu,
-                                                  TranslationBlock *tb,
-                                                  bool search_pc)
+                                                  TranslationBlock *tb)
 {
     CPUState *cs = CPU(cpu);
     CPUX86State *env = &cpu->env;
     DisasContext dc1, *dc = &dc1;
     target_ulong pc_ptr;
     CPUBreakpoint *bp;
-    int j, lj;
     uint64_t flags;
     target_ulong pc_start;
     target_ulong cs_base;
@@ -7994,7 +8104,6 @@ static inline void gen_intermediate_code_internal(X86CPU *cpu,
 
     dc->is_jmp = DISAS_NEXT;
     pc_ptr = pc_start;
-    lj = -1;
     num_insns = 0;
     max_insns = tb->cflags & CF_COUNT_MASK;
     if (max_insns == 0)
@@ -8011,18 +8120,7 @@ static inline void gen_intermediate_code_internal(X86CPU *cpu,
                 }
             }
         }
-        if (search_pc) {
-            j = tcg_op_buf_count();
-            if (lj < j) {
-                lj++;
-                while (lj < j)
-                    tcg_ctx.gen_opc_instr_start[lj++] = 0;
-            }
-            tcg_ctx.gen_opc_pc[lj] = pc_ptr;
-            gen_opc_cc_op[lj] = dc->cc_op;
-            tcg_ctx.gen_opc_instr_start[lj] = 1;
-            tcg_ctx.gen_opc_icount[lj] = num_insns;
-        }
+        tcg_gen_insn_start(pc_ptr, dc->cc_op);
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO))
             gen_io_start();
 
@@ -8075,14 +8173,6 @@ static inline void gen_intermediate_code_internal(X86CPU *cpu,
 done_generating:
     gen_tb_end(tb, num_insns);
 
-    /* we don't forget to fill the last values */
-    if (search_pc) {
-        j = tcg_op_buf_count();
-        lj++;
-        while (lj <= j)
-            tcg_ctx.gen_opc_instr_start[lj++] = 0;
-    }
-
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)) {
         int disas_flags;
@@ -8099,42 +8189,22 @@ done_generating:
     }
 #endif
 
-    if (!search_pc) {
-        tb->size = pc_ptr - pc_start;
-        tb->icount = num_insns;
-    }
+    tb->size = pc_ptr - pc_start;
+    tb->icount = num_insns;
 }
 
 void gen_intermediate_code(CPUX86State *env, TranslationBlock *tb)
 {
-    gen_intermediate_code_internal(x86_env_get_cpu(env), tb, false);
+    gen_intermediate_code_internal(x86_env_get_cpu(env), tb);
 }
 
-void gen_intermediate_code_pc(CPUX86State *env, TranslationBlock *tb)
+void restore_state_to_opc(CPUX86State *env, TranslationBlock *tb,
+                          target_ulong *data)
 {
-    gen_intermediate_code_internal(x86_env_get_cpu(env), tb, true);
-}
+    int cc_op = data[1];
 
-void restore_state_to_opc(CPUX86State *env, TranslationBlock *tb, int pc_pos)
-{
-    int cc_op;
-#ifdef DEBUG_DISAS
-    if (qemu_loglevel_mask(CPU_LOG_TB_OP)) {
-        int i;
-        qemu_log("RESTORE:\n");
-        for(i = 0;i <= pc_pos; i++) {
-            if (tcg_ctx.gen_opc_instr_start[i]) {
-                qemu_log("0x%04x: " TARGET_FMT_lx "\n", i,
-                        tcg_ctx.gen_opc_pc[i]);
-            }
-        }
-        qemu_log("pc_pos=0x%x eip=" TARGET_FMT_lx " cs_base=%x\n",
-                pc_pos, tcg_ctx.gen_opc_pc[pc_pos] - tb->cs_base,
-                (uint32_t)tb->cs_base);
-    }
-#endif
-    env->eip = tcg_ctx.gen_opc_pc[pc_pos] - tb->cs_base;
-    cc_op = gen_opc_cc_op[pc_pos];
-    if (cc_op != CC_OP_DYNAMIC)
+    env->eip = data[0] - tb->cs_base;
+    if (cc_op != CC_OP_DYNAMIC) {
         env->cc_op = cc_op;
+    }
 }
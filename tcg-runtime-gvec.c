@@ -0,0 +1,163 @@
+/*
+ * Out-of-line helpers for TCG generic vector operations
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "qemu-common.h"
+#include "cpu.h"
+#include "exec/helper-proto.h"
+#include "tcg-gvec-desc.h"
+
+
+/* Clear the bytes of the register beyond the operation size.  */
+static inline void clear_high(void *d, intptr_t oprsz, uint32_t desc)
+{
+    intptr_t maxsz = simd_maxsz(desc);
+
+    if (unlikely(maxsz > oprsz)) {
+        memset(d + oprsz, 0, maxsz - oprsz);
+    }
+}
+
+#define DO_GVEC_3(NAME, TYPE, OP)                                       \
+void HELPER(NAME)(void *d, void *a, void *b, uint32_t desc)            \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i < oprsz; i += sizeof(TYPE)) {                         \
+        TYPE aa = *(TYPE *)(a + i);                                     \
+        TYPE bb = *(TYPE *)(b + i);                                     \
+        *(TYPE *)(d + i) = OP;                                          \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+#define DO_GVEC_2(NAME, TYPE, OP)                                       \
+void HELPER(NAME)(void *d, void *a, uint32_t desc)                     \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i < oprsz; i += sizeof(TYPE)) {                         \
+        TYPE aa = *(TYPE *)(a + i);                                     \
+        *(TYPE *)(d + i) = OP;                                          \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+#define DO_GVEC_2I(NAME, TYPE, OP)                                      \
+void HELPER(NAME)(void *d, void *a, uint32_t desc)                     \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    int32_t shift = simd_data(desc);                                    \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i < oprsz; i += sizeof(TYPE)) {                         \
+        TYPE aa = *(TYPE *)(a + i);                                     \
+        *(TYPE *)(d + i) = OP;                                          \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+void HELPER(gvec_mov)(void *d, void *a, uint32_t desc)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+
+    memmove(d, a, oprsz);
+    clear_high(d, oprsz, desc);
+}
+
+void HELPER(gvec_dup64)(void *d, uint32_t desc, uint64_t c)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+    intptr_t i;
+
+    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+        *(uint64_t *)(d + i) = c;
+    }
+    clear_high(d, oprsz, desc);
+}
+
+DO_GVEC_3(gvec_add8, uint8_t, aa + bb)
+DO_GVEC_3(gvec_add16, uint16_t, aa + bb)
+DO_GVEC_3(gvec_add32, uint32_t, aa + bb)
+DO_GVEC_3(gvec_add64, uint64_t, aa + bb)
+
+DO_GVEC_3(gvec_sub8, uint8_t, aa - bb)
+DO_GVEC_3(gvec_sub16, uint16_t, aa - bb)
+DO_GVEC_3(gvec_sub32, uint32_t, aa - bb)
+DO_GVEC_3(gvec_sub64, uint64_t, aa - bb)
+
+DO_GVEC_2(gvec_neg8, uint8_t, -aa)
+DO_GVEC_2(gvec_neg16, uint16_t, -aa)
+DO_GVEC_2(gvec_neg32, uint32_t, -aa)
+DO_GVEC_2(gvec_neg64, uint64_t, -aa)
+
+/* The logical operations do not care about element boundaries.  */
+DO_GVEC_2(gvec_not, uint64_t, ~aa)
+DO_GVEC_3(gvec_and, uint64_t, aa & bb)
+DO_GVEC_3(gvec_or, uint64_t, aa | bb)
+DO_GVEC_3(gvec_xor, uint64_t, aa ^ bb)
+DO_GVEC_3(gvec_andc, uint64_t, aa & ~bb)
+DO_GVEC_3(gvec_orc, uint64_t, aa | ~bb)
+
+/* The shift count is in the data field and is always in range.  */
+DO_GVEC_2I(gvec_shl8i, uint8_t, aa << shift)
+DO_GVEC_2I(gvec_shl16i, uint16_t, aa << shift)
+DO_GVEC_2I(gvec_shl32i, uint32_t, aa << shift)
+DO_GVEC_2I(gvec_shl64i, uint64_t, aa << shift)
+
+DO_GVEC_2I(gvec_shr8i, uint8_t, aa >> shift)
+DO_GVEC_2I(gvec_shr16i, uint16_t, aa >> shift)
+DO_GVEC_2I(gvec_shr32i, uint32_t, aa >> shift)
+DO_GVEC_2I(gvec_shr64i, uint64_t, aa >> shift)
+
+DO_GVEC_2I(gvec_sar8i, int8_t, aa >> shift)
+DO_GVEC_2I(gvec_sar16i, int16_t, aa >> shift)
+DO_GVEC_2I(gvec_sar32i, int32_t, aa >> shift)
+DO_GVEC_2I(gvec_sar64i, int64_t, aa >> shift)
+
+/* Comparisons set each element to all ones if true, zero if false.  */
+#define DO_CMP(NAME, OP)                                        \
+DO_GVEC_3(gvec_##NAME##8, int8_t, -(aa OP bb))                  \
+DO_GVEC_3(gvec_##NAME##16, int16_t, -(aa OP bb))                \
+DO_GVEC_3(gvec_##NAME##32, int32_t, -(aa OP bb))                \
+DO_GVEC_3(gvec_##NAME##64, int64_t, -(int64_t)(aa OP bb))
+
+#define DO_CMPU(NAME, OP)                                       \
+DO_GVEC_3(gvec_##NAME##8, uint8_t, -(aa OP bb))                 \
+DO_GVEC_3(gvec_##NAME##16, uint16_t, -(aa OP bb))               \
+DO_GVEC_3(gvec_##NAME##32, uint32_t, -(aa OP bb))               \
+DO_GVEC_3(gvec_##NAME##64, uint64_t, -(uint64_t)(aa OP bb))
+
+DO_CMP(eq, ==)
+DO_CMP(ne, !=)
+DO_CMP(lt, <)
+DO_CMP(le, <=)
+DO_CMPU(ltu, <)
+DO_CMPU(leu, <=)
+
+#undef DO_CMP
+#undef DO_CMPU
+#undef DO_GVEC_2
+#undef DO_GVEC_2I
+#undef DO_GVEC_3
@@ -23,16 +23,10 @@
  */
 #include <stdint.h>
 #include "qemu/host-utils.h"
-
-/* This file is compiled once, and thus we can't include the standard
-   "exec/helper-proto.h", which has includes that are target specific.  */
-
-#include "exec/helper-head.h"
-
-#define DEF_HELPER_FLAGS_2(name, flags, ret, t1, t2) \
-  dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2));
-
-#include "tcg-runtime.h"
+#include "cpu.h"
+#include "exec/helper-proto.h"
+#include "exec/exec-all.h"
+#include "tcg.h"
 
 
 /* 32-bit helpers */
@@ -107,3 +101,29 @@ int64_t HELPER(mulsh_i64)(int64_t arg1, int64_t arg2)
     muls64(&l, &h, arg1, arg2);
     return h;
 }
+
+/* Find the TB that follows an indirect branch in the jump cache, like
+   tb_find_fast does, so that generated code can jump to it directly.
+   On a miss, the caller's TB returns to the main loop.  */
+void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    if (likely(tb && tb->pc == pc && tb->cs_base == cs_base &&
+               tb->flags == flags)) {
+        tb_mark_used(tb);
+        return tb->tc_ptr;
+    }
+    return tcg_ctx.code_gen_epilogue;
+}
+
+/* Guest threads run in parallel: order stores against later loads, too.  */
+void HELPER(mb)(void)
+{
+    smp_mb();
+}
@@ -93,6 +93,10 @@ enum {
     TCG_AREG0 = TCG_REG_R6,
 };
 
+#define TCG_TARGET_HAS_goto_ptr         0
+
+#define TCG_TARGET_IMPLEMENTS_DYN_TLB 0
+
 static inline void flush_icache_range(uintptr_t start, uintptr_t stop)
 {
 #if QEMU_GNUC_PREREQ(4, 1)
@@ -29,6 +29,9 @@ static const char * const tcg_target_reg_names[TCG_TARGET_NB_REGS] = {
 #if TCG_TARGET_REG_BITS == 64
     "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
     "%r8",  "%r9",  "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+    "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+    "%xmm8", "%xmm9", "%xmm10", "%xmm11",
+    "%xmm12", "%xmm13", "%xmm14", "%xmm15",
 #else
     "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
 #endif
@@ -52,6 +55,26 @@ static const int tcg_target_reg_alloc_order[] = {
     TCG_REG_RSI,
     TCG_REG_RDI,
     TCG_REG_RAX,
+    TCG_REG_XMM0,
+    TCG_REG_XMM1,
+    TCG_REG_XMM2,
+    TCG_REG_XMM3,
+    TCG_REG_XMM4,
+    TCG_REG_XMM5,
+#ifndef _WIN64
+    /* The Win64 ABI has xmm6-xmm15 as callee-saves, and the prologue
+       does not save them.  Therefore only allocate xmm0-xmm5 there.  */
+    TCG_REG_XMM6,
+    TCG_REG_XMM7,
+    TCG_REG_XMM8,
+    TCG_REG_XMM9,
+    TCG_REG_XMM10,
+    TCG_REG_XMM11,
+    TCG_REG_XMM12,
+    TCG_REG_XMM13,
+    TCG_REG_XMM14,
+    TCG_REG_XMM15,
+#endif
 #else
     TCG_REG_EBX,
     TCG_REG_ESI,
@@ -93,6 +116,9 @@ static const int tcg_target_call_oarg_regs[] = {
 #define TCG_CT_CONST_U32 0x200
 #define TCG_CT_CONST_I32 0x400
 
+#define ALL_GENERAL_REGS   0x0000ffffu
+#define ALL_VECTOR_REGS    0xffff0000u
+
 /* Registers used with L constraint, which are the first argument 
    registers on x86_64, and two random call clobbered registers on
    i386. */
@@ -139,6 +165,19 @@ static bool have_bmi2;
 # define have_bmi2 0
 #endif
 
+/* The vector ops are only implemented with the VEX encoding, and only
+   for 64-bit hosts, see tcg-target.h.  */
+bool have_avx1;
+bool have_avx2;
+
+#ifdef TCG_TARGET_CODE_RELOC
+uint64_t tcg_target_code_features(void)
+{
+    return have_cmov | have_movbe << 1 | have_bmi1 << 2 | have_bmi2 << 3
+           | have_avx1 << 4 | have_avx2 << 5;
+}
+#endif
+
 static tcg_insn_unit *tb_ret_addr;
 
 static void patch_reloc(tcg_insn_unit *code_ptr, int type,
@@ -248,6 +287,11 @@ static int target_parse_constraint(TCGArgConstraint *ct, const char **pct_str)
         ct->ct |= TCG_CT_CONST_I32;
         break;
 
+    case 'x':
+        ct->ct |= TCG_CT_REG;
+        tcg_regset_set32(ct->u.regs, 0, ALL_VECTOR_REGS);
+        break;
+
     default:
         return -1;
     }
@@ -300,6 +344,7 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #endif
 #define P_SIMDF3        0x10000         /* 0xf3 opcode prefix */
 #define P_SIMDF2        0x20000         /* 0xf2 opcode prefix */
+#define P_VEXL          0x40000         /* Set VEX.L = 1 */
 
 #define OPC_ARITH_EvIz	(0x81)
 #define OPC_ARITH_EvIb	(0x83)
@@ -310,6 +355,7 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_CALL_Jz	(0xe8)
 #define OPC_CMOVCC      (0x40 | P_EXT)  /* ... plus condition code */
 #define OPC_CMP_GvEv	(OPC_ARITH_GvEv | (ARITH_CMP << 3))
+#define OPC_AND_GvEv	(OPC_ARITH_GvEv | (ARITH_AND << 3))
 #define OPC_DEC_r32	(0x48)
 #define OPC_IMUL_GvEv	(0xaf | P_EXT)
 #define OPC_IMUL_GvEvIb	(0x6b)
@@ -348,6 +394,44 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_TESTL	(0x85)
 #define OPC_XCHG_ax_r32	(0x90)
 
+#define OPC_MOVDQA_VxWx (0x6f | P_EXT | P_DATA16)
+#define OPC_MOVDQU_VxWx (0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx (0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_VqWq   (0x7e | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_WqVq   (0xd6 | P_EXT | P_DATA16)
+#define OPC_MOVQ_VqEq   (0x6e | P_EXT | P_DATA16 | P_REXW)
+#define OPC_PADDB       (0xfc | P_EXT | P_DATA16)
+#define OPC_PADDW       (0xfd | P_EXT | P_DATA16)
+#define OPC_PADDD       (0xfe | P_EXT | P_DATA16)
+#define OPC_PADDQ       (0xd4 | P_EXT | P_DATA16)
+#define OPC_PAND        (0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN       (0xdf | P_EXT | P_DATA16)
+#define OPC_PBROADCASTB (0x78 | P_EXT38 | P_DATA16)
+#define OPC_PBROADCASTW (0x79 | P_EXT38 | P_DATA16)
+#define OPC_PBROADCASTD (0x58 | P_EXT38 | P_DATA16)
+#define OPC_PBROADCASTQ (0x59 | P_EXT38 | P_DATA16)
+#define OPC_PCMPEQB     (0x74 | P_EXT | P_DATA16)
+#define OPC_PCMPEQW     (0x75 | P_EXT | P_DATA16)
+#define OPC_PCMPEQD     (0x76 | P_EXT | P_DATA16)
+#define OPC_PCMPEQQ     (0x29 | P_EXT38 | P_DATA16)
+#define OPC_PCMPGTB     (0x64 | P_EXT | P_DATA16)
+#define OPC_PCMPGTW     (0x65 | P_EXT | P_DATA16)
+#define OPC_PCMPGTD     (0x66 | P_EXT | P_DATA16)
+#define OPC_PCMPGTQ     (0x37 | P_EXT38 | P_DATA16)
+#define OPC_POR         (0xeb | P_EXT | P_DATA16)
+#define OPC_PSHUFD      (0x70 | P_EXT | P_DATA16)
+#define OPC_PSHIFTW_Ib  (0x71 | P_EXT | P_DATA16) /* /2 /6 /4 */
+#define OPC_PSHIFTD_Ib  (0x72 | P_EXT | P_DATA16) /* /2 /6 /4 */
+#define OPC_PSHIFTQ_Ib  (0x73 | P_EXT | P_DATA16) /* /2 /6 */
+#define OPC_PSUBB       (0xf8 | P_EXT | P_DATA16)
+#define OPC_PSUBW       (0xf9 | P_EXT | P_DATA16)
+#define OPC_PSUBD       (0xfa | P_EXT | P_DATA16)
+#define OPC_PSUBQ       (0xfb | P_EXT | P_DATA16)
+#define OPC_PUNPCKLBW   (0x60 | P_EXT | P_DATA16)
+#define OPC_PUNPCKLWD   (0x61 | P_EXT | P_DATA16)
+#define OPC_PUNPCKLQDQ  (0x6c | P_EXT | P_DATA16)
+#define OPC_PXOR        (0xef | P_EXT | P_DATA16)
+
 #define OPC_GRP3_Ev	(0xf7)
 #define OPC_GRP5	(0xff)
 
@@ -485,11 +569,20 @@ static void tcg_out_modrm(TCGContext *s, int opc, int r, int rm)
     tcg_out8(s, 0xc0 | (LOWREGMASK(r) << 3) | LOWREGMASK(rm));
 }
 
-static void tcg_out_vex_modrm(TCGContext *s, int opc, int r, int v, int rm)
+static void tcg_out_vex_opc(TCGContext *s, int opc, int r, int v,
+                            int rm, int index)
 {
     int tmp;
 
-    if ((opc & (P_REXW | P_EXT | P_EXT38)) || (rm & 8)) {
+    /* Use the two byte form if possible, which cannot encode
+       VEX.W, VEX.B, VEX.X, or an m-mmmm field other than P_EXT.  */
+    if ((opc & (P_EXT | P_EXT38 | P_REXW)) == P_EXT
+        && ((rm | index) & 8) == 0) {
+        /* Two byte VEX prefix.  */
+        tcg_out8(s, 0xc5);
+
+        tmp = (r & 8 ? 0 : 0x80);              /* VEX.R */
+    } else {
         /* Three byte VEX prefix.  */
         tcg_out8(s, 0xc4);
 
@@ -501,18 +594,15 @@ static void tcg_out_vex_modrm(TCGContext *s, int opc, int r, int v, int rm)
         } else {
             tcg_abort();
         }
-        tmp |= 0x40;                       /* VEX.X */
-        tmp |= (r & 8 ? 0 : 0x80);         /* VEX.R */
-        tmp |= (rm & 8 ? 0 : 0x20);        /* VEX.B */
+        tmp |= (r & 8 ? 0 : 0x80);             /* VEX.R */
+        tmp |= (index & 8 ? 0 : 0x40);         /* VEX.X */
+        tmp |= (rm & 8 ? 0 : 0x20);            /* VEX.B */
         tcg_out8(s, tmp);
 
-        tmp = (opc & P_REXW ? 0x80 : 0);   /* VEX.W */
-    } else {
-        /* Two byte VEX prefix.  */
-        tcg_out8(s, 0xc5);
-
-        tmp = (r & 8 ? 0 : 0x80);          /* VEX.R */
+        tmp = (opc & P_REXW ? 0x80 : 0);       /* VEX.W */
     }
+
+    tmp |= (opc & P_VEXL ? 0x04 : 0);          /* VEX.L */
     /* VEX.pp */
     if (opc & P_DATA16) {
         tmp |= 1;                          /* 0x66 */
@@ -524,9 +614,45 @@ static void tcg_out_vex_modrm(TCGContext *s, int opc, int r, int v, int rm)
     tmp |= (~v & 15) << 3;                 /* VEX.vvvv */
     tcg_out8(s, tmp);
     tcg_out8(s, opc);
+}
+
+static void tcg_out_vex_modrm(TCGContext *s, int opc, int r, int v, int rm)
+{
+    tcg_out_vex_opc(s, opc, r, v, rm, 0);
     tcg_out8(s, 0xc0 | (LOWREGMASK(r) << 3) | LOWREGMASK(rm));
 }
 
+/* A VEX-encoded instruction with a "rm + offset" memory operand.  */
+static void tcg_out_vex_modrm_offset(TCGContext *s, int opc, int r, int v,
+                                     int rm, intptr_t offset)
+{
+    int mod, len;
+
+    assert(offset == (int32_t)offset);
+    if (offset == 0 && LOWREGMASK(rm) != TCG_REG_EBP) {
+        mod = 0, len = 0;
+    } else if (offset == (int8_t)offset) {
+        mod = 0x40, len = 1;
+    } else {
+        mod = 0x80, len = 4;
+    }
+
+    tcg_out_vex_opc(s, opc, r, v, rm, 0);
+    if (LOWREGMASK(rm) != TCG_REG_ESP) {
+        tcg_out8(s, mod | (LOWREGMASK(r) << 3) | LOWREGMASK(rm));
+    } else {
+        /* The %esp encoding is the escape to the SIB form.  */
+        tcg_out8(s, mod | (LOWREGMASK(r) << 3) | 4);
+        tcg_out8(s, (4 << 3) | LOWREGMASK(rm));
+    }
+
+    if (len == 1) {
+        tcg_out8(s, offset);
+    } else if (len == 4) {
+        tcg_out32(s, offset);
+    }
+}
+
 /* Output an opcode with a full "rm + (index<<shift) + offset" address mode.
    We handle either RM and INDEX missing with a negative value.  In 64-bit
    mode for absolute addresses, ~RM is the size of the immediate operand
@@ -543,6 +669,11 @@ static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
                the 32-bit-mode absolute addressing encoding.  */
             intptr_t pc = (intptr_t)s->code_ptr + 5 + ~rm;
             intptr_t disp = offset - pc;
+
+            /* neither form can be described by a TCGCodeReloc */
+            if (s->code_reloc) {
+                s->code_unrelocatable = true;
+            }
             if (disp == (int32_t)disp) {
                 tcg_out_opc(s, opc, r, 0, 0);
                 tcg_out8(s, (LOWREGMASK(r) << 3) | 5);
@@ -634,9 +765,24 @@ static inline void tgen_arithr(TCGContext *s, int subop, int dest, int src)
 static inline void tcg_out_mov(TCGContext *s, TCGType type,
                                TCGReg ret, TCGReg arg)
 {
-    if (arg != ret) {
-        int opc = OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0);
-        tcg_out_modrm(s, opc, ret, arg);
+    if (arg == ret) {
+        return;
+    }
+    switch (type) {
+    case TCG_TYPE_I32:
+    case TCG_TYPE_I64:
+        tcg_out_modrm(s, OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0),
+                      ret, arg);
+        break;
+    case TCG_TYPE_V64:
+    case TCG_TYPE_V128:
+        tcg_out_vex_modrm(s, OPC_MOVDQA_VxWx, ret, 0, arg);
+        break;
+    case TCG_TYPE_V256:
+        tcg_out_vex_modrm(s, OPC_MOVDQA_VxWx | P_VEXL, ret, 0, arg);
+        break;
+    default:
+        tcg_abort();
     }
 }
 
@@ -660,9 +806,10 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
         return;
     }
 
-    /* Try a 7 byte pc-relative lea before the 10 byte movq.  */
+    /* Try a 7 byte pc-relative lea before the 10 byte movq; the lea
+       ties the code to its address, so not if it may be moved.  */
     diff = arg - ((uintptr_t)s->code_ptr + 7);
-    if (diff == (int32_t)diff) {
+    if (diff == (int32_t)diff && !s->code_reloc) {
         tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
         tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
         tcg_out32(s, diff);
@@ -673,6 +820,15 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     tcg_out64(s, arg);
 }
 
+/* Load a host address with the 10 byte movq whatever its value, so that
+   a relocation can patch it.  */
+static void tcg_out_movi_reloc(TCGContext *s, TCGReg ret, uintptr_t arg)
+{
+    tcg_out_opc(s, OPC_MOVL_Iv + P_REXW + LOWREGMASK(ret), 0, ret, 0);
+    tcg_out64(s, arg);
+    tcg_out_code_reloc(s, s->code_ptr - 8, TCG_CODE_RELOC_ABS64, arg);
+}
+
 static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
 {
     if (val == (int8_t)val) {
@@ -696,18 +852,57 @@ static inline void tcg_out_pop(TCGContext *s, int reg)
     tcg_out_opc(s, OPC_POP_r32 + LOWREGMASK(reg), 0, reg, 0);
 }
 
+/* The vector loads and stores do not require alignment: neither the
+   guest registers in env nor the spill slots are necessarily aligned
+   to the vector size.  */
 static inline void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret,
                               TCGReg arg1, intptr_t arg2)
 {
-    int opc = OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0);
-    tcg_out_modrm_offset(s, opc, ret, arg1, arg2);
+    switch (type) {
+    case TCG_TYPE_I32:
+    case TCG_TYPE_I64:
+        tcg_out_modrm_offset(s, OPC_MOVL_GvEv
+                             + (type == TCG_TYPE_I64 ? P_REXW : 0),
+                             ret, arg1, arg2);
+        break;
+    case TCG_TYPE_V64:
+        tcg_out_vex_modrm_offset(s, OPC_MOVQ_VqWq, ret, 0, arg1, arg2);
+        break;
+    case TCG_TYPE_V128:
+        tcg_out_vex_modrm_offset(s, OPC_MOVDQU_VxWx, ret, 0, arg1, arg2);
+        break;
+    case TCG_TYPE_V256:
+        tcg_out_vex_modrm_offset(s, OPC_MOVDQU_VxWx | P_VEXL,
+                                 ret, 0, arg1, arg2);
+        break;
+    default:
+        tcg_abort();
+    }
 }
 
 static inline void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg,
                               TCGReg arg1, intptr_t arg2)
 {
-    int opc = OPC_MOVL_EvGv + (type == TCG_TYPE_I64 ? P_REXW : 0);
-    tcg_out_modrm_offset(s, opc, arg, arg1, arg2);
+    switch (type) {
+    case TCG_TYPE_I32:
+    case TCG_TYPE_I64:
+        tcg_out_modrm_offset(s, OPC_MOVL_EvGv
+                             + (type == TCG_TYPE_I64 ? P_REXW : 0),
+                             arg, arg1, arg2);
+        break;
+    case TCG_TYPE_V64:
+        tcg_out_vex_modrm_offset(s, OPC_MOVQ_WqVq, arg, 0, arg1, arg2);
+        break;
+    case TCG_TYPE_V128:
+        tcg_out_vex_modrm_offset(s, OPC_MOVDQU_WxVx, arg, 0, arg1, arg2);
+        break;
+    case TCG_TYPE_V256:
+        tcg_out_vex_modrm_offset(s, OPC_MOVDQU_WxVx | P_VEXL,
+                                 arg, 0, arg1, arg2);
+        break;
+    default:
+        tcg_abort();
+    }
 }
 
 static inline void tcg_out_sti(TCGContext *s, TCGType type, TCGReg base,
@@ -1106,8 +1301,14 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
     if (disp == (int32_t)disp) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
         tcg_out32(s, disp);
+        tcg_out_code_reloc(s, s->code_ptr - 4, TCG_CODE_RELOC_REL32,
+                           (uintptr_t)dest);
     } else {
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_R10, (uintptr_t)dest);
+        if (s->code_reloc) {
+            tcg_out_movi_reloc(s, TCG_REG_R10, (uintptr_t)dest);
+        } else {
+            tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_R10, (uintptr_t)dest);
+        }
         tcg_out_modrm(s, OPC_GRP5,
                       call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev, TCG_REG_R10);
     }
@@ -1200,15 +1401,15 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     tgen_arithi(s, ARITH_AND + trexw, r1,
                 TARGET_PAGE_MASK | ((1 << s_bits) - 1), 0);
-    tgen_arithi(s, ARITH_AND + hrexw, r0,
-                (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
-
-    tcg_out_modrm_sib_offset(s, OPC_LEA + hrexw, r0, TCG_AREG0, r0, 0,
-                             offsetof(CPUArchState, tlb_table[mem_index][0])
-                             + which);
+    /* The TLB is resized at flush time, so both its size and its
+       location are loaded from env.  */
+    tcg_out_modrm_offset(s, OPC_AND_GvEv + hrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_mask[mem_index]));
+    tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_table[mem_index]));
 
-    /* cmp 0(r0), r1 */
-    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, 0);
+    /* cmp which(r0), r1 */
+    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, which);
 
     /* Prepare for both the fast path add of the tlb addend, and the slow
        path function argument setup.  There are two cases worth note:
@@ -1224,8 +1425,8 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
     s->code_ptr += 4;
 
     if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-        /* cmp 4(r0), addrhi */
-        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, 4);
+        /* cmp which+4(r0), addrhi */
+        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, which + 4);
 
         /* jne slow_path */
         tcg_out_opc(s, OPC_JCC_long + JCC_JNE, 0, 0, 0);
@@ -1237,7 +1438,7 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     /* add addend(r0), r1 */
     tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r1, r0,
-                         offsetof(CPUTLBEntry, addend) - which);
+                         offsetof(CPUTLBEntry, addend));
 }
 
 /*
@@ -1714,6 +1915,171 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
 #endif
 }
 
+static void tcg_out_dup_vec(TCGContext *s, TCGType type, unsigned vece,
+                            TCGReg r, TCGReg a)
+{
+    /* Move the integer into the low element, then replicate it.  */
+    tcg_out_vex_modrm(s, OPC_MOVQ_VqEq, r, 0, a);
+    if (have_avx2) {
+        static const int bcast_insn[4] = {
+            OPC_PBROADCASTB, OPC_PBROADCASTW, OPC_PBROADCASTD, OPC_PBROADCASTQ
+        };
+        int vexl = type == TCG_TYPE_V256 ? P_VEXL : 0;
+        tcg_out_vex_modrm(s, bcast_insn[vece] | vexl, r, 0, r);
+    } else {
+        /* Without AVX2 there are no 256-bit vectors, see tcg-target.h.  */
+        switch (vece) {
+        case MO_8:
+            tcg_out_vex_modrm(s, OPC_PUNPCKLBW, r, r, r);
+            /* FALLTHRU */
+        case MO_16:
+            tcg_out_vex_modrm(s, OPC_PUNPCKLWD, r, r, r);
+            /* FALLTHRU */
+        case MO_32:
+            tcg_out_vex_modrm(s, OPC_PSHUFD, r, 0, r);
+            tcg_out8(s, 0);
+            break;
+        case MO_64:
+            tcg_out_vex_modrm(s, OPC_PUNPCKLQDQ, r, r, r);
+            break;
+        default:
+            tcg_abort();
+        }
+    }
+}
+
+static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
+                           const TCGArg *args, const int *const_args)
+{
+    static const int add_insn[4] = {
+        OPC_PADDB, OPC_PADDW, OPC_PADDD, OPC_PADDQ
+    };
+    static const int sub_insn[4] = {
+        OPC_PSUBB, OPC_PSUBW, OPC_PSUBD, OPC_PSUBQ
+    };
+    static const int cmpeq_insn[4] = {
+        OPC_PCMPEQB, OPC_PCMPEQW, OPC_PCMPEQD, OPC_PCMPEQQ
+    };
+    static const int cmpgt_insn[4] = {
+        OPC_PCMPGTB, OPC_PCMPGTW, OPC_PCMPGTD, OPC_PCMPGTQ
+    };
+    static const int shift_insn[4] = {
+        -1, OPC_PSHIFTW_Ib, OPC_PSHIFTD_Ib, OPC_PSHIFTQ_Ib
+    };
+    const TCGOpDef *def = &tcg_op_defs[opc];
+    int nargs = def->nb_oargs + def->nb_iargs + def->nb_cargs;
+    TCGType type = args[nargs - 2] + TCG_TYPE_V64;
+    unsigned vece = args[nargs - 1];
+    TCGArg a0 = args[0], a1 = args[1], a2 = args[2];
+    int insn, sub;
+
+    switch (opc) {
+    case INDEX_op_add_vec:
+        insn = add_insn[vece];
+        goto gen_simd;
+    case INDEX_op_sub_vec:
+        insn = sub_insn[vece];
+        goto gen_simd;
+    case INDEX_op_and_vec:
+        insn = OPC_PAND;
+        goto gen_simd;
+    case INDEX_op_or_vec:
+        insn = OPC_POR;
+        goto gen_simd;
+    case INDEX_op_xor_vec:
+        insn = OPC_PXOR;
+        goto gen_simd;
+    case INDEX_op_andc_vec:
+        /* PANDN inverts its first source.  */
+        insn = OPC_PANDN;
+        a1 = args[2];
+        a2 = args[1];
+        goto gen_simd;
+    case INDEX_op_cmp_vec:
+        /* tcg_gen_cmp_vec reduces every condition to these.  */
+        switch (args[3]) {
+        case TCG_COND_EQ:
+            insn = cmpeq_insn[vece];
+            break;
+        case TCG_COND_GT:
+            insn = cmpgt_insn[vece];
+            break;
+        case TCG_COND_LT:
+            insn = cmpgt_insn[vece];
+            a1 = args[2];
+            a2 = args[1];
+            break;
+        default:
+            tcg_abort();
+        }
+    gen_simd:
+        if (type == TCG_TYPE_V256) {
+            insn |= P_VEXL;
+        }
+        tcg_out_vex_modrm(s, insn, a0, a1, a2);
+        break;
+
+    case INDEX_op_shli_vec:
+        sub = 6;
+        goto gen_shift;
+    case INDEX_op_shri_vec:
+        sub = 2;
+        goto gen_shift;
+    case INDEX_op_sari_vec:
+        assert(vece != MO_64);
+        sub = 4;
+    gen_shift:
+        assert(vece != MO_8);
+        insn = shift_insn[vece];
+        if (type == TCG_TYPE_V256) {
+            insn |= P_VEXL;
+        }
+        tcg_out_vex_modrm(s, insn, sub, a0, a1);
+        tcg_out8(s, a2);
+        break;
+
+    case INDEX_op_ld_vec:
+        tcg_out_ld(s, type, a0, a1, a2);
+        break;
+    case INDEX_op_st_vec:
+        tcg_out_st(s, type, a0, a1, a2);
+        break;
+    case INDEX_op_dup_vec:
+        tcg_out_dup_vec(s, type, vece, a0, a1);
+        break;
+
+    case INDEX_op_mov_vec:  /* Always emitted via tcg_out_mov.  */
+    default:
+        tcg_abort();
+    }
+}
+
+int tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece)
+{
+    switch (opc) {
+    case INDEX_op_add_vec:
+    case INDEX_op_sub_vec:
+    case INDEX_op_and_vec:
+    case INDEX_op_or_vec:
+    case INDEX_op_xor_vec:
+    case INDEX_op_andc_vec:
+    case INDEX_op_cmp_vec:
+    case INDEX_op_dup_vec:
+    case INDEX_op_ld_vec:
+    case INDEX_op_st_vec:
+        return 1;
+    case INDEX_op_shli_vec:
+    case INDEX_op_shri_vec:
+        /* There are no 8-bit shifts.  */
+        return vece != MO_8;
+    case INDEX_op_sari_vec:
+        /* ... nor, before AVX-512, a 64-bit arithmetic one.  */
+        return vece == MO_16 || vece == MO_32;
+    default:
+        return 0;
+    }
+}
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -1731,12 +2097,26 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 
     switch(opc) {
     case INDEX_op_exit_tb:
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+        if (s->code_reloc && args[0]) {
+            /* the value points into the TB */
+            tcg_out_movi_reloc(s, TCG_REG_EAX, args[0]);
+        } else {
+            tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+        }
         tcg_out_jmp(s, tb_ret_addr);
         break;
     case INDEX_op_goto_tb:
         if (s->tb_jmp_offset) {
             /* direct jump method */
+            int gap;
+
+            /* The displacement is patched while other vCPU threads may
+               be executing it; keep it 4-byte aligned so the store is
+               atomic.  */
+            gap = -(uintptr_t)(s->code_ptr + 1) & 3;
+            while (gap--) {
+                tcg_out8(s, 0x90); /* nop */
+            }
             tcg_out8(s, OPC_JMP_long); /* jmp im */
             s->tb_jmp_offset[args[0]] = tcg_current_code_size(s);
             tcg_out32(s, 0);
@@ -1747,6 +2127,10 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         s->tb_next_offset[args[0]] = tcg_current_code_size(s);
         break;
+    case INDEX_op_goto_ptr:
+        /* jmp to the given host address (could be epilogue) */
+        tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, args[0]);
+        break;
     case INDEX_op_br:
         tcg_out_jxx(s, JCC_JMP, args[0], 0);
         break;
@@ -2055,6 +2439,22 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         break;
 
+    case INDEX_op_dup_vec:
+    case INDEX_op_ld_vec:
+    case INDEX_op_st_vec:
+    case INDEX_op_add_vec:
+    case INDEX_op_sub_vec:
+    case INDEX_op_and_vec:
+    case INDEX_op_or_vec:
+    case INDEX_op_xor_vec:
+    case INDEX_op_andc_vec:
+    case INDEX_op_shli_vec:
+    case INDEX_op_shri_vec:
+    case INDEX_op_sari_vec:
+    case INDEX_op_cmp_vec:
+        tcg_out_vec_op(s, opc, args, const_args);
+        break;
+
     case INDEX_op_mov_i32:  /* Always emitted via tcg_out_mov.  */
     case INDEX_op_mov_i64:
     case INDEX_op_movi_i32: /* Always emitted via tcg_out_movi.  */
@@ -2070,6 +2470,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_br, { } },
     { INDEX_op_ld8u_i32, { "r", "r" } },
     { INDEX_op_ld8s_i32, { "r", "r" } },
@@ -2175,6 +2576,20 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_muls2_i64, { "a", "d", "a", "r" } },
     { INDEX_op_add2_i64, { "r", "r", "0", "1", "re", "re" } },
     { INDEX_op_sub2_i64, { "r", "r", "0", "1", "re", "re" } },
+
+    { INDEX_op_dup_vec, { "x", "r" } },
+    { INDEX_op_ld_vec, { "x", "r" } },
+    { INDEX_op_st_vec, { "x", "r" } },
+    { INDEX_op_add_vec, { "x", "x", "x" } },
+    { INDEX_op_sub_vec, { "x", "x", "x" } },
+    { INDEX_op_and_vec, { "x", "x", "x" } },
+    { INDEX_op_or_vec, { "x", "x", "x" } },
+    { INDEX_op_xor_vec, { "x", "x", "x" } },
+    { INDEX_op_andc_vec, { "x", "x", "x" } },
+    { INDEX_op_shli_vec, { "x", "x" } },
+    { INDEX_op_shri_vec, { "x", "x" } },
+    { INDEX_op_sari_vec, { "x", "x" } },
+    { INDEX_op_cmp_vec, { "x", "x", "x" } },
 #endif
 
 #if TCG_TARGET_REG_BITS == 64
@@ -2262,6 +2677,11 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, tcg_target_call_iarg_regs[1]);
 #endif
 
+    /* Return path for goto_ptr.  Set return value to 0, as exit_tb 0
+       would, and fall through to the rest of the epilogue.  */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_REG, TCG_REG_EAX, 0);
+
     /* TB epilogue */
     tb_ret_addr = s->code_ptr;
 
@@ -2298,6 +2718,14 @@ static void tcg_target_init(TCGContext *s)
         /* MOVBE is only available on Intel Atom and Haswell CPUs, so we
            need to probe for it.  */
         have_movbe = (c & bit_MOVBE) != 0;
+#endif
+#if TCG_TARGET_REG_BITS == 64 && defined(bit_AVX) && defined(bit_OSXSAVE)
+        /* The OS must also have enabled saving of the ymm state.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            unsigned xcr0, xcr0h;
+            asm("xgetbv" : "=a" (xcr0), "=d" (xcr0h) : "c" (0));
+            have_avx1 = (xcr0 & 6) == 6;
+        }
 #endif
     }
 
@@ -2309,13 +2737,28 @@ static void tcg_target_init(TCGContext *s)
 #endif
 #ifndef have_bmi2
         have_bmi2 = (b & bit_BMI2) != 0;
+#endif
+#ifdef bit_AVX2
+        have_avx2 = have_avx1 && (b & bit_AVX2) != 0;
 #endif
     }
 #endif
 
     if (TCG_TARGET_REG_BITS == 64) {
-        tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xffff);
-        tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I64], 0, 0xffff);
+        tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0,
+                         ALL_GENERAL_REGS);
+        tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I64], 0,
+                         ALL_GENERAL_REGS);
+        if (have_avx1) {
+            tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_V64], 0,
+                             ALL_VECTOR_REGS);
+            tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_V128], 0,
+                             ALL_VECTOR_REGS);
+        }
+        if (have_avx2) {
+            tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_V256], 0,
+                             ALL_VECTOR_REGS);
+        }
     } else {
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xff);
     }
@@ -2333,10 +2776,19 @@ static void tcg_target_init(TCGContext *s)
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R9);
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R10);
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R11);
+        /* All of the vector registers are call-clobbered with the SysV
+           ABI; Win64 preserves xmm6-xmm15, which are never allocated.  */
+        tcg_regset_set32(tcg_target_call_clobber_regs, 0, 0x003f0000u);
+#if !defined(_WIN64)
+        tcg_regset_set32(tcg_target_call_clobber_regs, 0, 0xffc00000u);
+#endif
     }
 
     tcg_regset_clear(s->reserved_regs);
     tcg_regset_set_reg(s->reserved_regs, TCG_REG_CALL_STACK);
+#if TCG_TARGET_REG_BITS == 64 && defined(_WIN64)
+    tcg_regset_set32(s->reserved_regs, 0, 0xffc00000u);
+#endif
 
     tcg_add_target_add_op_defs(x86_op_defs);
 }
@@ -28,7 +28,9 @@
 
 #ifdef __x86_64__
 # define TCG_TARGET_REG_BITS  64
-# define TCG_TARGET_NB_REGS   16
+# define TCG_TARGET_NB_REGS   32
+/* host addresses in the generated code are recorded as TCGCodeRelocs */
+# define TCG_TARGET_CODE_RELOC 1
 #else
 # define TCG_TARGET_REG_BITS  32
 # define TCG_TARGET_NB_REGS    8
@@ -54,6 +56,25 @@ typedef enum {
     TCG_REG_R13,
     TCG_REG_R14,
     TCG_REG_R15,
+
+    /* The vector registers, only used on 64-bit hosts.  */
+    TCG_REG_XMM0,
+    TCG_REG_XMM1,
+    TCG_REG_XMM2,
+    TCG_REG_XMM3,
+    TCG_REG_XMM4,
+    TCG_REG_XMM5,
+    TCG_REG_XMM6,
+    TCG_REG_XMM7,
+    TCG_REG_XMM8,
+    TCG_REG_XMM9,
+    TCG_REG_XMM10,
+    TCG_REG_XMM11,
+    TCG_REG_XMM12,
+    TCG_REG_XMM13,
+    TCG_REG_XMM14,
+    TCG_REG_XMM15,
+
     TCG_REG_RAX = TCG_REG_EAX,
     TCG_REG_RCX = TCG_REG_ECX,
     TCG_REG_RDX = TCG_REG_EDX,
@@ -74,6 +95,8 @@ typedef enum {
 #endif
 
 extern bool have_bmi1;
+extern bool have_avx1;
+extern bool have_avx2;
 
 /* optional instructions */
 #define TCG_TARGET_HAS_div2_i32         1
@@ -128,6 +151,18 @@ extern bool have_bmi1;
 #define TCG_TARGET_HAS_muls2_i64        1
 #define TCG_TARGET_HAS_muluh_i64        0
 #define TCG_TARGET_HAS_mulsh_i64        0
+
+/* Vector operations use the VEX encoding, so they need AVX; AVX2 adds
+   the integer operations on 256-bit vectors.  */
+#define TCG_TARGET_HAS_v64              have_avx1
+#define TCG_TARGET_HAS_v128             have_avx1
+#define TCG_TARGET_HAS_v256             have_avx2
+
+#define TCG_TARGET_HAS_andc_vec         1
+#define TCG_TARGET_HAS_orc_vec          0
+#define TCG_TARGET_HAS_not_vec          0
+#define TCG_TARGET_HAS_neg_vec          0
+#define TCG_TARGET_HAS_shi_vec          1
 #endif
 
 #define TCG_TARGET_deposit_i32_valid(ofs, len) \
@@ -141,6 +176,11 @@ extern bool have_bmi1;
 # define TCG_AREG0 TCG_REG_EBP
 #endif
 
+#define TCG_TARGET_HAS_goto_ptr         1
+
+/* The softmmu TLB size is read from env, see tcg_out_tlb_load */
+#define TCG_TARGET_IMPLEMENTS_DYN_TLB 1
+
 static inline void flush_icache_range(uintptr_t start, uintptr_t stop)
 {
 }
@@ -129,6 +129,10 @@ extern bool use_mips32r2_instructions;
 #include <sys/cachectl.h>
 #endif
 
+#define TCG_TARGET_HAS_goto_ptr         0
+
+#define TCG_TARGET_IMPLEMENTS_DYN_TLB 0
+
 static inline void flush_icache_range(uintptr_t start, uintptr_t stop)
 {
     cacheflush ((void *)start, stop-start, ICACHE);
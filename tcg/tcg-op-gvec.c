@@ -0,0 +1,1042 @@
+/*
+ * TCG generic vector operation expansion
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tcg.h"
+#include "tcg-op.h"
+#include "tcg-op-gvec.h"
+#include "tcg-gvec-desc.h"
+
+#define MAX_UNROLL  4
+
+/* Verify vector size and alignment rules.  OFS should be the OR of all
+   of the operand offsets so that we can check them all at once.  */
+static void check_size_align(uint32_t oprsz, uint32_t maxsz, uint32_t ofs)
+{
+    assert(oprsz > 0 && oprsz <= maxsz && maxsz <= 256);
+    assert((oprsz & 7) == 0);
+    assert((maxsz & 7) == 0);
+    assert((ofs & 7) == 0);
+}
+
+/* Verify that the destination does not partially overlap a source.  */
+static void check_overlap_2(uint32_t d, uint32_t a, uint32_t s)
+{
+    assert(d == a || d + s <= a || a + s <= d);
+}
+
+static void check_overlap_3(uint32_t d, uint32_t a, uint32_t b, uint32_t s)
+{
+    check_overlap_2(d, a, s);
+    check_overlap_2(d, b, s);
+    check_overlap_2(a, b, s);
+}
+
+/* Return true if OPRSZ can be expanded inline with at most MAX_UNROLL
+   operations of LNSZ bytes.  */
+static bool check_size_impl(uint32_t oprsz, uint32_t lnsz)
+{
+    return oprsz % lnsz == 0 && oprsz / lnsz <= MAX_UNROLL;
+}
+
+uint32_t simd_desc(uint32_t oprsz, uint32_t maxsz, int32_t data)
+{
+    uint32_t desc = 0;
+
+    assert(oprsz % 8 == 0 && oprsz <= (8 << SIMD_OPRSZ_BITS));
+    assert(maxsz % 8 == 0 && maxsz <= (8 << SIMD_MAXSZ_BITS));
+    assert(data == sextract32(data, 0, SIMD_DATA_BITS));
+
+    oprsz = (oprsz / 8) - 1;
+    maxsz = (maxsz / 8) - 1;
+    desc = deposit32(desc, SIMD_OPRSZ_SHIFT, SIMD_OPRSZ_BITS, oprsz);
+    desc = deposit32(desc, SIMD_MAXSZ_SHIFT, SIMD_MAXSZ_BITS, maxsz);
+    desc = deposit32(desc, SIMD_DATA_SHIFT, SIMD_DATA_BITS, data);
+
+    return desc;
+}
+
+void tcg_gen_gvec_2_ool(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                        uint32_t oprsz, uint32_t maxsz, int32_t data,
+                        gen_helper_gvec_2 *fn)
+{
+    TCGv_ptr a0 = tcg_temp_new_ptr();
+    TCGv_ptr a1 = tcg_temp_new_ptr();
+    TCGv_i32 desc = tcg_const_i32(simd_desc(oprsz, maxsz, data));
+
+    tcg_gen_addi_ptr(a0, env, dofs);
+    tcg_gen_addi_ptr(a1, env, aofs);
+
+    fn(a0, a1, desc);
+
+    tcg_temp_free_ptr(a0);
+    tcg_temp_free_ptr(a1);
+    tcg_temp_free_i32(desc);
+}
+
+void tcg_gen_gvec_3_ool(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                        uint32_t bofs, uint32_t oprsz, uint32_t maxsz,
+                        int32_t data, gen_helper_gvec_3 *fn)
+{
+    TCGv_ptr a0 = tcg_temp_new_ptr();
+    TCGv_ptr a1 = tcg_temp_new_ptr();
+    TCGv_ptr a2 = tcg_temp_new_ptr();
+    TCGv_i32 desc = tcg_const_i32(simd_desc(oprsz, maxsz, data));
+
+    tcg_gen_addi_ptr(a0, env, dofs);
+    tcg_gen_addi_ptr(a1, env, aofs);
+    tcg_gen_addi_ptr(a2, env, bofs);
+
+    fn(a0, a1, a2, desc);
+
+    tcg_temp_free_ptr(a0);
+    tcg_temp_free_ptr(a1);
+    tcg_temp_free_ptr(a2);
+    tcg_temp_free_i32(desc);
+}
+
+static uint32_t vec_type_size(TCGType type)
+{
+    return 8 << (type - TCG_TYPE_V64);
+}
+
+/* Select the host vector type with which to expand OPRSZ bytes of OP,
+   or return 0 (which is not a vector type) to use the integer
+   expansions.  With PREFER_I64, a 64-bit host uses its integer
+   registers rather than 64-bit vectors, which buy nothing there.  */
+static TCGType choose_vector_type(TCGOpcode op, unsigned vece,
+                                  uint32_t oprsz, bool prefer_i64)
+{
+    if (TCG_TARGET_HAS_v256 && check_size_impl(oprsz, 32)
+        && (!op || tcg_can_emit_vec_op(op, TCG_TYPE_V256, vece))) {
+        return TCG_TYPE_V256;
+    }
+    if (TCG_TARGET_HAS_v128 && check_size_impl(oprsz, 16)
+        && (!op || tcg_can_emit_vec_op(op, TCG_TYPE_V128, vece))) {
+        return TCG_TYPE_V128;
+    }
+    if (TCG_TARGET_HAS_v64 && !(prefer_i64 && TCG_TARGET_REG_BITS == 64)
+        && check_size_impl(oprsz, 8)
+        && (!op || tcg_can_emit_vec_op(op, TCG_TYPE_V64, vece))) {
+        return TCG_TYPE_V64;
+    }
+    return 0;
+}
+
+/* Clear MAXSZ bytes at DOFS.  */
+static void expand_clr(TCGv_ptr env, uint32_t dofs, uint32_t maxsz)
+{
+    tcg_gen_gvec_dupi(env, MO_64, dofs, maxsz, maxsz, 0);
+}
+
+/* Expand OPSZ bytes worth of two-operand operations using i32 elements.  */
+static void expand_2_i32(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                         uint32_t oprsz, void (*fni)(TCGv_i32, TCGv_i32))
+{
+    TCGv_i32 t0 = tcg_temp_new_i32();
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 4) {
+        tcg_gen_ld_i32(t0, env, aofs + i);
+        fni(t0, t0);
+        tcg_gen_st_i32(t0, env, dofs + i);
+    }
+    tcg_temp_free_i32(t0);
+}
+
+static void expand_2i_i32(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                          uint32_t oprsz, unsigned c,
+                          void (*fni)(TCGv_i32, TCGv_i32, unsigned))
+{
+    TCGv_i32 t0 = tcg_temp_new_i32();
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 4) {
+        tcg_gen_ld_i32(t0, env, aofs + i);
+        fni(t0, t0, c);
+        tcg_gen_st_i32(t0, env, dofs + i);
+    }
+    tcg_temp_free_i32(t0);
+}
+
+static void expand_3_i32(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                         uint32_t bofs, uint32_t oprsz,
+                         void (*fni)(TCGv_i32, TCGv_i32, TCGv_i32))
+{
+    TCGv_i32 t0 = tcg_temp_new_i32();
+    TCGv_i32 t1 = tcg_temp_new_i32();
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 4) {
+        tcg_gen_ld_i32(t0, env, aofs + i);
+        tcg_gen_ld_i32(t1, env, bofs + i);
+        fni(t0, t0, t1);
+        tcg_gen_st_i32(t0, env, dofs + i);
+    }
+    tcg_temp_free_i32(t1);
+    tcg_temp_free_i32(t0);
+}
+
+/* Expand OPSZ bytes worth of two-operand operations using i64 elements.  */
+static void expand_2_i64(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                         uint32_t oprsz, void (*fni)(TCGv_i64, TCGv_i64))
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, env, aofs + i);
+        fni(t0, t0);
+        tcg_gen_st_i64(t0, env, dofs + i);
+    }
+    tcg_temp_free_i64(t0);
+}
+
+static void expand_2i_i64(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                          uint32_t oprsz, unsigned c,
+                          void (*fni)(TCGv_i64, TCGv_i64, unsigned))
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, env, aofs + i);
+        fni(t0, t0, c);
+        tcg_gen_st_i64(t0, env, dofs + i);
+    }
+    tcg_temp_free_i64(t0);
+}
+
+static void expand_3_i64(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                         uint32_t bofs, uint32_t oprsz,
+                         void (*fni)(TCGv_i64, TCGv_i64, TCGv_i64))
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, env, aofs + i);
+        tcg_gen_ld_i64(t1, env, bofs + i);
+        fni(t0, t0, t1);
+        tcg_gen_st_i64(t0, env, dofs + i);
+    }
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t0);
+}
+
+/* Expand OPSZ bytes worth of two-operand operations using host vectors.  */
+static void expand_2_vec(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                         uint32_t aofs, uint32_t oprsz, TCGType type,
+                         void (*fni)(unsigned, TCGv_vec, TCGv_vec))
+{
+    TCGv_vec t0 = tcg_temp_new_vec(type);
+    uint32_t tysz = vec_type_size(type);
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += tysz) {
+        tcg_gen_ld_vec(t0, env, aofs + i);
+        fni(vece, t0, t0);
+        tcg_gen_st_vec(t0, env, dofs + i);
+    }
+    tcg_temp_free_vec(t0);
+}
+
+static void expand_2i_vec(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                          uint32_t aofs, uint32_t oprsz, TCGType type,
+                          int64_t c,
+                          void (*fni)(unsigned, TCGv_vec, TCGv_vec, int64_t))
+{
+    TCGv_vec t0 = tcg_temp_new_vec(type);
+    uint32_t tysz = vec_type_size(type);
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += tysz) {
+        tcg_gen_ld_vec(t0, env, aofs + i);
+        fni(vece, t0, t0, c);
+        tcg_gen_st_vec(t0, env, dofs + i);
+    }
+    tcg_temp_free_vec(t0);
+}
+
+static void expand_3_vec(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                         uint32_t aofs, uint32_t bofs, uint32_t oprsz,
+                         TCGType type,
+                         void (*fni)(unsigned, TCGv_vec, TCGv_vec, TCGv_vec))
+{
+    TCGv_vec t0 = tcg_temp_new_vec(type);
+    TCGv_vec t1 = tcg_temp_new_vec(type);
+    uint32_t tysz = vec_type_size(type);
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += tysz) {
+        tcg_gen_ld_vec(t0, env, aofs + i);
+        tcg_gen_ld_vec(t1, env, bofs + i);
+        fni(vece, t0, t0, t1);
+        tcg_gen_st_vec(t0, env, dofs + i);
+    }
+    tcg_temp_free_vec(t1);
+    tcg_temp_free_vec(t0);
+}
+
+/* Expand a vector two-operand operation.  */
+void tcg_gen_gvec_2(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                    uint32_t oprsz, uint32_t maxsz, const GVecGen2 *g)
+{
+    TCGType type = 0;
+
+    check_size_align(oprsz, maxsz, dofs | aofs);
+    check_overlap_2(dofs, aofs, maxsz);
+
+    if (g->fniv) {
+        type = choose_vector_type(g->opc, g->vece, oprsz, g->prefer_i64);
+    }
+    if (type) {
+        expand_2_vec(env, g->vece, dofs, aofs, oprsz, type, g->fniv);
+    } else if (g->fni8 && check_size_impl(oprsz, 8)) {
+        expand_2_i64(env, dofs, aofs, oprsz, g->fni8);
+    } else if (g->fni4 && check_size_impl(oprsz, 4)) {
+        expand_2_i32(env, dofs, aofs, oprsz, g->fni4);
+    } else {
+        assert(g->fno != NULL);
+        tcg_gen_gvec_2_ool(env, dofs, aofs, oprsz, maxsz, 0, g->fno);
+        return;
+    }
+
+    if (oprsz < maxsz) {
+        expand_clr(env, dofs + oprsz, maxsz - oprsz);
+    }
+}
+
+/* Expand a vector operation with an immediate operand, such as a shift
+   count, which is passed to the out-of-line helper as descriptor data.  */
+void tcg_gen_gvec_2i(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                     uint32_t oprsz, uint32_t maxsz, unsigned c,
+                     const GVecGen2i *g)
+{
+    TCGType type = 0;
+
+    check_size_align(oprsz, maxsz, dofs | aofs);
+    check_overlap_2(dofs, aofs, maxsz);
+
+    if (g->fniv) {
+        type = choose_vector_type(g->opc, g->vece, oprsz, g->prefer_i64);
+    }
+    if (type) {
+        expand_2i_vec(env, g->vece, dofs, aofs, oprsz, type, c, g->fniv);
+    } else if (g->fni8 && check_size_impl(oprsz, 8)) {
+        expand_2i_i64(env, dofs, aofs, oprsz, c, g->fni8);
+    } else if (g->fni4 && check_size_impl(oprsz, 4)) {
+        expand_2i_i32(env, dofs, aofs, oprsz, c, g->fni4);
+    } else {
+        assert(g->fno != NULL);
+        tcg_gen_gvec_2_ool(env, dofs, aofs, oprsz, maxsz, c, g->fno);
+        return;
+    }
+
+    if (oprsz < maxsz) {
+        expand_clr(env, dofs + oprsz, maxsz - oprsz);
+    }
+}
+
+/* Expand a vector three-operand operation.  */
+void tcg_gen_gvec_3(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                    uint32_t bofs, uint32_t oprsz, uint32_t maxsz,
+                    const GVecGen3 *g)
+{
+    TCGType type = 0;
+
+    check_size_align(oprsz, maxsz, dofs | aofs | bofs);
+    check_overlap_3(dofs, aofs, bofs, maxsz);
+
+    if (g->fniv) {
+        type = choose_vector_type(g->opc, g->vece, oprsz, g->prefer_i64);
+    }
+    if (type) {
+        expand_3_vec(env, g->vece, dofs, aofs, bofs, oprsz, type, g->fniv);
+    } else if (g->fni8 && check_size_impl(oprsz, 8)) {
+        expand_3_i64(env, dofs, aofs, bofs, oprsz, g->fni8);
+    } else if (g->fni4 && check_size_impl(oprsz, 4)) {
+        expand_3_i32(env, dofs, aofs, bofs, oprsz, g->fni4);
+    } else {
+        assert(g->fno != NULL);
+        tcg_gen_gvec_3_ool(env, dofs, aofs, bofs, oprsz, maxsz, 0, g->fno);
+        return;
+    }
+
+    if (oprsz < maxsz) {
+        expand_clr(env, dofs + oprsz, maxsz - oprsz);
+    }
+}
+
+/*
+ * Expand specific vector operations.
+ */
+
+static void vec_mov2(unsigned vece, TCGv_vec a, TCGv_vec b)
+{
+    tcg_gen_mov_vec(a, b);
+}
+
+void tcg_gen_gvec_mov(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2 g = {
+        .fni8 = tcg_gen_mov_i64,
+        .fniv = vec_mov2,
+        .fno = gen_helper_gvec_mov,
+        .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+    };
+
+    if (dofs != aofs) {
+        tcg_gen_gvec_2(env, dofs, aofs, oprsz, maxsz, &g);
+    } else {
+        check_size_align(oprsz, maxsz, dofs);
+        if (oprsz < maxsz) {
+            expand_clr(env, dofs + oprsz, maxsz - oprsz);
+        }
+    }
+}
+
+void tcg_gen_gvec_not(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2 g = {
+        .fni8 = tcg_gen_not_i64,
+        .fniv = tcg_gen_not_vec,
+        .fno = gen_helper_gvec_not,
+        .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+    };
+    tcg_gen_gvec_2(env, dofs, aofs, oprsz, maxsz, &g);
+}
+
+/* Perform a vector addition using normal addition and a mask.  The mask
+   should be the sign bit of each lane.  This 6-operation form is more
+   efficient than separate additions when there are 4 or more lanes in
+   the 64-bit operation.  */
+static void gen_addv_mask(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, TCGv_i64 m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_andc_i64(t1, a, m);
+    tcg_gen_andc_i64(t2, b, m);
+    tcg_gen_xor_i64(t3, a, b);
+    tcg_gen_add_i64(d, t1, t2);
+    tcg_gen_and_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+/* Likewise for subtraction: setting the sign bit of each lane of A and
+   clearing it in B keeps borrows from crossing lanes.  */
+static void gen_subv_mask(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, TCGv_i64 m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_or_i64(t1, a, m);
+    tcg_gen_andc_i64(t2, b, m);
+    tcg_gen_eqv_i64(t3, a, b);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_and_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+void tcg_gen_vec_add8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(dup_const(MO_8, 0x80));
+    gen_addv_mask(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+void tcg_gen_vec_add16_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(dup_const(MO_16, 0x8000));
+    gen_addv_mask(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+void tcg_gen_vec_sub8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(dup_const(MO_8, 0x80));
+    gen_subv_mask(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+void tcg_gen_vec_sub16_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(dup_const(MO_16, 0x8000));
+    gen_subv_mask(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+void tcg_gen_vec_neg8_i64(TCGv_i64 d, TCGv_i64 a)
+{
+    TCGv_i64 z = tcg_const_i64(0);
+    tcg_gen_vec_sub8_i64(d, z, a);
+    tcg_temp_free_i64(z);
+}
+
+void tcg_gen_vec_neg16_i64(TCGv_i64 d, TCGv_i64 a)
+{
+    TCGv_i64 z = tcg_const_i64(0);
+    tcg_gen_vec_sub16_i64(d, z, a);
+    tcg_temp_free_i64(z);
+}
+
+void tcg_gen_gvec_add(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g[4] = {
+        { .fni8 = tcg_gen_vec_add8_i64,
+          .fniv = tcg_gen_add_vec,
+          .fno = gen_helper_gvec_add8,
+          .opc = INDEX_op_add_vec,
+          .vece = MO_8 },
+        { .fni8 = tcg_gen_vec_add16_i64,
+          .fniv = tcg_gen_add_vec,
+          .fno = gen_helper_gvec_add16,
+          .opc = INDEX_op_add_vec,
+          .vece = MO_16 },
+        { .fni4 = tcg_gen_add_i32,
+          .fniv = tcg_gen_add_vec,
+          .fno = gen_helper_gvec_add32,
+          .opc = INDEX_op_add_vec,
+          .vece = MO_32 },
+        { .fni8 = tcg_gen_add_i64,
+          .fniv = tcg_gen_add_vec,
+          .fno = gen_helper_gvec_add64,
+          .opc = INDEX_op_add_vec,
+          .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+          .vece = MO_64 },
+    };
+
+    assert(vece <= MO_64);
+    tcg_gen_gvec_3(env, dofs, aofs, bofs, oprsz, maxsz, &g[vece]);
+}
+
+void tcg_gen_gvec_sub(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g[4] = {
+        { .fni8 = tcg_gen_vec_sub8_i64,
+          .fniv = tcg_gen_sub_vec,
+          .fno = gen_helper_gvec_sub8,
+          .opc = INDEX_op_sub_vec,
+          .vece = MO_8 },
+        { .fni8 = tcg_gen_vec_sub16_i64,
+          .fniv = tcg_gen_sub_vec,
+          .fno = gen_helper_gvec_sub16,
+          .opc = INDEX_op_sub_vec,
+          .vece = MO_16 },
+        { .fni4 = tcg_gen_sub_i32,
+          .fniv = tcg_gen_sub_vec,
+          .fno = gen_helper_gvec_sub32,
+          .opc = INDEX_op_sub_vec,
+          .vece = MO_32 },
+        { .fni8 = tcg_gen_sub_i64,
+          .fniv = tcg_gen_sub_vec,
+          .fno = gen_helper_gvec_sub64,
+          .opc = INDEX_op_sub_vec,
+          .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+          .vece = MO_64 },
+    };
+
+    assert(vece <= MO_64);
+    tcg_gen_gvec_3(env, dofs, aofs, bofs, oprsz, maxsz, &g[vece]);
+}
+
+void tcg_gen_gvec_neg(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2 g[4] = {
+        { .fni8 = tcg_gen_vec_neg8_i64,
+          .fniv = tcg_gen_neg_vec,
+          .fno = gen_helper_gvec_neg8,
+          .opc = INDEX_op_sub_vec,
+          .vece = MO_8 },
+        { .fni8 = tcg_gen_vec_neg16_i64,
+          .fniv = tcg_gen_neg_vec,
+          .fno = gen_helper_gvec_neg16,
+          .opc = INDEX_op_sub_vec,
+          .vece = MO_16 },
+        { .fni4 = tcg_gen_neg_i32,
+          .fniv = tcg_gen_neg_vec,
+          .fno = gen_helper_gvec_neg32,
+          .opc = INDEX_op_sub_vec,
+          .vece = MO_32 },
+        { .fni8 = tcg_gen_neg_i64,
+          .fniv = tcg_gen_neg_vec,
+          .fno = gen_helper_gvec_neg64,
+          .opc = INDEX_op_sub_vec,
+          .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+          .vece = MO_64 },
+    };
+
+    assert(vece <= MO_64);
+    tcg_gen_gvec_2(env, dofs, aofs, oprsz, maxsz, &g[vece]);
+}
+
+void tcg_gen_gvec_and(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = tcg_gen_and_i64,
+        .fniv = tcg_gen_and_vec,
+        .fno = gen_helper_gvec_and,
+        .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+    };
+    tcg_gen_gvec_3(env, dofs, aofs, bofs, oprsz, maxsz, &g);
+}
+
+void tcg_gen_gvec_or(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                     uint32_t aofs, uint32_t bofs,
+                     uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = tcg_gen_or_i64,
+        .fniv = tcg_gen_or_vec,
+        .fno = gen_helper_gvec_or,
+        .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+    };
+    tcg_gen_gvec_3(env, dofs, aofs, bofs, oprsz, maxsz, &g);
+}
+
+void tcg_gen_gvec_xor(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = tcg_gen_xor_i64,
+        .fniv = tcg_gen_xor_vec,
+        .fno = gen_helper_gvec_xor,
+        .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+    };
+    tcg_gen_gvec_3(env, dofs, aofs, bofs, oprsz, maxsz, &g);
+}
+
+void tcg_gen_gvec_andc(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                       uint32_t aofs, uint32_t bofs,
+                       uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = tcg_gen_andc_i64,
+        .fniv = tcg_gen_andc_vec,
+        .fno = gen_helper_gvec_andc,
+        .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+    };
+    tcg_gen_gvec_3(env, dofs, aofs, bofs, oprsz, maxsz, &g);
+}
+
+void tcg_gen_gvec_orc(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = tcg_gen_orc_i64,
+        .fniv = tcg_gen_orc_vec,
+        .fno = gen_helper_gvec_orc,
+        .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+    };
+    tcg_gen_gvec_3(env, dofs, aofs, bofs, oprsz, maxsz, &g);
+}
+
+void tcg_gen_vec_shl8i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c)
+{
+    uint64_t mask = dup_const(MO_8, 0xff << c);
+    tcg_gen_shli_i64(d, a, c);
+    tcg_gen_andi_i64(d, d, mask);
+}
+
+void tcg_gen_vec_shl16i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c)
+{
+    uint64_t mask = dup_const(MO_16, 0xffff << c);
+    tcg_gen_shli_i64(d, a, c);
+    tcg_gen_andi_i64(d, d, mask);
+}
+
+void tcg_gen_vec_shr8i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c)
+{
+    uint64_t mask = dup_const(MO_8, 0xff >> c);
+    tcg_gen_shri_i64(d, a, c);
+    tcg_gen_andi_i64(d, d, mask);
+}
+
+void tcg_gen_vec_shr16i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c)
+{
+    uint64_t mask = dup_const(MO_16, 0xffff >> c);
+    tcg_gen_shri_i64(d, a, c);
+    tcg_gen_andi_i64(d, d, mask);
+}
+
+/* Shift right, isolate each lane's sign bit and multiply it back up
+   into the C bits vacated above it; the product cannot carry into the
+   next lane.  */
+void tcg_gen_vec_sar8i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c)
+{
+    uint64_t s_mask = dup_const(MO_8, 0x80 >> c);
+    uint64_t c_mask = dup_const(MO_8, 0xff >> c);
+    TCGv_i64 s = tcg_temp_new_i64();
+
+    tcg_gen_shri_i64(d, a, c);
+    tcg_gen_andi_i64(s, d, s_mask);
+    tcg_gen_muli_i64(s, s, (2 << c) - 2);
+    tcg_gen_andi_i64(d, d, c_mask);
+    tcg_gen_or_i64(d, d, s);
+    tcg_temp_free_i64(s);
+}
+
+void tcg_gen_vec_sar16i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c)
+{
+    uint64_t s_mask = dup_const(MO_16, 0x8000 >> c);
+    uint64_t c_mask = dup_const(MO_16, 0xffff >> c);
+    TCGv_i64 s = tcg_temp_new_i64();
+
+    tcg_gen_shri_i64(d, a, c);
+    tcg_gen_andi_i64(s, d, s_mask);
+    tcg_gen_muli_i64(s, s, (2 << c) - 2);
+    tcg_gen_andi_i64(d, d, c_mask);
+    tcg_gen_or_i64(d, d, s);
+    tcg_temp_free_i64(s);
+}
+
+void tcg_gen_gvec_shli(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                       uint32_t aofs, unsigned shift,
+                       uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2i g[4] = {
+        { .fni8 = tcg_gen_vec_shl8i_i64,
+          .fniv = tcg_gen_shli_vec,
+          .fno = gen_helper_gvec_shl8i,
+          .opc = INDEX_op_shli_vec,
+          .vece = MO_8 },
+        { .fni8 = tcg_gen_vec_shl16i_i64,
+          .fniv = tcg_gen_shli_vec,
+          .fno = gen_helper_gvec_shl16i,
+          .opc = INDEX_op_shli_vec,
+          .vece = MO_16 },
+        { .fni4 = tcg_gen_shli_i32,
+          .fniv = tcg_gen_shli_vec,
+          .fno = gen_helper_gvec_shl32i,
+          .opc = INDEX_op_shli_vec,
+          .vece = MO_32 },
+        { .fni8 = tcg_gen_shli_i64,
+          .fniv = tcg_gen_shli_vec,
+          .fno = gen_helper_gvec_shl64i,
+          .opc = INDEX_op_shli_vec,
+          .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+          .vece = MO_64 },
+    };
+
+    assert(vece <= MO_64);
+    assert(shift < (8 << vece));
+    if (shift == 0) {
+        tcg_gen_gvec_mov(env, vece, dofs, aofs, oprsz, maxsz);
+    } else {
+        tcg_gen_gvec_2i(env, dofs, aofs, oprsz, maxsz, shift, &g[vece]);
+    }
+}
+
+void tcg_gen_gvec_shri(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                       uint32_t aofs, unsigned shift,
+                       uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2i g[4] = {
+        { .fni8 = tcg_gen_vec_shr8i_i64,
+          .fniv = tcg_gen_shri_vec,
+          .fno = gen_helper_gvec_shr8i,
+          .opc = INDEX_op_shri_vec,
+          .vece = MO_8 },
+        { .fni8 = tcg_gen_vec_shr16i_i64,
+          .fniv = tcg_gen_shri_vec,
+          .fno = gen_helper_gvec_shr16i,
+          .opc = INDEX_op_shri_vec,
+          .vece = MO_16 },
+        { .fni4 = tcg_gen_shri_i32,
+          .fniv = tcg_gen_shri_vec,
+          .fno = gen_helper_gvec_shr32i,
+          .opc = INDEX_op_shri_vec,
+          .vece = MO_32 },
+        { .fni8 = tcg_gen_shri_i64,
+          .fniv = tcg_gen_shri_vec,
+          .fno = gen_helper_gvec_shr64i,
+          .opc = INDEX_op_shri_vec,
+          .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+          .vece = MO_64 },
+    };
+
+    assert(vece <= MO_64);
+    assert(shift < (8 << vece));
+    if (shift == 0) {
+        tcg_gen_gvec_mov(env, vece, dofs, aofs, oprsz, maxsz);
+    } else {
+        tcg_gen_gvec_2i(env, dofs, aofs, oprsz, maxsz, shift, &g[vece]);
+    }
+}
+
+void tcg_gen_gvec_sari(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                       uint32_t aofs, unsigned shift,
+                       uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2i g[4] = {
+        { .fni8 = tcg_gen_vec_sar8i_i64,
+          .fniv = tcg_gen_sari_vec,
+          .fno = gen_helper_gvec_sar8i,
+          .opc = INDEX_op_sari_vec,
+          .vece = MO_8 },
+        { .fni8 = tcg_gen_vec_sar16i_i64,
+          .fniv = tcg_gen_sari_vec,
+          .fno = gen_helper_gvec_sar16i,
+          .opc = INDEX_op_sari_vec,
+          .vece = MO_16 },
+        { .fni4 = tcg_gen_sari_i32,
+          .fniv = tcg_gen_sari_vec,
+          .fno = gen_helper_gvec_sar32i,
+          .opc = INDEX_op_sari_vec,
+          .vece = MO_32 },
+        { .fni8 = tcg_gen_sari_i64,
+          .fniv = tcg_gen_sari_vec,
+          .fno = gen_helper_gvec_sar64i,
+          .opc = INDEX_op_sari_vec,
+          .prefer_i64 = TCG_TARGET_REG_BITS == 64,
+          .vece = MO_64 },
+    };
+
+    assert(vece <= MO_64);
+    assert(shift < (8 << vece));
+    if (shift == 0) {
+        tcg_gen_gvec_mov(env, vece, dofs, aofs, oprsz, maxsz);
+    } else {
+        tcg_gen_gvec_2i(env, dofs, aofs, oprsz, maxsz, shift, &g[vece]);
+    }
+}
+
+void tcg_gen_gvec_cmp(TCGv_ptr env, TCGCond cond, unsigned vece,
+                      uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static gen_helper_gvec_3 * const eq_fn[4] = {
+        gen_helper_gvec_eq8, gen_helper_gvec_eq16,
+        gen_helper_gvec_eq32, gen_helper_gvec_eq64
+    };
+    static gen_helper_gvec_3 * const ne_fn[4] = {
+        gen_helper_gvec_ne8, gen_helper_gvec_ne16,
+        gen_helper_gvec_ne32, gen_helper_gvec_ne64
+    };
+    static gen_helper_gvec_3 * const lt_fn[4] = {
+        gen_helper_gvec_lt8, gen_helper_gvec_lt16,
+        gen_helper_gvec_lt32, gen_helper_gvec_lt64
+    };
+    static gen_helper_gvec_3 * const le_fn[4] = {
+        gen_helper_gvec_le8, gen_helper_gvec_le16,
+        gen_helper_gvec_le32, gen_helper_gvec_le64
+    };
+    static gen_helper_gvec_3 * const ltu_fn[4] = {
+        gen_helper_gvec_ltu8, gen_helper_gvec_ltu16,
+        gen_helper_gvec_ltu32, gen_helper_gvec_ltu64
+    };
+    static gen_helper_gvec_3 * const leu_fn[4] = {
+        gen_helper_gvec_leu8, gen_helper_gvec_leu16,
+        gen_helper_gvec_leu32, gen_helper_gvec_leu64
+    };
+    static gen_helper_gvec_3 * const * const fns[16] = {
+        [TCG_COND_EQ] = eq_fn,
+        [TCG_COND_NE] = ne_fn,
+        [TCG_COND_LT] = lt_fn,
+        [TCG_COND_LE] = le_fn,
+        [TCG_COND_LTU] = ltu_fn,
+        [TCG_COND_LEU] = leu_fn,
+    };
+    TCGType type;
+    uint32_t i;
+
+    check_size_align(oprsz, maxsz, dofs | aofs | bofs);
+    check_overlap_3(dofs, aofs, bofs, maxsz);
+    assert(vece <= MO_64);
+
+    if (cond == TCG_COND_NEVER || cond == TCG_COND_ALWAYS) {
+        tcg_gen_gvec_dupi(env, MO_64, dofs, maxsz, maxsz,
+                          -(cond == TCG_COND_ALWAYS));
+        return;
+    }
+
+    type = choose_vector_type(INDEX_op_cmp_vec, vece, oprsz, vece == MO_64);
+    if (type) {
+        TCGv_vec t0 = tcg_temp_new_vec(type);
+        TCGv_vec t1 = tcg_temp_new_vec(type);
+        uint32_t tysz = vec_type_size(type);
+
+        for (i = 0; i < oprsz; i += tysz) {
+            tcg_gen_ld_vec(t0, env, aofs + i);
+            tcg_gen_ld_vec(t1, env, bofs + i);
+            tcg_gen_cmp_vec(cond, vece, t0, t0, t1);
+            tcg_gen_st_vec(t0, env, dofs + i);
+        }
+        tcg_temp_free_vec(t1);
+        tcg_temp_free_vec(t0);
+    } else if (vece == MO_64 && check_size_impl(oprsz, 8)) {
+        TCGv_i64 t0 = tcg_temp_new_i64();
+        TCGv_i64 t1 = tcg_temp_new_i64();
+
+        for (i = 0; i < oprsz; i += 8) {
+            tcg_gen_ld_i64(t0, env, aofs + i);
+            tcg_gen_ld_i64(t1, env, bofs + i);
+            tcg_gen_setcond_i64(cond, t0, t0, t1);
+            tcg_gen_neg_i64(t0, t0);
+            tcg_gen_st_i64(t0, env, dofs + i);
+        }
+        tcg_temp_free_i64(t1);
+        tcg_temp_free_i64(t0);
+    } else if (vece == MO_32 && check_size_impl(oprsz, 4)) {
+        TCGv_i32 t0 = tcg_temp_new_i32();
+        TCGv_i32 t1 = tcg_temp_new_i32();
+
+        for (i = 0; i < oprsz; i += 4) {
+            tcg_gen_ld_i32(t0, env, aofs + i);
+            tcg_gen_ld_i32(t1, env, bofs + i);
+            tcg_gen_setcond_i32(cond, t0, t0, t1);
+            tcg_gen_neg_i32(t0, t0);
+            tcg_gen_st_i32(t0, env, dofs + i);
+        }
+        tcg_temp_free_i32(t1);
+        tcg_temp_free_i32(t0);
+    } else {
+        gen_helper_gvec_3 * const *fn = fns[cond];
+
+        if (fn == NULL) {
+            uint32_t tmp = aofs;
+            aofs = bofs;
+            bofs = tmp;
+            cond = tcg_swap_cond(cond);
+            fn = fns[cond];
+            assert(fn != NULL);
+        }
+        tcg_gen_gvec_3_ool(env, dofs, aofs, bofs, oprsz, maxsz, 0, fn[vece]);
+        return;
+    }
+
+    if (oprsz < maxsz) {
+        expand_clr(env, dofs + oprsz, maxsz - oprsz);
+    }
+}
+
+/* Replicate the low VECE-sized element of IN across all of T.  */
+static void gen_dup_i64(unsigned vece, TCGv_i64 t, TCGv_i64 in)
+{
+    switch (vece) {
+    case MO_8:
+        tcg_gen_ext8u_i64(t, in);
+        tcg_gen_muli_i64(t, t, 0x0101010101010101ull);
+        break;
+    case MO_16:
+        tcg_gen_ext16u_i64(t, in);
+        tcg_gen_muli_i64(t, t, 0x0001000100010001ull);
+        break;
+    case MO_32:
+        tcg_gen_deposit_i64(t, in, in, 32, 32);
+        break;
+    default:
+        tcg_gen_mov_i64(t, in);
+        break;
+    }
+}
+
+void tcg_gen_gvec_dup_i64(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                          uint32_t oprsz, uint32_t maxsz, TCGv_i64 in)
+{
+    TCGType type = 0;
+    uint32_t i;
+
+    check_size_align(oprsz, maxsz, dofs);
+    assert(vece <= MO_64);
+
+    /* The vector dup takes its input from a single host register.  */
+    if (TCG_TARGET_REG_BITS == 64) {
+        type = choose_vector_type(INDEX_op_dup_vec, vece, oprsz, true);
+    }
+    if (type) {
+        TCGv_vec t_vec = tcg_temp_new_vec(type);
+        uint32_t tysz = vec_type_size(type);
+
+        tcg_gen_dup_i64_vec(vece, t_vec, in);
+        for (i = 0; i < oprsz; i += tysz) {
+            tcg_gen_st_vec(t_vec, env, dofs + i);
+        }
+        tcg_temp_free_vec(t_vec);
+    } else {
+        TCGv_i64 t_64 = tcg_temp_new_i64();
+
+        gen_dup_i64(vece, t_64, in);
+        if (check_size_impl(oprsz, 8)) {
+            for (i = 0; i < oprsz; i += 8) {
+                tcg_gen_st_i64(t_64, env, dofs + i);
+            }
+        } else {
+            TCGv_ptr t_ptr = tcg_temp_new_ptr();
+            TCGv_i32 desc = tcg_const_i32(simd_desc(oprsz, maxsz, 0));
+
+            tcg_gen_addi_ptr(t_ptr, env, dofs);
+            gen_helper_gvec_dup64(t_ptr, desc, t_64);
+            tcg_temp_free_ptr(t_ptr);
+            tcg_temp_free_i32(desc);
+            tcg_temp_free_i64(t_64);
+            return;
+        }
+        tcg_temp_free_i64(t_64);
+    }
+
+    if (oprsz < maxsz) {
+        expand_clr(env, dofs + oprsz, maxsz - oprsz);
+    }
+}
+
+void tcg_gen_gvec_dup_i32(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                          uint32_t oprsz, uint32_t maxsz, TCGv_i32 in)
+{
+    TCGv_i64 t = tcg_temp_new_i64();
+
+    assert(vece <= MO_32);
+    tcg_gen_extu_i32_i64(t, in);
+    tcg_gen_gvec_dup_i64(env, vece, dofs, oprsz, maxsz, t);
+    tcg_temp_free_i64(t);
+}
+
+void tcg_gen_gvec_dupi(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                       uint32_t oprsz, uint32_t maxsz, uint64_t c)
+{
+    TCGv_i64 t = tcg_const_i64(dup_const(vece, c));
+
+    tcg_gen_gvec_dup_i64(env, MO_64, dofs, oprsz, maxsz, t);
+    tcg_temp_free_i64(t);
+}
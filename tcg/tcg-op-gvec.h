@@ -0,0 +1,168 @@
+/*
+ * TCG generic vector operation expansion
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TCG_TCG_OP_GVEC_H
+#define TCG_TCG_OP_GVEC_H
+
+/*
+ * "Generic" vectors.  All operands are given as offsets from ENV,
+ * and the vectors live in memory: OPRSZ is the number of bytes the
+ * operation affects and MAXSZ the size of the guest register, the bytes
+ * in between being cleared.  Both are multiples of 8 and at most 256,
+ * with OPRSZ <= MAXSZ.
+ *
+ * The expansion uses host vector operations when they are available,
+ * otherwise unrolled integer operations for small sizes, and an
+ * out-of-line helper from tcg-runtime-gvec.c as the last resort.
+ */
+
+typedef void gen_helper_gvec_2(TCGv_ptr, TCGv_ptr, TCGv_i32);
+typedef void gen_helper_gvec_3(TCGv_ptr, TCGv_ptr, TCGv_ptr, TCGv_i32);
+
+/* Expand a call to an out-of-line helper, passing it the descriptor
+   built from OPRSZ, MAXSZ and DATA (see tcg-gvec-desc.h).  */
+void tcg_gen_gvec_2_ool(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                        uint32_t oprsz, uint32_t maxsz, int32_t data,
+                        gen_helper_gvec_2 *fn);
+void tcg_gen_gvec_3_ool(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                        uint32_t bofs, uint32_t oprsz, uint32_t maxsz,
+                        int32_t data, gen_helper_gvec_3 *fn);
+
+/* Descriptions of an operation, one expander per implementation.
+   Any of FNI8, FNI4 and FNIV may be NULL, FNO may not.  */
+typedef struct {
+    /* Expand inline as a 64-bit or 32-bit integer operation.  */
+    void (*fni8)(TCGv_i64, TCGv_i64);
+    void (*fni4)(TCGv_i32, TCGv_i32);
+    /* Expand inline with a host vector type.  */
+    void (*fniv)(unsigned, TCGv_vec, TCGv_vec);
+    /* Expand out-of-line helper w/descriptor.  */
+    gen_helper_gvec_2 *fno;
+    /* The opcode, if any, that FNIV requires from the host.  */
+    TCGOpcode opc;
+    /* The vector element size, if applicable.  */
+    uint8_t vece;
+    /* Prefer i64 to v64.  */
+    bool prefer_i64;
+} GVecGen2;
+
+typedef struct {
+    void (*fni8)(TCGv_i64, TCGv_i64, unsigned);
+    void (*fni4)(TCGv_i32, TCGv_i32, unsigned);
+    void (*fniv)(unsigned, TCGv_vec, TCGv_vec, int64_t);
+    gen_helper_gvec_2 *fno;
+    TCGOpcode opc;
+    uint8_t vece;
+    bool prefer_i64;
+} GVecGen2i;
+
+typedef struct {
+    void (*fni8)(TCGv_i64, TCGv_i64, TCGv_i64);
+    void (*fni4)(TCGv_i32, TCGv_i32, TCGv_i32);
+    void (*fniv)(unsigned, TCGv_vec, TCGv_vec, TCGv_vec);
+    gen_helper_gvec_3 *fno;
+    TCGOpcode opc;
+    uint8_t vece;
+    bool prefer_i64;
+} GVecGen3;
+
+void tcg_gen_gvec_2(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                    uint32_t oprsz, uint32_t maxsz, const GVecGen2 *g);
+void tcg_gen_gvec_2i(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                     uint32_t oprsz, uint32_t maxsz, unsigned c,
+                     const GVecGen2i *g);
+void tcg_gen_gvec_3(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                    uint32_t bofs, uint32_t oprsz, uint32_t maxsz,
+                    const GVecGen3 *g);
+
+/* Expand a specific vector operation.  */
+
+void tcg_gen_gvec_mov(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_not(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_neg(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz, uint32_t maxsz);
+
+void tcg_gen_gvec_add(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_sub(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+
+void tcg_gen_gvec_and(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_or(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                     uint32_t aofs, uint32_t bofs,
+                     uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_xor(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_andc(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                       uint32_t aofs, uint32_t bofs,
+                       uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_orc(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+
+/* SHIFT must be less than the element size in bits.  */
+void tcg_gen_gvec_shli(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                       uint32_t aofs, unsigned shift,
+                       uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_shri(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                       uint32_t aofs, unsigned shift,
+                       uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_sari(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                       uint32_t aofs, unsigned shift,
+                       uint32_t oprsz, uint32_t maxsz);
+
+/* Set each element to all ones if COND holds, to zero otherwise.  */
+void tcg_gen_gvec_cmp(TCGv_ptr env, TCGCond cond, unsigned vece,
+                      uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+
+/* Replicate an element across the vector.  */
+void tcg_gen_gvec_dup_i32(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                          uint32_t oprsz, uint32_t maxsz, TCGv_i32 in);
+void tcg_gen_gvec_dup_i64(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                          uint32_t oprsz, uint32_t maxsz, TCGv_i64 in);
+void tcg_gen_gvec_dupi(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                       uint32_t oprsz, uint32_t maxsz, uint64_t c);
+
+/* 64-bit integer operations on packed elements, as used by the
+   expanders above.  */
+void tcg_gen_vec_add8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b);
+void tcg_gen_vec_add16_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b);
+void tcg_gen_vec_sub8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b);
+void tcg_gen_vec_sub16_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b);
+void tcg_gen_vec_neg8_i64(TCGv_i64 d, TCGv_i64 a);
+void tcg_gen_vec_neg16_i64(TCGv_i64 d, TCGv_i64 a);
+void tcg_gen_vec_shl8i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c);
+void tcg_gen_vec_shl16i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c);
+void tcg_gen_vec_shr8i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c);
+void tcg_gen_vec_shr16i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c);
+void tcg_gen_vec_sar8i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c);
+void tcg_gen_vec_sar16i_i64(TCGv_i64 d, TCGv_i64 a, unsigned c);
+
+#endif
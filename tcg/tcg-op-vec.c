@@ -0,0 +1,276 @@
+/*
+ * TCG host vector operation emitters
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tcg.h"
+#include "tcg-op.h"
+
+/* The vector length argument of the vector ops.  */
+static inline TCGType vec_type(TCGv_vec v)
+{
+    return tcg_ctx.temps[GET_TCGV_VEC(v)].base_type;
+}
+
+static inline TCGArg vec_vecl(TCGType type)
+{
+    return type - TCG_TYPE_V64;
+}
+
+static void vec_gen_2(TCGOpcode opc, TCGType type, unsigned vece,
+                      TCGArg r, TCGArg a)
+{
+    tcg_gen_op4(&tcg_ctx, opc, r, a, vec_vecl(type), vece);
+}
+
+static void vec_gen_3(TCGOpcode opc, TCGType type, unsigned vece,
+                      TCGArg r, TCGArg a, TCGArg b)
+{
+    tcg_gen_op5(&tcg_ctx, opc, r, a, b, vec_vecl(type), vece);
+}
+
+static void vec_gen_4(TCGOpcode opc, TCGType type, unsigned vece,
+                      TCGArg r, TCGArg a, TCGArg b, TCGArg c)
+{
+    tcg_gen_op6(&tcg_ctx, opc, r, a, b, c, vec_vecl(type), vece);
+}
+
+static void vec_gen_op2(TCGOpcode opc, unsigned vece,
+                        TCGv_vec r, TCGv_vec a)
+{
+    TCGType type = vec_type(r);
+
+    assert(vec_type(a) == type);
+    vec_gen_2(opc, type, vece, GET_TCGV_VEC(r), GET_TCGV_VEC(a));
+}
+
+static void vec_gen_op3(TCGOpcode opc, unsigned vece,
+                        TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    TCGType type = vec_type(r);
+
+    assert(vec_type(a) == type);
+    assert(vec_type(b) == type);
+    vec_gen_3(opc, type, vece, GET_TCGV_VEC(r),
+              GET_TCGV_VEC(a), GET_TCGV_VEC(b));
+}
+
+void tcg_gen_mov_vec(TCGv_vec r, TCGv_vec a)
+{
+    if (!TCGV_EQUAL_VEC(r, a)) {
+        assert(vec_type(a) == vec_type(r));
+        tcg_gen_op2(&tcg_ctx, INDEX_op_mov_vec,
+                    GET_TCGV_VEC(r), GET_TCGV_VEC(a));
+    }
+}
+
+void tcg_gen_dup_i64_vec(unsigned vece, TCGv_vec r, TCGv_i64 a)
+{
+    /* The integer input must fit in a single host register.  */
+    assert(TCG_TARGET_REG_BITS == 64);
+    vec_gen_2(INDEX_op_dup_vec, vec_type(r), vece,
+              GET_TCGV_VEC(r), GET_TCGV_I64(a));
+}
+
+void tcg_gen_dup_i32_vec(unsigned vece, TCGv_vec r, TCGv_i32 a)
+{
+    assert(vece <= MO_32);
+    vec_gen_2(INDEX_op_dup_vec, vec_type(r), vece,
+              GET_TCGV_VEC(r), GET_TCGV_I32(a));
+}
+
+void tcg_gen_dupi_vec(unsigned vece, TCGv_vec r, uint64_t a)
+{
+    TCGv_i64 t = tcg_const_i64(dup_const(vece, a));
+
+    tcg_gen_dup_i64_vec(MO_64, r, t);
+    tcg_temp_free_i64(t);
+}
+
+void tcg_gen_ld_vec(TCGv_vec r, TCGv_ptr base, tcg_target_long offset)
+{
+    vec_gen_3(INDEX_op_ld_vec, vec_type(r), 0, GET_TCGV_VEC(r),
+              GET_TCGV_PTR(base), offset);
+}
+
+void tcg_gen_st_vec(TCGv_vec r, TCGv_ptr base, tcg_target_long offset)
+{
+    vec_gen_3(INDEX_op_st_vec, vec_type(r), 0, GET_TCGV_VEC(r),
+              GET_TCGV_PTR(base), offset);
+}
+
+void tcg_gen_add_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_add_vec, vece, r, a, b);
+}
+
+void tcg_gen_sub_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_sub_vec, vece, r, a, b);
+}
+
+void tcg_gen_neg_vec(unsigned vece, TCGv_vec r, TCGv_vec a)
+{
+    if (TCG_TARGET_HAS_neg_vec) {
+        vec_gen_op2(INDEX_op_neg_vec, vece, r, a);
+    } else {
+        TCGv_vec t = tcg_temp_new_vec_matching(r);
+        tcg_gen_dupi_vec(MO_64, t, 0);
+        tcg_gen_sub_vec(vece, r, t, a);
+        tcg_temp_free_vec(t);
+    }
+}
+
+void tcg_gen_and_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_and_vec, 0, r, a, b);
+}
+
+void tcg_gen_or_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_or_vec, 0, r, a, b);
+}
+
+void tcg_gen_xor_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_xor_vec, 0, r, a, b);
+}
+
+void tcg_gen_not_vec(unsigned vece, TCGv_vec r, TCGv_vec a)
+{
+    if (TCG_TARGET_HAS_not_vec) {
+        vec_gen_op2(INDEX_op_not_vec, 0, r, a);
+    } else {
+        TCGv_vec t = tcg_temp_new_vec_matching(r);
+        tcg_gen_dupi_vec(MO_64, t, -1);
+        tcg_gen_xor_vec(0, r, a, t);
+        tcg_temp_free_vec(t);
+    }
+}
+
+void tcg_gen_andc_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    if (TCG_TARGET_HAS_andc_vec) {
+        vec_gen_op3(INDEX_op_andc_vec, 0, r, a, b);
+    } else {
+        TCGv_vec t = tcg_temp_new_vec_matching(r);
+        tcg_gen_not_vec(0, t, b);
+        tcg_gen_and_vec(0, r, a, t);
+        tcg_temp_free_vec(t);
+    }
+}
+
+void tcg_gen_orc_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    if (TCG_TARGET_HAS_orc_vec) {
+        vec_gen_op3(INDEX_op_orc_vec, 0, r, a, b);
+    } else {
+        TCGv_vec t = tcg_temp_new_vec_matching(r);
+        tcg_gen_not_vec(0, t, b);
+        tcg_gen_or_vec(0, r, a, t);
+        tcg_temp_free_vec(t);
+    }
+}
+
+static void do_shifti(TCGOpcode opc, unsigned vece,
+                      TCGv_vec r, TCGv_vec a, int64_t i)
+{
+    TCGType type = vec_type(r);
+
+    assert(vec_type(a) == type);
+    assert(i >= 0 && i < (8 << vece));
+
+    if (i == 0) {
+        tcg_gen_mov_vec(r, a);
+    } else {
+        assert(tcg_can_emit_vec_op(opc, type, vece));
+        vec_gen_3(opc, type, vece, GET_TCGV_VEC(r), GET_TCGV_VEC(a), i);
+    }
+}
+
+void tcg_gen_shli_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i)
+{
+    do_shifti(INDEX_op_shli_vec, vece, r, a, i);
+}
+
+void tcg_gen_shri_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i)
+{
+    do_shifti(INDEX_op_shri_vec, vece, r, a, i);
+}
+
+void tcg_gen_sari_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i)
+{
+    do_shifti(INDEX_op_sari_vec, vece, r, a, i);
+}
+
+/* Backends only need to implement EQ, GT and LT for cmp_vec; every other
+   condition is derived from those here.  */
+void tcg_gen_cmp_vec(TCGCond cond, unsigned vece, TCGv_vec r,
+                     TCGv_vec a, TCGv_vec b)
+{
+    TCGType type = vec_type(r);
+    TCGv_vec t1 = a, t2 = b;
+    bool inv = false;
+
+    assert(vec_type(a) == type);
+    assert(vec_type(b) == type);
+
+    switch (cond) {
+    case TCG_COND_NEVER:
+    case TCG_COND_ALWAYS:
+        tcg_gen_dupi_vec(MO_64, r, cond == TCG_COND_ALWAYS ? -1 : 0);
+        return;
+    case TCG_COND_NE:
+    case TCG_COND_LE:
+    case TCG_COND_GE:
+    case TCG_COND_LEU:
+    case TCG_COND_GEU:
+        cond = tcg_invert_cond(cond);
+        inv = true;
+        break;
+    default:
+        break;
+    }
+
+    if (is_unsigned_cond(cond)) {
+        /* Flip the sign bits, so that a signed comparison gives the
+           unsigned result.  */
+        TCGv_vec s = tcg_temp_new_vec(type);
+
+        tcg_gen_dupi_vec(vece, s, 1ull << ((8 << vece) - 1));
+        t1 = tcg_temp_new_vec(type);
+        t2 = tcg_temp_new_vec(type);
+        tcg_gen_xor_vec(vece, t1, a, s);
+        tcg_gen_xor_vec(vece, t2, b, s);
+        tcg_temp_free_vec(s);
+        cond = tcg_signed_cond(cond);
+    }
+
+    vec_gen_4(INDEX_op_cmp_vec, type, vece, GET_TCGV_VEC(r),
+              GET_TCGV_VEC(t1), GET_TCGV_VEC(t2), cond);
+
+    if (!TCGV_EQUAL_VEC(t1, a)) {
+        tcg_temp_free_vec(t1);
+        tcg_temp_free_vec(t2);
+    }
+    if (inv) {
+        tcg_gen_not_vec(vece, r, r);
+    }
+}
@@ -24,6 +24,7 @@
 
 #include "tcg.h"
 #include "tcg-op.h"
+#include "qom/cpu.h"
 
 /* Reduce the number of ifdefs below.  This assumes that all uses of
    TCGV_HIGH and TCGV_LOW are properly protected by a conditional that
@@ -1832,6 +1833,29 @@ void tcg_gen_goto_tb(unsigned idx)
     tcg_gen_op1i(INDEX_op_goto_tb, idx);
 }
 
+void tcg_gen_lookup_and_goto_ptr(TCGv_ptr env)
+{
+    if (TCG_TARGET_HAS_goto_ptr) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        gen_helper_lookup_tb_ptr(ptr, env);
+        tcg_gen_op1i(INDEX_op_goto_ptr, GET_TCGV_PTR(ptr));
+        tcg_temp_free_ptr(ptr);
+    } else {
+        tcg_gen_exit_tb(0);
+    }
+}
+
+void tcg_gen_mb(void)
+{
+#ifdef CONFIG_USER_ONLY
+    gen_helper_mb();
+#else
+    if (qemu_tcg_mttcg_enabled()) {
+        gen_helper_mb();
+    }
+#endif
+}
+
 static inline TCGMemOp tcg_canonicalize_memop(TCGMemOp op, bool is64, bool st)
 {
     switch (op & MO_SIZE) {
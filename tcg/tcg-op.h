@@ -701,6 +701,39 @@ static inline void tcg_gen_trunc_i64_i32(TCGv_i32 ret, TCGv_i64 arg)
     tcg_gen_trunc_shr_i64_i32(ret, arg, 0);
 }
 
+/* Vector ops.  These are only available when the host has the vector
+   type involved, see TCG_TARGET_HAS_v64 et al; most users want the
+   tcg_gen_gvec_* expanders from tcg-op-gvec.h instead, which fall back
+   to integer code or out-of-line helpers.  VECE is the log2 of the
+   element size in bytes.  */
+
+void tcg_gen_mov_vec(TCGv_vec r, TCGv_vec a);
+void tcg_gen_dup_i32_vec(unsigned vece, TCGv_vec r, TCGv_i32 a);
+void tcg_gen_dup_i64_vec(unsigned vece, TCGv_vec r, TCGv_i64 a);
+void tcg_gen_dupi_vec(unsigned vece, TCGv_vec r, uint64_t a);
+
+void tcg_gen_ld_vec(TCGv_vec r, TCGv_ptr base, tcg_target_long offset);
+void tcg_gen_st_vec(TCGv_vec r, TCGv_ptr base, tcg_target_long offset);
+
+void tcg_gen_add_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_sub_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_neg_vec(unsigned vece, TCGv_vec r, TCGv_vec a);
+void tcg_gen_and_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_or_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_xor_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_andc_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_orc_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_not_vec(unsigned vece, TCGv_vec r, TCGv_vec a);
+
+void tcg_gen_shli_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i);
+void tcg_gen_shri_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i);
+void tcg_gen_sari_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i);
+
+/* Set each element of R to all ones if COND holds for the corresponding
+   elements of A and B, and to zero otherwise.  */
+void tcg_gen_cmp_vec(TCGCond cond, unsigned vece, TCGv_vec r,
+                     TCGv_vec a, TCGv_vec b);
+
 /* QEMU specific operations.  */
 
 #ifndef TARGET_LONG_BITS
@@ -719,6 +752,58 @@ static inline void tcg_gen_debug_insn_start(uint64_t pc)
 #endif
 }
 
+#ifdef TARGET_INSN_START_EXTRA_WORDS
+/* Mark the start of a guest insn, with the data restore_state_to_opc
+   needs to resume at it.  */
+#if TARGET_LONG_BITS <= TCG_TARGET_REG_BITS
+#if TARGET_INSN_START_WORDS == 1
+static inline void tcg_gen_insn_start(target_ulong pc)
+{
+    tcg_gen_op1(&tcg_ctx, INDEX_op_insn_start, pc);
+}
+#elif TARGET_INSN_START_WORDS == 2
+static inline void tcg_gen_insn_start(target_ulong pc, target_ulong a1)
+{
+    tcg_gen_op2(&tcg_ctx, INDEX_op_insn_start, pc, a1);
+}
+#elif TARGET_INSN_START_WORDS == 3
+static inline void tcg_gen_insn_start(target_ulong pc, target_ulong a1,
+                                      target_ulong a2)
+{
+    tcg_gen_op3(&tcg_ctx, INDEX_op_insn_start, pc, a1, a2);
+}
+#else
+#error "Unhandled number of operands to insn_start"
+#endif
+#else
+#if TARGET_INSN_START_WORDS == 1
+static inline void tcg_gen_insn_start(target_ulong pc)
+{
+    tcg_gen_op2(&tcg_ctx, INDEX_op_insn_start,
+                (uint32_t)pc, (uint32_t)(pc >> 32));
+}
+#elif TARGET_INSN_START_WORDS == 2
+static inline void tcg_gen_insn_start(target_ulong pc, target_ulong a1)
+{
+    tcg_gen_op4(&tcg_ctx, INDEX_op_insn_start,
+                (uint32_t)pc, (uint32_t)(pc >> 32),
+                (uint32_t)a1, (uint32_t)(a1 >> 32));
+}
+#elif TARGET_INSN_START_WORDS == 3
+static inline void tcg_gen_insn_start(target_ulong pc, target_ulong a1,
+                                      target_ulong a2)
+{
+    tcg_gen_op6(&tcg_ctx, INDEX_op_insn_start,
+                (uint32_t)pc, (uint32_t)(pc >> 32),
+                (uint32_t)a1, (uint32_t)(a1 >> 32),
+                (uint32_t)a2, (uint32_t)(a2 >> 32));
+}
+#else
+#error "Unhandled number of operands to insn_start"
+#endif
+#endif
+#endif /* TARGET_INSN_START_EXTRA_WORDS */
+
 static inline void tcg_gen_exit_tb(uintptr_t val)
 {
     tcg_gen_op1i(INDEX_op_exit_tb, val);
@@ -726,6 +811,28 @@ static inline void tcg_gen_exit_tb(uintptr_t val)
 
 void tcg_gen_goto_tb(unsigned idx);
 
+/**
+ * tcg_gen_lookup_and_goto_ptr() - look up the next TB, jump to it on a hit
+ * @env: the CPU state pointer
+ *
+ * Emit code that looks up the TB for the CPU state in @env, whose PC the
+ * caller has already stored, and jumps straight to it instead of returning
+ * to the main loop.  If no TB is found, the current TB exits as with
+ * tcg_gen_exit_tb(0).  Use this for indirect branches that do not change
+ * any state that the main loop must see, such as the interrupt masks.
+ */
+void tcg_gen_lookup_and_goto_ptr(TCGv_ptr env);
+
+/**
+ * tcg_gen_mb() - emit a guest full memory barrier
+ *
+ * Orders all earlier guest memory accesses against all later ones, as
+ * x86 MFENCE or ARM DMB/DSB do.  This only costs anything when guest
+ * threads really run in parallel, i.e. in user-mode emulation and with
+ * multi-threaded TCG.
+ */
+void tcg_gen_mb(void);
+
 #if TARGET_LONG_BITS == 32
 #define TCGv TCGv_i32
 #define tcg_temp_new() tcg_temp_new_i32()
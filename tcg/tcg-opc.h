@@ -167,14 +167,49 @@ DEF(muls2_i64, 2, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_muls2_i64))
 DEF(muluh_i64, 1, 2, 0, IMPL(TCG_TARGET_HAS_muluh_i64))
 DEF(mulsh_i64, 1, 2, 0, IMPL(TCG_TARGET_HAS_mulsh_i64))
 
+/* Host vector support.  Every vector op but mov_vec ends with two
+   constant arguments, the vector length (0 for 64, 1 for 128 and 2 for
+   256 bits) and the log2 of the element size in bytes.  */
+
+#define IMPLVEC  TCG_OPF_VECTOR | IMPL(TCG_TARGET_MAYBE_vec)
+
+DEF(mov_vec, 1, 1, 0, TCG_OPF_VECTOR | TCG_OPF_NOT_PRESENT)
+DEF(dup_vec, 1, 1, 2, IMPLVEC)
+
+DEF(ld_vec, 1, 1, 3, IMPLVEC)
+DEF(st_vec, 0, 2, 3, IMPLVEC)
+
+DEF(add_vec, 1, 2, 2, IMPLVEC)
+DEF(sub_vec, 1, 2, 2, IMPLVEC)
+DEF(neg_vec, 1, 1, 2, IMPLVEC | IMPL(TCG_TARGET_HAS_neg_vec))
+
+DEF(and_vec, 1, 2, 2, IMPLVEC)
+DEF(or_vec, 1, 2, 2, IMPLVEC)
+DEF(xor_vec, 1, 2, 2, IMPLVEC)
+DEF(andc_vec, 1, 2, 2, IMPLVEC | IMPL(TCG_TARGET_HAS_andc_vec))
+DEF(orc_vec, 1, 2, 2, IMPLVEC | IMPL(TCG_TARGET_HAS_orc_vec))
+DEF(not_vec, 1, 1, 2, IMPLVEC | IMPL(TCG_TARGET_HAS_not_vec))
+
+DEF(shli_vec, 1, 1, 3, IMPLVEC | IMPL(TCG_TARGET_HAS_shi_vec))
+DEF(shri_vec, 1, 1, 3, IMPLVEC | IMPL(TCG_TARGET_HAS_shi_vec))
+DEF(sari_vec, 1, 1, 3, IMPLVEC | IMPL(TCG_TARGET_HAS_shi_vec))
+
+DEF(cmp_vec, 1, 2, 3, IMPLVEC)
+
 /* QEMU specific */
 #if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
 DEF(debug_insn_start, 0, 0, 2, TCG_OPF_NOT_PRESENT)
 #else
 DEF(debug_insn_start, 0, 0, 1, TCG_OPF_NOT_PRESENT)
 #endif
+#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
+DEF(insn_start, 0, 0, 2 * TARGET_INSN_START_WORDS, TCG_OPF_NOT_PRESENT)
+#else
+DEF(insn_start, 0, 0, TARGET_INSN_START_WORDS, TCG_OPF_NOT_PRESENT)
+#endif
 DEF(exit_tb, 0, 0, 1, TCG_OPF_BB_END)
 DEF(goto_tb, 0, 0, 1, TCG_OPF_BB_END)
+DEF(goto_ptr, 0, 1, 0, TCG_OPF_BB_END | IMPL(TCG_TARGET_HAS_goto_ptr))
 
 #define TLADDR_ARGS    (TARGET_LONG_BITS <= TCG_TARGET_REG_BITS ? 1 : 2)
 #define DATA64_ARGS  (TCG_TARGET_REG_BITS == 64 ? 1 : 2)
@@ -192,4 +227,5 @@ DEF(qemu_st_i64, 0, TLADDR_ARGS + DATA64_ARGS, 2,
 #undef DATA64_ARGS
 #undef IMPL
 #undef IMPL64
+#undef IMPLVEC
 #undef DEF
@@ -120,7 +120,7 @@ TCGOpDef tcg_op_defs[] = {
 };
 const size_t tcg_op_defs_max = ARRAY_SIZE(tcg_op_defs);
 
-static TCGRegSet tcg_target_available_regs[2];
+static TCGRegSet tcg_target_available_regs[TCG_TYPE_COUNT];
 static TCGRegSet tcg_target_call_clobber_regs;
 
 #if TCG_TARGET_INSN_UNIT_SIZE == 1
@@ -261,6 +261,36 @@ int gen_new_label(void)
     return idx;
 }
 
+/* Record the host address @target, stored at @field in the form @type,
+   if the caller of tcg_gen_code asked for relocations.  */
+#ifdef TCG_TARGET_CODE_RELOC
+static void tcg_out_code_reloc(TCGContext *s, tcg_insn_unit *field,
+                               TCGCodeRelocType type, uintptr_t target)
+{
+    TCGCodeReloc *r;
+
+    if (!s->code_reloc) {
+        return;
+    }
+    if (s->nb_code_relocs == TCG_MAX_CODE_RELOCS) {
+        s->code_unrelocatable = true;
+        return;
+    }
+    r = &s->code_relocs[s->nb_code_relocs++];
+    r->offset = tcg_ptr_byte_diff(field, s->code_buf);
+    r->type = type;
+    r->target = target;
+}
+#else
+static inline void tcg_out_code_reloc(TCGContext *s, tcg_insn_unit *field,
+                                      TCGCodeRelocType type,
+                                      uintptr_t target)
+{
+    /* the backend cannot describe its host addresses */
+    s->code_unrelocatable |= s->code_reloc;
+}
+#endif
+
 #include "tcg-target.c"
 
 /* pool based memory allocation */
@@ -410,6 +440,9 @@ void tcg_func_start(TCGContext *s)
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
 
+    s->code_unrelocatable = false;
+    s->nb_code_relocs = 0;
+
 #ifdef CONFIG_DEBUG_TCG
     s->goto_tb_issue_mask = 0;
 #endif
@@ -613,6 +646,39 @@ TCGv_i64 tcg_temp_new_internal_i64(int temp_local)
     return MAKE_TCGV_I64(idx);
 }
 
+TCGv_vec tcg_temp_new_vec(TCGType type)
+{
+    int idx;
+
+#ifdef CONFIG_DEBUG_TCG
+    switch (type) {
+    case TCG_TYPE_V64:
+        assert(TCG_TARGET_HAS_v64);
+        break;
+    case TCG_TYPE_V128:
+        assert(TCG_TARGET_HAS_v128);
+        break;
+    case TCG_TYPE_V256:
+        assert(TCG_TARGET_HAS_v256);
+        break;
+    default:
+        tcg_abort();
+    }
+#endif
+
+    idx = tcg_temp_new_internal(type, 0);
+    return MAKE_TCGV_VEC(idx);
+}
+
+/* Create a new temp of the same type as an existing temp.  */
+TCGv_vec tcg_temp_new_vec_matching(TCGv_vec match)
+{
+    TCGTemp *t = &tcg_ctx.temps[GET_TCGV_VEC(match)];
+
+    assert(t->temp_allocated != 0);
+    return tcg_temp_new_vec(t->base_type);
+}
+
 static void tcg_temp_free_internal(int idx)
 {
     TCGContext *s = &tcg_ctx;
@@ -645,6 +711,11 @@ void tcg_temp_free_i64(TCGv_i64 arg)
     tcg_temp_free_internal(GET_TCGV_I64(arg));
 }
 
+void tcg_temp_free_vec(TCGv_vec arg)
+{
+    tcg_temp_free_internal(GET_TCGV_VEC(arg));
+}
+
 TCGv_i32 tcg_const_i32(int32_t val)
 {
     TCGv_i32 t0;
@@ -1013,6 +1084,20 @@ void tcg_dump_ops(TCGContext *s)
                 qemu_log("\n");
             }
             qemu_log(" ---- 0x%" PRIx64, pc);
+        } else if (c == INDEX_op_insn_start) {
+            if (oi != s->gen_first_op_idx) {
+                qemu_log("\n");
+            }
+            qemu_log(" ----");
+            for (i = 0; i < TARGET_INSN_START_WORDS; ++i) {
+                uint64_t a;
+#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
+                a = ((uint64_t)args[i * 2 + 1] << 32) | args[i * 2];
+#else
+                a = args[i];
+#endif
+                qemu_log(" " TARGET_FMT_lx, (target_ulong)a);
+            }
         } else if (c == INDEX_op_call) {
             /* variable number of arguments */
             nb_oargs = op->callo;
@@ -1385,6 +1470,7 @@ static void tcg_liveness_analysis(TCGContext *s)
             }
             break;
         case INDEX_op_debug_insn_start:
+        case INDEX_op_insn_start:
             break;
         case INDEX_op_discard:
             /* mark the temporary as dead */
@@ -1618,21 +1704,35 @@ static void check_regs(TCGContext *s)
 static void temp_allocate_frame(TCGContext *s, int temp)
 {
     TCGTemp *ts;
+    tcg_target_long size;
+
     ts = &s->temps[temp];
+    /* Vector slots are accessed with unaligned moves, so only the size
+       of the slot depends on the type.  */
+    switch (ts->type) {
+    case TCG_TYPE_V128:
+        size = 16;
+        break;
+    case TCG_TYPE_V256:
+        size = 32;
+        break;
+    default:
+        size = sizeof(tcg_target_long);
+        break;
+    }
 #if !(defined(__sparc__) && TCG_TARGET_REG_BITS == 64)
     /* Sparc64 stack is accessed with offset of 2047 */
     s->current_frame_offset = (s->current_frame_offset +
                                (tcg_target_long)sizeof(tcg_target_long) - 1) &
         ~(sizeof(tcg_target_long) - 1);
 #endif
-    if (s->current_frame_offset + (tcg_target_long)sizeof(tcg_target_long) >
-        s->frame_end) {
+    if (s->current_frame_offset + size > s->frame_end) {
         tcg_abort();
     }
     ts->mem_offset = s->current_frame_offset;
     ts->mem_reg = s->frame_reg;
     ts->mem_allocated = 1;
-    s->current_frame_offset += sizeof(tcg_target_long);
+    s->current_frame_offset += size;
 }
 
 /* sync register 'reg' by saving it to the corresponding temporary */
@@ -2259,7 +2359,7 @@ static inline int tcg_gen_code_common(TCGContext *s,
                                       tcg_insn_unit *gen_code_buf,
                                       long search_pc)
 {
-    int oi, oi_next;
+    int i, oi, oi_next, num_insns;
 
 #ifdef DEBUG_DISAS
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP))) {
@@ -2303,6 +2403,7 @@ static inline int tcg_gen_code_common(TCGContext *s,
 
     tcg_out_tb_init(s);
 
+    num_insns = -1;
     for (oi = s->gen_first_op_idx; oi >= 0; oi = oi_next) {
         TCGOp * const op = &s->gen_op_buf[oi];
         TCGArg * const args = &s->gen_opparam_buf[op->args];
@@ -2319,6 +2420,7 @@ static inline int tcg_gen_code_common(TCGContext *s,
         switch (opc) {
         case INDEX_op_mov_i32:
         case INDEX_op_mov_i64:
+        case INDEX_op_mov_vec:
             tcg_reg_alloc_mov(s, def, args, dead_args, sync_args);
             break;
         case INDEX_op_movi_i32:
@@ -2327,6 +2429,21 @@ static inline int tcg_gen_code_common(TCGContext *s,
             break;
         case INDEX_op_debug_insn_start:
             break;
+        case INDEX_op_insn_start:
+            if (num_insns >= 0) {
+                s->gen_insn_end_off[num_insns] = tcg_current_code_size(s);
+            }
+            num_insns++;
+            for (i = 0; i < TARGET_INSN_START_WORDS; ++i) {
+                target_ulong a;
+#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
+                a = ((target_ulong)args[i * 2 + 1] << 32) | args[i * 2];
+#else
+                a = args[i];
+#endif
+                s->gen_insn_data[num_insns][i] = a;
+            }
+            break;
         case INDEX_op_discard:
             temp_dead(s, args[0]);
             break;
@@ -2356,6 +2473,12 @@ static inline int tcg_gen_code_common(TCGContext *s,
         check_regs(s);
 #endif
     }
+    /* The slow paths emitted by tcg_out_tb_finalize are not part of any
+       insn: a fault is always reported with a return address in the
+       main body of the TB.  */
+    if (num_insns >= 0) {
+        s->gen_insn_end_off[num_insns] = tcg_current_code_size(s);
+    }
 
     /* Generate TB finalization at the end of block */
     tcg_out_tb_finalize(s);
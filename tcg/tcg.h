@@ -119,6 +119,31 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_HAS_rem_i64          0
 #endif
 
+/* Host vector registers are optional.  A backend that has them defines
+   TCG_TARGET_HAS_v64/v128/v256 (which may be runtime tests), plus the
+   optional vector ops, and implements tcg_can_emit_vec_op.  */
+#if !defined(TCG_TARGET_HAS_v64) \
+    && !defined(TCG_TARGET_HAS_v128) \
+    && !defined(TCG_TARGET_HAS_v256)
+#define TCG_TARGET_MAYBE_vec            0
+#define TCG_TARGET_HAS_neg_vec          0
+#define TCG_TARGET_HAS_not_vec          0
+#define TCG_TARGET_HAS_andc_vec         0
+#define TCG_TARGET_HAS_orc_vec          0
+#define TCG_TARGET_HAS_shi_vec          0
+#else
+#define TCG_TARGET_MAYBE_vec            1
+#endif
+#ifndef TCG_TARGET_HAS_v64
+#define TCG_TARGET_HAS_v64              0
+#endif
+#ifndef TCG_TARGET_HAS_v128
+#define TCG_TARGET_HAS_v128             0
+#endif
+#ifndef TCG_TARGET_HAS_v256
+#define TCG_TARGET_HAS_v256             0
+#endif
+
 /* For 32-bit targets, some sort of unsigned widening multiply is required.  */
 #if TCG_TARGET_REG_BITS == 32 \
     && !(defined(TCG_TARGET_HAS_mulu2_i32) \
@@ -126,6 +151,16 @@ typedef uint64_t TCGRegSet;
 # error "Missing unsigned widening multiply"
 #endif
 
+/* Targets that define TARGET_INSN_START_EXTRA_WORDS mark each guest insn
+   with an insn_start op, which carries the guest PC and that many more
+   target_ulong words needed to restore the CPU state in the middle of
+   the TB; see restore_state_to_opc.  */
+#ifdef TARGET_INSN_START_EXTRA_WORDS
+# define TARGET_INSN_START_WORDS (1 + TARGET_INSN_START_EXTRA_WORDS)
+#else
+# define TARGET_INSN_START_WORDS 1
+#endif
+
 typedef enum TCGOpcode {
 #define DEF(name, oargs, iargs, cargs, flags) INDEX_op_ ## name,
 #include "tcg-opc.h"
@@ -194,6 +229,12 @@ typedef struct TCGPool {
 typedef enum TCGType {
     TCG_TYPE_I32,
     TCG_TYPE_I64,
+
+    /* Host vector registers, see TCG_TARGET_HAS_v64 et al.  */
+    TCG_TYPE_V64,
+    TCG_TYPE_V128,
+    TCG_TYPE_V256,
+
     TCG_TYPE_COUNT, /* number of different types */
 
     /* An alias for the size of the host register.  */
@@ -281,11 +322,13 @@ typedef tcg_target_ulong TCGArg;
    need to know about any of this, and should treat TCGv as an opaque type.
    In addition we do typechecking for different types of variables.  TCGv_i32
    and TCGv_i64 are 32/64-bit variables respectively.  TCGv and TCGv_ptr
-   are aliases for target_ulong and host pointer sized values respectively.  */
+   are aliases for target_ulong and host pointer sized values respectively.
+   TCGv_vec is a host vector register of one of the TCG_TYPE_V* types.  */
 
 typedef struct TCGv_i32_d *TCGv_i32;
 typedef struct TCGv_i64_d *TCGv_i64;
 typedef struct TCGv_ptr_d *TCGv_ptr;
+typedef struct TCGv_vec_d *TCGv_vec;
 
 static inline TCGv_i32 QEMU_ARTIFICIAL MAKE_TCGV_I32(intptr_t i)
 {
@@ -302,6 +345,11 @@ static inline TCGv_ptr QEMU_ARTIFICIAL MAKE_TCGV_PTR(intptr_t i)
     return (TCGv_ptr)i;
 }
 
+static inline TCGv_vec QEMU_ARTIFICIAL MAKE_TCGV_VEC(intptr_t i)
+{
+    return (TCGv_vec)i;
+}
+
 static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_I32(TCGv_i32 t)
 {
     return (intptr_t)t;
@@ -317,6 +365,11 @@ static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_PTR(TCGv_ptr t)
     return (intptr_t)t;
 }
 
+static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_VEC(TCGv_vec t)
+{
+    return (intptr_t)t;
+}
+
 #if TCG_TARGET_REG_BITS == 32
 #define TCGV_LOW(t) MAKE_TCGV_I32(GET_TCGV_I64(t))
 #define TCGV_HIGH(t) MAKE_TCGV_I32(GET_TCGV_I64(t) + 1)
@@ -325,6 +378,7 @@ static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_PTR(TCGv_ptr t)
 #define TCGV_EQUAL_I32(a, b) (GET_TCGV_I32(a) == GET_TCGV_I32(b))
 #define TCGV_EQUAL_I64(a, b) (GET_TCGV_I64(a) == GET_TCGV_I64(b))
 #define TCGV_EQUAL_PTR(a, b) (GET_TCGV_PTR(a) == GET_TCGV_PTR(b))
+#define TCGV_EQUAL_VEC(a, b) (GET_TCGV_VEC(a) == GET_TCGV_VEC(b))
 
 /* Dummy definition to avoid compiler warnings.  */
 #define TCGV_UNUSED_I32(x) x = MAKE_TCGV_I32(-1)
@@ -397,6 +451,12 @@ static inline TCGCond tcg_unsigned_cond(TCGCond c)
     return c & 2 ? (TCGCond)(c ^ 6) : c;
 }
 
+/* Create a "signed" version of an "unsigned" comparison.  */
+static inline TCGCond tcg_signed_cond(TCGCond c)
+{
+    return c & 4 ? (TCGCond)(c ^ 6) : c;
+}
+
 /* Must a comparison be considered unsigned?  */
 static inline bool is_unsigned_cond(TCGCond c)
 {
@@ -467,6 +527,28 @@ QEMU_BUILD_BUG_ON(NB_OPS > 0xff);
 QEMU_BUILD_BUG_ON(OPC_BUF_SIZE >= 0x7fff);
 QEMU_BUILD_BUG_ON(OPPARAM_BUF_SIZE >= 0x7fff);
 
+/* Host addresses embedded in the generated code of a TB.  They are
+   recorded by backends that define TCG_TARGET_CODE_RELOC, so that the
+   code can be copied to another address, or into another process.  */
+typedef enum TCGCodeRelocType {
+    TCG_CODE_RELOC_ABS64,       /* 64-bit absolute address */
+    TCG_CODE_RELOC_REL32,       /* 32-bit displacement from the field's end */
+} TCGCodeRelocType;
+
+typedef struct TCGCodeReloc {
+    uint32_t offset;            /* of the field, from the start of the TB */
+    TCGCodeRelocType type;
+    uintptr_t target;
+} TCGCodeReloc;
+
+#define TCG_MAX_CODE_RELOCS 256
+
+#ifdef TCG_TARGET_CODE_RELOC
+/* Host features that the backend selected the generated code with; code
+   saved by another process can only be used if they are the same.  */
+uint64_t tcg_target_code_features(void);
+#endif
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -480,6 +562,14 @@ struct TCGContext {
     uint16_t *tb_next_offset;
     uint16_t *tb_jmp_offset; /* != NULL if USE_DIRECT_JUMP */
 
+    /* relocation recording, enabled by the caller of tcg_gen_code; the
+       code is unrelocatable if it embeds host addresses that the backend
+       cannot describe, e.g. those loaded with tcg_const_ptr */
+    bool code_reloc;
+    bool code_unrelocatable;
+    int nb_code_relocs;
+    TCGCodeReloc code_relocs[TCG_MAX_CODE_RELOCS];
+
     /* liveness analysis */
     uint16_t *op_dead_args; /* for each operation, each bit tells if the
                                corresponding argument is dead */
@@ -532,6 +622,8 @@ struct TCGContext {
        extension that allows arithmetic on void*.  */
     int code_gen_max_blocks;
     void *code_gen_prologue;
+    /* Return path of goto_ptr: leaves the TB returning 0, like exit_tb 0 */
+    void *code_gen_epilogue;
     void *code_gen_buffer;
     size_t code_gen_buffer_size;
     /* threshold to flush the translated code buffer */
@@ -557,6 +649,12 @@ struct TCGContext {
     uint16_t gen_opc_icount[OPC_BUF_SIZE];
     uint8_t gen_opc_instr_start[OPC_BUF_SIZE];
 
+    /* Filled in by tcg_gen_code from the insn_start ops: the data of each
+       guest insn, and where its host code ends.  A TB cannot have more
+       insns than ops.  */
+    target_ulong gen_insn_data[OPC_BUF_SIZE][TARGET_INSN_START_WORDS];
+    uint32_t gen_insn_end_off[OPC_BUF_SIZE];
+
     TCGLabel labels[TCG_MAX_LABELS];
 };
 
@@ -574,6 +672,13 @@ static inline bool tcg_op_buf_full(void)
     return tcg_op_buf_count() >= OPC_MAX_SIZE;
 }
 
+/* A host address used as a constant cannot be relocated.  */
+static inline intptr_t tcg_host_ptr(const void *p)
+{
+    tcg_ctx.code_unrelocatable = true;
+    return (intptr_t)p;
+}
+
 /* pool based memory allocation */
 
 void *tcg_malloc_internal(TCGContext *s, int size);
@@ -633,6 +738,10 @@ static inline TCGv_i64 tcg_temp_local_new_i64(void)
 void tcg_temp_free_i64(TCGv_i64 arg);
 char *tcg_get_arg_str_i64(TCGContext *s, char *buf, int buf_size, TCGv_i64 arg);
 
+TCGv_vec tcg_temp_new_vec(TCGType type);
+TCGv_vec tcg_temp_new_vec_matching(TCGv_vec match);
+void tcg_temp_free_vec(TCGv_vec arg);
+
 #if defined(CONFIG_DEBUG_TCG)
 /* If you call tcg_clear_temp_count() at the start of a section of
  * code which is not supposed to leak any TCG temporaries, then
@@ -678,6 +787,8 @@ enum {
     /* Instruction is optional and not implemented by the host, or insn
        is generic and should not be implemened by the host.  */
     TCG_OPF_NOT_PRESENT  = 0x10,
+    /* Instruction operands are vectors.  */
+    TCG_OPF_VECTOR       = 0x20,
 };
 
 typedef struct TCGOpDef {
@@ -720,7 +831,7 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I32(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I32(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i32((intptr_t)(V)))
+#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i32(tcg_host_ptr(V)))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i32((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -731,7 +842,7 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I64(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I64(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i64((intptr_t)(V)))
+#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i64(tcg_host_ptr(V)))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i64((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -755,6 +866,47 @@ TCGv_i64 tcg_const_i64(int64_t val);
 TCGv_i32 tcg_const_local_i32(int32_t val);
 TCGv_i64 tcg_const_local_i64(int64_t val);
 
+/**
+ * tcg_can_emit_vec_op:
+ * @opc: a vector opcode
+ * @type: TCG_TYPE_V64, TCG_TYPE_V128 or TCG_TYPE_V256
+ * @vece: log2 of the element size in bytes
+ *
+ * Return nonzero if the host can emit @opc for vectors of @type with
+ * elements of size @vece.  Callers must also check that @type itself is
+ * available, see TCG_TARGET_HAS_v64 et al.
+ */
+#if TCG_TARGET_MAYBE_vec
+int tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece);
+#else
+static inline int tcg_can_emit_vec_op(TCGOpcode opc, TCGType type,
+                                      unsigned vece)
+{
+    return 0;
+}
+#endif
+
+/**
+ * dup_const:
+ * @vece: log2 of the element size in bytes
+ * @c: the element value
+ *
+ * Return @c replicated to fill 64 bits.
+ */
+static inline uint64_t dup_const(unsigned vece, uint64_t c)
+{
+    switch (vece) {
+    case MO_8:
+        return 0x0101010101010101ull * (uint8_t)c;
+    case MO_16:
+        return 0x0001000100010001ull * (uint16_t)c;
+    case MO_32:
+        return 0x0000000100000001ull * (uint32_t)c;
+    default:
+        return c;
+    }
+}
+
 /**
  * tcg_ptr_byte_diff
  * @a, @b: addresses to be differenced
@@ -41,6 +41,8 @@
 
 /* Test-specific defines. */
 #define TEST_IMAGE_SIZE    (64 * 1024 * 1024)
+#define PERF_LOOPS         2000
+#define PERF_BUFSIZE       4096
 
 /*** Globals ***/
 static char tmp_path[] = "/tmp/qtest.XXXXXX";
@@ -71,9 +73,10 @@ static void string_bswap16(uint16_t *s, size_t bytes)
 /*** Test Setup & Teardown ***/
 
 /**
- * Start a Q35 machine and bookmark a handle to the AHCI device.
+ * Start a Q35 machine with @image as its disk,
+ * and bookmark a handle to the AHCI device.
  */
-static AHCIQState *ahci_boot(void)
+static AHCIQState *ahci_boot_image(const char *image)
 {
     AHCIQState *s;
     const char *cli;
@@ -85,7 +88,7 @@ static AHCIQState *ahci_boot(void)
         " -M q35 "
         "-device ide-hd,drive=drive0 "
         "-global ide-hd.ver=%s";
-    s->parent = qtest_pc_boot(cli, tmp_path, "testdisk", "version");
+    s->parent = qtest_pc_boot(cli, image, "testdisk", "version");
     alloc_set_flags(s->parent->alloc, ALLOC_LEAK_ASSERT);
 
     /* Verify that we have an AHCI device present. */
@@ -94,6 +97,14 @@ static AHCIQState *ahci_boot(void)
     return s;
 }
 
+/**
+ * Start a Q35 machine and bookmark a handle to the AHCI device.
+ */
+static AHCIQState *ahci_boot(void)
+{
+    return ahci_boot_image(tmp_path);
+}
+
 /**
  * Clean up the PCI device, then terminate the QEMU instance.
  */
@@ -852,6 +863,41 @@ static void test_dma_rw_simple(void)
     ahci_shutdown(ahci);
 }
 
+/**
+ * Measure DMA reads per second of the HBA model, on top of null-co so that
+ * the block layer does as little work as possible.
+ */
+static void test_dma_perf(void)
+{
+    AHCIQState *ahci;
+    uint64_t ptr;
+    uint8_t port;
+    double duration;
+    int i;
+
+    ahci = ahci_boot_image("null-co://");
+    ahci_pci_enable(ahci);
+    ahci_hba_enable(ahci);
+
+    port = ahci_port_select(ahci);
+    ahci_port_clear(ahci, port);
+    ptr = ahci_alloc(ahci, PERF_BUFSIZE);
+    g_assert(ptr);
+
+    g_test_timer_start();
+    for (i = 0; i < PERF_LOOPS; i++) {
+        ahci_guest_io(ahci, port, CMD_READ_DMA, ptr, PERF_BUFSIZE);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("AHCI %u DMA reads of %u bytes: %f s, %f ops/s\n",
+                   PERF_LOOPS, PERF_BUFSIZE, duration,
+                   PERF_LOOPS / duration);
+
+    ahci_free(ahci, ptr);
+    ahci_shutdown(ahci);
+}
+
 /******************************************************************************/
 
 int main(int argc, char **argv)
@@ -908,6 +954,9 @@ int main(int argc, char **argv)
     qtest_add_func("/ahci/hba_enable", test_hba_enable);
     qtest_add_func("/ahci/identify",   test_identify);
     qtest_add_func("/ahci/dma/simple", test_dma_rw_simple);
+    if (g_test_perf()) {
+        qtest_add_func("/ahci/dma/perf", test_dma_perf);
+    }
 
     ret = g_test_run();
 
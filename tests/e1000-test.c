@@ -9,8 +9,22 @@
 
 #include <glib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 #include "libqtest.h"
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqos/pci-pc.h"
+#include "libqos/malloc.h"
+#include "libqos/malloc-pc.h"
+#include "hw/net/e1000_regs.h"
+
+#define PCI_SLOT        0x04
+
+#define TX_RING_SIZE    16
+#define PERF_LOOPS      10000
+#define PERF_PKT_SIZE   1024
 
 /* Tests only initialization so far. TODO: Replace with functional tests */
 static void test_device(gconstpointer data)
@@ -28,6 +42,93 @@ static void test_device(gconstpointer data)
     g_free(args);
 }
 
+/*
+ * The backend is one end of a socket pair, and the test reads the packets
+ * from the other end.  The same packet buffer is queued over and over on
+ * a small transmit ring, so that each packet costs a single TDT write.
+ */
+static void perf_tx(void)
+{
+    QPCIBus *bus;
+    QPCIDevice *dev;
+    QGuestAllocator *alloc;
+    struct e1000_tx_desc desc[TX_RING_SIZE];
+    uint8_t pkt[PERF_PKT_SIZE], rpkt[PERF_PKT_SIZE];
+    uint64_t ring, buf;
+    uint32_t len;
+    void *mmio;
+    double duration;
+    ssize_t ret;
+    char *args;
+    int sv[2];
+    int i;
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sv);
+    g_assert_cmpint(ret, !=, -1);
+
+    args = g_strdup_printf("-netdev socket,fd=%d,id=hs0 "
+                           "-device e1000,netdev=hs0,addr=%x.0",
+                           sv[1], PCI_SLOT);
+    qtest_start(args);
+    g_free(args);
+
+    bus = qpci_init_pc();
+    dev = qpci_device_find(bus, QPCI_DEVFN(PCI_SLOT, 0));
+    g_assert(dev != NULL);
+    qpci_device_enable(dev);
+    mmio = qpci_iomap(dev, 0, NULL);
+    alloc = pc_alloc_init();
+
+    memset(pkt, 0xff, 6);
+    for (i = 6; i < sizeof(pkt); i++) {
+        pkt[i] = i;
+    }
+    buf = guest_alloc(alloc, sizeof(pkt));
+    memwrite(buf, pkt, sizeof(pkt));
+
+    for (i = 0; i < TX_RING_SIZE; i++) {
+        desc[i].buffer_addr = cpu_to_le64(buf);
+        desc[i].lower.data = cpu_to_le32(E1000_TXD_CMD_EOP |
+                                         E1000_TXD_CMD_RS | sizeof(pkt));
+        desc[i].upper.data = 0;
+    }
+    ring = guest_alloc(alloc, sizeof(desc));
+    memwrite(ring, desc, sizeof(desc));
+
+    qpci_io_writel(dev, mmio + E1000_TDBAL, ring);
+    qpci_io_writel(dev, mmio + E1000_TDBAH, ring >> 32);
+    qpci_io_writel(dev, mmio + E1000_TDLEN, sizeof(desc));
+    qpci_io_writel(dev, mmio + E1000_TDH, 0);
+    qpci_io_writel(dev, mmio + E1000_TDT, 0);
+    qpci_io_writel(dev, mmio + E1000_TCTL, E1000_TCTL_EN);
+
+    g_test_timer_start();
+    for (i = 0; i < PERF_LOOPS; i++) {
+        qpci_io_writel(dev, mmio + E1000_TDT, (i + 1) % TX_RING_SIZE);
+
+        ret = recv(sv[0], &len, sizeof(len), MSG_WAITALL);
+        g_assert_cmpint(ret, ==, sizeof(len));
+        g_assert_cmpint(ntohl(len), ==, sizeof(pkt));
+        ret = recv(sv[0], rpkt, sizeof(rpkt), MSG_WAITALL);
+        g_assert_cmpint(ret, ==, sizeof(rpkt));
+    }
+    duration = g_test_timer_elapsed();
+    g_assert(memcmp(pkt, rpkt, sizeof(pkt)) == 0);
+    g_assert_cmphex(qpci_io_readl(dev, mmio + E1000_TDH), ==,
+                    PERF_LOOPS % TX_RING_SIZE);
+
+    g_test_message("e1000 %u TX packets of %zu bytes: %f s, %f ops/s\n",
+                   PERF_LOOPS, sizeof(pkt), duration, PERF_LOOPS / duration);
+
+    guest_free(alloc, ring);
+    guest_free(alloc, buf);
+    qpci_iounmap(dev, mmio);
+    g_free(dev);
+    qtest_end();
+    close(sv[0]);
+    close(sv[1]);
+}
+
 static const char *models[] = {
     "e1000",
     "e1000-82540em",
@@ -47,6 +148,9 @@ int main(int argc, char **argv)
         path = g_strdup_printf("/%s/e1000/%s", qtest_get_arch(), models[i]);
         g_test_add_data_func(path, models[i], test_device);
     }
+    if (g_test_perf()) {
+        qtest_add_func("/e1000/perf/tx", perf_tx);
+    }
 
     return g_test_run();
 }
@@ -131,7 +131,7 @@ static void ide_test_quit(void)
     qtest_end();
 }
 
-static QPCIDevice *get_pci_device(uint16_t *bmdma_base)
+static QPCIDevice *get_pci_device(uint16_t *bmdma_base, bool bus_master)
 {
     QPCIDevice *dev;
     uint16_t vendor_id, device_id;
@@ -152,7 +152,12 @@ static QPCIDevice *get_pci_device(uint16_t *bmdma_base)
     /* Map bmdma BAR */
     *bmdma_base = (uint16_t)(uintptr_t) qpci_iomap(dev, 4, NULL);
 
-    qpci_device_enable(dev);
+    if (bus_master) {
+        qpci_device_enable(dev);
+    } else {
+        qpci_config_writew(dev, PCI_COMMAND,
+                           PCI_COMMAND_IO | PCI_COMMAND_MEMORY);
+    }
 
     return dev;
 }
@@ -182,11 +187,11 @@ static int send_dma_request(int cmd, uint64_t sector, int nb_sectors,
     uint8_t status;
     int flags;
 
-    dev = get_pci_device(&bmdma_base);
-
     flags = cmd & ~0xff;
     cmd &= 0xff;
 
+    dev = get_pci_device(&bmdma_base, !(flags & CMDF_NO_BM));
+
     switch (cmd) {
     case CMD_READ_DMA:
         from_dev = true;
@@ -198,11 +203,6 @@ static int send_dma_request(int cmd, uint64_t sector, int nb_sectors,
         g_assert_not_reached();
     }
 
-    if (flags & CMDF_NO_BM) {
-        qpci_config_writew(dev, PCI_COMMAND,
-                           PCI_COMMAND_IO | PCI_COMMAND_MEMORY);
-    }
-
     /* Select device 0 */
     outb(IDE_BASE + reg_device, 0 | LBA);
 
@@ -382,6 +382,22 @@ static void test_bmdma_no_busmaster(void)
     assert_bit_clear(inb(IDE_BASE + reg_status), DF | ERR);
 }
 
+/* The bus master address space of the device starts out disabled, so it
+ * is empty from the very first commit.  DMA must not crash even if the
+ * guest never set the Bus Master bit.
+ */
+static void test_bmdma_no_busmaster_at_boot(void)
+{
+    ide_test_start(
+        "-drive file=%s,if=ide,serial=%s,cache=writeback,format=raw "
+        "-global ide-hd.ver=%s",
+        tmp_path, "testdisk", "version");
+
+    test_bmdma_no_busmaster();
+
+    ide_test_quit();
+}
+
 static void test_bmdma_setup(void)
 {
     ide_test_start(
@@ -615,6 +631,8 @@ int main(int argc, char **argv)
     qtest_add_func("/ide/bmdma/long_prdt", test_bmdma_long_prdt);
     qtest_add_func("/ide/bmdma/no_busmaster", test_bmdma_no_busmaster);
     qtest_add_func("/ide/bmdma/teardown", test_bmdma_teardown);
+    qtest_add_func("/ide/bmdma/no_busmaster_at_boot",
+                   test_bmdma_no_busmaster_at_boot);
 
     qtest_add_func("/ide/flush", test_flush);
     qtest_add_func("/ide/flush_nodev", test_flush_nodev);
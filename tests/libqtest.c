@@ -33,6 +33,7 @@
 #include "qapi/qmp/json-parser.h"
 #include "qapi/qmp/json-streamer.h"
 #include "qapi/qmp/qjson.h"
+#include "sysemu/qtest-binary.h"
 
 #define MAX_IRQ 256
 #define SOCKET_TIMEOUT 5
@@ -261,27 +262,31 @@ static void GCC_FMT_ATTR(2, 3) qtest_sendf(QTestState *s, const char *fmt, ...)
     va_end(ap);
 }
 
+static void qtest_recv(QTestState *s)
+{
+    ssize_t len;
+    char buffer[1024];
+
+    do {
+        len = read(s->fd, buffer, sizeof(buffer));
+    } while (len == -1 && errno == EINTR);
+
+    if (len == -1 || len == 0) {
+        fprintf(stderr, "Broken pipe\n");
+        exit(1);
+    }
+
+    g_string_append_len(s->rx, buffer, len);
+}
+
 static GString *qtest_recv_line(QTestState *s)
 {
     GString *line;
     size_t offset;
     char *eol;
 
-    while ((eol = strchr(s->rx->str, '\n')) == NULL) {
-        ssize_t len;
-        char buffer[1024];
-
-        len = read(s->fd, buffer, sizeof(buffer));
-        if (len == -1 && errno == EINTR) {
-            continue;
-        }
-
-        if (len == -1 || len == 0) {
-            fprintf(stderr, "Broken pipe\n");
-            exit(1);
-        }
-
-        g_string_append_len(s->rx, buffer, len);
+    while ((eol = memchr(s->rx->str, '\n', s->rx->len)) == NULL) {
+        qtest_recv(s);
     }
 
     offset = eol - s->rx->str;
@@ -291,6 +296,29 @@ static GString *qtest_recv_line(QTestState *s)
     return line;
 }
 
+static bool qtest_irq_event(QTestState *s, gchar **words)
+{
+    int irq;
+
+    if (strcmp(words[0], "IRQ") != 0) {
+        return false;
+    }
+
+    g_assert(words[1] != NULL);
+    g_assert(words[2] != NULL);
+
+    irq = strtoul(words[2], NULL, 0);
+    g_assert_cmpint(irq, >=, 0);
+    g_assert_cmpint(irq, <, MAX_IRQ);
+
+    if (strcmp(words[1], "raise") == 0) {
+        s->irq_level[irq] = true;
+    } else {
+        s->irq_level[irq] = false;
+    }
+    return true;
+}
+
 static gchar **qtest_rsp(QTestState *s, int expected_args)
 {
     GString *line;
@@ -302,22 +330,7 @@ redo:
     words = g_strsplit(line->str, " ", 0);
     g_string_free(line, TRUE);
 
-    if (strcmp(words[0], "IRQ") == 0) {
-        int irq;
-
-        g_assert(words[1] != NULL);
-        g_assert(words[2] != NULL);
-
-        irq = strtoul(words[2], NULL, 0);
-        g_assert_cmpint(irq, >=, 0);
-        g_assert_cmpint(irq, <, MAX_IRQ);
-
-        if (strcmp(words[1], "raise") == 0) {
-            s->irq_level[irq] = true;
-        } else {
-            s->irq_level[irq] = false;
-        }
-
+    if (qtest_irq_event(s, words)) {
         g_strfreev(words);
         goto redo;
     }
@@ -336,6 +349,64 @@ redo:
     return words;
 }
 
+/*
+ * Send a binary frame with @in_len bytes of payload, and copy the payload
+ * of the response, which must be @out_len bytes long, to @out.
+ */
+static void qtest_bin(QTestState *s, const QTestBinReq *req,
+                      const void *in, size_t in_len, void *out, size_t out_len)
+{
+    uint8_t hdr[QTEST_BIN_REQ_LEN];
+    uint8_t status;
+    uint32_t len;
+
+    qtest_bin_req_encode(hdr, req);
+    socket_send(s->fd, (const char *)hdr, sizeof(hdr));
+    if (in_len) {
+        socket_send(s->fd, in, in_len);
+    }
+
+    /* IRQ messages can come before the response */
+    for (;;) {
+        gchar **words;
+        GString *line;
+
+        while (s->rx->len == 0) {
+            qtest_recv(s);
+        }
+        if ((uint8_t)s->rx->str[0] == QTEST_BIN_MAGIC) {
+            break;
+        }
+
+        line = qtest_recv_line(s);
+        words = g_strsplit(line->str, " ", 0);
+        g_string_free(line, TRUE);
+        g_assert(qtest_irq_event(s, words));
+        g_strfreev(words);
+    }
+
+    while (s->rx->len < QTEST_BIN_RSP_LEN) {
+        qtest_recv(s);
+    }
+    status = s->rx->str[1];
+    len = qtest_bin_ld((const uint8_t *)s->rx->str + 4, 4);
+    while (s->rx->len < QTEST_BIN_RSP_LEN + len) {
+        qtest_recv(s);
+    }
+
+    if (status != QTEST_BIN_OK) {
+        fprintf(stderr, "qtest: %.*s\n", (int)len,
+                s->rx->str + QTEST_BIN_RSP_LEN);
+    }
+    g_assert_cmpint(status, ==, QTEST_BIN_OK);
+    g_assert_cmpuint(len, ==, out_len);
+
+    if (len) {
+        memcpy(out, s->rx->str + QTEST_BIN_RSP_LEN, len);
+    }
+    g_string_erase(s->rx, 0, QTEST_BIN_RSP_LEN + len);
+}
+
 typedef struct {
     JSONMessageParser parser;
     QDict *response;
@@ -615,34 +686,20 @@ uint64_t qtest_readq(QTestState *s, uint64_t addr)
     return qtest_read(s, "readq", addr);
 }
 
-static int hex2nib(char ch)
-{
-    if (ch >= '0' && ch <= '9') {
-        return ch - '0';
-    } else if (ch >= 'a' && ch <= 'f') {
-        return 10 + (ch - 'a');
-    } else if (ch >= 'A' && ch <= 'F') {
-        return 10 + (ch - 'a');
-    } else {
-        return -1;
-    }
-}
-
 void qtest_memread(QTestState *s, uint64_t addr, void *data, size_t size)
 {
     uint8_t *ptr = data;
-    gchar **args;
-    size_t i;
+    QTestBinReq req = { .op = QTEST_BIN_READ };
 
-    qtest_sendf(s, "read 0x%" PRIx64 " 0x%zx\n", addr, size);
-    args = qtest_rsp(s, 2);
+    while (size) {
+        req.addr = addr;
+        req.count = MIN(size, QTEST_BIN_MAX_LEN);
+        qtest_bin(s, &req, NULL, 0, ptr, req.count);
 
-    for (i = 0; i < size; i++) {
-        ptr[i] = hex2nib(args[1][2 + (i * 2)]) << 4;
-        ptr[i] |= hex2nib(args[1][2 + (i * 2) + 1]);
+        addr += req.count;
+        ptr += req.count;
+        size -= req.count;
     }
-
-    g_strfreev(args);
 }
 
 void qtest_add_func(const char *str, void (*fn))
@@ -655,26 +712,91 @@ void qtest_add_func(const char *str, void (*fn))
 void qtest_memwrite(QTestState *s, uint64_t addr, const void *data, size_t size)
 {
     const uint8_t *ptr = data;
-    size_t i;
+    QTestBinReq req = { .op = QTEST_BIN_WRITE };
+
+    while (size) {
+        req.addr = addr;
+        req.count = MIN(size, QTEST_BIN_MAX_LEN);
+        qtest_bin(s, &req, ptr, req.count, NULL, 0);
 
-    qtest_sendf(s, "write 0x%" PRIx64 " 0x%zx 0x", addr, size);
-    for (i = 0; i < size; i++) {
-        qtest_sendf(s, "%02x", ptr[i]);
+        addr += req.count;
+        ptr += req.count;
+        size -= req.count;
     }
-    qtest_sendf(s, "\n");
-    qtest_rsp(s, 0);
 }
 
 void qtest_memset(QTestState *s, uint64_t addr, uint8_t pattern, size_t size)
 {
+    QTestBinReq req = { .op = QTEST_BIN_MEMSET, .arg = pattern };
+
+    while (size) {
+        req.addr = addr;
+        req.count = MIN(size, QTEST_BIN_MAX_LEN);
+        qtest_bin(s, &req, NULL, 0, NULL, 0);
+
+        addr += req.count;
+        size -= req.count;
+    }
+}
+
+/* Split a burst into frames of at most QTEST_BIN_MAX_LEN bytes */
+static void qtest_burst(QTestState *s, uint8_t op, uint64_t addr,
+                        uint64_t stride, unsigned size, uint64_t *values,
+                        size_t count)
+{
+    QTestBinReq req = { .op = op, .size = size, .arg = stride };
+    bool out = op == QTEST_BIN_MMIO_WRITE || op == QTEST_BIN_PIO_OUT;
+    uint8_t *buf;
     size_t i;
 
-    qtest_sendf(s, "write 0x%" PRIx64 " 0x%zx 0x", addr, size);
-    for (i = 0; i < size; i++) {
-        qtest_sendf(s, "%02x", pattern);
+    buf = g_malloc(MIN(count, QTEST_BIN_MAX_LEN / size) * size);
+    while (count) {
+        req.addr = addr;
+        req.count = MIN(count, QTEST_BIN_MAX_LEN / size);
+        if (out) {
+            for (i = 0; i < req.count; i++) {
+                qtest_bin_st(buf + i * size, size, values[i]);
+            }
+            qtest_bin(s, &req, buf, req.count * size, NULL, 0);
+        } else {
+            qtest_bin(s, &req, NULL, 0, buf, req.count * size);
+            for (i = 0; i < req.count; i++) {
+                values[i] = qtest_bin_ld(buf + i * size, size);
+            }
+        }
+
+        addr += req.count * stride;
+        values += req.count;
+        count -= req.count;
     }
-    qtest_sendf(s, "\n");
-    qtest_rsp(s, 0);
+    g_free(buf);
+}
+
+void qtest_mmio_read_burst(QTestState *s, uint64_t addr, uint64_t stride,
+                           unsigned size, uint64_t *values, size_t count)
+{
+    qtest_burst(s, QTEST_BIN_MMIO_READ, addr, stride, size, values, count);
+}
+
+void qtest_mmio_write_burst(QTestState *s, uint64_t addr, uint64_t stride,
+                            unsigned size, const uint64_t *values,
+                            size_t count)
+{
+    qtest_burst(s, QTEST_BIN_MMIO_WRITE, addr, stride, size,
+                (uint64_t *)values, count);
+}
+
+void qtest_pio_in_burst(QTestState *s, uint16_t addr, uint16_t stride,
+                        unsigned size, uint64_t *values, size_t count)
+{
+    qtest_burst(s, QTEST_BIN_PIO_IN, addr, stride, size, values, count);
+}
+
+void qtest_pio_out_burst(QTestState *s, uint16_t addr, uint16_t stride,
+                         unsigned size, const uint64_t *values, size_t count)
+{
+    qtest_burst(s, QTEST_BIN_PIO_OUT, addr, stride, size,
+                (uint64_t *)values, count);
 }
 
 QDict *qmp(const char *fmt, ...)
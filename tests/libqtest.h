@@ -294,6 +294,67 @@ void qtest_memwrite(QTestState *s, uint64_t addr, const void *data, size_t size)
  */
 void qtest_memset(QTestState *s, uint64_t addr, uint8_t patt, size_t size);
 
+/**
+ * qtest_mmio_read_burst:
+ * @s: #QTestState instance to operate on.
+ * @addr: Guest address of the first read.
+ * @stride: Distance between the addresses of consecutive reads, or 0.
+ * @size: Width of each read in bytes: 1, 2, 4 or 8.
+ * @values: Array where the @count values read will be stored.
+ * @count: Number of reads.
+ *
+ * Perform @count reads like qtest_readb() and friends, in a single
+ * round trip.
+ */
+void qtest_mmio_read_burst(QTestState *s, uint64_t addr, uint64_t stride,
+                           unsigned size, uint64_t *values, size_t count);
+
+/**
+ * qtest_mmio_write_burst:
+ * @s: #QTestState instance to operate on.
+ * @addr: Guest address of the first write.
+ * @stride: Distance between the addresses of consecutive writes, or 0.
+ * @size: Width of each write in bytes: 1, 2, 4 or 8.
+ * @values: Array of the @count values to write.
+ * @count: Number of writes.
+ *
+ * Perform @count writes like qtest_writeb() and friends, in a single
+ * round trip.
+ */
+void qtest_mmio_write_burst(QTestState *s, uint64_t addr, uint64_t stride,
+                            unsigned size, const uint64_t *values,
+                            size_t count);
+
+/**
+ * qtest_pio_in_burst:
+ * @s: #QTestState instance to operate on.
+ * @addr: I/O port of the first read.
+ * @stride: Distance between the ports of consecutive reads, or 0.
+ * @size: Width of each read in bytes: 1, 2 or 4.
+ * @values: Array where the @count values read will be stored.
+ * @count: Number of reads.
+ *
+ * Perform @count reads like qtest_inb() and friends, in a single
+ * round trip.
+ */
+void qtest_pio_in_burst(QTestState *s, uint16_t addr, uint16_t stride,
+                        unsigned size, uint64_t *values, size_t count);
+
+/**
+ * qtest_pio_out_burst:
+ * @s: #QTestState instance to operate on.
+ * @addr: I/O port of the first write.
+ * @stride: Distance between the ports of consecutive writes, or 0.
+ * @size: Width of each write in bytes: 1, 2 or 4.
+ * @values: Array of the @count values to write.
+ * @count: Number of writes.
+ *
+ * Perform @count writes like qtest_outb() and friends, in a single
+ * round trip.
+ */
+void qtest_pio_out_burst(QTestState *s, uint16_t addr, uint16_t stride,
+                         unsigned size, const uint64_t *values, size_t count);
+
 /**
  * qtest_clock_step_next:
  * @s: #QTestState instance to operate on.
@@ -645,6 +706,73 @@ static inline void qmemset(uint64_t addr, uint8_t patt, size_t size)
     qtest_memset(global_qtest, addr, patt, size);
 }
 
+/**
+ * mmio_read_burst:
+ * @addr: Guest address of the first read.
+ * @stride: Distance between the addresses of consecutive reads, or 0.
+ * @size: Width of each read in bytes: 1, 2, 4 or 8.
+ * @values: Array where the @count values read will be stored.
+ * @count: Number of reads.
+ *
+ * Perform @count reads from guest memory in a single round trip.
+ */
+static inline void mmio_read_burst(uint64_t addr, uint64_t stride,
+                                   unsigned size, uint64_t *values,
+                                   size_t count)
+{
+    qtest_mmio_read_burst(global_qtest, addr, stride, size, values, count);
+}
+
+/**
+ * mmio_write_burst:
+ * @addr: Guest address of the first write.
+ * @stride: Distance between the addresses of consecutive writes, or 0.
+ * @size: Width of each write in bytes: 1, 2, 4 or 8.
+ * @values: Array of the @count values to write.
+ * @count: Number of writes.
+ *
+ * Perform @count writes to guest memory in a single round trip.
+ */
+static inline void mmio_write_burst(uint64_t addr, uint64_t stride,
+                                    unsigned size, const uint64_t *values,
+                                    size_t count)
+{
+    qtest_mmio_write_burst(global_qtest, addr, stride, size, values, count);
+}
+
+/**
+ * pio_in_burst:
+ * @addr: I/O port of the first read.
+ * @stride: Distance between the ports of consecutive reads, or 0.
+ * @size: Width of each read in bytes: 1, 2 or 4.
+ * @values: Array where the @count values read will be stored.
+ * @count: Number of reads.
+ *
+ * Perform @count reads from I/O ports in a single round trip.
+ */
+static inline void pio_in_burst(uint16_t addr, uint16_t stride,
+                                unsigned size, uint64_t *values, size_t count)
+{
+    qtest_pio_in_burst(global_qtest, addr, stride, size, values, count);
+}
+
+/**
+ * pio_out_burst:
+ * @addr: I/O port of the first write.
+ * @stride: Distance between the ports of consecutive writes, or 0.
+ * @size: Width of each write in bytes: 1, 2 or 4.
+ * @values: Array of the @count values to write.
+ * @count: Number of writes.
+ *
+ * Perform @count writes to I/O ports in a single round trip.
+ */
+static inline void pio_out_burst(uint16_t addr, uint16_t stride,
+                                 unsigned size, const uint64_t *values,
+                                 size_t count)
+{
+    qtest_pio_out_burst(global_qtest, addr, stride, size, values, count);
+}
+
 /**
  * clock_step_next:
  *
@@ -0,0 +1,285 @@
+/*
+ * QTest testcase for multi-threaded TCG
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "libqtest.h"
+#include "qemu/osdep.h"
+
+/* Guest memory written by the boot code below */
+#define DATA            0x1000
+#define BAR             (DATA + 0x000)  /* barrier counter */
+#define FLAG0           (DATA + 0x040)
+#define FLAG1           (DATA + 0x080)
+#define R0              (DATA + 0x0c0)
+#define R1              (DATA + 0x100)
+#define SBV             (DATA + 0x140)  /* store buffering violations */
+#define XVAR            (DATA + 0x180)  /* LOCK inc counter, byte 3 stored */
+#define ACOUNT          (DATA + 0x1c0)  /* LOCK incs done by CPU 0 */
+#define LOST            (DATA + 0x200)  /* CPU 1 byte stores undone */
+#define BDONE           (DATA + 0x240)
+#define DONE            (DATA + 0x280)
+#define SB_ITERS        2000
+#define ST_ITERS        500
+#define DONE_SIGNATURE  0xdead
+
+/* Boot sector: CPU 0 wakes CPU 1 with INIT/SIPI, both switch to 32-bit
+ * flat protected mode and then run
+ *  - a store buffering (Dekker) test: each CPU sets its flag, executes
+ *    MFENCE and reads the other's flag.  Both reading 0 is forbidden.
+ *  - CPU 0 doing LOCK INC on a dword whose top byte CPU 1 keeps storing
+ *    to with plain stores.  A LOCK INC that is not atomic against those
+ *    stores writes back a stale top byte.
+ * Built from this source with "gcc -m32 -c" and
+ * "ld -m elf_i386 -Ttext 0x7c00 --oformat binary", using the defines above:
+ *
+ *         .code16
+ *         .text
+ *         .globl _start
+ * _start:
+ *         cli
+ *         xor %ax, %ax
+ *         mov %ax, %ds
+ *         mov %ax, %es
+ *         mov %ax, %ss
+ *         mov $0x7000, %sp
+ *         cld
+ *         mov $DATA, %di
+ *         mov $0x180, %cx
+ *         rep stosw
+ *         # AP trampoline at 0x8000: ljmp $0, $ap_entry
+ *         movb $0xea, 0x8000
+ *         movw $ap_entry, 0x8001
+ *         movw $0, 0x8003
+ *         lgdt gdtr
+ *         mov %cr0, %eax
+ *         or $1, %al
+ *         mov %eax, %cr0
+ *         ljmp $0x08, $bsp32
+ *
+ * ap_entry:
+ *         cli
+ *         xor %ax, %ax
+ *         mov %ax, %ds
+ *         lgdt gdtr
+ *         mov %cr0, %eax
+ *         or $1, %al
+ *         mov %eax, %cr0
+ *         ljmp $0x08, $ap32
+ *
+ *         .code32
+ * bsp32:
+ *         mov $0x10, %ax
+ *         mov %ax, %ds
+ *         mov %ax, %ss
+ *         mov $0x7000, %esp
+ *         # INIT, then SIPI with vector 0x08, to all but self
+ *         movl $0x000c4500, 0xfee00300
+ *         mov $0x10000, %ecx
+ * 1:      loop 1b
+ *         movl $0x000c4608, 0xfee00300
+ *         xor %ebx, %ebx
+ *         jmp test
+ *
+ * ap32:
+ *         mov $0x10, %ax
+ *         mov %ax, %ds
+ *         mov %ax, %ss
+ *         mov $0x6000, %esp
+ *         mov $1, %ebx
+ *
+ * test:
+ *         xor %esi, %esi
+ *         # store buffering: both CPUs must not read the old flag
+ *         mov $SB_ITERS, %edi
+ * sb_loop:
+ *         call barrier
+ *         test %ebx, %ebx
+ *         jnz 1f
+ *         movl $1, FLAG0
+ *         mfence
+ *         mov FLAG1, %eax
+ *         mov %eax, R0
+ *         jmp 2f
+ * 1:      movl $1, FLAG1
+ *         mfence
+ *         mov FLAG0, %eax
+ *         mov %eax, R1
+ * 2:      call barrier
+ *         test %ebx, %ebx
+ *         jnz 3f
+ *         mov R0, %eax
+ *         or R1, %eax
+ *         jnz 4f
+ *         incl SBV
+ * 4:      movl $0, FLAG0
+ *         movl $0, FLAG1
+ * 3:      call barrier
+ *         dec %edi
+ *         jnz sb_loop
+ *
+ *         # LOCK inc on CPU 0 must not undo CPU 1's plain byte stores
+ *         call barrier
+ *         test %ebx, %ebx
+ *         jnz 2f
+ *         xor %ecx, %ecx
+ * 1:      lock incl XVAR
+ *         inc %ecx
+ *         cmpl $0, BDONE
+ *         je 1b
+ *         mov %ecx, ACOUNT
+ *         jmp finish
+ * 2:      mov $ST_ITERS, %edi
+ *         mov $1, %edx
+ * 3:      mov %dl, XVAR + 3
+ *         mov $32, %ecx
+ * 4:      loop 4b
+ *         cmp XVAR + 3, %dl
+ *         je 5f
+ *         incl LOST
+ * 5:      inc %edx
+ *         dec %edi
+ *         jnz 3b
+ *         movl $1, BDONE
+ *
+ * finish:
+ *         call barrier
+ *         test %ebx, %ebx
+ *         jnz halt
+ *         movl $0xdead, DONE
+ * halt:
+ *         cli
+ *         hlt
+ *         jmp halt
+ *
+ * # both CPUs arrive before either leaves
+ * barrier:
+ *         add $2, %esi
+ *         lock incl BAR
+ * 1:      cmp %esi, BAR
+ *         jb 1b
+ *         ret
+ *
+ *         .p2align 3
+ * gdt:
+ *         .quad 0
+ *         .quad 0x00cf9a000000ffff
+ *         .quad 0x00cf92000000ffff
+ * gdtr:
+ *         .word gdtr - gdt - 1
+ *         .long gdt
+ */
+static const uint8_t boot_code[] = {
+    0xfa, 0x31, 0xc0, 0x8e, 0xd8, 0x8e, 0xc0, 0x8e, 0xd0, 0xbc, 0x00, 0x70,
+    0xfc, 0xbf, 0x00, 0x10, 0xb9, 0x80, 0x01, 0xf3, 0xab, 0xc6, 0x06, 0x00,
+    0x80, 0xea, 0xc7, 0x06, 0x01, 0x80, 0x38, 0x7c, 0xc7, 0x06, 0x03, 0x80,
+    0x00, 0x00, 0x0f, 0x01, 0x16, 0xa0, 0x7d, 0x0f, 0x20, 0xc0, 0x0c, 0x01,
+    0x0f, 0x22, 0xc0, 0xea, 0x4f, 0x7c, 0x08, 0x00, 0xfa, 0x31, 0xc0, 0x8e,
+    0xd8, 0x0f, 0x01, 0x16, 0xa0, 0x7d, 0x0f, 0x20, 0xc0, 0x0c, 0x01, 0x0f,
+    0x22, 0xc0, 0xea, 0x7b, 0x7c, 0x08, 0x00, 0x66, 0xb8, 0x10, 0x00, 0x8e,
+    0xd8, 0x8e, 0xd0, 0xbc, 0x00, 0x70, 0x00, 0x00, 0xc7, 0x05, 0x00, 0x03,
+    0xe0, 0xfe, 0x00, 0x45, 0x0c, 0x00, 0xb9, 0x00, 0x00, 0x01, 0x00, 0xe2,
+    0xfe, 0xc7, 0x05, 0x00, 0x03, 0xe0, 0xfe, 0x08, 0x46, 0x0c, 0x00, 0x31,
+    0xdb, 0xeb, 0x12, 0x66, 0xb8, 0x10, 0x00, 0x8e, 0xd8, 0x8e, 0xd0, 0xbc,
+    0x00, 0x60, 0x00, 0x00, 0xbb, 0x01, 0x00, 0x00, 0x00, 0x31, 0xf6, 0xbf,
+    0xd0, 0x07, 0x00, 0x00, 0xe8, 0xda, 0x00, 0x00, 0x00, 0x85, 0xdb, 0x75,
+    0x19, 0xc7, 0x05, 0x40, 0x10, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0f,
+    0xae, 0xf0, 0xa1, 0x80, 0x10, 0x00, 0x00, 0xa3, 0xc0, 0x10, 0x00, 0x00,
+    0xeb, 0x17, 0xc7, 0x05, 0x80, 0x10, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+    0x0f, 0xae, 0xf0, 0xa1, 0x40, 0x10, 0x00, 0x00, 0xa3, 0x00, 0x11, 0x00,
+    0x00, 0xe8, 0xa1, 0x00, 0x00, 0x00, 0x85, 0xdb, 0x75, 0x27, 0xa1, 0xc0,
+    0x10, 0x00, 0x00, 0x0b, 0x05, 0x00, 0x11, 0x00, 0x00, 0x75, 0x06, 0xff,
+    0x05, 0x40, 0x11, 0x00, 0x00, 0xc7, 0x05, 0x40, 0x10, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xc7, 0x05, 0x80, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0xe8, 0x71, 0x00, 0x00, 0x00, 0x4f, 0x75, 0x8f, 0xe8, 0x69, 0x00,
+    0x00, 0x00, 0x85, 0xdb, 0x75, 0x1b, 0x31, 0xc9, 0xf0, 0xff, 0x05, 0x80,
+    0x11, 0x00, 0x00, 0x41, 0x83, 0x3d, 0x40, 0x12, 0x00, 0x00, 0x00, 0x74,
+    0xef, 0x89, 0x0d, 0xc0, 0x11, 0x00, 0x00, 0xeb, 0x33, 0xbf, 0xf4, 0x01,
+    0x00, 0x00, 0xba, 0x01, 0x00, 0x00, 0x00, 0x88, 0x15, 0x83, 0x11, 0x00,
+    0x00, 0xb9, 0x20, 0x00, 0x00, 0x00, 0xe2, 0xfe, 0x3a, 0x15, 0x83, 0x11,
+    0x00, 0x00, 0x74, 0x06, 0xff, 0x05, 0x00, 0x12, 0x00, 0x00, 0x42, 0x4f,
+    0x75, 0xe1, 0xc7, 0x05, 0x40, 0x12, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+    0xe8, 0x12, 0x00, 0x00, 0x00, 0x85, 0xdb, 0x75, 0x0a, 0xc7, 0x05, 0x80,
+    0x12, 0x00, 0x00, 0xad, 0xde, 0x00, 0x00, 0xfa, 0xf4, 0xeb, 0xfc, 0x83,
+    0xc6, 0x02, 0xf0, 0xff, 0x05, 0x00, 0x10, 0x00, 0x00, 0x39, 0x35, 0x00,
+    0x10, 0x00, 0x00, 0x72, 0xf8, 0xc3, 0x66, 0x90, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x00, 0x00, 0x00, 0x9a, 0xcf, 0x00,
+    0xff, 0xff, 0x00, 0x00, 0x00, 0x92, 0xcf, 0x00, 0x17, 0x00, 0x88, 0x7d,
+    0x00, 0x00,
+};
+
+/* The BIOS only reads the first sector, but q35 wants a larger disk */
+static uint8_t boot_sector[0x7e000];
+
+static const char *disk = "tests/mttcg-test-disk.raw";
+
+static void test_mttcg_ordering(void)
+{
+    char *args;
+    uint32_t done = 0;
+    int i;
+
+    args = g_strdup_printf("-net none -display none "
+                           "-machine accel=tcg,tcg-thread=multi -smp 2 "
+                           "-drive id=hd0,if=none,file=%s,format=raw "
+                           "-device ide-hd,drive=hd0", disk);
+    qtest_start(args);
+
+    /* Wait at most 2 minutes; guest atomics stop the other vCPU */
+    for (i = 0; i < 1200; i++) {
+        done = readl(DONE);
+        if (done == DONE_SIGNATURE) {
+            break;
+        }
+        g_usleep(G_USEC_PER_SEC / 10);
+    }
+    g_assert_cmphex(done, ==, DONE_SIGNATURE);
+
+    g_assert_cmpuint(readl(SBV), ==, 0);
+    g_assert_cmpuint(readl(LOST), ==, 0);
+    g_assert_cmpuint(readl(ACOUNT), >, 0);
+    g_assert_cmpuint(readl(XVAR) & 0xffffff, ==, readl(ACOUNT));
+
+    qtest_quit(global_qtest);
+    g_free(args);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *arch = qtest_get_arch();
+    FILE *f;
+    int ret;
+
+    g_assert(sizeof(boot_code) <= 510);
+    memcpy(boot_sector, boot_code, sizeof(boot_code));
+    boot_sector[0x1fe] = 0x55;
+    boot_sector[0x1ff] = 0xaa;
+
+    f = fopen(disk, "w");
+    if (!f) {
+        fprintf(stderr, "Couldn't open \"%s\": %s", disk, strerror(errno));
+        return 1;
+    }
+    fwrite(boot_sector, 1, sizeof(boot_sector), f);
+    fclose(f);
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* multi-threaded TCG needs an x86-64 Linux host */
+#if defined(__linux__) && defined(__x86_64__)
+    if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
+        qtest_add_func("/mttcg/ordering", test_mttcg_ordering);
+    }
+#endif
+
+    ret = g_test_run();
+    unlink(disk);
+    return ret;
+}
@@ -0,0 +1,173 @@
+/*
+ * QTest testcase for pc-testdev
+ *
+ * The iomem buffer opted out of the global mutex, the ioports did not.
+ * qtest accesses are dispatched from the main loop, which holds the
+ * mutex, so the perf tests measure the cost of dispatch, not contention
+ * between vCPUs.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include "libqtest.h"
+#include "qemu/osdep.h"
+
+#define IOMEM_BASE      0xff000000
+#define IOMEM_LEN       0x10000
+#define IOPORT_BASE     0xe0
+#define IOPORT_BYTE     0xe8
+
+#define PERF_LOOPS      20000
+#define PERF_BURST      256
+
+/* iomem, opted out of the global mutex */
+static void test_iomem(void)
+{
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        writel(IOMEM_BASE + i * 4, 0x11111111 * i);
+    }
+    for (i = 0; i < 16; i++) {
+        g_assert_cmphex(readl(IOMEM_BASE + i * 4), ==, 0x11111111 * i);
+    }
+
+    writeq(IOMEM_BASE + IOMEM_LEN - 8, 0x0123456789abcdefULL);
+    g_assert_cmphex(readq(IOMEM_BASE + IOMEM_LEN - 8), ==,
+                    0x0123456789abcdefULL);
+    g_assert_cmphex(readb(IOMEM_BASE + IOMEM_LEN - 8), ==, 0xef);
+    g_assert_cmphex(readw(IOMEM_BASE + IOMEM_LEN - 2), ==, 0x0123);
+
+    writeb(IOMEM_BASE + 1, 0x5a);
+    g_assert_cmphex(readl(IOMEM_BASE), ==, 0x00005a00);
+}
+
+/* the ioports, which still need the global mutex */
+static void test_ioport(void)
+{
+    outl(IOPORT_BASE, 0xdeadbeef);
+    g_assert_cmphex(inl(IOPORT_BASE), ==, 0xdeadbeef);
+    g_assert_cmphex(inw(IOPORT_BASE + 2), ==, 0xdead);
+
+    outb(IOPORT_BYTE + 1, 0x42);
+    g_assert_cmphex(inb(IOPORT_BYTE + 1), ==, 0x42);
+}
+
+/* binary frames: bursts and bulk transfers, mixed with text commands */
+static void test_binary(void)
+{
+    uint64_t out[16], in[16];
+    uint8_t buf[4096], rbuf[4096];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        out[i] = 0x0101010101010101ULL * (i + 1);
+    }
+    mmio_write_burst(IOMEM_BASE, 8, 8, out, 16);
+    for (i = 0; i < 16; i++) {
+        g_assert_cmphex(readq(IOMEM_BASE + i * 8), ==, out[i]);
+    }
+    mmio_read_burst(IOMEM_BASE, 4, 4, in, 16);
+    for (i = 0; i < 16; i++) {
+        g_assert_cmphex(in[i], ==, readl(IOMEM_BASE + i * 4));
+    }
+
+    /* a zero stride hits the same register every time */
+    mmio_write_burst(IOMEM_BASE, 0, 2, out, 16);
+    g_assert_cmphex(readw(IOMEM_BASE), ==, (uint16_t)out[15]);
+
+    out[0] = 0xdeadbeef;
+    pio_out_burst(IOPORT_BASE, 0, 4, out, 1);
+    pio_in_burst(IOPORT_BASE, 2, 2, in, 2);
+    g_assert_cmphex(in[0], ==, 0xbeef);
+    g_assert_cmphex(in[1], ==, 0xdead);
+
+    for (i = 0; i < sizeof(buf); i++) {
+        buf[i] = i * 7;
+    }
+    memwrite(IOMEM_BASE + 1, buf, sizeof(buf));
+    memread(IOMEM_BASE + 1, rbuf, sizeof(rbuf));
+    g_assert(memcmp(buf, rbuf, sizeof(buf)) == 0);
+    g_assert_cmphex(readb(IOMEM_BASE + 1), ==, buf[0]);
+
+    qmemset(IOMEM_BASE, 0x5a, 16);
+    g_assert_cmphex(readq(IOMEM_BASE + 8), ==, 0x5a5a5a5a5a5a5a5aULL);
+}
+
+static void perf_iomem(void)
+{
+    double duration;
+    int i;
+
+    g_test_timer_start();
+    for (i = 0; i < PERF_LOOPS; i++) {
+        writel(IOMEM_BASE + (i & 0xfff) * 4, i);
+        g_assert_cmpuint(readl(IOMEM_BASE + (i & 0xfff) * 4), ==, i);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("MMIO %u round trips: %f s, %f us each\n",
+                   PERF_LOOPS, duration, duration * 1e6 / PERF_LOOPS);
+}
+
+static void perf_ioport(void)
+{
+    double duration;
+    int i;
+
+    g_test_timer_start();
+    for (i = 0; i < PERF_LOOPS; i++) {
+        outl(IOPORT_BASE, i);
+        g_assert_cmpuint(inl(IOPORT_BASE), ==, i);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("PIO %u round trips: %f s, %f us each\n",
+                   PERF_LOOPS, duration, duration * 1e6 / PERF_LOOPS);
+}
+
+static void perf_iomem_burst(void)
+{
+    uint64_t out[PERF_BURST], in[PERF_BURST];
+    double duration;
+    int i, j;
+
+    g_test_timer_start();
+    for (i = 0; i < PERF_LOOPS; i += PERF_BURST) {
+        for (j = 0; j < PERF_BURST; j++) {
+            out[j] = i + j;
+        }
+        mmio_write_burst(IOMEM_BASE, 4, 4, out, PERF_BURST);
+        mmio_read_burst(IOMEM_BASE, 4, 4, in, PERF_BURST);
+        g_assert(memcmp(in, out, sizeof(in)) == 0);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("MMIO %u burst accesses: %f s, %f us each\n", PERF_LOOPS, duration,
+                   duration * 1e6 / PERF_LOOPS);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/pc-testdev/iomem", test_iomem);
+    qtest_add_func("/pc-testdev/ioport", test_ioport);
+    qtest_add_func("/pc-testdev/binary", test_binary);
+    if (g_test_perf()) {
+        qtest_add_func("/pc-testdev/perf/iomem", perf_iomem);
+        qtest_add_func("/pc-testdev/perf/ioport", perf_ioport);
+        qtest_add_func("/pc-testdev/perf/iomem_burst", perf_iomem_burst);
+    }
+
+    qtest_start("-device pc-testdev");
+    ret = g_test_run();
+
+    qtest_end();
+
+    return ret;
+}
@@ -0,0 +1,111 @@
+/*
+ * Parallel atomic operations test for x86 guests
+ *
+ * Several threads hammer on shared counters with LOCK-prefixed and
+ * implicitly locked instructions; the totals are only correct if the
+ * emulator keeps these instructions atomic while guest threads run on
+ * different host threads.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#define NR_THREADS 4
+#define NR_LOOPS 100000
+
+static volatile uint32_t inc_counter;
+static volatile uint32_t xadd_counter;
+static volatile uint32_t cmpxchg_counter;
+static volatile uint32_t spin_lock_word;
+static volatile uint32_t spin_counter;
+
+static inline void atomic_inc(volatile uint32_t *p)
+{
+    asm volatile("lock incl %0" : "+m" (*p) : : "memory");
+}
+
+static inline uint32_t atomic_xadd(volatile uint32_t *p, uint32_t v)
+{
+    asm volatile("lock xaddl %0, %1" : "+r" (v), "+m" (*p) : : "memory");
+    return v;
+}
+
+static inline uint32_t atomic_cmpxchg(volatile uint32_t *p, uint32_t old,
+                                      uint32_t new)
+{
+    uint32_t prev;
+
+    asm volatile("lock cmpxchgl %2, %1"
+                 : "=a" (prev), "+m" (*p)
+                 : "r" (new), "0" (old)
+                 : "memory");
+    return prev;
+}
+
+/* xchg with a memory operand is locked even without the prefix */
+static inline uint32_t atomic_xchg(volatile uint32_t *p, uint32_t v)
+{
+    asm volatile("xchgl %0, %1" : "+r" (v), "+m" (*p) : : "memory");
+    return v;
+}
+
+static void *thread_func(void *arg)
+{
+    uint32_t old;
+    int i;
+
+    for (i = 0; i < NR_LOOPS; i++) {
+        atomic_inc(&inc_counter);
+        atomic_xadd(&xadd_counter, 2);
+
+        do {
+            old = cmpxchg_counter;
+        } while (atomic_cmpxchg(&cmpxchg_counter, old, old + 1) != old);
+
+        while (atomic_xchg(&spin_lock_word, 1)) {
+            while (spin_lock_word) {
+                asm volatile("pause" : : : "memory");
+            }
+        }
+        spin_counter++;
+        atomic_xchg(&spin_lock_word, 0);
+    }
+    return NULL;
+}
+
+static int check(const char *name, uint32_t val, uint32_t expected)
+{
+    if (val != expected) {
+        printf("%s: got %" PRIu32 ", expected %" PRIu32 "\n",
+               name, val, expected);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[NR_THREADS];
+    uint32_t total = NR_THREADS * NR_LOOPS;
+    int i, err = 0;
+
+    for (i = 0; i < NR_THREADS; i++) {
+        pthread_create(&threads[i], NULL, thread_func, NULL);
+    }
+    for (i = 0; i < NR_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    err |= check("lock inc", inc_counter, total);
+    err |= check("lock xadd", xadd_counter, total * 2);
+    err |= check("lock cmpxchg", cmpxchg_counter, total);
+    err |= check("xchg spinlock", spin_counter, total);
+    if (!err) {
+        printf("Atomic test OK\n");
+    }
+    return err;
+}
@@ -0,0 +1,73 @@
+/*
+ * Faults raised while translating guest code
+ *
+ * The guest jumps to code whose bytes are, partly or entirely, on a page
+ * it cannot read.  The fault is raised by the translator rather than by
+ * generated code, and must still be delivered to the guest as SIGSEGV.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static sigjmp_buf jmp_env;
+static volatile int faults;
+
+static void segv_handler(int sig, siginfo_t *info, void *puc)
+{
+    faults++;
+    siglongjmp(jmp_env, 1);
+}
+
+static void run_at(void *code)
+{
+    if (sigsetjmp(jmp_env, 1) == 0) {
+        ((void (*)(void))code)();
+        printf("FAIL: no fault running code at %p\n", code);
+        exit(1);
+    }
+}
+
+int main(void)
+{
+    struct sigaction act;
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned char *buf;
+
+    buf = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    /* movl $imm32, %eax, with the immediate on the next page */
+    buf[page - 1] = 0xb8;
+    if (mprotect(buf, page, PROT_READ | PROT_EXEC) ||
+        mprotect(buf + page, page, PROT_NONE)) {
+        perror("mprotect");
+        return 1;
+    }
+
+    act.sa_sigaction = segv_handler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &act, NULL);
+
+    /* an instruction that crosses into the unreadable page */
+    run_at(buf + page - 1);
+    /* a block that starts on the unreadable page */
+    run_at(buf + page);
+
+    if (faults != 2) {
+        printf("FAIL: %d faults, expected 2\n", faults);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
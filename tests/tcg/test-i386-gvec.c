@@ -0,0 +1,337 @@
+/*
+ * MMX/SSE2 integer vector operations test for x86 guests
+ *
+ * The translator expands the integer add/sub/logic/compare and
+ * shift-by-immediate instructions with the generic vector expanders:
+ * on hosts with AVX they become host vector instructions, elsewhere
+ * unrolled 64-bit integer operations or the out-of-line helpers.  Every
+ * instruction is run on a set of edge-case and pseudo-random operands,
+ * in its MMX, SSE register, SSE memory and same-register forms, and the
+ * result is compared with a scalar reference computed element by element.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define NR_RANDOM 32
+#define MAX_ERRORS 10
+
+typedef void vec_fn(uint8_t *d, const uint8_t *a, const uint8_t *b);
+
+enum {
+    OP_ADD, OP_SUB, OP_AND, OP_ANDN, OP_OR, OP_XOR, OP_CMPEQ, OP_CMPGT,
+    OP_SHR, OP_SAR, OP_SHL,
+};
+
+#define M16(p) (*(uint8_t (*)[16])(p))
+#define M8(p)  (*(uint8_t (*)[8])(p))
+
+/* "op %xmm1, %xmm0", "op mem, %xmm0", "op %xmm0, %xmm0" and
+   "op %mm1, %mm0".  The memory operand must be 16-byte aligned.  */
+#define BINOP(insn)                                                     \
+static void xmm_##insn(uint8_t *d, const uint8_t *a, const uint8_t *b) \
+{                                                                       \
+    asm volatile("movdqu %1, %%xmm0\n\t"                                \
+                 "movdqu %2, %%xmm1\n\t"                                \
+                 #insn " %%xmm1, %%xmm0\n\t"                            \
+                 "movdqu %%xmm0, %0"                                    \
+                 : "=m" (M16(d)) : "m" (M16(a)), "m" (M16(b))           \
+                 : "xmm0", "xmm1");                                     \
+}                                                                       \
+static void xmm_mem_##insn(uint8_t *d, const uint8_t *a,                \
+                           const uint8_t *b)                            \
+{                                                                       \
+    asm volatile("movdqu %1, %%xmm0\n\t"                                \
+                 #insn " %2, %%xmm0\n\t"                                \
+                 "movdqu %%xmm0, %0"                                    \
+                 : "=m" (M16(d)) : "m" (M16(a)), "m" (M16(b))           \
+                 : "xmm0");                                             \
+}                                                                       \
+static void xmm_same_##insn(uint8_t *d, const uint8_t *a,               \
+                            const uint8_t *b)                           \
+{                                                                       \
+    asm volatile("movdqu %1, %%xmm0\n\t"                                \
+                 #insn " %%xmm0, %%xmm0\n\t"                            \
+                 "movdqu %%xmm0, %0"                                    \
+                 : "=m" (M16(d)) : "m" (M16(a)) : "xmm0");              \
+}                                                                       \
+static void mmx_##insn(uint8_t *d, const uint8_t *a, const uint8_t *b) \
+{                                                                       \
+    asm volatile("movq %1, %%mm0\n\t"                                   \
+                 "movq %2, %%mm1\n\t"                                   \
+                 #insn " %%mm1, %%mm0\n\t"                              \
+                 "movq %%mm0, %0\n\t"                                   \
+                 "emms"                                                 \
+                 : "=m" (M8(d)) : "m" (M8(a)), "m" (M8(b))              \
+                 : "mm0", "mm1");                                       \
+}
+
+/* "op $n, %xmm0" and "op $n, %mm0" */
+#define SHIFTOP(insn, esize, op, n)                                     \
+static void xmm_##insn##_##n(uint8_t *d, const uint8_t *a,              \
+                             const uint8_t *b)                          \
+{                                                                       \
+    asm volatile("movdqu %1, %%xmm0\n\t"                                \
+                 #insn " $" #n ", %%xmm0\n\t"                           \
+                 "movdqu %%xmm0, %0"                                    \
+                 : "=m" (M16(d)) : "m" (M16(a)) : "xmm0");              \
+}                                                                       \
+static void mmx_##insn##_##n(uint8_t *d, const uint8_t *a,              \
+                             const uint8_t *b)                          \
+{                                                                       \
+    asm volatile("movq %1, %%mm0\n\t"                                   \
+                 #insn " $" #n ", %%mm0\n\t"                            \
+                 "movq %%mm0, %0\n\t"                                   \
+                 "emms"                                                 \
+                 : "=m" (M8(d)) : "m" (M8(a)) : "mm0");                 \
+}
+
+/* Counts at and around the element sizes, including the out of range
+   ones that clear the element or fill it with the sign bit.  */
+#define SHIFT_COUNTS(X, insn, esize, op)                                \
+    X(insn, esize, op, 0) X(insn, esize, op, 1) X(insn, esize, op, 7)   \
+    X(insn, esize, op, 8) X(insn, esize, op, 15) X(insn, esize, op, 16) \
+    X(insn, esize, op, 31) X(insn, esize, op, 32)                       \
+    X(insn, esize, op, 63) X(insn, esize, op, 64)                       \
+    X(insn, esize, op, 255)
+
+#define BINOPS(X) \
+    X(paddb, 1, OP_ADD) X(paddw, 2, OP_ADD) X(paddd, 4, OP_ADD)         \
+    X(paddq, 8, OP_ADD) X(psubb, 1, OP_SUB) X(psubw, 2, OP_SUB)         \
+    X(psubd, 4, OP_SUB) X(psubq, 8, OP_SUB) X(pand, 8, OP_AND)          \
+    X(pandn, 8, OP_ANDN) X(por, 8, OP_OR) X(pxor, 8, OP_XOR)            \
+    X(pcmpeqb, 1, OP_CMPEQ) X(pcmpeqw, 2, OP_CMPEQ)                     \
+    X(pcmpeqd, 4, OP_CMPEQ) X(pcmpgtb, 1, OP_CMPGT)                     \
+    X(pcmpgtw, 2, OP_CMPGT) X(pcmpgtd, 4, OP_CMPGT)
+
+#define SHIFTOPS(X) \
+    X(psrlw, 2, OP_SHR) X(psrld, 4, OP_SHR) X(psrlq, 8, OP_SHR)         \
+    X(psraw, 2, OP_SAR) X(psrad, 4, OP_SAR)                             \
+    X(psllw, 2, OP_SHL) X(pslld, 4, OP_SHL) X(psllq, 8, OP_SHL)
+
+#define DEF_BINOP(insn, esize, op) BINOP(insn)
+#define DEF_SHIFTOPS(insn, esize, op) SHIFT_COUNTS(SHIFTOP, insn, esize, op)
+BINOPS(DEF_BINOP)
+SHIFTOPS(DEF_SHIFTOPS)
+
+struct vec_test {
+    const char *name;
+    int esize;
+    int op;
+    int count;
+    vec_fn *xmm;
+    vec_fn *xmm_mem;
+    vec_fn *xmm_same;
+    vec_fn *mmx;
+};
+
+#define BINOP_ENTRY(insn, esize, op) \
+    { #insn, esize, op, 0, xmm_##insn, xmm_mem_##insn, xmm_same_##insn, \
+      mmx_##insn },
+#define SHIFTOP_ENTRY(insn, esize, op, n) \
+    { #insn " $" #n, esize, op, n, xmm_##insn##_##n, NULL, NULL, \
+      mmx_##insn##_##n },
+#define SHIFTOPS_ENTRIES(insn, esize, op) \
+    SHIFT_COUNTS(SHIFTOP_ENTRY, insn, esize, op)
+
+static const struct vec_test tests[] = {
+    BINOPS(BINOP_ENTRY)
+    SHIFTOPS(SHIFTOPS_ENTRIES)
+};
+
+static const uint64_t patterns[] = {
+    0,
+    ~0ULL,
+    0x8080808080808080ULL,
+    0x7f7f7f7f7f7f7f7fULL,
+    0x8000800080008000ULL,
+    0x7fff7fff7fff7fffULL,
+    0x8000000080000000ULL,
+    0x7fffffff7fffffffULL,
+    0x8000000000000000ULL,
+    0x7fffffffffffffffULL,
+    0x00ff00ff00ff00ffULL,
+    0x0123456789abcdefULL,
+    0xfedcba9876543210ULL,
+};
+
+#define NR_PATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+#define NR_INPUTS (NR_PATTERNS + NR_RANDOM)
+
+static uint8_t inputs[NR_INPUTS][16] __attribute__((aligned(16)));
+
+static uint64_t get_elem(const uint8_t *p, int esize)
+{
+    uint64_t v = 0;
+    int i;
+
+    for (i = esize - 1; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static void set_elem(uint8_t *p, int esize, uint64_t v)
+{
+    int i;
+
+    for (i = 0; i < esize; i++) {
+        p[i] = v;
+        v >>= 8;
+    }
+}
+
+static int64_t sext(uint64_t v, int bits)
+{
+    return bits == 64 ? (int64_t)v : (int64_t)(v << (64 - bits)) >> (64 - bits);
+}
+
+/* The scalar reference, one element at a time.  */
+static void ref_op(const struct vec_test *t, uint8_t *d, const uint8_t *a,
+                   const uint8_t *b, int len)
+{
+    int bits = t->esize * 8;
+    uint64_t mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+    int i;
+
+    for (i = 0; i < len; i += t->esize) {
+        uint64_t x = get_elem(a + i, t->esize);
+        uint64_t y = get_elem(b + i, t->esize);
+        uint64_t r;
+
+        switch (t->op) {
+        case OP_ADD:
+            r = x + y;
+            break;
+        case OP_SUB:
+            r = x - y;
+            break;
+        case OP_AND:
+            r = x & y;
+            break;
+        case OP_ANDN:
+            r = ~x & y;
+            break;
+        case OP_OR:
+            r = x | y;
+            break;
+        case OP_XOR:
+            r = x ^ y;
+            break;
+        case OP_CMPEQ:
+            r = x == y ? ~0ULL : 0;
+            break;
+        case OP_CMPGT:
+            r = sext(x, bits) > sext(y, bits) ? ~0ULL : 0;
+            break;
+        case OP_SHR:
+            r = t->count >= bits ? 0 : x >> t->count;
+            break;
+        case OP_SAR:
+            r = sext(x, bits) >> (t->count >= bits ? bits - 1 : t->count);
+            break;
+        case OP_SHL:
+            r = t->count >= bits ? 0 : x << t->count;
+            break;
+        default:
+            abort();
+        }
+        set_elem(d + i, t->esize, r & mask);
+    }
+}
+
+static void print_vec(const char *label, const uint8_t *p, int len)
+{
+    int i;
+
+    printf("  %s:", label);
+    for (i = len - 1; i >= 0; i--) {
+        printf("%s%02x", (i & 7) == 7 ? " " : "", p[i]);
+    }
+    printf("\n");
+}
+
+static int check_form(const struct vec_test *t, const char *form,
+                      vec_fn *fn, int len, const uint8_t *a,
+                      const uint8_t *b, int *errors)
+{
+    uint8_t d[16] __attribute__((aligned(16)));
+    uint8_t ref[16];
+
+    if (!fn) {
+        return 0;
+    }
+    memset(d, 0x55, sizeof(d));
+    fn(d, a, b);
+    ref_op(t, ref, a, b, len);
+    if (memcmp(d, ref, len) == 0) {
+        return 0;
+    }
+    if ((*errors)++ < MAX_ERRORS) {
+        printf("%s (%s) mismatch\n", t->name, form);
+        print_vec("a", a, len);
+        print_vec("b", b, len);
+        print_vec("got", d, len);
+        print_vec("expected", ref, len);
+    }
+    return 1;
+}
+
+static void init_inputs(void)
+{
+    uint64_t seed = 0x2545f4914f6cdd1dULL;
+    unsigned i, j;
+
+    /* Pair each pattern with the next one so that the two halves of
+       the xmm register differ.  */
+    for (i = 0; i < NR_PATTERNS; i++) {
+        uint64_t lo = patterns[i];
+        uint64_t hi = patterns[(i + 1) % NR_PATTERNS];
+
+        set_elem(inputs[i], 8, lo);
+        set_elem(inputs[i] + 8, 8, hi);
+    }
+    for (; i < NR_INPUTS; i++) {
+        for (j = 0; j < 16; j += 8) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            set_elem(inputs[i] + j, 8, seed);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned i, j, k;
+    int err = 0;
+
+    init_inputs();
+    for (k = 0; k < sizeof(tests) / sizeof(tests[0]); k++) {
+        const struct vec_test *t = &tests[k];
+        int errors = 0;
+
+        for (i = 0; i < NR_INPUTS; i++) {
+            const uint8_t *a = inputs[i];
+
+            check_form(t, "xmm, same", t->xmm_same, 16, a, a, &errors);
+            for (j = 0; j < NR_INPUTS; j++) {
+                const uint8_t *b = inputs[j];
+
+                check_form(t, "xmm", t->xmm, 16, a, b, &errors);
+                check_form(t, "xmm, mem", t->xmm_mem, 16, a, b, &errors);
+                check_form(t, "mmx", t->mmx, 8, a, b, &errors);
+            }
+        }
+        if (errors) {
+            printf("%s: %d mismatches\n", t->name, errors);
+            err = 1;
+        }
+    }
+    if (!err) {
+        printf("Vector test OK\n");
+    }
+    return err;
+}
@@ -0,0 +1,131 @@
+/*
+ * Persistent translation cache and partly replaced file mappings
+ *
+ * The guest maps a file of code and then maps anonymous memory with
+ * MAP_FIXED over part of it, as the dynamic linker does with the data
+ * segment of a library.  The code that is still mapped from the file must
+ * keep its cache file: run under "-tb-cache DIR", the test leaves one
+ * cache file more for each of its two mappings than when it is run with
+ * the "nocode" argument, which does not run the mapped code.
+ *
+ * Cache files are keyed on the identity of the mapped file, so the files
+ * of code are only written by the first run and reused by the next ones.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define NB_PAGES 3
+
+static long page;
+static int nocode;
+
+/* movl $val, %eax; ret */
+static void put_func(unsigned char *p, int val)
+{
+    p[0] = 0xb8;
+    memcpy(p + 1, &val, 4);
+    p[5] = 0xc3;
+}
+
+static int call_func(unsigned char *p)
+{
+    return ((int (*)(void))p)();
+}
+
+static unsigned char *map_code(const char *path)
+{
+    unsigned char *buf;
+    void *p;
+    int fd, i;
+
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        buf = calloc(NB_PAGES, page);
+        for (i = 0; i < NB_PAGES; i++) {
+            put_func(buf + i * page, i + 1);
+        }
+        if (write(fd, buf, NB_PAGES * page) != NB_PAGES * page) {
+            perror(path);
+            exit(1);
+        }
+        free(buf);
+    } else {
+        fd = open(path, O_RDONLY);
+    }
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    p = mmap(NULL, NB_PAGES * page, PROT_READ | PROT_EXEC, MAP_PRIVATE,
+             fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return p;
+}
+
+static void map_over(unsigned char *p)
+{
+    if (mmap(p, page, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != p) {
+        perror("mmap MAP_FIXED");
+        exit(1);
+    }
+}
+
+static void check(unsigned char *p, int expected)
+{
+    int i, val;
+
+    if (nocode) {
+        return;
+    }
+    /* run it enough times to be sure it was translated and cached */
+    for (i = 0; i < 100; i++) {
+        val = call_func(p);
+        if (val != expected) {
+            printf("FAIL: code at %p returned %d instead of %d\n",
+                   p, val, expected);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char *code;
+
+    page = sysconf(_SC_PAGESIZE);
+    nocode = argc > 1 && !strcmp(argv[1], "nocode");
+
+    /* the tail of the mapping is replaced */
+    code = map_code("test-i386-tbcache.tail");
+    map_over(code + 2 * page);
+    check(code, 1);
+    check(code + page, 2);
+
+    /* a hole in the middle of the mapping */
+    code = map_code("test-i386-tbcache.hole");
+    map_over(code + page);
+    check(code, 1);
+    check(code + 2 * page, 3);
+
+    /* the replaced page is not code from the file any more */
+    if (!nocode) {
+        put_func(code + page, 4);
+    }
+    mprotect(code + page, page, PROT_READ | PROT_EXEC);
+    check(code + page, 4);
+
+    printf("OK\n");
+    return 0;
+}
@@ -15,6 +15,7 @@
 #include "qemu/timer.h"
 #include "qemu/sockets.h"
 #include "qemu/error-report.h"
+#include "qapi/error.h"
 
 static AioContext *ctx;
 
@@ -376,6 +377,60 @@ static void test_flush_event_notifier(void)
     event_notifier_cleanup(&data.e);
 }
 
+#ifndef _WIN32
+/* Busy polling is only implemented in aio-posix.c */
+static bool event_poll_cb(void *opaque)
+{
+    EventNotifierTestData *data = opaque;
+
+    if (data->active == 0) {
+        return false;
+    }
+    data->active--;
+    return true;
+}
+
+static void test_poll_event_notifier(void)
+{
+    EventNotifierTestData data = { .n = 0, .active = 0 };
+    uint64_t hits = ctx->poll_hits, misses = ctx->poll_misses;
+
+    event_notifier_init(&data.e, false);
+    aio_set_event_notifier(ctx, &data.e, event_ready_cb);
+    aio_set_event_notifier_poll(ctx, &data.e, event_poll_cb);
+    aio_context_set_poll_params(ctx, 1000000000, 0, 0, &error_abort);
+
+    /* No polling window yet: sleep until the notifier fires, which teaches
+     * the context that a polling window would have been useful.  Nothing
+     * was polled, so this is not a miss.
+     */
+    event_notifier_set(&data.e);
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.n, ==, 1);
+    g_assert_cmpint(ctx->poll_misses, ==, misses);
+    g_assert_cmpint(ctx->poll_ns, >, 0);
+
+    /* The poll handler finds nothing and the notifier wakes us up */
+    event_notifier_set(&data.e);
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.n, ==, 2);
+    g_assert_cmpint(ctx->poll_misses, ==, misses + 1);
+
+    /* Now work is found by the poll handler, without sleeping */
+    data.active = 1;
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.active, ==, 0);
+    g_assert_cmpint(data.n, ==, 2);
+    g_assert_cmpint(ctx->poll_hits, ==, hits + 1);
+
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+    g_assert_cmpint(ctx->poll_ns, ==, 0);
+    aio_set_event_notifier(ctx, &data.e, NULL);
+    g_assert(!aio_poll(ctx, false));
+    event_notifier_cleanup(&data.e);
+}
+#endif
+
 static void test_wait_event_notifier_noflush(void)
 {
     EventNotifierTestData data = { .n = 0 };
@@ -481,6 +536,100 @@ static void test_timer_schedule(void)
     timer_del(&data.timer);
 }
 
+/* More handlers than the threshold at which aio-posix.c switches to epoll */
+#define MANY_FDS 128
+
+static void test_many_event_notifiers(void)
+{
+    EventNotifierTestData *data = g_new0(EventNotifierTestData, MANY_FDS);
+    int i;
+
+    for (i = 0; i < MANY_FDS; i++) {
+        event_notifier_init(&data[i].e, false);
+        aio_set_event_notifier(ctx, &data[i].e, event_ready_cb);
+    }
+#ifdef CONFIG_EPOLL_CREATE1
+    g_assert(ctx->epoll_enabled);
+#endif
+    g_assert(!aio_poll(ctx, false));
+
+    event_notifier_set(&data[MANY_FDS / 2].e);
+    g_assert(aio_poll(ctx, true));
+    for (i = 0; i < MANY_FDS; i++) {
+        g_assert_cmpint(data[i].n, ==, i == MANY_FDS / 2);
+    }
+
+    /* Handlers removed and re-added while the set is in use */
+    aio_set_event_notifier(ctx, &data[0].e, NULL);
+    event_notifier_set(&data[0].e);
+    g_assert(!aio_poll(ctx, false));
+    aio_set_event_notifier(ctx, &data[0].e, event_ready_cb);
+    g_assert(aio_poll(ctx, false));
+    g_assert_cmpint(data[0].n, ==, 1);
+
+    for (i = 0; i < MANY_FDS; i++) {
+        aio_set_event_notifier(ctx, &data[i].e, NULL);
+        event_notifier_cleanup(&data[i].e);
+    }
+    g_assert(!aio_poll(ctx, false));
+    g_free(data);
+}
+
+/* Measure the cost of one event loop iteration as the number of registered
+ * fds grows, with and without epoll.  Only one fd is ever ready.
+ */
+static int64_t bench_event_notifiers(int nfds, bool use_epoll, int iterations)
+{
+    EventNotifierTestData *data = g_new0(EventNotifierTestData, nfds);
+    AioContext *bctx = aio_context_new(&error_abort);
+    int64_t start, elapsed;
+    int i;
+
+    if (!use_epoll) {
+        bctx->epoll_available = false;
+    }
+    for (i = 0; i < nfds; i++) {
+        event_notifier_init(&data[i].e, false);
+        aio_set_event_notifier(bctx, &data[i].e, event_ready_cb);
+    }
+
+    start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    for (i = 0; i < iterations; i++) {
+        event_notifier_set(&data[nfds - 1].e);
+        aio_poll(bctx, true);
+    }
+    elapsed = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+    g_assert_cmpint(data[nfds - 1].n, ==, iterations);
+
+    for (i = 0; i < nfds; i++) {
+        aio_set_event_notifier(bctx, &data[i].e, NULL);
+        event_notifier_cleanup(&data[i].e);
+    }
+    aio_context_unref(bctx);
+    g_free(data);
+
+    return elapsed / iterations;
+}
+
+static void test_bench_event_notifiers(void)
+{
+    static const int nfds[] = { 1, 16, 64, 256, 512 };
+    int i;
+
+    if (!g_test_perf()) {
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(nfds); i++) {
+        int64_t ppoll_ns = bench_event_notifiers(nfds[i], false, 100000);
+        int64_t epoll_ns = bench_event_notifiers(nfds[i], true, 100000);
+
+        g_test_message("%4d fds: ppoll %6" PRId64 " ns/iter, "
+                       "epoll %6" PRId64 " ns/iter",
+                       nfds[i], ppoll_ns, epoll_ns);
+    }
+}
+
 /* Now the same tests, using the context as a GSource.  They are
  * very similar to the ones above, with g_main_context_iteration
  * replacing aio_poll.  However:
@@ -843,7 +992,12 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait",              test_wait_event_notifier);
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
+#ifndef _WIN32
+    g_test_add_func("/aio/event/poll",              test_poll_event_notifier);
+#endif
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
+    g_test_add_func("/aio/event/many",              test_many_event_notifiers);
+    g_test_add_func("/aio/event/bench",             test_bench_event_notifiers);
 
     g_test_add_func("/aio-gsource/notify",                  test_source_notify);
     g_test_add_func("/aio-gsource/flush",                   test_source_flush);
@@ -0,0 +1,79 @@
+/*
+ * Bitmap unit-tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include "qemu/bitmap.h"
+
+#define BMAP_BITS (BITS_PER_LONG * 4)
+
+/* Every (start, nr) pair over a few words, against the non-atomic ops */
+static void test_bitmap_set_atomic(void)
+{
+    unsigned long *bmap = bitmap_new(BMAP_BITS);
+    unsigned long *ref = bitmap_new(BMAP_BITS);
+    long start, nr;
+
+    for (start = 0; start < BMAP_BITS; start++) {
+        for (nr = 0; start + nr <= BMAP_BITS; nr++) {
+            bitmap_zero(bmap, BMAP_BITS);
+            bitmap_zero(ref, BMAP_BITS);
+            bitmap_set_atomic(bmap, start, nr);
+            bitmap_set(ref, start, nr);
+            g_assert(bitmap_equal(bmap, ref, BMAP_BITS));
+        }
+    }
+
+    g_free(bmap);
+    g_free(ref);
+}
+
+static void test_bitmap_test_and_clear_atomic(void)
+{
+    unsigned long *bmap = bitmap_new(BMAP_BITS);
+    unsigned long *ref = bitmap_new(BMAP_BITS);
+    long start, nr;
+
+    for (start = 0; start < BMAP_BITS; start++) {
+        for (nr = 0; start + nr <= BMAP_BITS; nr++) {
+            /* a full bitmap: the range was dirty iff it is not empty */
+            bitmap_fill(bmap, BMAP_BITS);
+            bitmap_fill(ref, BMAP_BITS);
+            g_assert(bitmap_test_and_clear_atomic(bmap, start, nr) == !!nr);
+            bitmap_clear(ref, start, nr);
+            g_assert(bitmap_equal(bmap, ref, BMAP_BITS));
+
+            /* the range is now clean; bits outside it are left alone */
+            g_assert(!bitmap_test_and_clear_atomic(bmap, start, nr));
+            g_assert(bitmap_equal(bmap, ref, BMAP_BITS));
+        }
+    }
+
+    /* a single bit at either end of the range is found */
+    bitmap_zero(bmap, BMAP_BITS);
+    set_bit_atomic(BITS_PER_LONG - 1, bmap);
+    g_assert(!bitmap_test_and_clear_atomic(bmap, BITS_PER_LONG,
+                                           BITS_PER_LONG * 2));
+    g_assert(bitmap_test_and_clear_atomic(bmap, BITS_PER_LONG - 1,
+                                          BITS_PER_LONG * 2));
+    g_assert(bitmap_empty(bmap, BMAP_BITS));
+
+    set_bit_atomic(BITS_PER_LONG * 3, bmap);
+    g_assert(bitmap_test_and_clear_atomic(bmap, 1, BITS_PER_LONG * 3));
+    g_assert(bitmap_empty(bmap, BMAP_BITS));
+
+    g_free(bmap);
+    g_free(ref);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bitmap/set_atomic", test_bitmap_set_atomic);
+    g_test_add_func("/bitmap/test_and_clear_atomic",
+                    test_bitmap_test_and_clear_atomic);
+    return g_test_run();
+}
@@ -0,0 +1,176 @@
+/*
+ * Test the resizable hash table
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include "qemu/qht.h"
+#include "qemu/rcu.h"
+
+#define N 5000
+
+static QHT ht;
+static int32_t arr[N];
+
+/* a small @hash_bits gives few distinct hashes, and thus long chains */
+static uint32_t hash_of(int32_t val, int hash_bits)
+{
+    if (hash_bits >= 32) {
+        return val;
+    }
+    return (uint32_t)val & ((1u << hash_bits) - 1);
+}
+
+static bool is_equal(const void *obj, const void *userp)
+{
+    const int32_t *a = obj;
+    const int32_t *b = userp;
+
+    return *a == *b;
+}
+
+static void check(int start, int end, bool present, int hash_bits)
+{
+    int i;
+
+    rcu_read_lock();
+    for (i = start; i < end; i++) {
+        int32_t *p = qht_lookup(&ht, is_equal, &arr[i],
+                                hash_of(arr[i], hash_bits));
+
+        if (present) {
+            g_assert(p == &arr[i]);
+        } else {
+            g_assert(p == NULL);
+        }
+    }
+    rcu_read_unlock();
+}
+
+static void insert(int start, int end, int hash_bits)
+{
+    int i;
+
+    for (i = start; i < end; i++) {
+        g_assert(qht_insert(&ht, &arr[i], hash_of(arr[i], hash_bits)));
+    }
+}
+
+static void rm(int start, int end, int hash_bits)
+{
+    int i;
+
+    for (i = start; i < end; i++) {
+        g_assert(qht_remove(&ht, &arr[i], hash_of(arr[i], hash_bits)));
+    }
+}
+
+static void count_func(QHT *ht, void *obj, uint32_t hash, void *userp)
+{
+    unsigned int *count = userp;
+
+    (*count)++;
+}
+
+static unsigned int count_entries(void)
+{
+    unsigned int count = 0;
+
+    qht_iter(&ht, count_func, &count);
+    return count;
+}
+
+static void do_test(unsigned int mode, int hash_bits)
+{
+    QHTStats stats;
+    size_t bucket_slots;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        arr[i] = i;
+    }
+    qht_init(&ht, 64, mode);
+    qht_statistics_init(&ht, &stats);
+    bucket_slots = stats.slots / stats.head_buckets;
+
+    insert(0, N, hash_bits);
+    check(0, N, true, hash_bits);
+    g_assert_cmpuint(count_entries(), ==, N);
+
+    /* duplicates are refused */
+    g_assert(!qht_insert(&ht, &arr[10], hash_of(arr[10], hash_bits)));
+
+    /* removing from the middle of chains keeps the rest reachable */
+    for (i = 0; i < N; i += 3) {
+        g_assert(qht_remove(&ht, &arr[i], hash_of(arr[i], hash_bits)));
+        g_assert(!qht_remove(&ht, &arr[i], hash_of(arr[i], hash_bits)));
+    }
+    for (i = 0; i < N; i++) {
+        rcu_read_lock();
+        g_assert(qht_lookup(&ht, is_equal, &arr[i],
+                            hash_of(arr[i], hash_bits)) ==
+                 (i % 3 ? &arr[i] : NULL));
+        rcu_read_unlock();
+    }
+
+    qht_statistics_init(&ht, &stats);
+    g_assert_cmpuint(stats.entries, ==, N - (N + 2) / 3);
+    g_assert_cmpuint(stats.used_head_buckets, <=, stats.head_buckets);
+    g_assert_cmpuint(stats.entries, <=, stats.slots);
+
+    g_assert(qht_resize(&ht, N * 4));
+    g_assert(!qht_resize(&ht, N * 4));
+    for (i = 0; i < N; i += 3) {
+        g_assert(qht_insert(&ht, &arr[i], hash_of(arr[i], hash_bits)));
+    }
+    check(0, N, true, hash_bits);
+
+    rm(0, N / 2, hash_bits);
+    check(0, N / 2, false, hash_bits);
+    check(N / 2, N, true, hash_bits);
+
+    qht_reset(&ht);
+    check(0, N, false, hash_bits);
+    g_assert_cmpuint(count_entries(), ==, 0);
+    qht_statistics_init(&ht, &stats);
+    g_assert_cmpuint(stats.entries, ==, 0);
+    g_assert_cmpuint(stats.used_head_buckets, ==, 0);
+    /* overflow buckets are gone */
+    g_assert_cmpuint(stats.slots, ==, stats.head_buckets * bucket_slots);
+
+    insert(0, N, hash_bits);
+    check(0, N, true, hash_bits);
+
+    qht_destroy(&ht);
+}
+
+static void test_fixed(void)
+{
+    do_test(0, 4);
+    do_test(0, 32);
+}
+
+static void test_resize(void)
+{
+    QHTStats stats;
+
+    do_test(QHT_MODE_AUTO_RESIZE, 32);
+
+    /* with a well-spread hash the table grows instead of chaining */
+    qht_init(&ht, 64, QHT_MODE_AUTO_RESIZE);
+    insert(0, N, 32);
+    qht_statistics_init(&ht, &stats);
+    g_assert_cmpuint(stats.head_buckets, >, 64);
+    g_assert_cmpuint(stats.entries, ==, N);
+    qht_destroy(&ht);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/qht/fixed", test_fixed);
+    g_test_add_func("/qht/resize", test_resize);
+    return g_test_run();
+}
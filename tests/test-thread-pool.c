@@ -5,6 +5,7 @@
 #include "block/block.h"
 #include "qemu/timer.h"
 #include "qemu/error-report.h"
+#include "qapi/error.h"
 
 static AioContext *ctx;
 static ThreadPool *pool;
@@ -133,6 +134,60 @@ static void test_submit_many(void)
     }
 }
 
+static void test_stats(void)
+{
+    ThreadPoolInfo *before, *after;
+
+    before = thread_pool_get_info(pool);
+    test_submit_many();
+    after = thread_pool_get_info(pool);
+
+    g_assert_cmpint(after->completed, ==, before->completed + 100);
+    g_assert_cmpint(after->queue_depth, ==, 0);
+    g_assert_cmpint(after->max_queue_depth, >=, 1);
+    g_assert_cmpint(after->wait_ns, >=, before->wait_ns);
+    g_assert_cmpint(after->service_ns, >, before->service_ns);
+    g_assert_cmpint(after->threads, <=, after->max_threads);
+
+    qapi_free_ThreadPoolInfo(before);
+    qapi_free_ThreadPoolInfo(after);
+}
+
+static void test_min_threads(void)
+{
+    ThreadPoolInfo *info = NULL;
+    int i;
+
+    aio_context_set_thread_pool_params(ctx, 4, 64, 10000, -1, &error_abort);
+
+    /* Workers are started from a bottom half, then start each other */
+    for (i = 0; i < 500; i++) {
+        aio_poll(ctx, false);
+        info = thread_pool_get_info(pool);
+        if (info->idle_threads >= 4) {
+            break;
+        }
+        qapi_free_ThreadPoolInfo(info);
+        info = NULL;
+        g_usleep(10000);
+    }
+    g_assert(info);
+    g_assert_cmpint(info->min_threads, ==, 4);
+    g_assert_cmpint(info->threads, >=, 4);
+    qapi_free_ThreadPoolInfo(info);
+
+    aio_context_set_thread_pool_params(ctx, 0, THREAD_POOL_MAX_THREADS_DEFAULT,
+                                       THREAD_POOL_IDLE_TIMEOUT_DEFAULT, -1,
+                                       &error_abort);
+
+    /* Invalid combinations are rejected */
+    aio_context_set_thread_pool_params(ctx, 8, 4, 10000, -1, NULL);
+    info = thread_pool_get_info(pool);
+    g_assert_cmpint(info->min_threads, ==, 0);
+    g_assert_cmpint(info->max_threads, ==, THREAD_POOL_MAX_THREADS_DEFAULT);
+    qapi_free_ThreadPoolInfo(info);
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -241,6 +296,8 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/stats", test_stats);
+    g_test_add_func("/thread-pool/min-threads", test_min_threads);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
@@ -47,12 +47,25 @@
 #define QEMU_CMD        QEMU_CMD_ACCEL QEMU_CMD_MEM QEMU_CMD_CHR \
                         QEMU_CMD_NETDEV QEMU_CMD_NET QEMU_CMD_ROM
 
+#define QEMU_CMD_MQ_NETDEV " -netdev vhost-user,id=net0,chardev=chr0," \
+                           "vhostforce,queues=2"
+#define QEMU_CMD_MQ_NET    " -device virtio-net-pci,netdev=net0,mq=on," \
+                           "vectors=6 "
+#define QEMU_CMD_MQ     QEMU_CMD_ACCEL QEMU_CMD_MEM QEMU_CMD_CHR \
+                        QEMU_CMD_MQ_NETDEV QEMU_CMD_MQ_NET QEMU_CMD_ROM
+
 #define HUGETLBFS_MAGIC       0x958458f6
 
 /*********** FROM hw/virtio/vhost-user.c *************************************/
 
 #define VHOST_MEMORY_MAX_NREGIONS    8
 
+#define VHOST_USER_F_PROTOCOL_FEATURES 30
+#define VHOST_USER_PROTOCOL_F_MQ        0
+#define VHOST_USER_PROTOCOL_F_LOG_SHMFD 1
+
+#define VHOST_LOG_PAGE 0x1000
+
 typedef enum VhostUserRequest {
     VHOST_USER_NONE = 0,
     VHOST_USER_GET_FEATURES = 1,
@@ -69,6 +82,10 @@ typedef enum VhostUserRequest {
     VHOST_USER_SET_VRING_KICK = 12,
     VHOST_USER_SET_VRING_CALL = 13,
     VHOST_USER_SET_VRING_ERR = 14,
+    VHOST_USER_GET_PROTOCOL_FEATURES = 15,
+    VHOST_USER_SET_PROTOCOL_FEATURES = 16,
+    VHOST_USER_GET_QUEUE_NUM = 17,
+    VHOST_USER_SET_VRING_ENABLE = 18,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -85,6 +102,11 @@ typedef struct VhostUserMemory {
     VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
 } VhostUserMemory;
 
+typedef struct VhostUserLog {
+    uint64_t mmap_size;
+    uint64_t mmap_offset;
+} VhostUserLog;
+
 typedef struct VhostUserMsg {
     VhostUserRequest request;
 
@@ -97,6 +119,7 @@ typedef struct VhostUserMsg {
         struct vhost_vring_state state;
         struct vhost_vring_addr addr;
         VhostUserMemory memory;
+        VhostUserLog log;
     };
 } QEMU_PACKED VhostUserMsg;
 
@@ -111,10 +134,24 @@ static VhostUserMsg m __attribute__ ((unused));
 #define VHOST_USER_VERSION    (0x1)
 /*****************************************************************************/
 
-int fds_num = 0, fds[VHOST_MEMORY_MAX_NREGIONS];
-static VhostUserMemory memory;
-static GMutex *data_mutex;
-static GCond *data_cond;
+/* A minimal vhost-user backend: it records the memory table and the dirty
+ * log it is given, and answers the requests that need a reply.
+ */
+typedef struct TestServer {
+    gchar *socket_path;
+    gchar *chr_name;
+    CharDriverState *chr;
+    int fds_num;
+    int fds[VHOST_MEMORY_MAX_NREGIONS];
+    VhostUserMemory memory;
+    GMutex *data_mutex;
+    GCond *data_cond;
+    int log_fd;
+    uint64_t log_size;
+    /* queue pairs reported with VHOST_USER_PROTOCOL_F_MQ if above 1 */
+    uint64_t queues;
+    int requests[VHOST_USER_MAX];
+} TestServer;
 
 static gint64 _get_time(void)
 {
@@ -201,58 +238,97 @@ static GThread *_thread_new(const gchar *name, GThreadFunc func, gpointer data)
     return thread;
 }
 
-static void read_guest_mem(void)
+static void wait_for_fds(TestServer *s)
 {
-    uint32_t *guest_mem;
     gint64 end_time;
-    int i, j;
-    size_t size;
 
-    g_mutex_lock(data_mutex);
+    g_mutex_lock(s->data_mutex);
 
     end_time = _get_time() + 5 * G_TIME_SPAN_SECOND;
-    while (!fds_num) {
-        if (!_cond_wait_until(data_cond, data_mutex, end_time)) {
+    while (!s->fds_num) {
+        if (!_cond_wait_until(s->data_cond, s->data_mutex, end_time)) {
             /* timeout has passed */
-            g_assert(fds_num);
+            g_assert(s->fds_num);
             break;
         }
     }
 
     /* check for sanity */
-    g_assert_cmpint(fds_num, >, 0);
-    g_assert_cmpint(fds_num, ==, memory.nregions);
+    g_assert_cmpint(s->fds_num, >, 0);
+    g_assert_cmpint(s->fds_num, ==, s->memory.nregions);
+
+    g_mutex_unlock(s->data_mutex);
+}
+
+static void wait_for_log_fd(TestServer *s)
+{
+    gint64 end_time;
+
+    g_mutex_lock(s->data_mutex);
 
-    /* iterate all regions */
-    for (i = 0; i < fds_num; i++) {
+    end_time = _get_time() + 5 * G_TIME_SPAN_SECOND;
+    while (s->log_fd == -1) {
+        if (!_cond_wait_until(s->data_cond, s->data_mutex, end_time)) {
+            /* timeout has passed */
+            g_assert(s->log_fd != -1);
+            break;
+        }
+    }
+
+    g_mutex_unlock(s->data_mutex);
+}
 
-        /* We'll check only the region statring at 0x0*/
-        if (memory.regions[i].guest_phys_addr != 0x0) {
+/* Map the region holding guest physical address @gpa, as a backend would
+ * to access the rings and buffers.  Returns the host address for @gpa.
+ */
+static uint8_t *map_guest_mem(TestServer *s, uint64_t gpa,
+                              void **base, size_t *size)
+{
+    int i;
+
+    for (i = 0; i < s->fds_num; i++) {
+        VhostUserMemoryRegion *reg = &s->memory.regions[i];
+        uint8_t *mem;
+
+        if (gpa < reg->guest_phys_addr ||
+            gpa - reg->guest_phys_addr >= reg->memory_size) {
             continue;
         }
 
-        g_assert_cmpint(memory.regions[i].memory_size, >, 1024);
+        *size = reg->memory_size + reg->mmap_offset;
+        mem = mmap(0, *size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   s->fds[i], 0);
+        g_assert(mem != MAP_FAILED);
+        *base = mem;
+        return mem + reg->mmap_offset + (gpa - reg->guest_phys_addr);
+    }
 
-        size =  memory.regions[i].memory_size + memory.regions[i].mmap_offset;
+    g_assert_not_reached();
+    return NULL;
+}
 
-        guest_mem = mmap(0, size, PROT_READ | PROT_WRITE,
-                         MAP_SHARED, fds[i], 0);
+static void read_guest_mem(const void *data)
+{
+    TestServer *s = (void *)data;
+    uint32_t *guest_mem;
+    void *base;
+    size_t size;
+    int j;
 
-        g_assert(guest_mem != MAP_FAILED);
-        guest_mem += (memory.regions[i].mmap_offset / sizeof(*guest_mem));
+    wait_for_fds(s);
 
-        for (j = 0; j < 256; j++) {
-            uint32_t a = readl(memory.regions[i].guest_phys_addr + j*4);
-            uint32_t b = guest_mem[j];
+    g_mutex_lock(s->data_mutex);
 
-            g_assert_cmpint(a, ==, b);
-        }
+    guest_mem = (uint32_t *)map_guest_mem(s, 0, &base, &size);
+    for (j = 0; j < 256; j++) {
+        uint32_t a = readl(j * 4);
+        uint32_t b = guest_mem[j];
 
-        munmap(guest_mem, memory.regions[i].memory_size);
+        g_assert_cmpint(a, ==, b);
     }
+    munmap(base, size);
 
-    g_assert_cmpint(1, ==, 1);
-    g_mutex_unlock(data_mutex);
+    g_mutex_unlock(s->data_mutex);
 }
 
 static void *thread_function(void *data)
@@ -270,7 +346,8 @@ static int chr_can_read(void *opaque)
 
 static void chr_read(void *opaque, const uint8_t *buf, int size)
 {
-    CharDriverState *chr = opaque;
+    TestServer *s = opaque;
+    CharDriverState *chr = s->chr;
     VhostUserMsg msg;
     uint8_t *p = (uint8_t *) &msg;
     int fd;
@@ -280,7 +357,7 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
         return;
     }
 
-    g_mutex_lock(data_mutex);
+    g_mutex_lock(s->data_mutex);
     memcpy(p, buf, VHOST_USER_HDR_SIZE);
 
     if (msg.size) {
@@ -288,12 +365,37 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
         qemu_chr_fe_read_all(chr, p, msg.size);
     }
 
+    if (msg.request < VHOST_USER_MAX) {
+        s->requests[msg.request]++;
+    }
+
     switch (msg.request) {
     case VHOST_USER_GET_FEATURES:
         /* send back features to qemu */
         msg.flags |= VHOST_USER_REPLY_MASK;
         msg.size = sizeof(m.u64);
-        msg.u64 = 0;
+        msg.u64 = (1ULL << VHOST_F_LOG_ALL) |
+                  (1ULL << VHOST_USER_F_PROTOCOL_FEATURES);
+        p = (uint8_t *) &msg;
+        qemu_chr_fe_write_all(chr, p, VHOST_USER_HDR_SIZE + msg.size);
+        break;
+
+    case VHOST_USER_GET_PROTOCOL_FEATURES:
+        /* send back protocol features to qemu */
+        msg.flags |= VHOST_USER_REPLY_MASK;
+        msg.size = sizeof(m.u64);
+        msg.u64 = 1ULL << VHOST_USER_PROTOCOL_F_LOG_SHMFD;
+        if (s->queues > 1) {
+            msg.u64 |= 1ULL << VHOST_USER_PROTOCOL_F_MQ;
+        }
+        p = (uint8_t *) &msg;
+        qemu_chr_fe_write_all(chr, p, VHOST_USER_HDR_SIZE + msg.size);
+        break;
+
+    case VHOST_USER_GET_QUEUE_NUM:
+        msg.flags |= VHOST_USER_REPLY_MASK;
+        msg.size = sizeof(m.u64);
+        msg.u64 = s->queues;
         p = (uint8_t *) &msg;
         qemu_chr_fe_write_all(chr, p, VHOST_USER_HDR_SIZE + msg.size);
         break;
@@ -309,11 +411,29 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
 
     case VHOST_USER_SET_MEM_TABLE:
         /* received the mem table */
-        memcpy(&memory, &msg.memory, sizeof(msg.memory));
-        fds_num = qemu_chr_fe_get_msgfds(chr, fds, sizeof(fds) / sizeof(int));
+        memcpy(&s->memory, &msg.memory, sizeof(msg.memory));
+        s->fds_num = qemu_chr_fe_get_msgfds(chr, s->fds,
+                                            G_N_ELEMENTS(s->fds));
 
         /* signal the test that it can continue */
-        g_cond_signal(data_cond);
+        g_cond_signal(s->data_cond);
+        break;
+
+    case VHOST_USER_SET_LOG_BASE:
+        /* received the shared dirty log */
+        if (s->log_fd != -1) {
+            close(s->log_fd);
+        }
+        qemu_chr_fe_get_msgfds(chr, &s->log_fd, 1);
+        s->log_size = msg.log.mmap_size;
+
+        /* acknowledge that the new log is in use */
+        msg.flags |= VHOST_USER_REPLY_MASK;
+        msg.size = 0;
+        p = (uint8_t *) &msg;
+        qemu_chr_fe_write_all(chr, p, VHOST_USER_HDR_SIZE);
+
+        g_cond_signal(s->data_cond);
         break;
 
     case VHOST_USER_SET_VRING_KICK:
@@ -330,7 +450,7 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
     default:
         break;
     }
-    g_mutex_unlock(data_mutex);
+    g_mutex_unlock(s->data_mutex);
 }
 
 static const char *init_hugepagefs(void)
@@ -366,44 +486,232 @@ static const char *init_hugepagefs(void)
     return path;
 }
 
+static TestServer *test_server_new(const gchar *name)
+{
+    TestServer *server = g_new0(TestServer, 1);
+    gchar *chr_path;
+
+    server->socket_path = g_strdup_printf("/tmp/vhost-%s-%d.sock",
+                                          name, getpid());
+    server->chr_name = g_strdup_printf("chr-%s", name);
+    server->log_fd = -1;
+    server->queues = 1;
+    server->data_mutex = _mutex_new();
+    server->data_cond = _cond_new();
+
+    /* create char dev and add read handlers */
+    chr_path = g_strdup_printf("unix:%s,server,nowait", server->socket_path);
+    server->chr = qemu_chr_new(server->chr_name, chr_path, NULL);
+    g_free(chr_path);
+    qemu_chr_add_handlers(server->chr, chr_can_read, chr_read, NULL, server);
+
+    return server;
+}
+
+static void test_server_free(TestServer *server)
+{
+    int i;
+
+    qemu_chr_delete(server->chr);
+
+    for (i = 0; i < server->fds_num; i++) {
+        close(server->fds[i]);
+    }
+    if (server->log_fd != -1) {
+        close(server->log_fd);
+    }
+
+    unlink(server->socket_path);
+    g_free(server->socket_path);
+    g_free(server->chr_name);
+    _cond_free(server->data_cond);
+    _mutex_free(server->data_mutex);
+    g_free(server);
+}
+
+static const char *hugefs;
+
+static QTestState *qtest_start_with_server(TestServer *server,
+                                           const char *extra)
+{
+    gchar *qemu_cmd;
+    QTestState *s;
+
+    if (server->queues > 1) {
+        qemu_cmd = g_strdup_printf(QEMU_CMD_MQ "%s", hugefs,
+                                   server->socket_path, extra);
+    } else {
+        qemu_cmd = g_strdup_printf(QEMU_CMD "%s", hugefs,
+                                   server->socket_path, extra);
+    }
+    s = qtest_init(qemu_cmd);
+    g_free(qemu_cmd);
+
+    return s;
+}
+
+static bool migrate_completed(QTestState *s)
+{
+    QDict *rsp, *ret;
+    const char *status;
+    bool completed;
+
+    rsp = qtest_qmp(s, "{ 'execute': 'query-migrate' }");
+    g_assert(qdict_haskey(rsp, "return"));
+    ret = qdict_get_qdict(rsp, "return");
+    g_assert(qdict_haskey(ret, "status"));
+    status = qdict_get_str(ret, "status");
+    g_assert_cmpstr(status, !=, "failed");
+    completed = !strcmp(status, "completed");
+    QDECREF(rsp);
+
+    return completed;
+}
+
+static void add_data_func(const char *str, const void *data,
+                          GTestDataFunc fn)
+{
+    gchar *path = g_strdup_printf("/%s/%s", qtest_get_arch(), str);
+    g_test_add_data_func(path, data, fn);
+    g_free(path);
+}
+
+/* Requests about the whole device are sent once per connection, not once
+ * per queue pair: a two queue pair device sends as many of them as the
+ * single queue device of the other tests.
+ */
+static void test_multiqueue(const void *data)
+{
+    TestServer *s = (void *)data;
+    TestServer *mq = test_server_new("mq");
+    QTestState *to;
+    static const VhostUserRequest once[] = {
+        VHOST_USER_GET_FEATURES,
+        VHOST_USER_SET_OWNER,
+        VHOST_USER_GET_PROTOCOL_FEATURES,
+        VHOST_USER_SET_PROTOCOL_FEATURES,
+    };
+    int i;
+
+    mq->queues = 2;
+    to = qtest_start_with_server(mq, "");
+
+    wait_for_fds(s);
+    wait_for_fds(mq);
+
+    g_mutex_lock(s->data_mutex);
+    g_mutex_lock(mq->data_mutex);
+    for (i = 0; i < ARRAY_SIZE(once); i++) {
+        g_assert_cmpint(mq->requests[once[i]], ==, s->requests[once[i]]);
+    }
+    g_assert_cmpint(mq->requests[VHOST_USER_GET_QUEUE_NUM], ==, 1);
+    g_mutex_unlock(mq->data_mutex);
+    g_mutex_unlock(s->data_mutex);
+
+    qtest_quit(to);
+    test_server_free(mq);
+}
+
+/* The backend of the source dirties a guest page behind QEMU's back while
+ * migration is running.  The page must reach the destination through the
+ * shared dirty log.
+ */
+static void test_migrate(const void *data)
+{
+    TestServer *s = (void *)data;
+    TestServer *dest = test_server_new("dest");
+    QTestState *from = global_qtest, *to;
+    gchar *uri, *extra;
+    uint64_t gpa = 256 * 1024 * 1024, page = gpa / VHOST_LOG_PAGE;
+    uint8_t *log, *host;
+    void *base;
+    size_t size;
+    QDict *rsp;
+    int i;
+
+    wait_for_fds(s);
+
+    uri = g_strdup_printf("unix:%s.migrate", dest->socket_path);
+    extra = g_strdup_printf(" -incoming %s", uri);
+    to = qtest_start_with_server(dest, extra);
+    g_free(extra);
+
+    /* slow enough that the dirty page is logged before migration ends */
+    rsp = qtest_qmp(from, "{ 'execute': 'migrate_set_speed',"
+                          "  'arguments': { 'value': 10 } }");
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+
+    rsp = qtest_qmp(from, "{ 'execute': 'migrate',"
+                          "  'arguments': { 'uri': %s } }", uri);
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+
+    wait_for_log_fd(s);
+
+    g_mutex_lock(s->data_mutex);
+    g_assert_cmpint(s->log_size, >, page / 8);
+    log = mmap(0, s->log_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               s->log_fd, 0);
+    g_assert(log != MAP_FAILED);
+
+    host = map_guest_mem(s, gpa, &base, &size);
+    for (i = 0; i < VHOST_LOG_PAGE; i++) {
+        host[i] = i & 0xff;
+    }
+    __sync_fetch_and_or(&log[page / 8], 1 << (page % 8));
+
+    munmap(base, size);
+    munmap(log, s->log_size);
+    g_mutex_unlock(s->data_mutex);
+
+    rsp = qtest_qmp(from, "{ 'execute': 'migrate_set_speed',"
+                          "  'arguments': { 'value': 1073741824 } }");
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+
+    for (i = 0; i < 600 && !migrate_completed(from); i++) {
+        g_usleep(100 * 1000);
+    }
+    g_assert(migrate_completed(from));
+
+    for (i = 0; i < VHOST_LOG_PAGE; i++) {
+        g_assert_cmpint(qtest_readb(to, gpa + i), ==, i & 0xff);
+    }
+
+    qtest_quit(to);
+    test_server_free(dest);
+    unlink(uri + strlen("unix:"));
+    g_free(uri);
+}
+
 int main(int argc, char **argv)
 {
     QTestState *s = NULL;
-    CharDriverState *chr = NULL;
-    const char *hugefs = 0;
-    char *socket_path = 0;
-    char *qemu_cmd = 0;
-    char *chr_path = 0;
+    TestServer *server = NULL;
     int ret;
 
     g_test_init(&argc, &argv, NULL);
 
     module_call_init(MODULE_INIT_QOM);
+    qemu_add_opts(&qemu_chardev_opts);
 
     hugefs = init_hugepagefs();
     if (!hugefs) {
         return 0;
     }
 
-    socket_path = g_strdup_printf("/tmp/vhost-%d.sock", getpid());
-
-    /* create char dev and add read handlers */
-    qemu_add_opts(&qemu_chardev_opts);
-    chr_path = g_strdup_printf("unix:%s,server,nowait", socket_path);
-    chr = qemu_chr_new("chr0", chr_path, NULL);
-    g_free(chr_path);
-    qemu_chr_add_handlers(chr, chr_can_read, chr_read, NULL, chr);
+    server = test_server_new("test");
 
     /* run the main loop thread so the chardev may operate */
-    data_mutex = _mutex_new();
-    data_cond = _cond_new();
     _thread_new(NULL, thread_function, NULL);
 
-    qemu_cmd = g_strdup_printf(QEMU_CMD, hugefs, socket_path);
-    s = qtest_start(qemu_cmd);
-    g_free(qemu_cmd);
+    s = qtest_start_with_server(server, "");
+    global_qtest = s;
 
-    qtest_add_func("/vhost-user/read-guest-mem", read_guest_mem);
+    add_data_func("/vhost-user/read-guest-mem", server, read_guest_mem);
+    add_data_func("/vhost-user/multiqueue", server, test_multiqueue);
+    add_data_func("/vhost-user/migrate", server, test_migrate);
 
     ret = g_test_run();
 
@@ -412,10 +720,7 @@ int main(int argc, char **argv)
     }
 
     /* cleanup */
-    unlink(socket_path);
-    g_free(socket_path);
-    _cond_free(data_cond);
-    _mutex_free(data_mutex);
+    test_server_free(server);
 
     return ret;
 }
@@ -47,6 +47,9 @@
 
 #define PCI_SLOT_HP             0x06
 
+#define PERF_LOOPS              10000
+#define PERF_REQ_SIZE           4096
+
 typedef struct QVirtioBlkReq {
     uint32_t type;
     uint32_t ioprio;
@@ -663,6 +666,216 @@ static void hotplug(void)
     test_end();
 }
 
+static QVirtioPCIDevice *irq_coalesce_start(const char *opts,
+                                            QGuestAllocator **alloc,
+                                            QVirtQueuePCI **vqpci)
+{
+    QVirtioPCIDevice *dev;
+    uint32_t features;
+    char *cmdline;
+
+    cmdline = g_strdup_printf("-drive if=none,id=drive0,file=null-co://,"
+                              "format=raw "
+                              "-drive if=none,id=drive1,file=null-co://,"
+                              "format=raw "
+                              "-device virtio-blk-pci,id=drv0,drive=drive0,"
+                              "addr=%x.%x,%s", PCI_SLOT, PCI_FN, opts);
+    qtest_start(cmdline);
+    g_free(cmdline);
+
+    dev = virtio_blk_init(qpci_init_pc(), PCI_SLOT);
+
+    features = qvirtio_get_features(&qvirtio_pci, &dev->vdev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    QVIRTIO_F_RING_INDIRECT_DESC | QVIRTIO_F_RING_EVENT_IDX |
+                            QVIRTIO_BLK_F_SCSI);
+    qvirtio_set_features(&qvirtio_pci, &dev->vdev, features);
+
+    *alloc = pc_alloc_init();
+    *vqpci = (QVirtQueuePCI *)qvirtqueue_setup(&qvirtio_pci, &dev->vdev,
+                                               *alloc, 0);
+    qvirtio_set_driver_ok(&qvirtio_pci, &dev->vdev);
+    return dev;
+}
+
+/* Queue a read of the first sector */
+static uint64_t irq_coalesce_read(QGuestAllocator *alloc,
+                                  QVirtioPCIDevice *dev, QVirtQueuePCI *vqpci)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head;
+
+    req.type = QVIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = 0;
+    req.data = g_malloc0(512);
+    req_addr = virtio_blk_request(alloc, &req, 512);
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(&vqpci->vq, req_addr, 16, false, true);
+    qvirtqueue_add(&vqpci->vq, req_addr + 16, 512, true, true);
+    qvirtqueue_add(&vqpci->vq, req_addr + 528, 1, true, false);
+    qvirtqueue_kick(&qvirtio_pci, &dev->vdev, &vqpci->vq, free_head);
+    return req_addr;
+}
+
+static void irq_coalesce_end(QGuestAllocator *alloc, QVirtioPCIDevice *dev,
+                             QVirtQueuePCI *vqpci)
+{
+    guest_free(alloc, vqpci->vq.desc);
+    qvirtio_pci_device_disable(dev);
+    g_free(dev);
+    test_end();
+}
+
+/* The interrupt is sent once the frame limit is reached */
+static void pci_irq_coalesce_frames(void)
+{
+    QVirtioPCIDevice *dev;
+    QVirtQueuePCI *vqpci;
+    QGuestAllocator *alloc;
+    QDict *response;
+    uint64_t req_addr[2];
+    uint8_t status;
+    char *addr;
+
+    /* one second is more than the test takes */
+    dev = irq_coalesce_start("irq-coalesce-usecs=1000000,"
+                             "irq-coalesce-frames=2", &alloc, &vqpci);
+
+    req_addr[0] = irq_coalesce_read(alloc, dev, vqpci);
+    status = qvirtio_wait_status_byte_no_isr(&qvirtio_pci, &dev->vdev,
+                                             &vqpci->vq, req_addr[0] + 528,
+                                             QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(status, ==, 0);
+    g_assert(!qvirtio_pci.get_queue_isr_status(&dev->vdev, &vqpci->vq));
+
+    req_addr[1] = irq_coalesce_read(alloc, dev, vqpci);
+    qvirtio_wait_queue_isr(&qvirtio_pci, &dev->vdev, &vqpci->vq,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(readb(req_addr[1] + 528), ==, 0);
+
+    guest_free(alloc, req_addr[0]);
+    guest_free(alloc, req_addr[1]);
+
+    /* a frame limit without a delay is rejected... */
+    addr = g_strdup_printf("%x.%x", PCI_SLOT_HP, PCI_FN);
+    response = qmp("{'execute': 'device_add', 'arguments': {"
+                   " 'driver': 'virtio-blk-pci', 'id': 'drv1',"
+                   " 'drive': 'drive1', 'addr': %s,"
+                   " 'irq-coalesce-frames': 2 }}", addr);
+    g_assert(qdict_haskey(response, "error"));
+    QDECREF(response);
+
+    /* and so is a delay above one second */
+    response = qmp("{'execute': 'device_add', 'arguments': {"
+                   " 'driver': 'virtio-blk-pci', 'id': 'drv1',"
+                   " 'drive': 'drive1', 'addr': %s,"
+                   " 'irq-coalesce-usecs': 5000000 }}", addr);
+    g_assert(qdict_haskey(response, "error"));
+    QDECREF(response);
+    g_free(addr);
+
+    irq_coalesce_end(alloc, dev, vqpci);
+}
+
+/* The interrupt is sent when the delay expires */
+static void pci_irq_coalesce_timeout(void)
+{
+    QVirtioPCIDevice *dev;
+    QVirtQueuePCI *vqpci;
+    QGuestAllocator *alloc;
+    uint64_t req_addr;
+    uint8_t status;
+
+    dev = irq_coalesce_start("irq-coalesce-usecs=1000", &alloc, &vqpci);
+
+    req_addr = irq_coalesce_read(alloc, dev, vqpci);
+    status = qvirtio_wait_status_byte_no_isr(&qvirtio_pci, &dev->vdev,
+                                             &vqpci->vq, req_addr + 528,
+                                             QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(status, ==, 0);
+    g_assert(!qvirtio_pci.get_queue_isr_status(&dev->vdev, &vqpci->vq));
+
+    /* 1000 us after the completion */
+    clock_step(1000 * 1000);
+    g_assert(qvirtio_pci.get_queue_isr_status(&dev->vdev, &vqpci->vq));
+
+    guest_free(alloc, req_addr);
+    irq_coalesce_end(alloc, dev, vqpci);
+}
+
+/* Read throughput of the device model alone, on top of null-co */
+static void pci_perf(void)
+{
+    QVirtioPCIDevice *dev;
+    QPCIBus *bus;
+    QVirtQueuePCI *vqpci;
+    QGuestAllocator *alloc;
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t features;
+    uint32_t free_head;
+    double duration;
+    char *cmdline;
+    int i;
+
+    cmdline = g_strdup_printf("-drive if=none,id=drive0,file=null-co://,"
+                              "format=raw "
+                              "-device virtio-blk-pci,id=drv0,drive=drive0,"
+                              "addr=%x.%x", PCI_SLOT, PCI_FN);
+    qtest_start(cmdline);
+    g_free(cmdline);
+    bus = qpci_init_pc();
+
+    dev = virtio_blk_init(bus, PCI_SLOT);
+
+    features = qvirtio_get_features(&qvirtio_pci, &dev->vdev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    QVIRTIO_F_RING_INDIRECT_DESC | QVIRTIO_F_RING_EVENT_IDX |
+                            QVIRTIO_BLK_F_SCSI);
+    qvirtio_set_features(&qvirtio_pci, &dev->vdev, features);
+
+    alloc = pc_alloc_init();
+    vqpci = (QVirtQueuePCI *)qvirtqueue_setup(&qvirtio_pci, &dev->vdev,
+                                                                    alloc, 0);
+    qvirtio_set_driver_ok(&qvirtio_pci, &dev->vdev);
+
+    req.type = QVIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = 0;
+    req.data = g_malloc0(PERF_REQ_SIZE);
+    req_addr = virtio_blk_request(alloc, &req, PERF_REQ_SIZE);
+    g_free(req.data);
+
+    /* Every request completes before the next one is queued, so the
+     * same three descriptors are made available again and again.
+     */
+    free_head = qvirtqueue_add(&vqpci->vq, req_addr, 16, false, true);
+    qvirtqueue_add(&vqpci->vq, req_addr + 16, PERF_REQ_SIZE, true, true);
+    qvirtqueue_add(&vqpci->vq, req_addr + 16 + PERF_REQ_SIZE, 1, true, false);
+
+    g_test_timer_start();
+    for (i = 0; i < PERF_LOOPS; i++) {
+        qvirtqueue_kick(&qvirtio_pci, &dev->vdev, &vqpci->vq, free_head);
+        qvirtio_wait_queue_isr(&qvirtio_pci, &dev->vdev, &vqpci->vq,
+                               QVIRTIO_BLK_TIMEOUT_US);
+    }
+    duration = g_test_timer_elapsed();
+    g_assert_cmpint(readb(req_addr + 16 + PERF_REQ_SIZE), ==, 0);
+
+    g_test_message("virtio-blk %u reads of %u bytes: %f s, %f ops/s\n",
+                   PERF_LOOPS, PERF_REQ_SIZE, duration,
+                   PERF_LOOPS / duration);
+
+    guest_free(alloc, req_addr);
+    guest_free(alloc, vqpci->vq.desc);
+    qvirtio_pci_device_disable(dev);
+    g_free(dev);
+    test_end();
+}
+
 int main(int argc, char **argv)
 {
     int ret;
@@ -675,6 +888,13 @@ int main(int argc, char **argv)
     g_test_add_func("/virtio/blk/pci/msix", pci_msix);
     g_test_add_func("/virtio/blk/pci/idx", pci_idx);
     g_test_add_func("/virtio/blk/pci/hotplug", hotplug);
+    g_test_add_func("/virtio/blk/pci/irq-coalesce/frames",
+                    pci_irq_coalesce_frames);
+    g_test_add_func("/virtio/blk/pci/irq-coalesce/timeout",
+                    pci_irq_coalesce_timeout);
+    if (g_test_perf()) {
+        g_test_add_func("/virtio/blk/pci/perf", pci_perf);
+    }
 
     ret = g_test_run();
 
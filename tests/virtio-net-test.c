@@ -9,30 +9,257 @@
 
 #include <glib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 #include "libqtest.h"
 #include "qemu/osdep.h"
 #include "libqos/pci.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-pci.h"
+#include "libqos/pci-pc.h"
+#include "libqos/malloc.h"
+#include "libqos/malloc-pc.h"
 
 #define PCI_SLOT_HP             0x06
+#define PCI_SLOT                0x04
+#define PCI_FN                  0x00
+
+#define QVIRTIO_NET_TIMEOUT_US  (30 * 1000 * 1000)
+#define VNET_HDR_SIZE           10
+
+#define PERF_LOOPS              10000
+#define PERF_PKT_SIZE           1024
 
 /* Tests only initialization so far. TODO: Replace with functional tests */
 static void pci_nop(void)
 {
 }
 
+/* Setting the features deletes the queues past the control queue.  The
+ * guest must not be able to run a deleted queue by programming its
+ * address and kicking it.
+ */
+static void kick_deleted_queue(void)
+{
+    QVirtioPCIDevice *dev;
+    QGuestAllocator *alloc;
+    QVirtQueue *vq;
+    QPCIBus *bus;
+    QDict *rsp;
+
+    bus = qpci_init_pc();
+    dev = qvirtio_pci_device_find(bus, QVIRTIO_NET_DEVICE_ID);
+    g_assert(dev != NULL);
+
+    qvirtio_pci_device_enable(dev);
+    qvirtio_reset(&qvirtio_pci, &dev->vdev);
+    qvirtio_set_acknowledge(&qvirtio_pci, &dev->vdev);
+    qvirtio_set_driver(&qvirtio_pci, &dev->vdev);
+    qvirtio_set_features(&qvirtio_pci, &dev->vdev, 0);
+
+    /* rx, tx and control are queues 0, 1 and 2 */
+    alloc = pc_alloc_init();
+    vq = qvirtqueue_setup(&qvirtio_pci, &dev->vdev, alloc, 2);
+
+    /* renegotiating deletes queues 2 and 3, and adds control back */
+    qvirtio_set_features(&qvirtio_pci, &dev->vdev, 0);
+
+    qvirtio_pci.queue_select(&dev->vdev, 3);
+    qvirtio_pci.set_queue_address(&dev->vdev, vq->desc / QVIRTIO_PCI_ALIGN);
+    qvirtio_set_driver_ok(&qvirtio_pci, &dev->vdev);
+    qpci_io_writew(dev->pdev, dev->addr + QVIRTIO_QUEUE_NOTIFY, 3);
+    qpci_io_writew(dev->pdev, dev->addr + QVIRTIO_QUEUE_NOTIFY, 2);
+
+    /* QEMU is still alive */
+    rsp = qmp("{ 'execute': 'query-status' }");
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+
+    guest_free(alloc, vq->desc);
+    g_free(vq);
+    qvirtio_reset(&qvirtio_pci, &dev->vdev);
+    qvirtio_pci_device_disable(dev);
+    g_free(dev);
+}
+
 static void hotplug(void)
 {
     qpci_plug_device_test("virtio-net-pci", "net1", PCI_SLOT_HP, NULL);
     qpci_unplug_acpi_device_test("net1", PCI_SLOT_HP);
 }
 
+/*
+ * The benchmarks start their own QEMU, whose backend is one end of a
+ * socket pair: the test reads what the guest sends from the other end,
+ * and writes there what the guest should receive.
+ */
+static QVirtioPCIDevice *perf_start(int *sv, QGuestAllocator **alloc)
+{
+    QVirtioPCIDevice *dev;
+    QPCIBus *bus;
+    char *args;
+    int ret;
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sv);
+    g_assert_cmpint(ret, !=, -1);
+
+    args = g_strdup_printf("-netdev socket,fd=%d,id=hs0 "
+                           "-device virtio-net-pci,netdev=hs0,addr=%x.%x",
+                           sv[1], PCI_SLOT, PCI_FN);
+    qtest_start(args);
+    g_free(args);
+
+    bus = qpci_init_pc();
+    dev = qvirtio_pci_device_find(bus, QVIRTIO_NET_DEVICE_ID);
+    g_assert(dev != NULL);
+    g_assert_cmphex(dev->pdev->devfn, ==, ((PCI_SLOT << 3) | PCI_FN));
+
+    qvirtio_pci_device_enable(dev);
+    qvirtio_reset(&qvirtio_pci, &dev->vdev);
+    qvirtio_set_acknowledge(&qvirtio_pci, &dev->vdev);
+    qvirtio_set_driver(&qvirtio_pci, &dev->vdev);
+
+    /* No offloads and no mergeable buffers: a plain 10-byte header */
+    qvirtio_set_features(&qvirtio_pci, &dev->vdev, 0);
+
+    *alloc = pc_alloc_init();
+    return dev;
+}
+
+static void perf_end(QVirtioPCIDevice *dev, int *sv)
+{
+    qvirtio_pci_device_disable(dev);
+    g_free(dev);
+    qtest_end();
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static void perf_tx(void)
+{
+    QTestState *saved = global_qtest;
+    QVirtioPCIDevice *dev;
+    QGuestAllocator *alloc;
+    QVirtQueuePCI *vqpci;
+    uint8_t pkt[PERF_PKT_SIZE], rpkt[PERF_PKT_SIZE];
+    uint64_t req_addr;
+    uint32_t free_head, len;
+    double duration;
+    ssize_t ret;
+    int sv[2];
+    int i;
+
+    dev = perf_start(sv, &alloc);
+    vqpci = (QVirtQueuePCI *)qvirtqueue_setup(&qvirtio_pci, &dev->vdev,
+                                              alloc, 1);
+    qvirtio_set_driver_ok(&qvirtio_pci, &dev->vdev);
+
+    memset(pkt, 0xff, 6);
+    for (i = 6; i < sizeof(pkt); i++) {
+        pkt[i] = i;
+    }
+    req_addr = guest_alloc(alloc, VNET_HDR_SIZE + sizeof(pkt));
+    qmemset(req_addr, 0, VNET_HDR_SIZE);
+    memwrite(req_addr + VNET_HDR_SIZE, pkt, sizeof(pkt));
+
+    /* Each packet is sent before the next is queued, so the descriptor
+     * can be made available again and again.
+     */
+    free_head = qvirtqueue_add(&vqpci->vq, req_addr,
+                               VNET_HDR_SIZE + sizeof(pkt), false, false);
+
+    g_test_timer_start();
+    for (i = 0; i < PERF_LOOPS; i++) {
+        qvirtqueue_kick(&qvirtio_pci, &dev->vdev, &vqpci->vq, free_head);
+        qvirtio_wait_queue_isr(&qvirtio_pci, &dev->vdev, &vqpci->vq,
+                               QVIRTIO_NET_TIMEOUT_US);
+
+        ret = recv(sv[0], &len, sizeof(len), MSG_WAITALL);
+        g_assert_cmpint(ret, ==, sizeof(len));
+        g_assert_cmpint(ntohl(len), ==, sizeof(pkt));
+        ret = recv(sv[0], rpkt, sizeof(rpkt), MSG_WAITALL);
+        g_assert_cmpint(ret, ==, sizeof(rpkt));
+    }
+    duration = g_test_timer_elapsed();
+    g_assert(memcmp(pkt, rpkt, sizeof(pkt)) == 0);
+
+    g_test_message("virtio-net %u TX packets of %zu bytes: %f s, %f ops/s\n",
+                   PERF_LOOPS, sizeof(pkt), duration, PERF_LOOPS / duration);
+
+    guest_free(alloc, req_addr);
+    guest_free(alloc, vqpci->vq.desc);
+    perf_end(dev, sv);
+    global_qtest = saved;
+}
+
+static void perf_rx(void)
+{
+    QTestState *saved = global_qtest;
+    QVirtioPCIDevice *dev;
+    QGuestAllocator *alloc;
+    QVirtQueuePCI *vqpci;
+    uint8_t pkt[PERF_PKT_SIZE], rpkt[PERF_PKT_SIZE];
+    uint64_t buf_addr;
+    uint32_t free_head, len;
+    double duration;
+    ssize_t ret;
+    int sv[2];
+    int i;
+
+    dev = perf_start(sv, &alloc);
+    vqpci = (QVirtQueuePCI *)qvirtqueue_setup(&qvirtio_pci, &dev->vdev,
+                                              alloc, 0);
+    qvirtio_set_driver_ok(&qvirtio_pci, &dev->vdev);
+
+    memset(pkt, 0xff, 6);
+    for (i = 6; i < sizeof(pkt); i++) {
+        pkt[i] = i;
+    }
+    len = htonl(sizeof(pkt));
+
+    buf_addr = guest_alloc(alloc, VNET_HDR_SIZE + sizeof(pkt));
+    free_head = qvirtqueue_add(&vqpci->vq, buf_addr,
+                               VNET_HDR_SIZE + sizeof(pkt), true, false);
+
+    g_test_timer_start();
+    for (i = 0; i < PERF_LOOPS; i++) {
+        qvirtqueue_kick(&qvirtio_pci, &dev->vdev, &vqpci->vq, free_head);
+
+        ret = send(sv[0], &len, sizeof(len), 0);
+        g_assert_cmpint(ret, ==, sizeof(len));
+        ret = send(sv[0], pkt, sizeof(pkt), 0);
+        g_assert_cmpint(ret, ==, sizeof(pkt));
+
+        qvirtio_wait_queue_isr(&qvirtio_pci, &dev->vdev, &vqpci->vq,
+                               QVIRTIO_NET_TIMEOUT_US);
+    }
+    duration = g_test_timer_elapsed();
+
+    memread(buf_addr + VNET_HDR_SIZE, rpkt, sizeof(rpkt));
+    g_assert(memcmp(pkt, rpkt, sizeof(pkt)) == 0);
+
+    g_test_message("virtio-net %u RX packets of %zu bytes: %f s, %f ops/s\n",
+                   PERF_LOOPS, sizeof(pkt), duration, PERF_LOOPS / duration);
+
+    guest_free(alloc, buf_addr);
+    guest_free(alloc, vqpci->vq.desc);
+    perf_end(dev, sv);
+    global_qtest = saved;
+}
+
 int main(int argc, char **argv)
 {
     int ret;
 
     g_test_init(&argc, &argv, NULL);
     qtest_add_func("/virtio/net/pci/nop", pci_nop);
+    qtest_add_func("/virtio/net/pci/kick-deleted-queue", kick_deleted_queue);
     qtest_add_func("/virtio/net/pci/hotplug", hotplug);
+    if (g_test_perf()) {
+        qtest_add_func("/virtio/net/pci/perf/tx", perf_tx);
+        qtest_add_func("/virtio/net/pci/perf/rx", perf_rx);
+    }
 
     qtest_start("-device virtio-net-pci");
     ret = g_test_run();
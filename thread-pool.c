@@ -17,6 +17,7 @@
 #include "qemu-common.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
+#include "qemu/atomic.h"
 #include "qemu/osdep.h"
 #include "block/coroutine.h"
 #include "trace.h"
@@ -26,6 +27,7 @@
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolWorker ThreadPoolWorker;
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -39,84 +41,275 @@ struct ThreadPoolElement {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* Moving state out of THREAD_QUEUED is protected by the lock of the
+     * queue that holds the request.  After that, only the worker thread
+     * can write to it.  Reads and writes of state and ret are ordered
+     * with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* The worker whose queue holds the request, or NULL for the pool's
+     * overflow queue.  Stable while state is THREAD_QUEUED.
+     */
+    ThreadPoolWorker *worker;
+
+    /* Timestamps for the queue statistics, in QEMU_CLOCK_REALTIME ns */
+    int64_t submit_ns;
+    int64_t start_ns;
+    int64_t end_ns;
+
+    /* Access to this list is protected by the lock of the queue.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* Access to this list is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+struct ThreadPoolWorker {
+    ThreadPool *pool;
+
+    /* Wakes the worker up when it is idle */
+    QemuSemaphore sem;
+
+    /* Requests queued for this worker.  Other workers may steal from the
+     * head of the queue.  Lock ordering is pool->lock, then lock.
+     */
+    QemuMutex lock;
+    QTAILQ_HEAD(, ThreadPoolElement) requests;
+    int depth;
+
+    /* The following fields are protected by pool->lock.  */
+    bool idle;
+    QLIST_ENTRY(ThreadPoolWorker) next;
+    QLIST_ENTRY(ThreadPoolWorker) idle_next;
+};
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
-    QemuSemaphore sem;
-    int max_threads;
     QEMUBH *new_thread_bh;
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    int max_queued;
+    uint64_t completed;
+    int64_t wait_ns;
+    int64_t max_wait_ns;
+    int64_t service_ns;
+
+    /* Number of requests waiting in any queue, updated atomically */
+    int queued;
 
     /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    QTAILQ_HEAD(, ThreadPoolElement) request_list; /* no worker running yet */
+    QLIST_HEAD(, ThreadPoolWorker) workers;
+    QLIST_HEAD(, ThreadPoolWorker) idle_workers;
+    int min_threads;
+    int max_threads;
+    int idle_timeout_ms;
+    int node;
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
+    uint64_t stolen;
     bool stopping;
 };
 
+static void thread_pool_run_request(ThreadPool *pool, ThreadPoolElement *req)
+{
+    int ret;
+
+    atomic_dec(&pool->queued);
+    req->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    ret = req->func(req->arg);
+
+    req->end_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    req->ret = ret;
+    /* Write ret before state.  */
+    smp_wmb();
+    req->state = THREAD_DONE;
+
+    qemu_bh_schedule(pool->completion_bh);
+}
+
+/* Take the oldest request from a worker's queue.  Runs with w->lock taken. */
+static ThreadPoolElement *worker_dequeue(ThreadPoolWorker *w)
+{
+    ThreadPoolElement *req = QTAILQ_FIRST(&w->requests);
+
+    if (req) {
+        QTAILQ_REMOVE(&w->requests, req, reqs);
+        w->depth--;
+        req->state = THREAD_ACTIVE;
+    }
+    return req;
+}
+
+/* Find work for @self when its own queue is empty: first requests that were
+ * submitted before any worker was running, then the head of the longest
+ * queue of another worker.  Runs with pool->lock taken.
+ */
+static ThreadPoolElement *worker_steal(ThreadPool *pool, ThreadPoolWorker *self)
+{
+    ThreadPoolWorker *w, *victim = NULL;
+    ThreadPoolElement *req;
+
+    req = QTAILQ_FIRST(&pool->request_list);
+    if (req) {
+        QTAILQ_REMOVE(&pool->request_list, req, reqs);
+        req->state = THREAD_ACTIVE;
+        return req;
+    }
+
+    QLIST_FOREACH(w, &pool->workers, next) {
+        int depth = atomic_read(&w->depth);
+
+        if (w != self && depth > (victim ? atomic_read(&victim->depth) : 0)) {
+            victim = w;
+        }
+    }
+    if (!victim) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&victim->lock);
+    req = worker_dequeue(victim);
+    qemu_mutex_unlock(&victim->lock);
+    if (req) {
+        pool->stolen++;
+    }
+    return req;
+}
+
+/* Take @w off the idle list and wake it up.  Each idle period gets exactly
+ * one post, so that busy workers never find stale wakeups on their
+ * semaphore.  Runs with pool->lock taken.
+ */
+static void worker_wake(ThreadPool *pool, ThreadPoolWorker *w)
+{
+    assert(w->idle);
+    w->idle = false;
+    QLIST_REMOVE(w, idle_next);
+    pool->idle_threads--;
+    qemu_sem_post(&w->sem);
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
+    ThreadPoolWorker *w = g_new0(ThreadPoolWorker, 1);
+    int node, timeout;
+
+    w->pool = pool;
+    qemu_sem_init(&w->sem, 0);
+    qemu_mutex_init(&w->lock);
+    QTAILQ_INIT(&w->requests);
+
+    node = atomic_read(&pool->node);
+    if (node >= 0) {
+        int ret = qemu_thread_bind_node(node);
+        if (ret < 0) {
+            trace_thread_pool_bind_node_failed(pool, node, ret);
+        }
+    }
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
+    QLIST_INSERT_HEAD(&pool->workers, w, next);
     do_spawn_thread(pool);
+    qemu_mutex_unlock(&pool->lock);
 
-    while (!pool->stopping) {
+    for (;;) {
         ThreadPoolElement *req;
+        bool may_exit;
         int ret;
 
-        do {
-            pool->idle_threads++;
+        /* Own queue first, without touching the pool lock.  Requests
+         * complete through the bottom half, so a worker with a backlog
+         * never takes it.
+         */
+        qemu_mutex_lock(&w->lock);
+        req = worker_dequeue(w);
+        qemu_mutex_unlock(&w->lock);
+        if (req) {
+            thread_pool_run_request(pool, req);
+            continue;
+        }
+
+        qemu_mutex_lock(&pool->lock);
+        if (pool->stopping) {
+            break;
+        }
+        req = worker_steal(pool, w);
+        if (req) {
+            qemu_mutex_unlock(&pool->lock);
+            thread_pool_run_request(pool, req);
+            continue;
+        }
+
+        /* Submitters only queue on workers while holding pool->lock, so an
+         * empty queue here stays empty until we are back on the idle list.
+         */
+        if (atomic_read(&w->depth)) {
             qemu_mutex_unlock(&pool->lock);
-            ret = qemu_sem_timedwait(&pool->sem, 10000);
-            qemu_mutex_lock(&pool->lock);
-            pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
-        if (ret == -1 || pool->stopping) {
+            continue;
+        }
+        if (pool->cur_threads > pool->max_threads) {
             break;
         }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
+        w->idle = true;
+        QLIST_INSERT_HEAD(&pool->idle_workers, w, idle_next);
+        pool->idle_threads++;
+        may_exit = pool->cur_threads > pool->min_threads;
+        timeout = pool->idle_timeout_ms;
         qemu_mutex_unlock(&pool->lock);
 
-        ret = req->func(req->arg);
-
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
-        req->state = THREAD_DONE;
+        /* Workers below the minimum sleep until they get work, or until
+         * thread_pool_update_params() wakes them up.
+         */
+        if (may_exit) {
+            ret = qemu_sem_timedwait(&w->sem, timeout);
+        } else {
+            qemu_sem_wait(&w->sem);
+            ret = 0;
+        }
 
         qemu_mutex_lock(&pool->lock);
-
-        qemu_bh_schedule(pool->completion_bh);
+        if (w->idle) {
+            /* Nobody handed us work */
+            w->idle = false;
+            QLIST_REMOVE(w, idle_next);
+            pool->idle_threads--;
+            if (ret == -1 && pool->cur_threads > pool->min_threads &&
+                !atomic_read(&w->depth)) {
+                break;
+            }
+        } else if (ret == -1) {
+            /* Woken up after the wait timed out; the post is already
+             * there, consume it so that the next wait does not return
+             * right away.
+             */
+            qemu_sem_wait(&w->sem);
+        }
+        qemu_mutex_unlock(&pool->lock);
     }
 
+    /* pool->lock is taken here */
+    QLIST_REMOVE(w, next);
+    assert(QTAILQ_EMPTY(&w->requests) || pool->stopping);
     pool->cur_threads--;
     qemu_cond_signal(&pool->worker_stopped);
     qemu_mutex_unlock(&pool->lock);
+
+    qemu_mutex_destroy(&w->lock);
+    qemu_sem_destroy(&w->sem);
+    g_free(w);
     return NULL;
 }
 
@@ -160,6 +353,22 @@ static void spawn_thread(ThreadPool *pool)
     }
 }
 
+static void thread_pool_account(ThreadPool *pool, ThreadPoolElement *elem)
+{
+    int64_t wait_ns;
+
+    if (!elem->start_ns) {
+        /* cancelled before it ran */
+        return;
+    }
+
+    wait_ns = elem->start_ns - elem->submit_ns;
+    pool->completed++;
+    pool->wait_ns += wait_ns;
+    pool->max_wait_ns = MAX(pool->max_wait_ns, wait_ns);
+    pool->service_ns += elem->end_ns - elem->start_ns;
+}
+
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
@@ -174,6 +383,11 @@ restart:
             trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                        elem->ret);
         }
+        if (elem->state == THREAD_DONE) {
+            /* Read state before the timestamps.  */
+            smp_rmb();
+            thread_pool_account(pool, elem);
+        }
         if (elem->state == THREAD_DONE && elem->common.cb) {
             QLIST_REMOVE(elem, all);
             /* Read state before ret.  */
@@ -202,19 +416,33 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
+    /* No thread has yet started working on elem if it is still queued.
+     * Holding pool->lock keeps elem->worker alive, and the queue lock keeps
+     * workers from taking elem while we look at it.
+     */
     qemu_mutex_lock(&pool->lock);
-    if (elem->state == THREAD_QUEUED &&
-        /* No thread has yet started working on elem. we can try to "steal"
-         * the item from the worker if we can get a signal from the
-         * semaphore.  Because this is non-blocking, we can do it with
-         * the lock taken and ensure that elem will remain THREAD_QUEUED.
-         */
-        qemu_sem_timedwait(&pool->sem, 0) == 0) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+    if (elem->state == THREAD_QUEUED) {
+        ThreadPoolWorker *w = elem->worker;
+
+        if (w) {
+            qemu_mutex_lock(&w->lock);
+        }
+        if (elem->state == THREAD_QUEUED) {
+            if (w) {
+                QTAILQ_REMOVE(&w->requests, elem, reqs);
+                w->depth--;
+            } else {
+                QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+            }
+            atomic_dec(&pool->queued);
+            qemu_bh_schedule(pool->completion_bh);
 
-        elem->state = THREAD_DONE;
-        elem->ret = -ECANCELED;
+            elem->state = THREAD_DONE;
+            elem->ret = -ECANCELED;
+        }
+        if (w) {
+            qemu_mutex_unlock(&w->lock);
+        }
     }
 
     qemu_mutex_unlock(&pool->lock);
@@ -238,6 +466,8 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolWorker *w;
+    bool idle;
 
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
@@ -249,13 +479,47 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
 
     trace_thread_pool_submit(pool, req, arg);
 
+    req->submit_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    req->start_ns = 0;
+    pool->max_queued = MAX(pool->max_queued,
+                           atomic_fetch_inc(&pool->queued) + 1);
+
     qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    w = QLIST_FIRST(&pool->idle_workers);
+    idle = w != NULL;
+    if (!idle) {
+        ThreadPoolWorker *iter;
+
+        if (pool->cur_threads < pool->max_threads) {
+            spawn_thread(pool);
+        }
+
+        /* Queue behind the least busy worker; idle workers steal from the
+         * busiest ones.
+         */
+        QLIST_FOREACH(iter, &pool->workers, next) {
+            if (!w || atomic_read(&iter->depth) < atomic_read(&w->depth)) {
+                w = iter;
+            }
+        }
+    }
+
+    req->worker = w;
+    if (w) {
+        qemu_mutex_lock(&w->lock);
+        QTAILQ_INSERT_TAIL(&w->requests, req, reqs);
+        w->depth++;
+        qemu_mutex_unlock(&w->lock);
+        if (idle) {
+            /* Hand the request straight to the idle worker; busy workers
+             * look at their queue before going idle.
+             */
+            worker_wake(pool, w);
+        }
+    } else {
+        QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
     qemu_mutex_unlock(&pool->lock);
-    qemu_sem_post(&pool->sem);
     return &req->common;
 }
 
@@ -287,6 +551,53 @@ void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(pool, func, arg, NULL, NULL);
 }
 
+void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
+{
+    ThreadPoolWorker *w, *next;
+
+    qemu_mutex_lock(&pool->lock);
+
+    pool->min_threads = ctx->thread_pool_min;
+    pool->max_threads = ctx->thread_pool_max;
+    pool->idle_timeout_ms = ctx->thread_pool_idle_timeout;
+    atomic_set(&pool->node, ctx->thread_pool_node);
+
+    /* Idle workers re-check the limits when woken up */
+    QLIST_FOREACH_SAFE(w, &pool->idle_workers, idle_next, next) {
+        worker_wake(pool, w);
+    }
+
+    while (pool->cur_threads < pool->min_threads) {
+        spawn_thread(pool);
+    }
+
+    qemu_mutex_unlock(&pool->lock);
+}
+
+ThreadPoolInfo *thread_pool_get_info(ThreadPool *pool)
+{
+    ThreadPoolInfo *info = g_new0(ThreadPoolInfo, 1);
+
+    qemu_mutex_lock(&pool->lock);
+    info->min_threads = pool->min_threads;
+    info->max_threads = pool->max_threads;
+    info->idle_timeout = pool->idle_timeout_ms;
+    info->has_node = pool->node >= 0;
+    info->node = pool->node;
+    info->threads = pool->cur_threads;
+    info->idle_threads = pool->idle_threads;
+    info->stolen = pool->stolen;
+    qemu_mutex_unlock(&pool->lock);
+
+    info->queue_depth = atomic_read(&pool->queued);
+    info->max_queue_depth = pool->max_queued;
+    info->completed = pool->completed;
+    info->wait_ns = pool->wait_ns;
+    info->max_wait_ns = pool->max_wait_ns;
+    info->service_ns = pool->service_ns;
+    return info;
+}
+
 static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
 {
     if (!ctx) {
@@ -298,12 +609,14 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
-    qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
     QTAILQ_INIT(&pool->request_list);
+    QLIST_INIT(&pool->workers);
+    QLIST_INIT(&pool->idle_workers);
+
+    thread_pool_update_params(pool, ctx);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
@@ -331,14 +644,17 @@ void thread_pool_free(ThreadPool *pool)
     /* Wait for worker threads to terminate */
     pool->stopping = true;
     while (pool->cur_threads > 0) {
-        qemu_sem_post(&pool->sem);
+        ThreadPoolWorker *w;
+
+        QLIST_FOREACH(w, &pool->workers, next) {
+            qemu_sem_post(&w->sem);
+        }
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
     }
 
     qemu_mutex_unlock(&pool->lock);
 
     qemu_bh_delete(pool->completion_bh);
-    qemu_sem_destroy(&pool->sem);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
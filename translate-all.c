@@ -55,6 +55,7 @@
 #endif
 #else
 #include "exec/address-spaces.h"
+#include "qmp-commands.h"
 #endif
 
 #include "exec/cputlb.h"
@@ -126,15 +127,184 @@ static void *l1_map[V_L1_SIZE];
 /* code generation context */
 TCGContext tcg_ctx;
 
+/* one host thread per vCPU, see qemu_tcg_configure */
+bool mttcg_enabled;
+
+/* other vCPU threads may be running translated code right now; false while
+ * a vCPU runs guest atomics in cpu_exec_step_atomic, see cpu_loop_exit_atomic
+ */
+bool parallel_cpus;
+
+/* translation blocks, the page table and tcg_ctx itself are protected by
+ * tb_lock.  The lock is only really taken when more than one thread can
+ * run guest code: always for user-mode emulation, and with multi-threaded
+ * TCG in system emulation.
+ */
+static DEFINE_TLS(bool, have_tb_lock);
+#define have_tb_lock tls_var(have_tb_lock)
+
+#ifdef CONFIG_USER_ONLY
+#define tb_lock_needed() true
+#else
+#define tb_lock_needed() qemu_tcg_mttcg_enabled()
+#endif
+
+void tb_lock(void)
+{
+    if (tb_lock_needed()) {
+        assert(!have_tb_lock);
+        qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
+        have_tb_lock = true;
+    }
+}
+
+void tb_unlock(void)
+{
+    if (tb_lock_needed()) {
+        assert(have_tb_lock);
+        have_tb_lock = false;
+        qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+    }
+}
+
+/* Take tb_lock unless this thread already holds it, as happens when
+ * guest page tables are updated while looking up a TB.  Returns true if
+ * the caller has to release it with tb_unlock().
+ */
+bool tb_lock_recursive(void)
+{
+    if (!tb_lock_needed() || have_tb_lock) {
+        return false;
+    }
+    tb_lock();
+    return true;
+}
+
+/* Drop tb_lock if this thread still holds it, e.g. after a longjmp
+ * out of code that was running under the lock.
+ */
+void tb_lock_reset(void)
+{
+    if (have_tb_lock) {
+        have_tb_lock = false;
+        qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+    }
+}
+
+#ifdef CONFIG_USER_ONLY
+/* x86 LOCK-prefixed instructions of user-mode guest threads are serialised
+ * against each other with this lock.  System emulation runs them with all
+ * other vCPUs stopped instead, see cpu_exec_step_atomic.
+ */
+static QemuMutex tcg_atomic_mutex;
+static DEFINE_TLS(bool, have_tcg_atomic_lock);
+#define have_tcg_atomic_lock tls_var(have_tcg_atomic_lock)
+
+void tcg_atomic_lock(void)
+{
+    qemu_mutex_lock(&tcg_atomic_mutex);
+    have_tcg_atomic_lock = true;
+}
+
+void tcg_atomic_unlock(void)
+{
+    if (have_tcg_atomic_lock) {
+        have_tcg_atomic_lock = false;
+        qemu_mutex_unlock(&tcg_atomic_mutex);
+    }
+}
+#endif
+
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2);
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
+static void tb_evict(CPUArchState *env);
 
 void cpu_gen_init(void)
 {
     tcg_context_init(&tcg_ctx); 
 }
 
+#ifdef TARGET_INSN_START_EXTRA_WORDS
+/* Encode VAL as a signed leb128 sequence at P.
+   Return P incremented past the encoded value.  */
+static uint8_t *encode_sleb128(uint8_t *p, target_long val)
+{
+    int more, byte;
+
+    do {
+        byte = val & 0x7f;
+        val >>= 7;
+        more = !((val == 0 && (byte & 0x40) == 0)
+                 || (val == -1 && (byte & 0x40) != 0));
+        if (more) {
+            byte |= 0x80;
+        }
+        *p++ = byte;
+    } while (more);
+
+    return p;
+}
+
+/* Decode a signed leb128 sequence at *PP; increment *PP past the
+   decoded value.  Return the decoded value.  */
+static target_long decode_sleb128(uint8_t **pp)
+{
+    uint8_t *p = *pp;
+    target_long val = 0;
+    int byte, shift = 0;
+
+    do {
+        byte = *p++;
+        val |= (target_ulong)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    if (shift < TARGET_LONG_BITS && (byte & 0x40)) {
+        val |= -(target_ulong)1 << shift;
+    }
+
+    *pp = p;
+    return val;
+}
+
+/* Encode the data collected about the instructions while compiling TB.
+   Place the data at BLOCK, and return the number of bytes consumed.
+
+   The logical table consists of TARGET_INSN_START_WORDS target_ulong's,
+   which come from the target's insn_start data, followed by a uintptr_t
+   which comes from the host pc of the end of the code implementing the
+   insn.
+
+   Each line of the table is encoded as sleb128 deltas from the previous
+   line.  The seed for the first line is { tb->pc, 0..., tb->tc_ptr }.
+   That is, the first column is seeded with the guest pc, the last column
+   with the host pc, and the middle columns with zeros.  */
+static int encode_search(TranslationBlock *tb, uint8_t *block)
+{
+    uint8_t *p = block;
+    int i, j, n;
+
+    tb->tc_search = block;
+
+    for (i = 0, n = tb->icount; i < n; ++i) {
+        target_ulong prev;
+
+        for (j = 0; j < TARGET_INSN_START_WORDS; ++j) {
+            if (i == 0) {
+                prev = (j == 0 ? tb->pc : 0);
+            } else {
+                prev = tcg_ctx.gen_insn_data[i - 1][j];
+            }
+            p = encode_sleb128(p, tcg_ctx.gen_insn_data[i][j] - prev);
+        }
+        prev = (i == 0 ? 0 : tcg_ctx.gen_insn_end_off[i - 1]);
+        p = encode_sleb128(p, tcg_ctx.gen_insn_end_off[i] - prev);
+    }
+
+    return p - block;
+}
+#endif
+
 /* return non zero if the very first instruction is invalid so that
    the virtual CPU can trigger an exception.
 
@@ -181,6 +351,7 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 #endif
     gen_code_size = tcg_gen_code(s, gen_code_buf);
     *gen_code_size_ptr = gen_code_size;
+    tb->tc_size = gen_code_size;
 #ifdef CONFIG_PROFILER
     s->code_time += profile_getclock();
     s->code_in_len += tb->size;
@@ -195,11 +366,64 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
         qemu_log_flush();
     }
 #endif
+
+#ifdef TARGET_INSN_START_EXTRA_WORDS
+    *gen_code_size_ptr += encode_search(tb, (uint8_t *)gen_code_buf +
+                                        gen_code_size);
+#endif
     return 0;
 }
 
 /* The cpu state corresponding to 'searched_pc' is restored.
  */
+#ifdef TARGET_INSN_START_EXTRA_WORDS
+static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
+                                     uintptr_t searched_pc)
+{
+    target_ulong data[TARGET_INSN_START_WORDS] = { tb->pc };
+    uintptr_t host_pc = (uintptr_t)tb->tc_ptr;
+    CPUArchState *env = cpu->env_ptr;
+    uint8_t *p = tb->tc_search;
+    int i, j, num_insns = tb->icount;
+#ifdef CONFIG_PROFILER
+    int64_t ti = profile_getclock();
+#endif
+
+    if (searched_pc < host_pc) {
+        return -1;
+    }
+
+    /* Reconstruct the stored insn data while looking for the point at
+       which the end of the insn exceeds the searched_pc.  */
+    for (i = 0; i < num_insns; ++i) {
+        for (j = 0; j < TARGET_INSN_START_WORDS; ++j) {
+            data[j] += decode_sleb128(&p);
+        }
+        host_pc += decode_sleb128(&p);
+        if (host_pc > searched_pc) {
+            goto found;
+        }
+    }
+    return -1;
+
+ found:
+    if (tb->cflags & CF_USE_ICOUNT) {
+        /* Reset the cycle counter to the start of the block
+           and shift it to the number of actually executed insns.  */
+        cpu->icount_decr.u16.low += num_insns - i;
+        /* Clear the IO flag.  */
+        cpu->can_do_io = 0;
+    }
+    restore_state_to_opc(env, tb, data);
+
+#ifdef CONFIG_PROFILER
+    tcg_ctx.restore_time += profile_getclock() - ti;
+    tcg_ctx.restore_count++;
+#endif
+    return 0;
+}
+#else
+/* Targets without insn_start data retranslate the TB to find the insn.  */
 static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
                                      uintptr_t searched_pc)
 {
@@ -256,11 +480,18 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
 #endif
     return 0;
 }
+#endif
 
 bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
 {
     TranslationBlock *tb;
+    bool found = false;
+    bool locked;
 
+    /* tb_find_pc walks the TB array; targets without insn_start data also
+       retranslate the block with tcg_ctx.  In user mode a guest fault can
+       also come from the translator itself, which already holds the lock. */
+    locked = tb_lock_recursive();
     tb = tb_find_pc(retaddr);
     if (tb) {
         cpu_restore_state_from_tb(cpu, tb, retaddr);
@@ -270,9 +501,12 @@ bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
             tb_phys_invalidate(tb, -1);
             tb_free(tb);
         }
-        return true;
+        found = true;
     }
-    return false;
+    if (locked) {
+        tb_unlock();
+    }
+    return found;
 }
 
 #ifdef _WIN32
@@ -658,6 +892,41 @@ static inline void *alloc_code_gen_buffer(void)
 }
 #endif /* USE_STATIC_CODE_GEN_BUFFER, USE_MMAP */
 
+/* Split the code buffer into at most TB_REGION_MAX regions of at least
+   TB_REGION_MIN_SIZE bytes; running out of space then only evicts the
+   code of one region instead of flushing everything.  */
+#define TB_REGION_MAX       8
+#define TB_REGION_MIN_SIZE  (1024 * 1024)
+
+static void tb_region_init(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    uint8_t *buf = tcg_ctx.code_gen_buffer;
+    size_t size = tcg_ctx.code_gen_buffer_size;
+    size_t region_size;
+    int i, n;
+
+    n = MIN(TB_REGION_MAX, size / TB_REGION_MIN_SIZE);
+    n = MAX(n, 1);
+    region_size = (size / n) & ~(size_t)(CODE_GEN_ALIGN - 1);
+
+    ctx->nb_regions = n;
+    ctx->region_max_tbs = tcg_ctx.code_gen_max_blocks / n;
+    ctx->regions = g_new0(TBRegion, n);
+    for (i = 0; i < n; i++) {
+        TBRegion *r = &ctx->regions[i];
+        uint8_t *end = i == n - 1 ? buf + size : buf + (i + 1) * region_size;
+
+        r->start = buf + i * region_size;
+        /* leave room for the largest TB, as for the whole buffer */
+        r->limit = end - TCG_MAX_OP_SIZE * OPC_BUF_SIZE;
+        r->end = r->start;
+        r->tbs = ctx->tbs + i * ctx->region_max_tbs;
+    }
+    ctx->cur_region = 0;
+    ctx->evict_hand = 0;
+}
+
 static inline void code_gen_alloc(size_t tb_size)
 {
     tcg_ctx.code_gen_buffer_size = size_code_gen_buffer(tb_size);
@@ -685,6 +954,7 @@ static inline void code_gen_alloc(size_t tb_size)
             CODE_GEN_AVG_BLOCK_SIZE;
     tcg_ctx.tb_ctx.tbs =
             g_malloc(tcg_ctx.code_gen_max_blocks * sizeof(TranslationBlock));
+    tb_region_init();
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -693,6 +963,12 @@ static inline void code_gen_alloc(size_t tb_size)
 void tcg_exec_init(unsigned long tb_size)
 {
     cpu_gen_init();
+    qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
+#ifdef CONFIG_USER_ONLY
+    qemu_mutex_init(&tcg_atomic_mutex);
+#endif
+    qht_init(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE,
+             QHT_MODE_AUTO_RESIZE);
     code_gen_alloc(tb_size);
     tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
     tcg_register_jit(tcg_ctx.code_gen_buffer, tcg_ctx.code_gen_buffer_size);
@@ -709,20 +985,26 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+/* Allocate a new translation block in the current region.  Returns NULL
+   if the region has too many translation blocks or too much generated
+   code; the caller must then make room with tb_evict.  */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &ctx->regions[ctx->cur_region];
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks ||
-        (tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer) >=
-         tcg_ctx.code_gen_buffer_max_size) {
+    if (r->nb_tbs >= ctx->region_max_tbs ||
+        (uint8_t *)tcg_ctx.code_gen_ptr >= r->limit) {
         return NULL;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &r->tbs[r->nb_tbs++];
+    ctx->nb_tbs++;
+    tb->region = r;
     tb->pc = pc;
     tb->cflags = 0;
+    tb->exec_count = 0;
+    tb->exit_count = 0;
     return tb;
 }
 
@@ -731,9 +1013,11 @@ void tb_free(TranslationBlock *tb)
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+    TBRegion *r = &tcg_ctx.tb_ctx.regions[tcg_ctx.tb_ctx.cur_region];
+
+    if (r->nb_tbs > 0 && tb == &r->tbs[r->nb_tbs - 1]) {
         tcg_ctx.code_gen_ptr = tb->tc_ptr;
+        r->nb_tbs--;
         tcg_ctx.tb_ctx.nb_tbs--;
     }
 }
@@ -781,10 +1065,13 @@ static void page_flush_tb(void)
 }
 
 /* flush all the translation blocks */
-/* XXX: tb_flush is currently not thread safe */
+/* XXX: tb_flush is not thread safe; with multi-threaded TCG it must run
+ * while no vCPU executes translated code, see tb_flush_safe.
+ */
 void tb_flush(CPUArchState *env1)
 {
     CPUState *cpu = ENV_GET_CPU(env1);
+    int i;
 
 #if defined(DEBUG_FLUSH)
     printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
@@ -798,12 +1085,20 @@ void tb_flush(CPUArchState *env1)
         cpu_abort(cpu, "Internal error: code buffer overflow\n");
     }
     tcg_ctx.tb_ctx.nb_tbs = 0;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+        r->nb_tbs = 0;
+        r->end = r->start;
+        r->used = false;
+    }
+    tcg_ctx.tb_ctx.cur_region = 0;
 
     CPU_FOREACH(cpu) {
         memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
     }
 
-    memset(tcg_ctx.tb_ctx.tb_phys_hash, 0, sizeof(tcg_ctx.tb_ctx.tb_phys_hash));
+    qht_reset(&tcg_ctx.tb_ctx.htable);
     page_flush_tb();
 
     tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
@@ -812,61 +1107,131 @@ void tb_flush(CPUArchState *env1)
     tcg_ctx.tb_ctx.tb_flush_count++;
 }
 
-#ifdef DEBUG_TB_CHECK
+#if !defined(CONFIG_USER_ONLY)
+typedef struct TBFlushRequest {
+    CPUState *cpu;
+    int flush_count;
+    int evict_count;
+} TBFlushRequest;
 
-static void tb_invalidate_check(target_ulong address)
+static void do_tb_flush_safe(void *data)
 {
-    TranslationBlock *tb;
-    int i;
+    TBFlushRequest *req = data;
 
-    address &= TARGET_PAGE_MASK;
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tb_ctx.tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
-            if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
-                  address >= tb->pc + tb->size)) {
-                printf("ERROR invalidate: address=" TARGET_FMT_lx
-                       " PC=%08lx size=%04x\n",
-                       address, (long)tb->pc, tb->size);
-            }
-        }
+    /* Several vCPUs may have run out of space at the same time; only
+     * the first request actually needs to flush.
+     */
+    if (tcg_ctx.tb_ctx.tb_flush_count == req->flush_count) {
+        tb_flush(req->cpu->env_ptr);
     }
+    g_free(req);
 }
 
-/* verify that all the pages have correct rights for code */
-static void tb_page_check(void)
+/* Flush the translation buffer once every vCPU has left the translated
+ * code.  Called from a vCPU thread inside cpu_exec, which must leave the
+ * execution loop afterwards so that the flush can proceed.
+ */
+static void tb_flush_safe(CPUState *cpu)
 {
-    TranslationBlock *tb;
-    int i, flags1, flags2;
-
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tcg_ctx.tb_ctx.tb_phys_hash[i]; tb != NULL;
-                tb = tb->phys_hash_next) {
-            flags1 = page_get_flags(tb->pc);
-            flags2 = page_get_flags(tb->pc + tb->size - 1);
-            if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
-                printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
-                       (long)tb->pc, tb->size, flags1, flags2);
-            }
-        }
+    TBFlushRequest *req = g_new(TBFlushRequest, 1);
+
+    req->cpu = cpu;
+    req->flush_count = tcg_ctx.tb_ctx.tb_flush_count;
+    async_safe_run_on_cpu(cpu, do_tb_flush_safe, req);
+}
+
+static void do_tb_evict_safe(void *data)
+{
+    TBFlushRequest *req = data;
+
+    /* As for flushes, only the first request needs to make room.  */
+    if (tcg_ctx.tb_ctx.tb_flush_count == req->flush_count &&
+        tcg_ctx.tb_ctx.tb_evict_count == req->evict_count) {
+        tb_evict(req->cpu->env_ptr);
     }
+    g_free(req);
 }
 
+/* Like tb_flush_safe, but only evict one region of the code buffer.  */
+static void tb_evict_safe(CPUState *cpu)
+{
+    TBFlushRequest *req = g_new(TBFlushRequest, 1);
+
+    req->cpu = cpu;
+    req->flush_count = tcg_ctx.tb_ctx.tb_flush_count;
+    req->evict_count = tcg_ctx.tb_ctx.tb_evict_count;
+    async_safe_run_on_cpu(cpu, do_tb_evict_safe, req);
+}
+
+/* Start or stop counting block executions.  Enabling flushes the
+ * translation buffer so that every block is retranslated with a counter,
+ * and resets the translation statistics.  Disabling only affects blocks
+ * translated from now on, so that the counts collected so far can still
+ * be read until the next flush.
+ */
+void tb_profile_enable(bool enable)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+
+    if (ctx->profile == enable) {
+        return;
+    }
+    tb_lock();
+    if (enable) {
+        ctx->prof_translations = 0;
+        ctx->prof_translate_time = 0;
+        ctx->prof_guest_bytes = 0;
+        ctx->prof_host_bytes = 0;
+    }
+    ctx->profile = enable;
+    tb_unlock();
+    if (enable && first_cpu) {
+        tb_flush_safe(first_cpu);
+    }
+}
 #endif
 
-static inline void tb_hash_remove(TranslationBlock **ptb, TranslationBlock *tb)
+#ifdef DEBUG_TB_CHECK
+
+static void do_tb_invalidate_check(QHT *ht, void *p, uint32_t hash,
+                                   void *userp)
 {
-    TranslationBlock *tb1;
+    TranslationBlock *tb = p;
+    target_ulong addr = *(target_ulong *)userp;
 
-    for (;;) {
-        tb1 = *ptb;
-        if (tb1 == tb) {
-            *ptb = tb1->phys_hash_next;
-            break;
-        }
-        ptb = &tb1->phys_hash_next;
+    if (!(addr + TARGET_PAGE_SIZE <= tb->pc || addr >= tb->pc + tb->size)) {
+        printf("ERROR invalidate: address=" TARGET_FMT_lx
+               " PC=%08lx size=%04x\n", addr, (long)tb->pc, tb->size);
+    }
+}
+
+static void tb_invalidate_check(target_ulong address)
+{
+    address &= TARGET_PAGE_MASK;
+    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_invalidate_check, &address);
+}
+
+static void do_tb_page_check(QHT *ht, void *p, uint32_t hash, void *userp)
+{
+    TranslationBlock *tb = p;
+    int flags1, flags2;
+
+    flags1 = page_get_flags(tb->pc);
+    flags2 = page_get_flags(tb->pc + tb->size - 1);
+    if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
+        printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
+               (long)tb->pc, tb->size, flags1, flags2);
     }
 }
 
+/* verify that all the pages have correct rights for code */
+static void tb_page_check(void)
+{
+    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_page_check, NULL);
+}
+
+#endif
+
 static inline void tb_page_remove(TranslationBlock **ptb, TranslationBlock *tb)
 {
     TranslationBlock *tb1;
@@ -920,19 +1285,24 @@ static inline void tb_reset_jump(TranslationBlock *tb, int n)
     tb_set_jmp_target(tb, n, (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[n]));
 }
 
-/* invalidate one TB */
-void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+/* Unlink one TB from the hash table, the page lists and the jump lists.
+   Returns false if the TB had already been invalidated.  */
+static bool do_tb_phys_invalidate(TranslationBlock *tb,
+                                  tb_page_addr_t page_addr)
 {
     CPUState *cpu;
     PageDesc *p;
-    unsigned int h, n1;
+    uint32_t h;
+    unsigned int n1;
     tb_page_addr_t phys_pc;
     TranslationBlock *tb1, *tb2;
 
     /* remove the TB from the hash list */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
-    h = tb_phys_hash_func(phys_pc);
-    tb_hash_remove(&tcg_ctx.tb_ctx.tb_phys_hash[h], tb);
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags, tb->cs_base);
+    if (!qht_remove(&tcg_ctx.tb_ctx.htable, tb, h)) {
+        return false;
+    }
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
@@ -974,8 +1344,73 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
         tb1 = tb2;
     }
     tb->jmp_first = (TranslationBlock *)((uintptr_t)tb | 2); /* fail safe */
+    return true;
+}
+
+/* invalidate one TB */
+void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+{
+    if (do_tb_phys_invalidate(tb, page_addr)) {
+        tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
+    }
+}
+
+/* Pick the region to empty with a clock scan: regions whose TBs were
+   looked up since the hand last passed get a second chance.  The current
+   region, which has just been filled, is never picked.  */
+static int tb_evict_pick_region(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r;
+
+    for (;;) {
+        ctx->evict_hand = (ctx->evict_hand + 1) % ctx->nb_regions;
+        if (ctx->evict_hand == ctx->cur_region) {
+            continue;
+        }
+        r = &ctx->regions[ctx->evict_hand];
+        if (!atomic_read(&r->used)) {
+            return ctx->evict_hand;
+        }
+        atomic_set(&r->used, false);
+    }
+}
+
+/* Make room for new TBs: empty the least recently used region of the
+   code buffer and allocate from it, unlinking all jumps into its TBs.
+   A buffer with a single region is flushed.  Like tb_flush, this must
+   not run while another vCPU executes translated code.  */
+static void tb_evict(CPUArchState *env)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r;
+    int i;
+
+    if (ctx->nb_regions == 1) {
+        tb_flush(env);
+        return;
+    }
 
-    tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
+    /* the region being left counts as used, its code is the newest */
+    r = &ctx->regions[ctx->cur_region];
+    r->end = tcg_ctx.code_gen_ptr;
+    r->used = true;
+
+    ctx->cur_region = tb_evict_pick_region();
+    r = &ctx->regions[ctx->cur_region];
+    trace_translate_evict_region(ctx->cur_region, r->nb_tbs);
+    for (i = 0; i < r->nb_tbs; i++) {
+        do_tb_phys_invalidate(&r->tbs[i], -1);
+    }
+    ctx->nb_tbs -= r->nb_tbs;
+    r->nb_tbs = 0;
+    r->end = r->start;
+    r->used = false;
+    tcg_ctx.code_gen_ptr = r->start;
+
+    /* cpu_exec must not chain to a TB that may have been evicted */
+    ctx->tb_invalidated_flag = 1;
+    ctx->tb_evict_count++;
 }
 
 static inline void set_bits(uint8_t *tab, int start, int len)
@@ -1043,15 +1478,28 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     int code_gen_size;
+    int64_t ti = 0;
 
     phys_pc = get_page_addr_code(env, pc);
     if (use_icount) {
         cflags |= CF_USE_ICOUNT;
     }
+    if (tcg_ctx.tb_ctx.profile) {
+        cflags |= CF_PROFILE;
+        ti = get_clock();
+    }
     tb = tb_alloc(pc);
     if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
+#if !defined(CONFIG_USER_ONLY)
+        if (qemu_tcg_mttcg_enabled()) {
+            /* other vCPUs may be running code from the buffer */
+            tb_evict_safe(cpu);
+            cpu->exception_index = EXCP_INTERRUPT;
+            cpu_loop_exit(cpu);
+        }
+#endif
+        /* eviction must be done */
+        tb_evict(env);
         /* cannot fail at this point */
         tb = tb_alloc(pc);
         /* Don't forget to invalidate previous TB info.  */
@@ -1061,10 +1509,25 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
-    cpu_gen_code(env, tb, &code_gen_size);
+    if (!tb_cache_load(cpu, tb, &code_gen_size)) {
+        /* record relocations if the code is to be saved */
+        tcg_ctx.code_reloc = tb_cache_wanted(cpu, tb);
+        cpu_gen_code(env, tb, &code_gen_size);
+        if (tcg_ctx.code_reloc) {
+            tb_cache_store(tb, code_gen_size);
+            tcg_ctx.code_reloc = false;
+        }
+    }
     tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)tcg_ctx.code_gen_ptr +
             code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
 
+    if (cflags & CF_PROFILE) {
+        tcg_ctx.tb_ctx.prof_translations++;
+        tcg_ctx.tb_ctx.prof_translate_time += get_clock() - ti;
+        tcg_ctx.tb_ctx.prof_guest_bytes += tb->size;
+        tcg_ctx.tb_ctx.prof_host_bytes += tb->tc_size;
+    }
+
     /* check next page if needed */
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
     phys_page2 = -1;
@@ -1380,17 +1843,11 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2)
 {
-    unsigned int h;
-    TranslationBlock **ptb;
+    uint32_t h;
 
     /* Grab the mmap lock to stop another thread invalidating this TB
        before we are done.  */
     mmap_lock();
-    /* add in the physical hash table */
-    h = tb_phys_hash_func(phys_pc);
-    ptb = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    tb->phys_hash_next = *ptb;
-    *ptb = tb;
 
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
@@ -1412,6 +1869,11 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
         tb_reset_jump(tb, 1);
     }
 
+    /* add in the physical hash table last: lookups do not take tb_lock,
+       so the TB must be complete when it becomes visible */
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags, tb->cs_base);
+    qht_insert(&tcg_ctx.tb_ctx.htable, tb, h);
+
 #ifdef DEBUG_TB_CHECK
     tb_page_check();
 #endif
@@ -1422,23 +1884,35 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
    tb[1].tc_ptr. Return NULL if not found */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
-    int m_min, m_max, m;
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    int m_min, m_max, m, i;
     uintptr_t v;
     TranslationBlock *tb;
+    TBRegion *r;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
+    /* find the region, the TBs of each one are sorted by tc_ptr */
+    for (i = ctx->nb_regions - 1; i >= 0; i--) {
+        if (tc_ptr >= (uintptr_t)ctx->regions[i].start) {
+            break;
+        }
+    }
+    if (i < 0) {
         return NULL;
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    r = &ctx->regions[i];
+    if (r->nb_tbs <= 0) {
+        return NULL;
+    }
+    if (tc_ptr >= (uintptr_t)(i == ctx->cur_region ? tcg_ctx.code_gen_ptr
+                                                   : r->end)) {
         return NULL;
     }
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
+        tb = &r->tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1448,7 +1922,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return &r->tbs[m_max];
 }
 
 #if !defined(CONFIG_USER_ONLY)
@@ -1457,6 +1931,7 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
     ram_addr_t ram_addr;
     MemoryRegion *mr;
     hwaddr l = 1;
+    bool locked;
 
     mr = address_space_translate(as, addr, &addr, &l, false);
     if (!(memory_region_is_ram(mr)
@@ -1465,7 +1940,11 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
     }
     ram_addr = (memory_region_get_ram_addr(mr) & TARGET_PAGE_MASK)
         + addr;
+    locked = tb_lock_recursive();
     tb_invalidate_phys_page_range(ram_addr, ram_addr + 1, 0);
+    if (locked) {
+        tb_unlock();
+    }
 }
 #endif /* !defined(CONFIG_USER_ONLY) */
 
@@ -1473,6 +1952,7 @@ void tb_check_watchpoint(CPUState *cpu)
 {
     TranslationBlock *tb;
 
+    tb_lock();
     tb = tb_find_pc(cpu->mem_io_pc);
     if (!tb) {
         cpu_abort(cpu, "check_watchpoint: could not find TB for pc=%p",
@@ -1480,6 +1960,7 @@ void tb_check_watchpoint(CPUState *cpu)
     }
     cpu_restore_state_from_tb(cpu, tb, cpu->mem_io_pc);
     tb_phys_invalidate(tb, -1);
+    tb_unlock();
 }
 
 #ifndef CONFIG_USER_ONLY
@@ -1525,6 +2006,8 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
     target_ulong pc, cs_base;
     uint64_t flags;
 
+    /* released by cpu_exec after cpu_resume_from_signal */
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (!tb) {
         cpu_abort(cpu, "cpu_io_recompile: could not find TB for pc=%p",
@@ -1591,51 +2074,96 @@ void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
            TB_JMP_PAGE_SIZE * sizeof(TranslationBlock *));
 }
 
+static void print_qht_statistics(FILE *f, fprintf_function cpu_fprintf,
+                                 const QHTStats *hst)
+{
+    int i;
+
+    cpu_fprintf(f, "TB hash buckets     %zu/%zu (%0.2f%% head buckets used)\n",
+                hst->used_head_buckets, hst->head_buckets,
+                hst->head_buckets ?
+                (double)hst->used_head_buckets / hst->head_buckets * 100 : 0);
+    cpu_fprintf(f, "TB hash occupancy   %zu/%zu (%0.2f%% of entry slots)\n",
+                hst->entries, hst->slots,
+                hst->slots ? (double)hst->entries / hst->slots * 100 : 0);
+    cpu_fprintf(f, "TB hash avg chain   %0.3f buckets max=%zu\n",
+                hst->used_head_buckets ?
+                (double)hst->chain_sum / hst->used_head_buckets : 0,
+                hst->max_chain);
+    cpu_fprintf(f, "TB hash chain hist ");
+    for (i = 0; i < QHT_STATS_CHAIN_HIST; i++) {
+        cpu_fprintf(f, " %d%s:%zu", i + 1,
+                    i == QHT_STATS_CHAIN_HIST - 1 ? "+" : "",
+                    hst->chain_hist[i]);
+    }
+    cpu_fprintf(f, "\n");
+}
+
+/* Bytes of generated code in all regions */
+static size_t tb_code_size(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    size_t size = 0;
+    int i;
+
+    for (i = 0; i < ctx->nb_regions; i++) {
+        TBRegion *r = &ctx->regions[i];
+
+        size += (i == ctx->cur_region ? (uint8_t *)tcg_ctx.code_gen_ptr
+                                      : r->end) - r->start;
+    }
+    return size;
+}
+
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    size_t code_size = tb_code_size();
     TranslationBlock *tb;
+    TBRegion *r;
+    QHTStats hst;
 
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        r = &tcg_ctx.tb_ctx.regions[i];
+        for (j = 0; j < r->nb_tbs; j++) {
+            tb = &r->tbs[j];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_buffer_max_size);
+    cpu_fprintf(f, "gen code size       %zd/%zd\n",
+                code_size, tcg_ctx.code_gen_buffer_max_size);
+    cpu_fprintf(f, "code regions        %d (current %d)\n",
+                tcg_ctx.tb_ctx.nb_regions, tcg_ctx.tb_ctx.cur_region);
     cpu_fprintf(f, "TB count            %d/%d\n",
             tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
             tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
                     tcg_ctx.tb_ctx.nb_tbs : 0,
             max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+    cpu_fprintf(f, "TB avg host size    %zd bytes (expansion ratio: %0.1f)\n",
+            tcg_ctx.tb_ctx.nb_tbs ? code_size / tcg_ctx.tb_ctx.nb_tbs : 0,
+                target_code_size ? (double) code_size /
+                                            target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
             tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
                                     tcg_ctx.tb_ctx.nb_tbs : 0);
@@ -1646,11 +2174,17 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 direct_jmp2_count,
                 tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
                         tcg_ctx.tb_ctx.nb_tbs : 0);
+
+    qht_statistics_init(&tcg_ctx.tb_ctx.htable, &hst);
+    print_qht_statistics(f, cpu_fprintf, &hst);
+
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB evict count      %d\n", tcg_ctx.tb_ctx.tb_evict_count);
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    dump_tlb_info(f, cpu_fprintf);
     tcg_dump_info(f, cpu_fprintf);
 }
 
@@ -1659,6 +2193,158 @@ void dump_opcount_info(FILE *f, fprintf_function cpu_fprintf)
     tcg_dump_op_count(f, cpu_fprintf);
 }
 
+static int tb_exec_count_cmp(const void *a, const void *b)
+{
+    const TranslationBlock *ta = *(TranslationBlock * const *)a;
+    const TranslationBlock *tb = *(TranslationBlock * const *)b;
+
+    if (ta->exec_count != tb->exec_count) {
+        return ta->exec_count > tb->exec_count ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Return the profiled blocks that have run at least once, hottest first,
+ * and store their number in *@nb.  Called with tb_lock held.
+ */
+static TranslationBlock **tb_profile_sort(int *nb)
+{
+    TranslationBlock **list = g_new(TranslationBlock *,
+                                    tcg_ctx.tb_ctx.nb_tbs + 1);
+    TranslationBlock *tb;
+    TBRegion *r;
+    int i, j, n = 0;
+
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        r = &tcg_ctx.tb_ctx.regions[i];
+        for (j = 0; j < r->nb_tbs; j++) {
+            tb = &r->tbs[j];
+            if ((tb->cflags & CF_PROFILE) && tb->exec_count) {
+                list[n++] = tb;
+            }
+        }
+    }
+    qsort(list, n, sizeof(*list), tb_exec_count_cmp);
+    *nb = n;
+    return list;
+}
+
+static inline tb_page_addr_t tb_phys_pc(const TranslationBlock *tb)
+{
+    return tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+}
+
+void dump_tb_profile(FILE *f, fprintf_function cpu_fprintf, int count)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TranslationBlock **list;
+    uint64_t total = 0;
+    int i, n;
+
+    cpu_fprintf(f, "\nProfile (%s):\n", ctx->profile ? "enabled" : "disabled");
+    cpu_fprintf(f, "translations        %" PRIu64 "\n",
+                ctx->prof_translations);
+    cpu_fprintf(f, "translation time    %" PRIu64 " us (%0.1f us/TB)\n",
+                ctx->prof_translate_time / 1000,
+                ctx->prof_translations ?
+                (double)ctx->prof_translate_time / 1000 /
+                ctx->prof_translations : 0);
+    cpu_fprintf(f, "translated bytes    %" PRIu64 " guest -> %" PRIu64
+                " host (expansion ratio: %0.1f)\n",
+                ctx->prof_guest_bytes, ctx->prof_host_bytes,
+                ctx->prof_guest_bytes ?
+                (double)ctx->prof_host_bytes / ctx->prof_guest_bytes : 0);
+
+    tb_lock();
+    list = tb_profile_sort(&n);
+    for (i = 0; i < n; i++) {
+        total += list[i]->exec_count;
+    }
+    if (n) {
+        cpu_fprintf(f, "\n%-18s %-18s %5s %6s %6s %12s %6s %10s\n",
+                    "guest pc", "phys pc", "insns", "guest", "host",
+                    "executions", "%", "exits");
+    }
+    for (i = 0; i < MIN(n, count); i++) {
+        TranslationBlock *tb = list[i];
+
+        cpu_fprintf(f, "0x%016" PRIx64 " 0x%016" PRIx64
+                    " %5u %6u %6u %12" PRIu64 " %6.2f %10" PRIu64 "\n",
+                    (uint64_t)tb->pc, (uint64_t)tb_phys_pc(tb),
+                    tb->icount, tb->size, tb->tc_size, tb->exec_count,
+                    (double)tb->exec_count * 100 / total, tb->exit_count);
+    }
+    tb_unlock();
+    g_free(list);
+}
+
+JitInfo *qmp_query_jit(bool has_count, int64_t count, Error **errp)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    JitInfo *info;
+    JitBlockInfoList *head = NULL, **tail = &head;
+    TranslationBlock **list;
+    int i, n;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "JIT information is only available with TCG");
+        return NULL;
+    }
+    if (!has_count) {
+        count = 10;
+    } else if (count < 0) {
+        error_setg(errp, "Parameter 'count' expects a non-negative value");
+        return NULL;
+    }
+
+    info = g_new0(JitInfo, 1);
+    info->profiling = ctx->profile;
+    info->translations = ctx->prof_translations;
+    info->translation_time_ns = ctx->prof_translate_time;
+    info->guest_bytes = ctx->prof_guest_bytes;
+    info->host_bytes = ctx->prof_host_bytes;
+
+    tb_lock();
+    info->code_size = tb_code_size();
+    info->code_capacity = tcg_ctx.code_gen_buffer_max_size;
+    info->blocks = ctx->nb_tbs;
+    info->max_blocks = tcg_ctx.code_gen_max_blocks;
+    info->flushes = ctx->tb_flush_count;
+    info->evictions = ctx->tb_evict_count;
+    info->invalidations = ctx->tb_phys_invalidate_count;
+
+    list = tb_profile_sort(&n);
+    for (i = 0; i < MIN(n, count); i++) {
+        TranslationBlock *tb = list[i];
+        JitBlockInfoList *entry = g_new0(JitBlockInfoList, 1);
+
+        entry->value = g_new0(JitBlockInfo, 1);
+        entry->value->pc = tb->pc;
+        entry->value->phys_pc = tb_phys_pc(tb);
+        entry->value->instructions = tb->icount;
+        entry->value->guest_size = tb->size;
+        entry->value->host_size = tb->tc_size;
+        entry->value->executions = tb->exec_count;
+        entry->value->exits = tb->exit_count;
+        *tail = entry;
+        tail = &entry->next;
+    }
+    tb_unlock();
+    g_free(list);
+
+    info->hot_blocks = head;
+    return info;
+}
+
+void qmp_jit_profile(bool enable, Error **errp)
+{
+    if (!tcg_enabled()) {
+        error_setg(errp, "JIT profiling is only available with TCG");
+        return;
+    }
+    tb_profile_enable(enable);
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
@@ -57,6 +57,8 @@ extern int daemon(int, int);
 #include "sysemu/sysemu.h"
 #include "trace.h"
 #include "qemu/sockets.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
 #include <sys/mman.h>
 #include <libgen.h>
 #include <setjmp.h>
@@ -344,11 +346,48 @@ char *qemu_get_exec_dir(void)
     return g_strdup(exec_dir);
 }
 
-static sigjmp_buf sigjump;
-
-static void sigbus_handler(int signal)
+/* More threads than this rarely help: page faults serialise on the
+ * memory cgroup and the mm locks.
+ */
+#define MAX_MEM_PREALLOC_THREADS 16
+
+typedef struct MemsetThread {
+    char *addr;
+    size_t numpages;
+    size_t hpagesize;
+    QemuThread pgthread;
+    sigjmp_buf env;
+} MemsetThread;
+
+static MemsetThread *memset_thread;
+static int memset_num_threads;
+static bool memset_thread_failed;
+static struct sigaction sigbus_oldact;
+
+static void sigbus_handler(int sig, siginfo_t *siginfo, void *ctx)
 {
-    siglongjmp(sigjump, 1);
+    int i;
+
+    if (memset_thread) {
+        for (i = 0; i < memset_num_threads; i++) {
+            if (qemu_thread_is_self(&memset_thread[i].pgthread)) {
+                siglongjmp(memset_thread[i].env, 1);
+            }
+        }
+    }
+
+    /* Not a preallocation fault, e.g. a machine check in a VCPU thread:
+     * hand it to the previous handler.  Without one, returning with the
+     * default action in place repeats the fault and kills the process.
+     */
+    if (sigbus_oldact.sa_flags & SA_SIGINFO) {
+        sigbus_oldact.sa_sigaction(sig, siginfo, ctx);
+    } else if (sigbus_oldact.sa_handler != SIG_DFL &&
+               sigbus_oldact.sa_handler != SIG_IGN) {
+        sigbus_oldact.sa_handler(sig);
+    } else {
+        signal(SIGBUS, SIG_DFL);
+    }
 }
 
 static size_t fd_getpagesize(int fd)
@@ -371,47 +410,95 @@ static size_t fd_getpagesize(int fd)
     return getpagesize();
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory)
+static void *do_touch_pages(void *arg)
+{
+    MemsetThread *memset_args = arg;
+    sigset_t set;
+    size_t i;
+
+    qemu_thread_get_self(&memset_args->pgthread);
+
+    /* qemu_thread_create() blocks all signals */
+    sigemptyset(&set);
+    sigaddset(&set, SIGBUS);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+    if (sigsetjmp(memset_args->env, 1)) {
+        memset_thread_failed = true;
+    } else {
+        for (i = 0; i < memset_args->numpages; i++) {
+            /* Write back what is there, memory may already be in use */
+            volatile char *p = memset_args->addr + i * memset_args->hpagesize;
+
+            *p = *p;
+        }
+    }
+    return NULL;
+}
+
+static void touch_all_pages(char *area, size_t hpagesize, size_t numpages,
+                            int threads)
+{
+    size_t numpages_per_thread, leftover;
+    char *addr = area;
+    int i;
+
+    memset_num_threads = MIN(MAX(threads, 1), MAX_MEM_PREALLOC_THREADS);
+    memset_num_threads = MIN(memset_num_threads, MAX(numpages, 1));
+    memset_thread = g_new0(MemsetThread, memset_num_threads);
+    numpages_per_thread = numpages / memset_num_threads;
+    leftover = numpages % memset_num_threads;
+
+    for (i = 0; i < memset_num_threads; i++) {
+        memset_thread[i].addr = addr;
+        memset_thread[i].numpages = numpages_per_thread + (i < leftover);
+        memset_thread[i].hpagesize = hpagesize;
+        qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
+                           do_touch_pages, &memset_thread[i],
+                           QEMU_THREAD_JOINABLE);
+        addr += memset_thread[i].numpages * hpagesize;
+    }
+    for (i = 0; i < memset_num_threads; i++) {
+        qemu_thread_join(&memset_thread[i].pgthread);
+    }
+
+    g_free(memset_thread);
+    memset_thread = NULL;
+}
+
+void os_mem_prealloc(int fd, char *area, size_t memory, int threads)
 {
     int ret;
-    struct sigaction act, oldact;
-    sigset_t set, oldset;
+    struct sigaction act;
+    size_t hpagesize = fd_getpagesize(fd);
+    int64_t start = get_clock();
 
     memset(&act, 0, sizeof(act));
-    act.sa_handler = &sigbus_handler;
-    act.sa_flags = 0;
+    act.sa_sigaction = &sigbus_handler;
+    act.sa_flags = SA_SIGINFO;
 
-    ret = sigaction(SIGBUS, &act, &oldact);
+    ret = sigaction(SIGBUS, &act, &sigbus_oldact);
     if (ret) {
         perror("os_mem_prealloc: failed to install signal handler");
         exit(1);
     }
 
-    /* unblock SIGBUS */
-    sigemptyset(&set);
-    sigaddset(&set, SIGBUS);
-    pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
-
-    if (sigsetjmp(sigjump, 1)) {
+    /* MAP_POPULATE silently ignores failures */
+    memory = (memory + hpagesize - 1) & -hpagesize;
+    memset_thread_failed = false;
+    touch_all_pages(area, hpagesize, memory / hpagesize, threads);
+    if (memset_thread_failed) {
         fprintf(stderr, "os_mem_prealloc: Insufficient free host memory "
                         "pages available to allocate guest RAM\n");
         exit(1);
-    } else {
-        int i;
-        size_t hpagesize = fd_getpagesize(fd);
-
-        /* MAP_POPULATE silently ignores failures */
-        memory = (memory + hpagesize - 1) & -hpagesize;
-        for (i = 0; i < (memory / hpagesize); i++) {
-            memset(area + (hpagesize * i), 0, 1);
-        }
-
-        ret = sigaction(SIGBUS, &oldact, NULL);
-        if (ret) {
-            perror("os_mem_prealloc: failed to reinstall signal handler");
-            exit(1);
-        }
+    }
 
-        pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    ret = sigaction(SIGBUS, &sigbus_oldact, NULL);
+    if (ret) {
+        perror("os_mem_prealloc: failed to reinstall signal handler");
+        exit(1);
     }
+
+    trace_os_mem_prealloc(area, memory, memset_num_threads,
+                          get_clock() - start);
 }
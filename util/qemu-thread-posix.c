@@ -23,9 +23,12 @@
 #ifdef __linux__
 #include <sys/syscall.h>
 #include <linux/futex.h>
+#include <sched.h>
 #endif
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
 #include "qemu/notify.h"
 
 static bool name_threads;
@@ -495,6 +498,101 @@ bool qemu_thread_is_self(QemuThread *thread)
    return pthread_equal(pthread_self(), thread->thread);
 }
 
+int qemu_host_node_cpus(int node, unsigned long *host_cpus,
+                        unsigned long nbits)
+{
+#ifdef __linux__
+    char path[64], buf[4096], *p;
+    bool empty = true;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    f = fopen(path, "r");
+    if (!f) {
+        return -errno;
+    }
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    if (!p) {
+        return -EINVAL;
+    }
+
+    /* The list looks like "0-3,8-11" */
+    while (*p && *p != '\n') {
+        unsigned long first, last;
+        char *end;
+
+        first = last = strtoul(p, &end, 10);
+        if (end == p) {
+            return -EINVAL;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+            if (end == p || last < first) {
+                return -EINVAL;
+            }
+        }
+        for (; first <= last && first < nbits; first++) {
+            set_bit(first, host_cpus);
+            empty = false;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return empty ? -EINVAL : 0;
+#else
+    return -ENOSYS;
+#endif
+}
+
+#ifdef __linux__
+static int cpu_set_from_bitmap(cpu_set_t *set, const unsigned long *host_cpus,
+                               unsigned long nbits)
+{
+    unsigned long cpu;
+
+    CPU_ZERO(set);
+    for (cpu = 0; cpu < nbits && cpu < CPU_SETSIZE; cpu++) {
+        if (test_bit(cpu, host_cpus)) {
+            CPU_SET(cpu, set);
+        }
+    }
+    return CPU_COUNT(set) ? 0 : -EINVAL;
+}
+#endif
+
+int qemu_thread_set_affinity(QemuThread *thread, const unsigned long *host_cpus,
+                             unsigned long nbits)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    int err;
+
+    err = cpu_set_from_bitmap(&set, host_cpus, nbits);
+    if (err) {
+        return err;
+    }
+    return -pthread_setaffinity_np(thread->thread, sizeof(set), &set);
+#else
+    return -ENOSYS;
+#endif
+}
+
+int qemu_thread_bind_node(int node)
+{
+    unsigned long host_cpus[BITS_TO_LONGS(MAX_HOST_CPUS)] = { 0 };
+    QemuThread self;
+    int ret;
+
+    ret = qemu_host_node_cpus(node, host_cpus, MAX_HOST_CPUS);
+    if (ret < 0) {
+        return ret;
+    }
+    qemu_thread_get_self(&self);
+    return qemu_thread_set_affinity(&self, host_cpus, MAX_HOST_CPUS);
+}
+
 void qemu_thread_exit(void *retval)
 {
     pthread_exit(retval);
@@ -394,6 +394,23 @@ void qemu_thread_get_self(QemuThread *thread)
     thread->tid = GetCurrentThreadId();
 }
 
+int qemu_host_node_cpus(int node, unsigned long *host_cpus,
+                        unsigned long nbits)
+{
+    return -ENOSYS;
+}
+
+int qemu_thread_set_affinity(QemuThread *thread, const unsigned long *host_cpus,
+                             unsigned long nbits)
+{
+    return -ENOSYS;
+}
+
+int qemu_thread_bind_node(int node)
+{
+    return -ENOSYS;
+}
+
 HANDLE qemu_thread_get_handle(QemuThread *thread)
 {
     QemuThreadData *data;
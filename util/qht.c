@@ -0,0 +1,390 @@
+/*
+ * Resizable hash table with lock-free lookups
+ *
+ * Copyright (c) 2015 the QEMU developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "qemu-common.h"
+#include "qemu/qht.h"
+#include "qemu/atomic.h"
+#include "qemu/rcu.h"
+#include "qemu/seqlock.h"
+
+/* The table is an array of head buckets, each holding a few (hash, pointer)
+ * pairs; when a head bucket is full, overflow buckets are chained to it.
+ * Entries of a chain are kept dense, so that a lookup can stop at the
+ * first empty slot: removal moves the chain's last entry into the hole.
+ *
+ * Writers are serialised by QHT.lock.  Every modification of a chain is
+ * done inside a write section of its head bucket's seqlock, so readers
+ * never take a lock: they walk the chain and retry if a writer was active
+ * meanwhile.  Growing the table builds a new bucket array and publishes
+ * it with RCU; the old one is freed after a grace period, and is never
+ * modified once the new one is visible.
+ *
+ * A bucket fills one 64-byte cache line.
+ */
+#if HOST_LONG_BITS == 32
+#define QHT_BUCKET_ENTRIES 6
+#else
+#define QHT_BUCKET_ENTRIES 3
+#endif
+
+#define QHT_BUCKET_ALIGN 64
+
+/* grow when more than 1/QHT_ADDED_BUCKETS_DIV of the head buckets overflow */
+#define QHT_ADDED_BUCKETS_DIV 8
+
+typedef struct QHTBucket QHTBucket;
+
+struct QHTBucket {
+    QemuSeqLock sequence;       /* only used in head buckets */
+    uint32_t hashes[QHT_BUCKET_ENTRIES];
+    void *pointers[QHT_BUCKET_ENTRIES];
+    QHTBucket *next;
+};
+
+QEMU_BUILD_BUG_ON(sizeof(QHTBucket) > QHT_BUCKET_ALIGN);
+
+struct QHTMap {
+    struct rcu_head rcu;
+    QHTBucket *buckets;
+    size_t n_buckets;
+    size_t n_added_buckets;
+    size_t n_entries;
+};
+
+static inline size_t qht_elems_to_buckets(size_t n_elems)
+{
+    return pow2ceil(MAX(n_elems / QHT_BUCKET_ENTRIES, 1));
+}
+
+static inline QHTBucket *qht_map_to_bucket(QHTMap *map, uint32_t hash)
+{
+    return &map->buckets[hash & (map->n_buckets - 1)];
+}
+
+static QHTBucket *qht_bucket_alloc(void)
+{
+    QHTBucket *b = qemu_memalign(QHT_BUCKET_ALIGN, sizeof(*b));
+
+    memset(b, 0, sizeof(*b));
+    return b;
+}
+
+static QHTMap *qht_map_create(size_t n_buckets)
+{
+    QHTMap *map = g_new0(QHTMap, 1);
+    size_t i;
+
+    map->n_buckets = n_buckets;
+    map->buckets = qemu_memalign(QHT_BUCKET_ALIGN,
+                                 n_buckets * sizeof(QHTBucket));
+    memset(map->buckets, 0, n_buckets * sizeof(QHTBucket));
+    for (i = 0; i < n_buckets; i++) {
+        seqlock_init(&map->buckets[i].sequence, NULL);
+    }
+    return map;
+}
+
+static void qht_map_destroy(QHTMap *map)
+{
+    QHTBucket *b, *next;
+    size_t i;
+
+    for (i = 0; i < map->n_buckets; i++) {
+        for (b = map->buckets[i].next; b; b = next) {
+            next = b->next;
+            qemu_vfree(b);
+        }
+    }
+    qemu_vfree(map->buckets);
+    g_free(map);
+}
+
+static void qht_map_reclaim(QHTMap *map)
+{
+    qht_map_destroy(map);
+}
+
+void qht_init(QHT *ht, size_t n_elems, unsigned int mode)
+{
+    qemu_mutex_init(&ht->lock);
+    ht->mode = mode;
+    ht->map = qht_map_create(qht_elems_to_buckets(n_elems));
+}
+
+void qht_destroy(QHT *ht)
+{
+    qht_map_destroy(ht->map);
+    qemu_mutex_destroy(&ht->lock);
+    memset(ht, 0, sizeof(*ht));
+}
+
+static void *qht_bucket_lookup(QHTBucket *head, QHTLookupFunc func,
+                               const void *userp, uint32_t hash)
+{
+    QHTBucket *b = head;
+    void *p;
+    int i;
+
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            p = atomic_read(&b->pointers[i]);
+            if (!p) {
+                return NULL;
+            }
+            if (atomic_read(&b->hashes[i]) == hash && func(p, userp)) {
+                return p;
+            }
+        }
+        b = atomic_rcu_read(&b->next);
+    } while (b);
+
+    return NULL;
+}
+
+void *qht_lookup(QHT *ht, QHTLookupFunc func, const void *userp,
+                 uint32_t hash)
+{
+    QHTMap *map = atomic_rcu_read(&ht->map);
+    QHTBucket *head = qht_map_to_bucket(map, hash);
+    unsigned version;
+    void *ret;
+
+    do {
+        version = seqlock_read_begin(&head->sequence);
+        ret = qht_bucket_lookup(head, func, userp, hash);
+    } while (seqlock_read_retry(&head->sequence, version));
+
+    return ret;
+}
+
+/* Returns false if @obj is already in @map.  Called with the lock held,
+ * or on a map that is not visible yet.
+ */
+static bool qht_map_insert(QHTMap *map, void *obj, uint32_t hash)
+{
+    QHTBucket *head = qht_map_to_bucket(map, hash);
+    QHTBucket *b = head, *prev = NULL;
+    int i;
+
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (!b->pointers[i]) {
+                goto found;
+            }
+            if (b->pointers[i] == obj) {
+                return false;
+            }
+        }
+        prev = b;
+        b = b->next;
+    } while (b);
+
+    /* the chain is full: fill a new bucket before making it visible */
+    b = qht_bucket_alloc();
+    b->hashes[0] = hash;
+    b->pointers[0] = obj;
+    seqlock_write_lock(&head->sequence);
+    atomic_rcu_set(&prev->next, b);
+    seqlock_write_unlock(&head->sequence);
+    map->n_added_buckets++;
+    map->n_entries++;
+    return true;
+
+found:
+    seqlock_write_lock(&head->sequence);
+    atomic_set(&b->hashes[i], hash);
+    atomic_set(&b->pointers[i], obj);
+    seqlock_write_unlock(&head->sequence);
+    map->n_entries++;
+    return true;
+}
+
+static void qht_map_iter(QHTMap *map, QHT *ht, QHTIterFunc func,
+                         void *userp)
+{
+    QHTBucket *b;
+    size_t i;
+    int j;
+
+    for (i = 0; i < map->n_buckets; i++) {
+        for (b = &map->buckets[i]; b; b = b->next) {
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                if (!b->pointers[j]) {
+                    goto next_head;
+                }
+                func(ht, b->pointers[j], b->hashes[j], userp);
+            }
+        }
+    next_head:
+        ;
+    }
+}
+
+static void qht_map_copy(QHT *ht, void *obj, uint32_t hash, void *userp)
+{
+    QHTMap *new = userp;
+
+    qht_map_insert(new, obj, hash);
+}
+
+/* Called with the lock held */
+static void qht_do_resize(QHT *ht, size_t n_buckets)
+{
+    QHTMap *old = ht->map;
+    QHTMap *new = qht_map_create(n_buckets);
+
+    qht_map_iter(old, ht, qht_map_copy, new);
+    atomic_rcu_set(&ht->map, new);
+    call_rcu(old, qht_map_reclaim, rcu);
+}
+
+bool qht_insert(QHT *ht, void *obj, uint32_t hash)
+{
+    QHTMap *map;
+    bool ret;
+
+    assert(obj);
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    ret = qht_map_insert(map, obj, hash);
+    if (ret && (ht->mode & QHT_MODE_AUTO_RESIZE) &&
+        map->n_added_buckets > map->n_buckets / QHT_ADDED_BUCKETS_DIV) {
+        qht_do_resize(ht, map->n_buckets * 2);
+    }
+    qemu_mutex_unlock(&ht->lock);
+    return ret;
+}
+
+bool qht_remove(QHT *ht, const void *obj, uint32_t hash)
+{
+    QHTMap *map;
+    QHTBucket *head, *b, *last_b = NULL;
+    int i, last_i = 0, obj_i = -1;
+    QHTBucket *obj_b = NULL;
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    head = qht_map_to_bucket(map, hash);
+
+    /* find @obj and the last entry of the chain */
+    for (b = head; b; b = b->next) {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (!b->pointers[i]) {
+                goto done;
+            }
+            if (b->pointers[i] == obj) {
+                obj_b = b;
+                obj_i = i;
+            }
+            last_b = b;
+            last_i = i;
+        }
+    }
+done:
+    if (!obj_b) {
+        qemu_mutex_unlock(&ht->lock);
+        return false;
+    }
+
+    seqlock_write_lock(&head->sequence);
+    if (obj_b != last_b || obj_i != last_i) {
+        atomic_set(&obj_b->hashes[obj_i], last_b->hashes[last_i]);
+        atomic_set(&obj_b->pointers[obj_i], last_b->pointers[last_i]);
+    }
+    atomic_set(&last_b->pointers[last_i], NULL);
+    atomic_set(&last_b->hashes[last_i], 0);
+    seqlock_write_unlock(&head->sequence);
+    map->n_entries--;
+
+    qemu_mutex_unlock(&ht->lock);
+    return true;
+}
+
+/* Replace the map with an empty one of the same size, so that overflow
+ * buckets are freed and the counters start again from zero.
+ */
+void qht_reset(QHT *ht)
+{
+    QHTMap *old;
+
+    qemu_mutex_lock(&ht->lock);
+    old = ht->map;
+    atomic_rcu_set(&ht->map, qht_map_create(old->n_buckets));
+    call_rcu(old, qht_map_reclaim, rcu);
+    qemu_mutex_unlock(&ht->lock);
+}
+
+bool qht_resize(QHT *ht, size_t n_elems)
+{
+    size_t n_buckets = qht_elems_to_buckets(n_elems);
+    bool ret = false;
+
+    qemu_mutex_lock(&ht->lock);
+    if (n_buckets != ht->map->n_buckets) {
+        qht_do_resize(ht, n_buckets);
+        ret = true;
+    }
+    qemu_mutex_unlock(&ht->lock);
+    return ret;
+}
+
+void qht_iter(QHT *ht, QHTIterFunc func, void *userp)
+{
+    qemu_mutex_lock(&ht->lock);
+    qht_map_iter(ht->map, ht, func, userp);
+    qemu_mutex_unlock(&ht->lock);
+}
+
+void qht_statistics_init(QHT *ht, QHTStats *stats)
+{
+    QHTMap *map;
+    QHTBucket *head, *b;
+    size_t i, entries, chain, buckets;
+    unsigned version;
+    int j;
+
+    memset(stats, 0, sizeof(*stats));
+
+    rcu_read_lock();
+    map = atomic_rcu_read(&ht->map);
+    stats->head_buckets = map->n_buckets;
+    for (i = 0; i < map->n_buckets; i++) {
+        head = &map->buckets[i];
+        do {
+            version = seqlock_read_begin(&head->sequence);
+            entries = 0;
+            chain = 0;
+            buckets = 0;
+            for (b = head; b; b = atomic_rcu_read(&b->next)) {
+                buckets++;
+                for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                    if (!atomic_read(&b->pointers[j])) {
+                        break;
+                    }
+                }
+                if (j) {
+                    chain++;
+                    entries += j;
+                }
+            }
+        } while (seqlock_read_retry(&head->sequence, version));
+
+        stats->entries += entries;
+        stats->slots += buckets * QHT_BUCKET_ENTRIES;
+        if (chain) {
+            stats->used_head_buckets++;
+            stats->chain_sum += chain;
+            stats->max_chain = MAX(stats->max_chain, chain);
+            stats->chain_hist[MIN(chain, QHT_STATS_CHAIN_HIST) - 1]++;
+        }
+    }
+    rcu_read_unlock();
+}